@@ -250,6 +250,7 @@ WGET_BEGIN_DECLS
 #define WGET_E_HANDSHAKE -5 /* general TLS handshake failure */
 #define WGET_E_CERTIFICATE -6 /* general TLS certificate failure */
 #define WGET_E_TLS_DISABLED -7 /* TLS was not enabled at compile time */
+#define WGET_E_UNSUPPORTED -8 /* not supported by the system or for this connection */
 
 typedef void (*wget_global_get_func_t)(const char *, size_t);
 
@@ -278,6 +279,7 @@ WGETAPI wget_global_get_func_t
 #define WGET_IO_READABLE 1
 #define WGET_IO_WRITABLE 2
 
+typedef int (*wget_ready_2_transfer_func_t)(int fd, int timeout, short mode);
 typedef int (*wget_update_load_t)(void *, FILE *fp);
 typedef int (*wget_update_save_t)(void *, FILE *fp);
 
@@ -287,6 +289,8 @@ WGETAPI int
 	wget_ready_2_write(int fd, int timeout);
 WGETAPI int
 	wget_ready_2_transfer(int fd, int timeout, short mode);
+WGETAPI void
+	wget_ready_2_transfer_set_func(wget_ready_2_transfer_func_t func);
 WGETAPI int
 	wget_strcmp(const char *s1, const char *s2) G_GNUC_WGET_PURE;
 WGETAPI int
@@ -1028,8 +1032,12 @@ WGETAPI void
 	wget_tls_session_free(wget_tls_session_t *tls_session);
 WGETAPI wget_tls_session_t *
 	wget_tls_session_new(const char *host, time_t maxage, const void *data, size_t data_size);
+WGETAPI void
+	wget_tls_session_set_alpn(wget_tls_session_t *tls_session, const char *alpn, size_t len) G_GNUC_WGET_NONNULL((1));
 WGETAPI int
 	wget_tls_session_get(const wget_tls_session_db_t *tls_session_db, const char *host, void **data, size_t *size);
+WGETAPI int
+	wget_tls_session_get2(const wget_tls_session_db_t *tls_session_db, const char *host, void **data, size_t *size, char **alpn);
 WGETAPI wget_tls_session_db_t *
 	wget_tls_session_db_init(wget_tls_session_db_t *tls_session_db);
 WGETAPI void
@@ -1044,6 +1052,10 @@ WGETAPI int
 	wget_tls_session_db_load(wget_tls_session_db_t *tls_session_db, const char *fname);
 WGETAPI int
 	wget_tls_session_db_changed(wget_tls_session_db_t *tls_session_db) G_GNUC_WGET_PURE;
+WGETAPI int
+	wget_tls_session_db_claim(wget_tls_session_db_t *tls_session_db, const char *host, int timeout) G_GNUC_WGET_NONNULL((2));
+WGETAPI void
+	wget_tls_session_db_release(wget_tls_session_db_t *tls_session_db, const char *host) G_GNUC_WGET_NONNULL((2));
 
 /*
  * Online Certificate Status Protocol (OCSP) routines
@@ -1062,9 +1074,9 @@ WGETAPI void
 WGETAPI wget_ocsp_t *
 	wget_ocsp_new(const char *fingerprint, time_t maxage, int valid);
 WGETAPI int
-	wget_ocsp_fingerprint_in_cache(const wget_ocsp_db_t *ocsp_db, const char *fingerprint, int *valid);
+	wget_ocsp_fingerprint_in_cache(wget_ocsp_db_t *ocsp_db, const char *fingerprint, int *valid);
 WGETAPI int
-	wget_ocsp_hostname_is_valid(const wget_ocsp_db_t *ocsp_db, const char *fingerprint);
+	wget_ocsp_hostname_is_valid(wget_ocsp_db_t *ocsp_db, const char *fingerprint);
 WGETAPI wget_ocsp_db_t *
 	wget_ocsp_db_init(wget_ocsp_db_t *ocsp_db);
 WGETAPI void
@@ -1271,6 +1283,16 @@ WGETAPI void
 	wget_tcp_deinit(wget_tcp_t **tcp);
 WGETAPI void
 	wget_dns_cache_free(void);
+WGETAPI int
+	wget_dns_cache_load(const char *fname);
+WGETAPI int
+	wget_dns_cache_save(const char *fname);
+WGETAPI void
+	wget_dns_cache_set_max_size(int max_size);
+WGETAPI void
+	wget_dns_prefetch(const char *host, const char *port);
+WGETAPI int
+	wget_dns_set_servers(const char *servers);
 WGETAPI void
 	wget_tcp_close(wget_tcp_t *tcp);
 WGETAPI void
@@ -1287,6 +1309,8 @@ WGETAPI void
 	wget_tcp_set_tcp_fastopen(wget_tcp_t *tcp, int tcp_fastopen);
 WGETAPI void
 	wget_tcp_set_tls_false_start(wget_tcp_t *tcp, int false_start);
+WGETAPI void
+	wget_tcp_set_tls_early_data(wget_tcp_t *tcp, int early_data);
 WGETAPI void
 	wget_tcp_set_ssl(wget_tcp_t *tcp, int ssl);
 WGETAPI int
@@ -1305,6 +1329,8 @@ WGETAPI int
 	wget_tcp_get_tcp_fastopen(wget_tcp_t *tcp) G_GNUC_WGET_PURE;
 WGETAPI int
 	wget_tcp_get_tls_false_start(wget_tcp_t *tcp) G_GNUC_WGET_PURE;
+WGETAPI int
+	wget_tcp_get_tls_early_data(wget_tcp_t *tcp) G_GNUC_WGET_PURE;
 WGETAPI int
 	wget_tcp_get_family(wget_tcp_t *tcp) G_GNUC_WGET_PURE;
 WGETAPI int
@@ -1343,6 +1369,8 @@ WGETAPI ssize_t
 	wget_tcp_write(wget_tcp_t *tcp, const char *buf, size_t count) G_GNUC_WGET_NONNULL_ALL;
 WGETAPI ssize_t
 	wget_tcp_read(wget_tcp_t *tcp, char *buf, size_t count) G_GNUC_WGET_NONNULL_ALL;
+WGETAPI ssize_t
+	wget_tcp_splice(wget_tcp_t *tcp, int fd, size_t count) G_GNUC_WGET_NONNULL_ALL;
 WGETAPI int
 	wget_tcp_ready_2_transfer(wget_tcp_t *tcp, int flags) G_GNUC_WGET_NONNULL_ALL;
 
@@ -1375,6 +1403,10 @@ WGETAPI int
 #define WGET_SSL_OCSP_CACHE        17
 #define WGET_SSL_ALPN              18
 #define WGET_SSL_SESSION_CACHE     19
+#define WGET_SSL_SESSION_WAIT      20
+#define WGET_SSL_OCSP_SOFT_FAIL    21
+#define WGET_SSL_CA_CACHE_FILE     22
+#define WGET_SSL_KTLS              23
 
 WGETAPI void
 	wget_ssl_init(void);
@@ -1405,6 +1437,21 @@ WGETAPI ssize_t
 WGETAPI ssize_t
 	wget_ssl_write_timeout(void *session, const char *buf, size_t count, int timeout) G_GNUC_WGET_NONNULL_ALL;
 
+typedef struct {
+	int
+		handshakes, // completed client handshakes
+		resumed, // handshakes that resumed a cached session
+		early_data, // handshakes that sent a request as early data (0-RTT) accepted by the server
+		early_data_rejected, // handshakes whose early data had to be sent again
+		ocsp_requests, // requests sent to OCSP responders
+		ocsp_certs, // certificates checked by these requests
+		verified_cached, // handshakes whose certificate chain verification was found in the cache
+		ktls; // connections whose received records are decrypted by the kernel (kTLS)
+} wget_ssl_stats_t;
+
+WGETAPI void
+	wget_ssl_get_stats(wget_ssl_stats_t *stats) G_GNUC_WGET_NONNULL_ALL;
+
 /*
  * HTTP routines
  */
@@ -1450,6 +1497,7 @@ enum {
 
 typedef struct wget_http_response_t wget_http_response_t;
 typedef int (*wget_http_header_callback_t)(wget_http_response_t *, void *);
+// the body callback is called with data == NULL after length bytes have been spliced into resp->splice_fd
 typedef int (*wget_http_body_callback_t)(wget_http_response_t *, void *, const char *, size_t);
 
 // keep the request as simple as possible
@@ -1523,7 +1571,8 @@ struct wget_http_response_t {
 	char
 		reason[32];
 	int
-		icy_metaint;
+		icy_metaint,
+		splice_fd; // with 'splice_body', see below
 	short
 		major;
 	short
@@ -1538,7 +1587,8 @@ struct wget_http_response_t {
 	char
 		hsts_include_subdomains;
 	unsigned char
-		hsts : 1; // if hsts_maxage and hsts_include_subdomains are valid
+		hsts : 1, // if hsts_maxage and hsts_include_subdomains are valid
+		splice_body : 1; // set by the header callback to have an identity body spliced into 'splice_fd'
 	size_t
 		cur_downloaded;
 };
@@ -1554,16 +1604,19 @@ typedef struct {
 		scheme;
 	wget_buffer_t *
 		buf;
+	wget_buffer_t *
+		readahead; // data received beyond the current response (HTTP/1.1 pipelining)
 #ifdef WITH_LIBNGHTTP2
 	nghttp2_session *
 		http2_session;
 #endif
 	wget_vector_t
-		*pending_requests; // List of unresponsed requests (HTTP1 only)
+		*pending_requests; // List of unresponsed requests
 	wget_vector_t
 		*received_http2_responses; // List of received (but yet unprocessed) responses (HTTP2 only)
 	int
-		pending_http2_requests; // Number of unresponsed requests (HTTP2 only)
+		pending_http2_requests, // Number of unresponsed requests (HTTP2 only)
+		max_concurrent_streams; // SETTINGS_MAX_CONCURRENT_STREAMS announced by the server, 1 before (HTTP2 only)
 	char
 		protocol; // WGET_PROTOCOL_HTTP_1_1 or WGET_PROTOCOL_HTTP_2_0
 	unsigned char
@@ -1753,6 +1806,8 @@ WGETAPI int
 	wget_hash_fast(wget_digest_algorithm_t algorithm, const void *text, size_t textlen, void *digest);
 WGETAPI int
 	wget_hash_get_len(wget_digest_algorithm_t algorithm) G_GNUC_WGET_CONST;
+WGETAPI wget_hash_hd_t *
+	wget_hash_alloc(void) G_GNUC_WGET_MALLOC;
 WGETAPI int
 	wget_hash_init(wget_hash_hd_t *dig, wget_digest_algorithm_t algorithm);
 WGETAPI int
@@ -0,0 +1,1507 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DNS resolving: cache, asynchronous lookups and a minimal stub resolver
+ *
+ * Lookups are done by a few resolver threads, so a slow name doesn't hold up the resolution
+ * of other names. Names can be resolved in advance (wget_dns_prefetch()), the result lands in
+ * the DNS cache. Callers of wget_tcp_resolve() waiting for the same name share one lookup.
+ *
+ * By default the system resolver (getaddrinfo()) is used. With wget_dns_set_servers(), names
+ * are sent as A/AAAA queries via UDP to the given name servers instead.
+ *
+ * RFC 1035: Domain names - implementation and specification
+ * RFC 3596: DNS Extensions to Support IP Version 6
+ */
+
+#if HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <c-ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#if HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#elif HAVE_WS2TCPIP_H
+# include <ws2tcpip.h>
+#endif
+#include <netdb.h>
+#include <netinet/in.h>
+
+#ifdef WITH_GNUTLS
+# include <gnutls/gnutls.h>
+# include <gnutls/crypto.h>
+#endif
+
+#include <wget.h>
+#include "private.h"
+#include "net.h"
+
+// resolver / DNS cache entry
+typedef struct ADDR_ENTRY ADDR_ENTRY;
+struct ADDR_ENTRY {
+	const char *
+		host;
+	const char *
+		port;
+	struct addrinfo *
+		addrinfo; // NULL for negative entries
+	ADDR_ENTRY
+		*prev, // LRU list, most recently used first
+		*next;
+	time_t
+		expires;
+	int
+		rc; // 0 or the EAI_* error code of a negative entry
+	unsigned char
+		handed_out : 1; // the address list has been returned by wget_tcp_resolve()
+};
+
+// a name being resolved by a resolver thread
+typedef struct DNS_LOOKUP DNS_LOOKUP;
+struct DNS_LOOKUP {
+	const char *
+		host;
+	const char *
+		port;
+	DNS_LOOKUP
+		*prev, // within the queue
+		*next;
+	struct addrinfo *
+		addrinfo; // result, a copy of what went into the DNS cache
+	int
+		family,
+		preferred_family,
+		timeout,
+		rc, // 0 or EAI_* error code
+		refs, // waiting callers + 1 while not done
+		pipefd[2]; // becomes readable when done, only created if someone waits
+	unsigned char
+		done : 1,
+		queued : 1,
+		urgent : 1; // someone waits for it
+};
+
+typedef struct {
+	DNS_LOOKUP
+		*head,
+		*tail;
+	int
+		size;
+} DNS_QUEUE;
+
+#define DNS_THREADS_MAX 8 // max. number of resolver threads
+#define DNS_PREFETCH_MAX 1024 // max. number of queued prefetches, more are resolved on demand
+#define DNS_SERVERS_MAX 3
+#define DNS_TIMEOUT 5000 // default timeout for a query in ms
+#define DNS_DEFAULT_TTL 300 // seconds to cache the results of getaddrinfo(), which doesn't tell the TTL
+#define DNS_NEGATIVE_TTL 60 // seconds to remember that a name doesn't exist
+#define DNS_MAX_TTL 86400 // cap for the TTLs from name servers
+
+// resolver / DNS cache container
+static wget_hashmap_t
+	*dns_cache;
+static ADDR_ENTRY
+	*lru_head,
+	*lru_tail;
+static wget_vector_t
+	*retired; // address lists of evicted entries that might still be in use
+static int
+	dns_cache_max_size = 10000; // <= 0: no limit
+static wget_thread_mutex_t
+	dns_mutex = WGET_THREAD_MUTEX_INITIALIZER; // protects everything below
+
+// lookups in progress and the resolver threads
+static wget_hashmap_t
+	*lookups;
+static DNS_QUEUE
+	urgent_queue, // first come, first serve
+	prefetch_queue;
+static wget_thread_cond_t
+	resolver_cond = WGET_THREAD_COND_INITIALIZER; // signalled when a lookup has been queued
+static wget_thread_t
+	resolver_tids[DNS_THREADS_MAX];
+static int
+	nresolvers,
+	nidle_resolvers,
+	resolver_generation; // bumped by wget_dns_cache_free(), abandoned threads of older generations quit
+static char
+	resolver_busy[DNS_THREADS_MAX], // the thread is resolving a name
+	resolver_stop;
+
+// name servers used by the stub resolver, none means getaddrinfo()
+static struct sockaddr_storage
+	dns_servers[DNS_SERVERS_MAX];
+static socklen_t
+	dns_servers_len[DNS_SERVERS_MAX];
+static int
+	ndns_servers;
+
+static struct addrinfo *_addrinfo_new(int family, const struct sockaddr *addr, socklen_t addrlen)
+{
+	// the address is stored behind the addrinfo structure
+	struct addrinfo *ai = xcalloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_storage));
+
+	ai->ai_family = family;
+	ai->ai_socktype = SOCK_STREAM;
+	ai->ai_protocol = IPPROTO_TCP;
+	ai->ai_addr = (struct sockaddr *)(ai + 1);
+	ai->ai_addrlen = addrlen;
+	memcpy(ai->ai_addr, addr, addrlen);
+
+	return ai;
+}
+
+// address lists of libwget are allocated by libwget, whether they came from getaddrinfo() or not
+static struct addrinfo *_addrinfo_copy(const struct addrinfo *ai)
+{
+	struct addrinfo *head = NULL, **tail = &head;
+
+	for (; ai; ai = ai->ai_next) {
+		if (ai->ai_addrlen > sizeof(struct sockaddr_storage))
+			continue;
+
+		*tail = _addrinfo_new(ai->ai_family, ai->ai_addr, ai->ai_addrlen);
+		(*tail)->ai_flags = ai->ai_flags;
+		(*tail)->ai_socktype = ai->ai_socktype;
+		(*tail)->ai_protocol = ai->ai_protocol;
+		tail = &(*tail)->ai_next;
+	}
+
+	return head;
+}
+
+void _wget_dns_freeaddrinfo(struct addrinfo *ai)
+{
+	while (ai) {
+		struct addrinfo *next = ai->ai_next;
+		xfree(ai);
+		ai = next;
+	}
+}
+
+static unsigned int G_GNUC_WGET_PURE _hash_host_port(const char *host, const char *port)
+{
+	unsigned int h = 0;
+
+	for (const unsigned char *p = (unsigned char *)host; p && *p; p++)
+		h = h * 101 + c_tolower(*p);
+
+	for (const unsigned char *p = (unsigned char *)port; p && *p; p++)
+		h = h * 101 + *p;
+
+	return h;
+}
+
+static int G_GNUC_WGET_PURE _compare_host_port(const char *host1, const char *port1, const char *host2, const char *port2)
+{
+	int n;
+
+	if ((n = wget_strcasecmp(host1, host2)) == 0)
+		return wget_strcasecmp_ascii(port1, port2);
+
+	return n;
+}
+
+static unsigned int G_GNUC_WGET_PURE _hash_addr(const ADDR_ENTRY *entry)
+{
+	return _hash_host_port(entry->host, entry->port);
+}
+
+static int G_GNUC_WGET_PURE _compare_addr(const ADDR_ENTRY *a1, const ADDR_ENTRY *a2)
+{
+	return _compare_host_port(a1->host, a1->port, a2->host, a2->port);
+}
+
+static void _free_retired(struct addrinfo *addrinfo)
+{
+	// the vector frees the head of the list
+	_wget_dns_freeaddrinfo(addrinfo->ai_next);
+}
+
+// an address list handed out by wget_tcp_resolve() stays valid until wget_dns_cache_free()
+static void _retire_addrinfo(struct addrinfo *addrinfo)
+{
+	if (!addrinfo)
+		return;
+
+	if (!retired) {
+		retired = wget_vector_create(16, -2, NULL);
+		wget_vector_set_destructor(retired, (wget_vector_destructor_t)_free_retired);
+	}
+
+	wget_vector_add_noalloc(retired, addrinfo);
+}
+
+static void _free_dns(ADDR_ENTRY *entry)
+{
+	if (entry->handed_out)
+		_retire_addrinfo(entry->addrinfo);
+	else
+		_wget_dns_freeaddrinfo(entry->addrinfo);
+
+	xfree(entry);
+}
+
+static void _lru_unlink(ADDR_ENTRY *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		lru_head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		lru_tail = entry->prev;
+}
+
+static void _lru_push(ADDR_ENTRY *entry)
+{
+	entry->prev = NULL;
+	entry->next = lru_head;
+
+	if (lru_head)
+		lru_head->prev = entry;
+	else
+		lru_tail = entry;
+
+	lru_head = entry;
+}
+
+// called with dns_mutex locked
+static void _cache_remove(ADDR_ENTRY *entry)
+{
+	_lru_unlink(entry);
+	wget_hashmap_remove(dns_cache, entry); // calls _free_dns()
+}
+
+// Looks up host:port in the DNS cache, called with dns_mutex locked.
+// Returns -1 if there is no valid entry, else 0 (addresses in '*out') or the EAI_* code of a negative entry.
+// 'copy' returns a copy of the address list, else the cached list, which then has to stay valid.
+static int _cache_get(const char *host, const char *port, struct addrinfo **out, int copy)
+{
+	ADDR_ENTRY *entry, key = { .host = host, .port = port };
+
+	if (!dns_cache || !(entry = wget_hashmap_get(dns_cache, &key)))
+		return -1;
+
+	if (entry->expires < time(NULL)) {
+		debug_printf("Drop expired dns cache entry %s:%s\n", host, port);
+		_cache_remove(entry);
+		return -1;
+	}
+
+	// DNS cache entry found
+	debug_printf("Found dns cache entry %s:%s\n", host, port);
+
+	if (entry != lru_head) {
+		_lru_unlink(entry);
+		_lru_push(entry);
+	}
+
+	if (out) {
+		if (copy)
+			*out = _addrinfo_copy(entry->addrinfo);
+		else {
+			*out = entry->addrinfo;
+			entry->handed_out = 1;
+		}
+	}
+
+	return entry->rc;
+}
+
+// Adds host:port to the DNS cache, taking ownership of 'addrinfo', called with dns_mutex locked.
+// Negative entries have no addresses and the EAI_* code in 'rc'.
+static void _cache_add(const char *host, const char *port, struct addrinfo *addrinfo, int rc, time_t expires)
+{
+	size_t hostlen = host ? strlen(host) + 1 : 0;
+	size_t portlen = port ? strlen(port) + 1 : 0;
+	ADDR_ENTRY *entryp = xcalloc(1, sizeof(ADDR_ENTRY) + hostlen + portlen), *old;
+
+	if (host) {
+		entryp->host = ((char *)entryp) + sizeof(ADDR_ENTRY);
+		memcpy((char *)entryp->host, host, hostlen); // ugly cast, but semantically ok
+	}
+
+	if (port) {
+		entryp->port = ((char *)entryp) + sizeof(ADDR_ENTRY) + hostlen;
+		memcpy((char *)entryp->port, port, portlen); // ugly cast, but semantically ok
+	}
+
+	entryp->addrinfo = addrinfo;
+	entryp->rc = rc;
+	entryp->expires = expires;
+
+	if (!dns_cache) {
+		dns_cache = wget_hashmap_create(128, -2, (wget_hashmap_hash_t)_hash_addr, (wget_hashmap_compare_t)_compare_addr);
+		wget_hashmap_set_key_destructor(dns_cache, (wget_hashmap_key_destructor_t)_free_dns);
+		wget_hashmap_set_value_destructor(dns_cache, NULL);
+	} else if ((old = wget_hashmap_get(dns_cache, entryp)))
+		_cache_remove(old);
+
+	debug_printf("Add dns cache entry %s:%s%s\n", host, port, rc ? " (negative)" : "");
+	wget_hashmap_put_noalloc(dns_cache, entryp, entryp);
+	_lru_push(entryp);
+
+	// evict the least recently used entries
+	while (dns_cache_max_size > 0 && wget_hashmap_size(dns_cache) > dns_cache_max_size)
+		_cache_remove(lru_tail);
+}
+
+void _wget_dns_cache_prefer(const char *host, const char *port, const struct addrinfo *ai)
+{
+	ADDR_ENTRY *entry, key = { .host = host, .port = port };
+
+	wget_thread_mutex_lock(&dns_mutex);
+
+	// lists handed out by wget_tcp_resolve() must not change
+	if (dns_cache && (entry = wget_hashmap_get(dns_cache, &key)) && !entry->handed_out) {
+		for (struct addrinfo **app = &entry->addrinfo; *app; app = &(*app)->ai_next) {
+			struct addrinfo *cur = *app;
+
+			if (cur->ai_addrlen == ai->ai_addrlen && !memcmp(cur->ai_addr, ai->ai_addr, ai->ai_addrlen)) {
+				*app = cur->ai_next;
+				cur->ai_next = entry->addrinfo;
+				entry->addrinfo = cur;
+				break;
+			}
+		}
+	}
+
+	wget_thread_mutex_unlock(&dns_mutex);
+}
+
+static int _is_negative(int rc)
+{
+	// only 'definitive' answers are cached, not temporary failures
+#ifdef EAI_NODATA
+	return rc == EAI_NONAME || rc == EAI_NODATA;
+#else
+	return rc == EAI_NONAME;
+#endif
+}
+
+// adds the result of a lookup to the cache, called with dns_mutex locked
+static void _cache_add_result(const char *host, const char *port, struct addrinfo *addrinfo, int rc, int ttl)
+{
+	if (rc == 0)
+		_cache_add(host, port, addrinfo, 0, time(NULL) + ttl);
+	else if (_is_negative(rc))
+		_cache_add(host, port, NULL, rc, time(NULL) + DNS_NEGATIVE_TTL);
+}
+
+/*
+ * Stub resolver
+ */
+
+// returns the length of the query or -1 if 'host' is not a valid domain name
+static int _dns_build_query(unsigned char *buf, uint16_t id, const char *host, uint16_t qtype)
+{
+	unsigned char *p = buf + 12;
+	size_t hostlen = strlen(host);
+
+	if (hostlen && host[hostlen - 1] == '.')
+		hostlen--; // fully qualified
+
+	if (hostlen == 0 || hostlen > 253)
+		return -1;
+
+	memset(buf, 0, 12);
+	buf[0] = id >> 8;
+	buf[1] = id & 0xFF;
+	buf[2] = 0x01; // RD: recursion desired
+	buf[5] = 1; // QDCOUNT
+
+	for (const char *s = host, *e; s < host + hostlen; s = e + 1) {
+		if (!(e = memchr(s, '.', host + hostlen - s)))
+			e = host + hostlen;
+
+		if (e == s || e - s > 63)
+			return -1;
+
+		*p++ = (unsigned char)(e - s);
+		memcpy(p, s, e - s);
+		p += e - s;
+	}
+
+	*p++ = 0; // root label
+	*p++ = qtype >> 8;
+	*p++ = qtype & 0xFF;
+	*p++ = 0;
+	*p++ = 1; // QCLASS IN
+
+	return (int)(p - buf);
+}
+
+// Returns an unpredictable 16 bit value, query IDs and source ports must not be guessable by an attacker.
+static uint16_t _dns_random(void)
+{
+	uint16_t r;
+	int fd;
+
+#ifdef WITH_GNUTLS
+	if (gnutls_rnd(GNUTLS_RND_RANDOM, &r, sizeof(r)) == 0)
+		return r;
+#endif
+
+	if ((fd = open("/dev/urandom", O_RDONLY)) != -1) {
+		ssize_t nbytes = read(fd, &r, sizeof(r));
+
+		close(fd);
+
+		if (nbytes == sizeof(r))
+			return r;
+	}
+
+	return (uint16_t) wget_random();
+}
+
+// Binds 'fd' to a random port, so an attacker has to guess the port in addition to the query ID.
+// If all tried ports are in use, the kernel chooses one on connect().
+static void _dns_bind_random_port(int fd, int family)
+{
+	for (int tries = 0; tries < 8; tries++) {
+		uint16_t port = 1024 + _dns_random() % (65536 - 1024);
+		int rc;
+
+		if (family == AF_INET6) {
+			struct sockaddr_in6 sin6 = { .sin6_family = AF_INET6, .sin6_port = htons(port), .sin6_addr = IN6ADDR_ANY_INIT };
+
+			rc = bind(fd, (struct sockaddr *)&sin6, sizeof(sin6));
+		} else {
+			struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(port) };
+
+			sin.sin_addr.s_addr = htonl(INADDR_ANY);
+			rc = bind(fd, (struct sockaddr *)&sin, sizeof(sin));
+		}
+
+		if (rc == 0)
+			return;
+	}
+}
+
+// Copies the (possibly compressed) domain name at 'p' to 'name', dot separated without the root label.
+// Returns the position behind the name or NULL if the name is malformed or longer than 'size'.
+static const unsigned char *_dns_get_name(const unsigned char *buf, const unsigned char *end, const unsigned char *p, char *name, size_t size)
+{
+	const unsigned char *next = NULL;
+	size_t pos = 0;
+	int hops = 0;
+
+	while (p < end) {
+		if ((*p & 0xC0) == 0xC0) {
+			// compression pointer, the hop limit breaks loops
+			if (p + 2 > end || ++hops > 16)
+				return NULL;
+
+			if (!next)
+				next = p + 2;
+
+			p = buf + (((p[0] & 0x3F) << 8) | p[1]);
+			continue;
+		}
+
+		if (*p & 0xC0)
+			return NULL; // reserved label type
+
+		if (*p == 0) {
+			name[pos] = 0;
+			return next ? next : p + 1;
+		}
+
+		if (p + 1 + *p > end || pos + *p + 2 > size)
+			return NULL;
+
+		if (pos)
+			name[pos++] = '.';
+
+		memcpy(name + pos, p + 1, *p);
+		pos += *p;
+		p += 1 + *p;
+	}
+
+	return NULL;
+}
+
+// whether 'name' equals the first 'hostlen' characters of 'host', ignoring case
+static int _dns_name_equal(const char *name, const char *host, size_t hostlen)
+{
+	return strlen(name) == hostlen && !wget_strncasecmp_ascii(name, host, hostlen);
+}
+
+// Appends the addresses of the answer in 'buf' to '*tail' and lowers '*ttl' to their TTL.
+// Only answers to the question for 'host' / 'qtype' are taken, addresses must belong to 'host' or to the
+// canonical name that the CNAME chain leads to.
+// Returns the RCODE or -1 on a malformed or unrelated answer.
+static int _dns_parse_answer(const unsigned char *buf, size_t len, const char *host, uint16_t qtype, uint16_t port, struct addrinfo ***tail, int *ttl)
+{
+	const unsigned char *p = buf + 12, *end = buf + len;
+	char name[256], owner[256];
+	size_t hostlen = strlen(host);
+	int ancount;
+
+	if (len < 12 || !(buf[2] & 0x80))
+		return -1; // not a response
+
+	if (((buf[4] << 8) | buf[5]) != 1)
+		return -1; // the question has to be echoed
+
+	if (hostlen && host[hostlen - 1] == '.')
+		hostlen--;
+
+	if (!(p = _dns_get_name(buf, end, p, name, sizeof(name))) || p + 4 > end
+		|| !_dns_name_equal(name, host, hostlen) || ((p[0] << 8) | p[1]) != qtype || ((p[2] << 8) | p[3]) != 1)
+		return -1;
+
+	p += 4;
+	ancount = (buf[6] << 8) | buf[7];
+
+	// the name whose addresses we are looking for, changes when following a CNAME
+	wget_strmemcpy(owner, sizeof(owner), host, hostlen);
+
+	// a recursive server sends CNAMEs followed by the addresses of the canonical name
+	while (ancount-- > 0) {
+		int type, class, rdlength, match;
+		uint32_t rrttl;
+
+		if (!(p = _dns_get_name(buf, end, p, name, sizeof(name))) || p + 10 > end)
+			break;
+
+		match = !wget_strcasecmp_ascii(name, owner);
+		type = (p[0] << 8) | p[1];
+		class = (p[2] << 8) | p[3];
+		rrttl = ((uint32_t)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+		rdlength = (p[8] << 8) | p[9];
+		p += 10;
+
+		if (p + rdlength > end)
+			break;
+
+		if (!match || class != 1) {
+			p += rdlength;
+			continue; // not related to the question
+		}
+
+		if (type == 5) {
+			if (!_dns_get_name(buf, p + rdlength, p, owner, sizeof(owner)))
+				break;
+		} else if (type == qtype && rrttl < (uint32_t) *ttl)
+			*ttl = (int) rrttl;
+
+		if (type == 1 && qtype == 1 && rdlength == 4) {
+			struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(port) };
+
+			memcpy(&sin.sin_addr, p, 4);
+			**tail = _addrinfo_new(AF_INET, (struct sockaddr *)&sin, sizeof(sin));
+			*tail = &(**tail)->ai_next;
+		} else if (type == 28 && qtype == 28 && rdlength == 16) {
+			struct sockaddr_in6 sin6 = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+
+			memcpy(&sin6.sin6_addr, p, 16);
+			**tail = _addrinfo_new(AF_INET6, (struct sockaddr *)&sin6, sizeof(sin6));
+			*tail = &(**tail)->ai_next;
+		}
+
+		p += rdlength;
+	}
+
+	return buf[3] & 0x0F;
+}
+
+// Asks the name server 'server' for the addresses of 'host', one query per address family.
+// Returns 0 (addresses found), EAI_NONAME (no such host) or EAI_AGAIN (try another server).
+static int _dns_query_server(int server, const char *host, uint16_t port, int family, int timeout, struct addrinfo **out, int *ttl)
+{
+	static const uint16_t qtypes[2] = { 1, 28 }; // A, AAAA
+	unsigned char buf[4096];
+	struct addrinfo *answers[2] = { NULL, NULL }, **tail;
+	uint16_t ids[2];
+	int rcodes[2] = { -1, -1 }, first, last, fd, rc = EAI_AGAIN;
+	long long deadline;
+
+	first = family == AF_INET6 ? 1 : 0;
+	last = family == AF_INET ? 0 : 1;
+
+	if ((fd = socket(dns_servers[server].ss_family, SOCK_DGRAM, 0)) == -1)
+		return EAI_AGAIN;
+
+	_dns_bind_random_port(fd, dns_servers[server].ss_family);
+
+	if (connect(fd, (struct sockaddr *)&dns_servers[server], dns_servers_len[server])) {
+		close(fd);
+		return EAI_AGAIN;
+	}
+
+	for (int it = first; it <= last; it++) {
+		int len;
+
+		ids[it] = _dns_random();
+
+		if ((len = _dns_build_query(buf, ids[it], host, qtypes[it])) < 0) {
+			close(fd);
+			return EAI_NONAME;
+		}
+
+		if (send(fd, buf, len, 0) != len) {
+			close(fd);
+			return EAI_AGAIN;
+		}
+	}
+
+	deadline = wget_get_timemillis() + timeout;
+
+	for (int pending = last - first + 1; pending > 0;) {
+		long long remaining = deadline - wget_get_timemillis();
+		ssize_t nbytes;
+
+		if (remaining <= 0 || wget_ready_2_transfer(fd, (int) remaining, WGET_IO_READABLE) <= 0)
+			break;
+
+		if ((nbytes = recv(fd, buf, sizeof(buf), 0)) < 12)
+			continue;
+
+		// ignore late answers to earlier attempts
+		for (int it = first; it <= last; it++) {
+			if (rcodes[it] == -1 && ((buf[0] << 8) | buf[1]) == ids[it]) {
+				tail = &answers[it];
+				if ((rcodes[it] = _dns_parse_answer(buf, nbytes, host, qtypes[it], port, &tail, ttl)) != -1)
+					pending--;
+				break;
+			}
+		}
+	}
+
+	close(fd);
+
+	// IPv4 first, --prefer-family may change the order later
+	if (answers[0]) {
+		for (tail = &answers[0]; *tail; tail = &(*tail)->ai_next);
+		*tail = answers[1];
+		*out = answers[0];
+		rc = 0;
+	} else if (answers[1]) {
+		*out = answers[1];
+		rc = 0;
+	} else {
+		// NXDOMAIN or NOERROR without addresses for every family is a definite answer,
+		// everything else (e.g. a timeout of the other query) is worth a retry and must not be cached
+		int nodata = 1;
+
+		for (int it = first; it <= last; it++) {
+			if (rcodes[it] == 3) {
+				rc = EAI_NONAME; // the name doesn't exist at all
+				break;
+			}
+
+			if (rcodes[it] != 0)
+				nodata = 0;
+		}
+
+		if (nodata)
+			rc = EAI_NONAME;
+	}
+
+	return rc;
+}
+
+static int _dns_stub_getaddrinfo(const char *host, const char *port, int family, int timeout, struct addrinfo **out, int *ttl)
+{
+	uint16_t portnum = 0;
+	int rc = EAI_AGAIN;
+
+	if (port) {
+		if (c_isdigit(*port))
+			portnum = (uint16_t) atoi(port);
+		else {
+			struct servent *se = getservbyname(port, "tcp");
+			if (se)
+				portnum = ntohs((uint16_t) se->s_port);
+		}
+	}
+
+	if (timeout <= 0)
+		timeout = DNS_TIMEOUT;
+
+	for (int tries = 0; tries < 2 && rc == EAI_AGAIN; tries++) {
+		for (int server = 0; server < ndns_servers && rc == EAI_AGAIN; server++)
+			rc = _dns_query_server(server, host, portnum, family, timeout, out, ttl);
+	}
+
+	return rc;
+}
+
+/**
+ * \param[in] servers Comma separated list of name server addresses (IP or IP:port, [IPv6]:port), NULL to use the system resolver
+ * \return 0 on success, -1 if an address could not be parsed
+ *
+ * Let libwget send its DNS queries to the given name servers instead of using the system resolver.
+ * Only addresses are looked up (A and AAAA records), /etc/hosts and search domains are not used.
+ * 'localhost' and IP addresses are still resolved locally.
+ */
+int wget_dns_set_servers(const char *servers)
+{
+	struct sockaddr_storage addrs[DNS_SERVERS_MAX];
+	socklen_t addrlens[DNS_SERVERS_MAX];
+	int naddrs = 0;
+
+	for (const char *s = servers, *e; s && *s; s = *e ? e + 1 : e) {
+		struct addrinfo hints = { .ai_flags = AI_NUMERICHOST | AI_NUMERICSERV, .ai_socktype = SOCK_DGRAM }, *ai;
+		const char *port = "53";
+		char *host, *p;
+
+		while (*s == ' ' || *s == ',')
+			s++;
+
+		for (e = s; *e && *e != ',' && *e != ' '; e++);
+
+		if (e == s)
+			break;
+
+		host = wget_strmemdup(s, e - s);
+
+		if (*host == '[' && (p = strchr(host, ']'))) {
+			// [IPv6]:port
+			*p++ = 0;
+			memmove(host, host + 1, p - host);
+			if (*p == ':')
+				port = p + 1;
+		} else if ((p = strchr(host, ':')) && !strchr(p + 1, ':')) {
+			// IPv4:port
+			*p = 0;
+			port = p + 1;
+		}
+
+		if (getaddrinfo(host, port, &hints, &ai) || !ai || ai->ai_addrlen > sizeof(struct sockaddr_storage)) {
+			error_printf(_("Failed to parse name server address '%.*s'\n"), (int)(e - s), s);
+			xfree(host);
+			return -1;
+		}
+
+		if (naddrs < DNS_SERVERS_MAX) {
+			memcpy(&addrs[naddrs], ai->ai_addr, ai->ai_addrlen);
+			addrlens[naddrs++] = ai->ai_addrlen;
+		}
+
+		freeaddrinfo(ai);
+		xfree(host);
+	}
+
+	wget_thread_mutex_lock(&dns_mutex);
+	memcpy(dns_servers, addrs, sizeof(addrs));
+	memcpy(dns_servers_len, addrlens, sizeof(addrlens));
+	ndns_servers = naddrs;
+	wget_thread_mutex_unlock(&dns_mutex);
+
+	return 0;
+}
+
+/*
+ * Resolving
+ */
+
+// the system resolver knows about 'localhost' (and /etc/hosts), a name server might not
+static int _is_local(const char *host)
+{
+	size_t len;
+
+	if (!wget_strcasecmp_ascii(host, "localhost") || !wget_strcasecmp_ascii(host, "localhost."))
+		return 1;
+
+	// RFC 6761: *.localhost
+	return (len = strlen(host)) > 10 && !wget_strcasecmp_ascii(host + len - 10, ".localhost");
+}
+
+// Resolves 'host', blocking until the result is known, returns 0 or an EAI_* error code.
+// '*ttl' is set to the number of seconds the result may be cached.
+static int _resolve(const char *host, const char *port, int family, int preferred_family, int passive, int timeout, struct addrinfo **out, int *ttl)
+{
+	struct addrinfo *addrinfo = NULL, hints;
+	int rc = 0, ai_flags = 0;
+
+	ai_flags |= (port && c_isdigit(*port) ? AI_NUMERICSERV : 0);
+	ai_flags |= AI_ADDRCONFIG;
+
+	if (passive) {
+		ai_flags |= AI_PASSIVE;
+	}
+
+	memset(&hints, 0 ,sizeof(hints));
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = ai_flags;
+
+	*ttl = DNS_DEFAULT_TTL;
+
+	if (port)
+		debug_printf("resolving %s:%s...\n", host, port);
+	else
+		debug_printf("resolving %s...\n", host);
+
+	if (ndns_servers && host && !_is_local(host)) {
+		struct addrinfo *ai;
+
+		// IP addresses don't need a name server
+		hints.ai_flags |= AI_NUMERICHOST;
+		if (getaddrinfo(host, port, &hints, &ai) == 0) {
+			addrinfo = _addrinfo_copy(ai);
+			freeaddrinfo(ai);
+		} else {
+			*ttl = DNS_MAX_TTL;
+			if ((rc = _dns_stub_getaddrinfo(host, port, family, timeout, &addrinfo, ttl)))
+				return rc;
+		}
+	} else {
+		struct addrinfo *ai;
+
+		// get the IP address for the server
+		for (int tries = 0, max = 3; tries < max; tries++) {
+			if ((rc = getaddrinfo(host, port, &hints, &ai)) == 0 || rc != EAI_AGAIN)
+				break;
+
+			if (tries < max - 1)
+				wget_millisleep(100);
+		}
+
+		if (rc)
+			return rc;
+
+		addrinfo = _addrinfo_copy(ai);
+		freeaddrinfo(ai);
+	}
+
+	if (family == AF_UNSPEC && preferred_family != AF_UNSPEC) {
+		struct addrinfo *preferred = NULL, *preferred_tail = NULL;
+		struct addrinfo *unpreferred = NULL, *unpreferred_tail = NULL;
+
+		// split address list into preferred and not preferred, keeping the original order
+		for (struct addrinfo *ai = addrinfo; ai;) {
+			if (ai->ai_family == preferred_family) {
+				if (preferred_tail)
+					preferred_tail->ai_next = ai;
+				else
+					preferred = ai; // remember the head of the list
+
+				preferred_tail = ai;
+				ai = ai->ai_next;
+				preferred_tail->ai_next = NULL;
+			} else {
+				if (unpreferred_tail)
+					unpreferred_tail->ai_next = ai;
+				else
+					unpreferred = ai; // remember the head of the list
+
+				unpreferred_tail = ai;
+				ai = ai->ai_next;
+				unpreferred_tail->ai_next = NULL;
+			}
+		}
+
+		// merge preferred + not preferred
+		if (preferred) {
+			preferred_tail->ai_next = unpreferred;
+			addrinfo = preferred;
+		} else {
+			addrinfo = unpreferred;
+		}
+	}
+
+	if (wget_logger_is_active(wget_get_logger(WGET_LOGGER_DEBUG))) {
+		for (struct addrinfo *ai = addrinfo; ai; ai = ai->ai_next) {
+			char adr[NI_MAXHOST], sport[NI_MAXSERV];
+
+			if ((rc = getnameinfo(ai->ai_addr, ai->ai_addrlen, adr, sizeof(adr), sport, sizeof(sport), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
+				debug_printf("has %s:%s\n", adr, sport);
+			else
+				debug_printf("has ???:%s (%s)\n", sport, gai_strerror(rc));
+		}
+	}
+
+	*out = addrinfo;
+
+	return 0;
+}
+
+/*
+ * Asynchronous lookups, all functions are called with dns_mutex locked
+ */
+
+static unsigned int G_GNUC_WGET_PURE _lookup_hash(const DNS_LOOKUP *lookup)
+{
+	return _hash_host_port(lookup->host, lookup->port);
+}
+
+static int G_GNUC_WGET_PURE _lookup_compare(const DNS_LOOKUP *l1, const DNS_LOOKUP *l2)
+{
+	return _compare_host_port(l1->host, l1->port, l2->host, l2->port);
+}
+
+static void _queue_append(DNS_QUEUE *queue, DNS_LOOKUP *lookup)
+{
+	lookup->prev = queue->tail;
+	lookup->next = NULL;
+
+	if (queue->tail)
+		queue->tail->next = lookup;
+	else
+		queue->head = lookup;
+
+	queue->tail = lookup;
+	queue->size++;
+	lookup->queued = 1;
+}
+
+static void _queue_remove(DNS_QUEUE *queue, DNS_LOOKUP *lookup)
+{
+	if (lookup->prev)
+		lookup->prev->next = lookup->next;
+	else
+		queue->head = lookup->next;
+
+	if (lookup->next)
+		lookup->next->prev = lookup->prev;
+	else
+		queue->tail = lookup->prev;
+
+	queue->size--;
+	lookup->prev = lookup->next = NULL;
+	lookup->queued = 0;
+}
+
+static void _lookup_unref(DNS_LOOKUP *lookup)
+{
+	if (--lookup->refs == 0) {
+		if (lookup->pipefd[0] != -1) {
+			close(lookup->pipefd[0]);
+			close(lookup->pipefd[1]);
+		}
+		_wget_dns_freeaddrinfo(lookup->addrinfo);
+		xfree(lookup);
+	}
+}
+
+static void *_resolver_thread(void *p)
+{
+	DNS_LOOKUP *lookup;
+	struct addrinfo *addrinfo;
+	int rc, ttl, slot = (int)(intptr_t) p, generation;
+
+	wget_thread_mutex_lock(&dns_mutex);
+
+	generation = resolver_generation;
+
+	while (!resolver_stop) {
+		if (!(lookup = urgent_queue.head ? urgent_queue.head : prefetch_queue.head)) {
+			nidle_resolvers++;
+			wget_thread_cond_wait(&resolver_cond, &dns_mutex, 0);
+			nidle_resolvers--;
+			continue;
+		}
+
+		_queue_remove(lookup->urgent ? &urgent_queue : &prefetch_queue, lookup);
+		resolver_busy[slot] = 1;
+		wget_thread_mutex_unlock(&dns_mutex);
+
+		addrinfo = NULL;
+		if ((rc = _resolve(lookup->host, lookup->port, lookup->family, lookup->preferred_family, 0, lookup->timeout, &addrinfo, &ttl)))
+			debug_printf("Failed to resolve %s (%s)\n", lookup->host, gai_strerror(rc));
+
+		wget_thread_mutex_lock(&dns_mutex);
+
+		if (generation != resolver_generation) {
+			// wget_dns_cache_free() didn't wait for us, the cache and the lookups table are gone
+			_wget_dns_freeaddrinfo(addrinfo);
+			lookup->rc = EAI_AGAIN;
+			lookup->done = 1;
+			if (lookup->pipefd[1] != -1 && write(lookup->pipefd[1], "", 1) != 1)
+				debug_printf("Failed to notify DNS lookup waiters (%d)\n", errno);
+			_lookup_unref(lookup);
+			break;
+		}
+
+		resolver_busy[slot] = 0;
+
+		// the waiters get their own copy, the cache entry might be gone when they wake up
+		lookup->rc = rc;
+		lookup->addrinfo = _addrinfo_copy(addrinfo);
+		lookup->done = 1;
+		_cache_add_result(lookup->host, lookup->port, addrinfo, rc, ttl);
+		wget_hashmap_remove_nofree(lookups, lookup);
+
+		if (lookup->pipefd[1] != -1) {
+			// the pipe stays readable, this wakes all waiting callers
+			if (write(lookup->pipefd[1], "", 1) != 1)
+				debug_printf("Failed to notify DNS lookup waiters (%d)\n", errno);
+		}
+
+		_lookup_unref(lookup);
+	}
+
+	wget_thread_mutex_unlock(&dns_mutex);
+
+	return NULL;
+}
+
+// returns the lookup of host:port, starting one if needed, NULL on failure
+static DNS_LOOKUP *_lookup_start(const char *host, const char *port, wget_tcp_t *tcp, int urgent)
+{
+	DNS_LOOKUP *lookup, key = { .host = host, .port = port };
+
+	if (!lookups) {
+		lookups = wget_hashmap_create(16, -2, (wget_hashmap_hash_t)_lookup_hash, (wget_hashmap_compare_t)_lookup_compare);
+		wget_hashmap_set_key_destructor(lookups, NULL);
+		wget_hashmap_set_value_destructor(lookups, NULL);
+	}
+
+	if (resolver_stop)
+		return NULL;
+
+	if ((lookup = wget_hashmap_get(lookups, &key))) {
+		// a caller is waiting, so resolve it before the prefetches
+		if (urgent && !lookup->urgent) {
+			if (lookup->queued) {
+				_queue_remove(&prefetch_queue, lookup);
+				_queue_append(&urgent_queue, lookup);
+			}
+			lookup->urgent = 1;
+		}
+
+		return lookup;
+	}
+
+	if (!urgent && prefetch_queue.size >= DNS_PREFETCH_MAX)
+		return NULL;
+
+	size_t hostlen = strlen(host) + 1;
+	size_t portlen = port ? strlen(port) + 1 : 0;
+
+	lookup = xcalloc(1, sizeof(DNS_LOOKUP) + hostlen + portlen);
+	lookup->host = memcpy((char *)(lookup + 1), host, hostlen);
+	lookup->port = port ? memcpy((char *)(lookup + 1) + hostlen, port, portlen) : NULL;
+	lookup->family = tcp->family;
+	lookup->preferred_family = tcp->preferred_family;
+	lookup->timeout = tcp->dns_timeout;
+	lookup->pipefd[0] = lookup->pipefd[1] = -1;
+	lookup->refs = 1; // released by the resolver thread
+	lookup->urgent = !!urgent;
+
+	wget_hashmap_put_noalloc(lookups, lookup, lookup);
+	_queue_append(urgent ? &urgent_queue : &prefetch_queue, lookup);
+
+	// start another resolver thread if all are busy
+	if (nidle_resolvers == 0 && nresolvers < DNS_THREADS_MAX) {
+		if (wget_thread_start(&resolver_tids[nresolvers], _resolver_thread, (void *)(intptr_t) nresolvers, 0) == 0)
+			nresolvers++;
+		else if (nresolvers == 0) {
+			error_printf(_("Failed to start resolver thread\n"));
+			_queue_remove(lookup->urgent ? &urgent_queue : &prefetch_queue, lookup);
+			wget_hashmap_remove_nofree(lookups, lookup);
+			xfree(lookup);
+			return NULL;
+		}
+	}
+
+	wget_thread_cond_signal(&resolver_cond);
+
+	return lookup;
+}
+
+/**
+ * \param[in] host Host name to resolve
+ * \param[in] port Port (number or service name) or NULL
+ *
+ * Start resolving \p host in the background, so the address is in the DNS cache when it is needed.
+ * Nothing is done if DNS caching is disabled or too many names are waiting to be resolved.
+ */
+void wget_dns_prefetch(const char *host, const char *port)
+{
+	wget_tcp_t *tcp = _wget_tcp_get_global();
+
+	if (host && wget_tcp_get_dns_caching(tcp) && wget_thread_support()) {
+		wget_thread_mutex_lock(&dns_mutex);
+		if (_cache_get(host, port, NULL, 0) == -1)
+			_lookup_start(host, port, tcp, 0);
+		wget_thread_mutex_unlock(&dns_mutex);
+	}
+}
+
+// the work horse of wget_tcp_resolve(), see there
+static int _tcp_resolve(wget_tcp_t *tcp, const char *host, const char *port, struct addrinfo **out, int copy)
+{
+	static wget_thread_mutex_t
+		mutex = WGET_THREAD_MUTEX_INITIALIZER;
+	DNS_LOOKUP *lookup;
+	int rc, ttl, done;
+
+	if (!tcp->caching)
+		return _resolve(host, port, tcp->family, tcp->preferred_family, tcp->passive, tcp->dns_timeout, out, &ttl);
+
+	wget_thread_mutex_lock(&dns_mutex);
+	rc = _cache_get(host, port, out, copy);
+	wget_thread_mutex_unlock(&dns_mutex);
+
+	if (rc != -1)
+		return rc;
+
+	if (tcp->passive || !wget_thread_support()) {
+		struct addrinfo *addrinfo = NULL;
+
+		// prevent multiple address resolutions of the same host/port
+		wget_thread_mutex_lock(&mutex);
+
+		// now try again
+		wget_thread_mutex_lock(&dns_mutex);
+		rc = _cache_get(host, port, out, copy);
+		wget_thread_mutex_unlock(&dns_mutex);
+
+		if (rc == -1) {
+			rc = _resolve(host, port, tcp->family, tcp->preferred_family, tcp->passive, tcp->dns_timeout, &addrinfo, &ttl);
+
+			wget_thread_mutex_lock(&dns_mutex);
+			if (copy)
+				*out = _addrinfo_copy(addrinfo);
+			_cache_add_result(host, port, addrinfo, rc, ttl);
+			if (!copy && rc == 0)
+				_cache_get(host, port, out, 0); // marks the list as handed out
+			wget_thread_mutex_unlock(&dns_mutex);
+		}
+
+		wget_thread_mutex_unlock(&mutex);
+
+		return rc;
+	}
+
+	// let a resolver thread do the work, so concurrent lookups of other names are not blocked
+	wget_thread_mutex_lock(&dns_mutex);
+
+	if (!(lookup = _lookup_start(host, port, tcp, 1))) {
+		wget_thread_mutex_unlock(&dns_mutex);
+		return EAI_SYSTEM;
+	}
+
+	lookup->refs++;
+
+	if (!lookup->done && lookup->pipefd[0] == -1 && pipe(lookup->pipefd)) {
+		lookup->pipefd[0] = lookup->pipefd[1] = -1;
+		rc = EAI_SYSTEM;
+	} else
+		rc = 0;
+
+	done = lookup->done;
+
+	wget_thread_mutex_unlock(&dns_mutex);
+
+	// wget_ready_2_transfer() lets an event loop run other tasks meanwhile
+	if (!rc && !done && wget_ready_2_transfer(lookup->pipefd[0], tcp->dns_timeout, WGET_IO_READABLE) <= 0)
+		rc = EAI_AGAIN; // timeout
+
+	wget_thread_mutex_lock(&dns_mutex);
+
+	if (!rc) {
+		if (!lookup->done)
+			rc = EAI_AGAIN;
+		else if (!(rc = lookup->rc)) {
+			if (copy)
+				*out = _addrinfo_copy(lookup->addrinfo);
+			else if (_cache_get(host, port, out, 0) != 0) {
+				// already evicted from the cache
+				*out = _addrinfo_copy(lookup->addrinfo);
+				_retire_addrinfo(*out);
+			}
+		}
+	}
+
+	_lookup_unref(lookup);
+
+	wget_thread_mutex_unlock(&dns_mutex);
+
+	return rc;
+}
+
+/**
+ * \param[in] tcp A TCP connection or NULL for the global settings
+ * \param[in] host Host name or IP address to resolve
+ * \param[in] port Port (number or service name) or NULL
+ * \return The list of addresses or NULL on error
+ *
+ * Resolve \p host, respecting the address family settings of \p tcp.
+ *
+ * With DNS caching enabled (the default), the returned list belongs to the DNS cache and stays valid
+ * until wget_dns_cache_free() is called. Without caching, the list has to be freed by the caller.
+ */
+struct addrinfo *wget_tcp_resolve(wget_tcp_t *tcp, const char *host, const char *port)
+{
+	struct addrinfo *addrinfo = NULL;
+	int rc;
+
+	if ((rc = _tcp_resolve(tcp ? tcp : _wget_tcp_get_global(), host, port, &addrinfo, 0))) {
+		error_printf(_("Failed to resolve %s:%s (%s)\n"), host, port, gai_strerror(rc));
+		return NULL;
+	}
+
+	return addrinfo;
+}
+
+struct addrinfo *_wget_tcp_resolve(wget_tcp_t *tcp, const char *host, const char *port)
+{
+	struct addrinfo *addrinfo = NULL;
+	int rc;
+
+	if ((rc = _tcp_resolve(tcp ? tcp : _wget_tcp_get_global(), host, port, &addrinfo, 1))) {
+		error_printf(_("Failed to resolve %s:%s (%s)\n"), host, port, gai_strerror(rc));
+		return NULL;
+	}
+
+	return addrinfo;
+}
+
+/*
+ * DNS cache persistence
+ *
+ * One line per entry:
+ *   <host> <port> <time_t expires> <0 or EAI_* code> <comma-separated IP addresses or '-'>
+ */
+
+static int _dns_cache_load(void *ctx G_GNUC_WGET_UNUSED, FILE *fp)
+{
+	char *buf = NULL, *linep, *fields[5];
+	size_t bufsize = 0;
+	ssize_t buflen;
+	time_t now = time(NULL);
+
+	while ((buflen = wget_getline(&buf, &bufsize, fp)) >= 0) {
+		struct addrinfo *addrinfo = NULL, **tail = &addrinfo;
+		const char *port;
+		time_t expires;
+		int nfields, rc;
+
+		linep = buf;
+
+		while (c_isspace(*linep)) linep++; // ignore leading whitespace
+		if (!*linep || *linep == '#')
+			continue; // skip empty lines and comments
+
+		for (nfields = 0; nfields < 5 && *linep; nfields++) {
+			fields[nfields] = linep;
+			while (*linep && !c_isspace(*linep))
+				linep++;
+			if (*linep)
+				*linep++ = 0;
+			while (c_isspace(*linep))
+				linep++;
+		}
+
+		if (nfields != 5) {
+			error_printf(_("Failed to parse DNS cache line: '%s'\n"), buf);
+			continue;
+		}
+
+		port = strcmp(fields[1], "-") ? fields[1] : NULL;
+		expires = (time_t) atoll(fields[2]);
+		rc = atoi(fields[3]);
+
+		if (expires < now)
+			continue; // drop expired entry
+
+		// entries in memory are younger
+		wget_thread_mutex_lock(&dns_mutex);
+		if (_cache_get(fields[0], port, NULL, 0) != -1) {
+			wget_thread_mutex_unlock(&dns_mutex);
+			continue;
+		}
+		wget_thread_mutex_unlock(&dns_mutex);
+
+		if (rc == 0) {
+			struct addrinfo hints = { .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICHOST }, *ai;
+
+			if (port && c_isdigit(*port))
+				hints.ai_flags |= AI_NUMERICSERV;
+
+			for (char *s = fields[4], *e; *s; s = *e ? e + 1 : e) {
+				if ((e = strchr(s, ',')))
+					*e = 0;
+				else
+					e = s + strlen(s);
+
+				if (getaddrinfo(s, port, &hints, &ai) == 0) {
+					*tail = _addrinfo_copy(ai);
+					freeaddrinfo(ai);
+					while (*tail)
+						tail = &(*tail)->ai_next;
+				}
+			}
+
+			if (!addrinfo)
+				continue;
+		} else if (!_is_negative(rc))
+			continue;
+
+		wget_thread_mutex_lock(&dns_mutex);
+		_cache_add(fields[0], port, addrinfo, rc, expires);
+		wget_thread_mutex_unlock(&dns_mutex);
+	}
+
+	xfree(buf);
+
+	return ferror(fp) ? -1 : 0;
+}
+
+static int _dns_cache_save(void *ctx G_GNUC_WGET_UNUSED, FILE *fp)
+{
+	time_t now = time(NULL);
+
+	wget_thread_mutex_lock(&dns_mutex);
+
+	if (dns_cache && wget_hashmap_size(dns_cache) > 0) {
+		fputs("#DNS cache 1.0 file\n", fp);
+		fputs("#Generated by Wget2 " PACKAGE_VERSION ". Edit at your own risk.\n", fp);
+		fputs("#<hostname> <port> <time_t expires> <error code> <addresses>\n\n", fp);
+
+		// least recently used first, so the most wanted entries survive a smaller cache on reload
+		for (ADDR_ENTRY *entry = lru_tail; entry; entry = entry->prev) {
+			if (entry->expires < now || !entry->host)
+				continue;
+
+			fprintf(fp, "%s %s %lld %d ", entry->host, entry->port ? entry->port : "-", (long long) entry->expires, entry->rc);
+
+			if (entry->addrinfo) {
+				for (struct addrinfo *ai = entry->addrinfo; ai; ai = ai->ai_next) {
+					char adr[NI_MAXHOST];
+
+					if (getnameinfo(ai->ai_addr, ai->ai_addrlen, adr, sizeof(adr), NULL, 0, NI_NUMERICHOST) == 0)
+						fprintf(fp, ai == entry->addrinfo ? "%s" : ",%s", adr);
+				}
+				fputc('\n', fp);
+			} else
+				fputs("-\n", fp);
+		}
+	}
+
+	wget_thread_mutex_unlock(&dns_mutex);
+
+	return ferror(fp) ? -1 : 0;
+}
+
+/**
+ * \param[in] fname Name of the DNS cache file
+ * \return 0 on success, -1 on error
+ *
+ * Load the DNS cache entries from \p fname that haven't expired yet.
+ * Entries already in memory are kept.
+ */
+int wget_dns_cache_load(const char *fname)
+{
+	if (!fname || !*fname)
+		return 0;
+
+	if (wget_update_file(fname, _dns_cache_load, NULL, NULL)) {
+		error_printf(_("Failed to read DNS cache data\n"));
+		return -1;
+	}
+
+	debug_printf("Fetched DNS cache data from '%s'\n", fname);
+	return 0;
+}
+
+/**
+ * \param[in] fname Name of the DNS cache file
+ * \return 0 on success, -1 on error
+ *
+ * Save the DNS cache to \p fname, merged with the valid entries already in the file.
+ */
+int wget_dns_cache_save(const char *fname)
+{
+	if (!fname || !*fname)
+		return -1;
+
+	if (wget_update_file(fname, _dns_cache_load, _dns_cache_save, NULL)) {
+		error_printf(_("Failed to write DNS cache file '%s'\n"), fname);
+		return -1;
+	}
+
+	debug_printf("Saved %d DNS cache entries into '%s'\n", wget_hashmap_size(dns_cache), fname);
+	return 0;
+}
+
+/**
+ * \param[in] max_size Max. number of DNS cache entries, 0 for no limit
+ *
+ * Limit the size of the DNS cache. The least recently used entries are dropped when the limit is reached.
+ */
+void wget_dns_cache_set_max_size(int max_size)
+{
+	wget_thread_mutex_lock(&dns_mutex);
+
+	dns_cache_max_size = max_size;
+
+	while (dns_cache_max_size > 0 && wget_hashmap_size(dns_cache) > dns_cache_max_size)
+		_cache_remove(lru_tail);
+
+	wget_thread_mutex_unlock(&dns_mutex);
+}
+
+void wget_dns_cache_free(void)
+{
+	wget_thread_t join_tids[DNS_THREADS_MAX];
+	int njoin = 0;
+
+	wget_thread_mutex_lock(&dns_mutex);
+	resolver_stop = 1;
+	wget_thread_cond_signal(&resolver_cond);
+
+	// idle threads quit right away, threads hanging in getaddrinfo() (e.g. for a prefetch) are abandoned,
+	// they notice the new generation when they come back and quit without touching the cache
+	for (int it = 0; it < nresolvers; it++) {
+		if (!resolver_busy[it])
+			join_tids[njoin++] = resolver_tids[it];
+		resolver_busy[it] = 0;
+	}
+
+	resolver_generation++;
+	wget_thread_mutex_unlock(&dns_mutex);
+
+	for (int it = 0; it < njoin; it++)
+		wget_thread_join(join_tids[it]);
+
+	wget_thread_mutex_lock(&dns_mutex);
+	nresolvers = 0;
+
+	for (DNS_LOOKUP *lookup; (lookup = urgent_queue.head ? urgent_queue.head : prefetch_queue.head);) {
+		_queue_remove(lookup->urgent ? &urgent_queue : &prefetch_queue, lookup);
+		wget_hashmap_remove_nofree(lookups, lookup);
+		_lookup_unref(lookup);
+	}
+
+	wget_hashmap_free(&lookups);
+	wget_hashmap_free(&dns_cache);
+	lru_head = lru_tail = NULL;
+	wget_vector_free(&retired);
+	resolver_stop = 0;
+	wget_thread_mutex_unlock(&dns_mutex);
+}
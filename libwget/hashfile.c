@@ -499,6 +499,18 @@ void wget_hash_deinit(wget_hash_hd_t *dig, void *digest)
 }
 #endif
 
+/**
+ * \return A new handle for wget_hash_init()
+ *
+ * Allocate a hashing handle. ::wget_hash_hd_t is an opaque type, so code outside of libwget
+ * can't declare one on the stack. The handle can be reused after wget_hash_deinit() and
+ * has to be freed with wget_xfree() when no longer needed.
+ */
+wget_hash_hd_t *wget_hash_alloc(void)
+{
+	return xmalloc(sizeof(wget_hash_hd_t));
+}
+
 /**
  * \param[in] hashname Name of the hashing algorithm. See wget_hash_get_algorithm()
  * \param[in] fd File descriptor for the target file
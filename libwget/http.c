@@ -1677,10 +1677,22 @@ static int _on_frame_send_callback(nghttp2_session *session G_GNUC_WGET_UNUSED,
 }
 
 static int _on_frame_recv_callback(nghttp2_session *session G_GNUC_WGET_UNUSED,
-	const nghttp2_frame *frame, void *user_data G_GNUC_WGET_UNUSED)
+	const nghttp2_frame *frame, void *user_data)
 {
 	_print_frame_type(frame->hd.type, '<', frame->hd.stream_id);
 
+	// the stream limit tells how many requests may be in flight at once
+	if (frame->hd.type == NGHTTP2_SETTINGS && !(frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+		wget_http_connection_t *conn = (wget_http_connection_t *) user_data;
+
+		for (size_t it = 0; it < frame->settings.niv; it++) {
+			if (frame->settings.iv[it].settings_id == NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS) {
+				conn->max_concurrent_streams = (int) frame->settings.iv[it].value;
+				debug_printf("server allows %d concurrent streams\n", conn->max_concurrent_streams);
+			}
+		}
+	}
+
 	// header callback after receiving all header tags
 	if (frame->hd.type == NGHTTP2_HEADERS) {
 		struct _http2_stream_context *ctx = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
@@ -1938,7 +1950,7 @@ int wget_http_open(wget_http_connection_t **_conn, const wget_iri_t *iri)
 
 	if ((rc = wget_tcp_connect(conn->tcp, host, port)) == WGET_E_SUCCESS) {
 		conn->esc_host = iri->host ? wget_strdup(iri->host) : NULL;
-		conn->port = iri->resolv_port;
+		conn->port = wget_strdup(iri->resolv_port); // the IRI might be freed while the connection is still in use
 		conn->scheme = iri->scheme;
 		conn->buf = wget_buffer_alloc(102400); // reusable buffer, large enough for most requests and responses
 #ifdef WITH_LIBNGHTTP2
@@ -1968,11 +1980,10 @@ int wget_http_open(wget_http_connection_t **_conn, const wget_iri_t *iri)
 			}
 
 			conn->received_http2_responses = wget_vector_create(16, -2, NULL);
-		} else
-			conn->pending_requests = wget_vector_create(16, -2, NULL);
-#else
-		conn->pending_requests = wget_vector_create(16, -2, NULL);
+			conn->max_concurrent_streams = 1; // more streams might be refused until the server's SETTINGS arrived
+		}
 #endif
+		conn->pending_requests = wget_vector_create(16, -2, NULL);
 	} else {
 		wget_http_close(_conn);
 	}
@@ -1989,8 +2000,25 @@ void wget_http_close(wget_http_connection_t **conn)
 			int rc = nghttp2_session_terminate_session((*conn)->http2_session, NGHTTP2_NO_ERROR);
 			if (rc)
 				error_printf(_("Failed to terminate HTTP2 session (%d)\n"), rc);
+
+			// free the contexts of streams that are still open (client streams have odd ids)
+			for (uint32_t id = 1; id < nghttp2_session_get_next_stream_id((*conn)->http2_session); id += 2) {
+				struct _http2_stream_context *ctx = nghttp2_session_get_stream_user_data((*conn)->http2_session, id);
+
+				if (ctx) {
+					nghttp2_session_set_stream_user_data((*conn)->http2_session, id, NULL);
+					wget_http_free_response(&ctx->resp);
+					wget_decompress_close(ctx->decompressor);
+					xfree(ctx);
+				}
+			}
+
 			nghttp2_session_del((*conn)->http2_session);
 		}
+		for (int it = 0; it < wget_vector_size((*conn)->received_http2_responses); it++) {
+			wget_http_response_t *resp = wget_vector_get((*conn)->received_http2_responses, it);
+			wget_http_free_response(&resp); // the request is still in 'pending_requests'
+		}
 		wget_vector_clear_nofree((*conn)->received_http2_responses);
 		wget_vector_free(&(*conn)->received_http2_responses);
 #endif
@@ -1998,9 +2026,10 @@ void wget_http_close(wget_http_connection_t **conn)
 //		if (!wget_tcp_get_dns_caching())
 //			freeaddrinfo((*conn)->addrinfo);
 		xfree((*conn)->esc_host);
-		// xfree((*conn)->port);
+		xfree((*conn)->port);
 		// xfree((*conn)->scheme);
 		wget_buffer_free(&(*conn)->buf);
+		wget_buffer_free(&(*conn)->readahead);
 		wget_vector_clear_nofree((*conn)->pending_requests);
 		wget_vector_free(&(*conn)->pending_requests);
 		xfree(*conn);
@@ -2069,6 +2098,7 @@ int wget_http_send_request(wget_http_connection_t *conn, wget_http_request_t *re
 		}
 
 		conn->pending_http2_requests++;
+		wget_vector_add_noalloc(conn->pending_requests, req);
 
 		debug_printf("HTTP2 stream id %d\n", req->stream_id);
 
@@ -2081,6 +2111,10 @@ int wget_http_send_request(wget_http_connection_t *conn, wget_http_request_t *re
 		return -1;
 	}
 
+	// TLS early data might be replayed by an attacker, allow it only for idempotent requests
+	if (strcmp(req->method, "GET") && strcmp(req->method, "HEAD"))
+		wget_tcp_set_tls_early_data(conn->tcp, 0);
+
 	if (wget_tcp_write(conn->tcp, conn->buf->data, nbytes) != nbytes) {
 		// An error will be written by the wget_tcp_write function.
 		// error_printf(_("Failed to send %zd bytes (%d)\n"), nbytes, errno);
@@ -2147,6 +2181,46 @@ ssize_t wget_http_request_to_buffer(wget_http_request_t *req, wget_buffer_t *buf
 	return buf->length;
 }
 
+// read from the connection, data received ahead of time (pipelining) comes first
+static ssize_t _http_read(wget_http_connection_t *conn, char *buf, size_t count)
+{
+	wget_buffer_t *readahead = conn->readahead;
+
+	if (readahead && readahead->length) {
+		size_t n = readahead->length < count ? readahead->length : count;
+
+		memcpy(buf, readahead->data, n);
+		readahead->length -= n;
+		memmove(readahead->data, readahead->data + n, readahead->length + 1);
+		return n;
+	}
+
+	return wget_tcp_read(conn->tcp, buf, count);
+}
+
+// keep data that has been read beyond the end of the current response (HTTP/1.1 pipelining)
+static void _http_unread(wget_http_connection_t *conn, const char *data, size_t length)
+{
+	wget_buffer_t *readahead;
+
+	if (!length)
+		return;
+
+	if (!(readahead = conn->readahead))
+		readahead = conn->readahead = wget_buffer_alloc(length > 1024 ? length : 1024);
+
+	if (readahead->length) {
+		// put it in front of what has not been consumed yet
+		wget_buffer_ensure_capacity(readahead, readahead->length + length);
+		memmove(readahead->data + length, readahead->data, readahead->length + 1);
+		memcpy(readahead->data, data, length);
+		readahead->length += length;
+	} else
+		wget_buffer_memcpy(readahead, data, length);
+
+	debug_printf("keep %zu bytes of the next response\n", length);
+}
+
 wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 {
 	size_t bufsize, body_len = 0, body_size = 0;
@@ -2203,6 +2277,13 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 			debug_printf("  ##  response status %d\n", resp->code);
 			wget_vector_remove_nofree(conn->received_http2_responses, 0);
 
+			for (int it = 0; it < wget_vector_size(conn->pending_requests); it++) {
+				if (wget_vector_get(conn->pending_requests, it) == resp->req) {
+					wget_vector_remove_nofree(conn->pending_requests, it);
+					break;
+				}
+			}
+
 			// a workaround for broken server configurations
 			// see http://mail-archives.apache.org/mod_mbox/httpd-dev/200207.mbox/<3D2D4E76.4010502@talex.com.pl>
 			if (resp->content_encoding == wget_content_encoding_gzip &&
@@ -2230,7 +2311,7 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 	buf = conn->buf->data;
 	bufsize = conn->buf->size;
 
-	while ((nbytes = wget_tcp_read(conn->tcp, buf + nread, bufsize - nread)) > 0) {
+	while ((nbytes = _http_read(conn, buf + nread, bufsize - nread)) > 0) {
 		debug_printf("nbytes %zd nread %zd %zu\n", nbytes, nread, bufsize);
 		nread += nbytes;
 		buf[nread] = 0; // 0-terminate to allow string functions
@@ -2272,10 +2353,13 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 					goto cleanup; // stop requested by callback function
 			}
 
-			if (req && !wget_strcasecmp_ascii(req->method, "HEAD"))
+			p += 4; // skip \r\n\r\n to point to body
+
+			if (req && !wget_strcasecmp_ascii(req->method, "HEAD")) {
+				_http_unread(conn, p, nread - (p - buf));
 				goto cleanup; // a HEAD response won't have a body
+			}
 
-			p += 4; // skip \r\n\r\n to point to body
 			break;
 		}
 
@@ -2291,6 +2375,8 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 		(resp->transfer_encoding == transfer_encoding_identity && resp->content_length == 0 && resp->content_length_valid)) {
 		// - body not included, see RFC 2616 4.3
 		// - body empty, see RFC 2616 4.4
+		if (resp)
+			_http_unread(conn, p, nread - (p - buf));
 		goto cleanup;
 	}
 
@@ -2353,7 +2439,7 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 				if (conn->abort_indicator || _abort_indicator)
 					goto cleanup;
 
-				if ((nbytes = wget_tcp_read(conn->tcp, buf + body_len, bufsize - body_len)) <= 0)
+				if ((nbytes = _http_read(conn, buf + body_len, bufsize - body_len)) <= 0)
 					goto cleanup;
 
 				body_len += nbytes;
@@ -2367,11 +2453,13 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 			debug_printf("chunk size is %zu\n", chunk_size);
 			if (chunk_size == 0) {
 				// now read 'trailer CRLF' which is '*(entity-header CRLF) CRLF'
-				if (*end == '\r' && end[1] == '\n') // shortcut for the most likely case (empty trailer)
+				if (*end == '\r' && end[1] == '\n') { // shortcut for the most likely case (empty trailer)
+					_http_unread(conn, end + 2, buf + body_len - (end + 2));
 					goto cleanup;
+				}
 
 				debug_printf("reading trailer\n");
-				while (!strstr(end, "\r\n\r\n")) {
+				while (!(p = strstr(end, "\r\n\r\n"))) {
 					if (body_len > 3) {
 						// just need to keep the last 3 bytes to avoid buffer resizing
 						memmove(buf, buf + body_len - 3, 4); // plus 0 terminator, just in case
@@ -2381,7 +2469,7 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 					if (conn->abort_indicator || _abort_indicator)
 						goto cleanup;
 
-					if ((nbytes = wget_tcp_read(conn->tcp, buf + body_len, bufsize - body_len)) <= 0)
+					if ((nbytes = _http_read(conn, buf + body_len, bufsize - body_len)) <= 0)
 						goto cleanup;
 
 					body_len += nbytes;
@@ -2390,6 +2478,7 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 					debug_printf("a nbytes %zd\n", nbytes);
 				}
 				debug_printf("end of trailer \n");
+				_http_unread(conn, p + 4, buf + body_len - (p + 4));
 				goto cleanup;
 			}
 
@@ -2412,7 +2501,7 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 				if (conn->abort_indicator || _abort_indicator)
 					goto cleanup;
 
-				if ((nbytes = wget_tcp_read(conn->tcp, buf, bufsize)) <= 0)
+				if ((nbytes = _http_read(conn, buf, bufsize)) <= 0)
 					goto cleanup;
 				debug_printf("a nbytes=%zd chunk_size=%zu\n", nread, chunk_size);
 
@@ -2451,14 +2540,53 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 		// read content_length bytes
 		debug_printf("method 2\n");
 
+		if (body_len > resp->content_length) {
+			// the beginning of the next (pipelined) response
+			_http_unread(conn, buf + resp->content_length, body_len - resp->content_length);
+			body_len = resp->content_length;
+			resp->cur_downloaded = body_len;
+		}
+
 		if (body_len)
 			wget_decompress(dc, buf, body_len);
 
-		while (body_len < resp->content_length) {
+		// the data received ahead (pipelining) has to go through _http_read()
+		if (resp->splice_body && (resp->content_encoding != wget_content_encoding_identity
+			|| (conn->readahead && conn->readahead->length)))
+		{
+			resp->splice_body = 0;
+		}
+
+		while (resp->splice_body && body_len < resp->content_length) {
 			if (conn->abort_indicator || _abort_indicator)
 				break;
 
-			if (((nbytes = wget_tcp_read(conn->tcp, buf, bufsize)) <= 0))
+			// move the body into the file without copying it through our buffers
+			if ((nbytes = wget_tcp_splice(conn->tcp, resp->splice_fd, resp->content_length - body_len)) == WGET_E_UNSUPPORTED) {
+				debug_printf("splice not possible, reading the body\n");
+				resp->splice_body = 0;
+				nbytes = 0;
+				break;
+			}
+
+			if (nbytes <= 0)
+				break;
+
+			body_len += nbytes;
+			debug_printf("spliced %zd total %zu/%zu\n", nbytes, body_len, resp->content_length);
+			resp->cur_downloaded += nbytes;
+			if (resp->req->body_callback(resp, resp->req->body_user_data, NULL, nbytes))
+				break;
+		}
+
+		while (!resp->splice_body && body_len < resp->content_length) {
+			if (conn->abort_indicator || _abort_indicator)
+				break;
+
+			// don't read beyond this response
+			size_t count = resp->content_length - body_len < bufsize ? resp->content_length - body_len : bufsize;
+
+			if (((nbytes = _http_read(conn, buf, count)) <= 0))
 				break;
 
 			body_len += nbytes;
@@ -2468,7 +2596,7 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 		}
 		if (nbytes < 0)
 			error_printf(_("Failed to read %zd bytes (%d)\n"), nbytes, errno);
-		if (body_len < resp->content_length)
+		if (body_len < resp->content_length && !conn->abort_indicator)
 			error_printf(_("Just got %zu of %zu bytes\n"), body_len, resp->content_length);
 		else if (body_len > resp->content_length)
 			error_printf(_("Body too large: %zu instead of %zu bytes\n"), body_len, resp->content_length);
@@ -2480,7 +2608,7 @@ wget_http_response_t *wget_http_get_response_cb(wget_http_connection_t *conn)
 		if (body_len)
 			wget_decompress(dc, buf, body_len);
 
-		while (!conn->abort_indicator && !_abort_indicator && (nbytes = wget_tcp_read(conn->tcp, buf, bufsize)) > 0) {
+		while (!conn->abort_indicator && !_abort_indicator && (nbytes = _http_read(conn, buf, bufsize)) > 0) {
 			body_len += nbytes;
 			debug_printf("nbytes %zd total %zu\n", nbytes, body_len);
 			resp->cur_downloaded += nbytes;
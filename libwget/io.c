@@ -188,6 +188,25 @@ ssize_t wget_getline(char **buf, size_t *bufsize, FILE *fp)
 	return wget_getline_internal(buf, bufsize, (void *)fp, __read);
 }
 
+static wget_ready_2_transfer_func_t
+	_ready_2_transfer_func;
+
+/**
+ * \param[in] func Function that replaces the waiting of wget_ready_2_transfer() or NULL to restore the default
+ *
+ * Set a function that waits for file descriptors instead of poll()/select().
+ *
+ * This allows an application to run libwget's blocking network code on top of its own event loop
+ * (e.g. user-space tasks multiplexed by epoll), since all waiting for sockets (connect, TLS handshake,
+ * reading and writing) is done via wget_ready_2_transfer().
+ *
+ * \p func is only called with a \p timeout not equal 0 and has to behave like wget_ready_2_transfer().
+ */
+void wget_ready_2_transfer_set_func(wget_ready_2_transfer_func_t func)
+{
+	_ready_2_transfer_func = func;
+}
+
 /**
  * \param[in] fd File descriptor to wait for
  * \param[in] timeout Max. duration in milliseconds to wait
@@ -207,6 +226,9 @@ int wget_ready_2_transfer(int fd, int timeout, short mode)
 {
 	int rc = -1;
 
+	if (_ready_2_transfer_func && timeout)
+		return _ready_2_transfer_func(fd, timeout, mode);
+
 #ifdef HAVE_POLL
 	struct pollfd pollfd;
 
@@ -440,10 +440,24 @@ wget_iri_t *wget_iri_clone(wget_iri_t *iri)
 	clone->userinfo = iri->userinfo ? (char *)clone + (size_t) (iri->userinfo - (const char *)iri): NULL;
 	clone->password = iri->password ? (char *)clone + (size_t) (iri->password - (const char *)iri): NULL;
 	clone->port = iri->port ? (char *)clone + (size_t) (iri->port - (const char *)iri): NULL;
-	clone->resolv_port = iri->resolv_port ? (char *)clone + (size_t) (iri->resolv_port - (const char *)iri): NULL;
-	clone->path = iri->path ? (char *)clone + (size_t) (iri->path - (const char *)iri): NULL;
-	clone->query = iri->query ? (char *)clone + (size_t) (iri->query - (const char *)iri): NULL;
-	clone->fragment = iri->fragment ? (char *)clone + (size_t) (iri->fragment - (const char *)iri): NULL;
+	// resolv_port points to a static default port string unless the port is given explicitly
+	clone->resolv_port = iri->resolv_port != iri->port ? iri->resolv_port : clone->port;
+
+	// path, query and fragment are allocated separately after a charset conversion
+	if (iri->path_allocated)
+		clone->path = wget_strdup(iri->path);
+	else
+		clone->path = iri->path ? (char *)clone + (size_t) (iri->path - (const char *)iri): NULL;
+
+	if (iri->query_allocated)
+		clone->query = wget_strdup(iri->query);
+	else
+		clone->query = iri->query ? (char *)clone + (size_t) (iri->query - (const char *)iri): NULL;
+
+	if (iri->fragment_allocated)
+		clone->fragment = wget_strdup(iri->fragment);
+	else
+		clone->fragment = iri->fragment ? (char *)clone + (size_t) (iri->fragment - (const char *)iri): NULL;
 
 	return clone;
 }
@@ -130,11 +130,12 @@ wget_list_append(wget_list_t **list, const void *data, size_t size)
  */
 void *wget_list_prepend(wget_list_t **list, const void *data, size_t size)
 {
-	if (!*list) {
-		return wget_list_append(list, data, size);
-	} else {
-		return wget_list_append(&(*list)->prev, data, size);
-	}
+	void *elem = wget_list_append(list, data, size);
+
+	// the new element has been inserted in front of the first element, make it the new first element
+	*list = ((wget_list_t *)elem) - 1;
+
+	return elem;
 }
 
 /**
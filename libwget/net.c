@@ -58,23 +58,17 @@
 #else
 # include <fcntl.h>
 #endif
+#ifdef HAVE_SPLICE
+#	include <sys/stat.h>
+#endif
 
 #include <wget.h>
 #include "private.h"
 #include "net.h"
 
-// resolver / DNS cache entry
-struct ADDR_ENTRY {
-	const char *
-		host;
-	const char *
-		port;
-	struct addrinfo *
-		addrinfo;
-};
-
 static struct wget_tcp_st _global_tcp = {
 	.sockfd = -1,
+	.splice_pipe = { -1, -1 },
 	.dns_timeout = -1,
 	.connect_timeout = -1,
 	.timeout = -1,
@@ -86,217 +80,10 @@ static struct wget_tcp_st _global_tcp = {
 #endif
 };
 
-// resolver / DNS cache container
-static wget_vector_t
-	*dns_cache;
-static wget_thread_mutex_t
-	dns_mutex = WGET_THREAD_MUTEX_INITIALIZER;
-
-static struct addrinfo *_wget_dns_cache_get(const char *host, const char *port)
+// the settings new wget_tcp_t objects start with
+wget_tcp_t *_wget_tcp_get_global(void)
 {
-	if (dns_cache) {
-		struct ADDR_ENTRY *entryp, entry = { .host = host, .port = port };
-		int index;
-
-		wget_thread_mutex_lock(&dns_mutex);
-		entryp = wget_vector_get(dns_cache, (index = wget_vector_find(dns_cache, &entry)));
-		wget_thread_mutex_unlock(&dns_mutex);
-
-		if (entryp) {
-			// DNS cache entry found
-			debug_printf("Found dns cache entry #%d\n", index);
-			return entryp->addrinfo;
-		}
-	}
-
-	return NULL;
-}
-
-static int G_GNUC_WGET_PURE _compare_addr(struct ADDR_ENTRY *a1, struct ADDR_ENTRY *a2)
-{
-	int n;
-
-	if ((n = wget_strcasecmp(a1->host, a2->host)) == 0)
-		return wget_strcasecmp_ascii(a1->port, a2->port);
-
-	return n;
-}
-
-static void _free_dns(struct ADDR_ENTRY *entry)
-{
-	freeaddrinfo(entry->addrinfo);
-}
-
-static struct addrinfo * _wget_dns_cache_add(const char *host, const char *port, struct addrinfo *addrinfo)
-{
-	// insert addrinfo into dns cache
-	size_t hostlen = host ? strlen(host) + 1 : 0;
-	size_t portlen = port ? strlen(port) + 1 : 0;
-	struct ADDR_ENTRY *entryp = xmalloc(sizeof(struct ADDR_ENTRY) + hostlen + portlen);
-	int index;
-
-	if (host) {
-		entryp->host = ((char *)entryp) + sizeof(struct ADDR_ENTRY);
-		memcpy((char *)entryp->host, host, hostlen); // ugly cast, but semantically ok
-	} else
-		entryp->host = NULL;
-
-	if (port) {
-		entryp->port = ((char *)entryp) + sizeof(struct ADDR_ENTRY) + hostlen;
-		memcpy((char *)entryp->port, port, portlen); // ugly cast, but semantically ok
-	} else
-		entryp->port = NULL;
-
-	entryp->addrinfo = addrinfo;
-
-	wget_thread_mutex_lock(&dns_mutex);
-	if (!dns_cache) {
-		dns_cache = wget_vector_create(4, -2, (wget_vector_compare_t)_compare_addr);
-		wget_vector_set_destructor(dns_cache, (wget_vector_destructor_t)_free_dns);
-	}
-
-	if ((index = wget_vector_find(dns_cache, entryp)) == -1) {
-		debug_printf("Add dns cache entry %s:%s\n", host, port);
-		wget_vector_insert_sorted_noalloc(dns_cache, entryp);
-	} else {
-		// race condition:
-		xfree(entryp);
-		freeaddrinfo(addrinfo);
-		addrinfo = wget_vector_get(dns_cache, index);
-	}
-	wget_thread_mutex_unlock(&dns_mutex);
-
-	return addrinfo;
-}
-
-void wget_dns_cache_free(void)
-{
-	wget_thread_mutex_lock(&dns_mutex);
-	wget_vector_free(&dns_cache);
-	wget_thread_mutex_unlock(&dns_mutex);
-}
-
-struct addrinfo *wget_tcp_resolve(wget_tcp_t *tcp, const char *host, const char *port)
-{
-	static wget_thread_mutex_t
-		mutex = WGET_THREAD_MUTEX_INITIALIZER;
-	struct addrinfo *addrinfo, hints;
-	int rc = 0, ai_flags = 0;
-
-	if (!tcp)
-		tcp = &_global_tcp;
-
-//	if (!port)
-//		port = "0";
-
-	// get the IP address for the server
-	for (int tries = 0, max = 3; tries < max; tries++) {
-		// if port is NULL,
-		if (tcp->caching) {
-			if ((addrinfo = _wget_dns_cache_get(host, port)))
-				return addrinfo;
-
-			// prevent multiple address resolutions of the same host/port
-			wget_thread_mutex_lock(&mutex);
-			// now try again
-			if ((addrinfo = _wget_dns_cache_get(host, port))) {
-				wget_thread_mutex_unlock(&mutex);
-				return addrinfo;
-			}
-		}
-		addrinfo = NULL;
-
-		ai_flags |= (port && c_isdigit(*port) ? AI_NUMERICSERV : 0);
-		ai_flags |= AI_ADDRCONFIG;
-
-		if (tcp->passive) {
-			ai_flags |= AI_PASSIVE;
-		}
-
-		memset(&hints, 0 ,sizeof(hints));
-		hints.ai_family = tcp->family;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = ai_flags;
-
-		if (port)
-			debug_printf("resolving %s:%s...\n", host, port);
-		else
-			debug_printf("resolving %s...\n", host);
-
-		if ((rc = getaddrinfo(host, port, &hints, &addrinfo)) == 0 || rc != EAI_AGAIN)
-			break;
-
-		if (tries < max - 1) {
-			if (tcp->caching)
-				wget_thread_mutex_unlock(&mutex);
-			wget_millisleep(100);
-		}
-	}
-
-	if (rc) {
-		error_printf(_("Failed to resolve %s:%s (%s)\n"), host, port, gai_strerror(rc));
-
-		if (tcp->caching)
-			wget_thread_mutex_unlock(&mutex);
-
-		return NULL;
-	}
-
-	if (tcp->family == AF_UNSPEC && tcp->preferred_family != AF_UNSPEC) {
-		struct addrinfo *preferred = NULL, *preferred_tail = NULL;
-		struct addrinfo *unpreferred = NULL, *unpreferred_tail = NULL;
-
-		// split address list into preferred and not preferred, keeping the original order
-		for (struct addrinfo *ai = addrinfo; ai;) {
-			if (ai->ai_family == tcp->preferred_family) {
-				if (preferred_tail)
-					preferred_tail->ai_next = ai;
-				else
-					preferred = ai; // remember the head of the list
-
-				preferred_tail = ai;
-				ai = ai->ai_next;
-				preferred_tail->ai_next = NULL;
-			} else {
-				if (unpreferred_tail)
-					unpreferred_tail->ai_next = ai;
-				else
-					unpreferred = ai; // remember the head of the list
-
-				unpreferred_tail = ai;
-				ai = ai->ai_next;
-				unpreferred_tail->ai_next = NULL;
-			}
-		}
-
-		// merge preferred + not preferred
-		if (preferred) {
-			preferred_tail->ai_next = unpreferred;
-			addrinfo = preferred;
-		} else {
-			addrinfo = unpreferred;
-		}
-	}
-
-	if (wget_logger_is_active(wget_get_logger(WGET_LOGGER_DEBUG))) {
-		for (struct addrinfo *ai = addrinfo; ai; ai = ai->ai_next) {
-			char adr[NI_MAXHOST], sport[NI_MAXSERV];
-
-			if ((rc = getnameinfo(ai->ai_addr, ai->ai_addrlen, adr, sizeof(adr), sport, sizeof(sport), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
-				debug_printf("has %s:%s\n", adr, sport);
-			else
-				debug_printf("has ???:%s (%s)\n", sport, gai_strerror(rc));
-		}
-	}
-
-	if (tcp->caching) {
-		// In case of a race condition the already existing addrinfo is returned.
-		// The addrinfo argument given to _wget_dns_cache_add() will be freed in this case.
-		addrinfo = _wget_dns_cache_add(host, port, addrinfo);
-		wget_thread_mutex_unlock(&mutex);
-	}
-
-	return addrinfo;
+	return &_global_tcp;
 }
 
 static int G_GNUC_WGET_CONST _value_to_family(int value)
@@ -345,6 +132,21 @@ int wget_tcp_get_tls_false_start(wget_tcp_t *tcp)
 	return (tcp ? tcp : &_global_tcp)->tls_false_start;
 }
 
+// Enable TLS 1.3 early data (0-RTT): when there is a session to resume, wget_ssl_open() defers
+// the handshake and the first write goes out together with the ClientHello.
+// Early data may be replayed by an attacker, so clear it on a connected 'tcp' before writing
+// anything that is not idempotent.
+
+void wget_tcp_set_tls_early_data(wget_tcp_t *tcp, int early_data)
+{
+	(tcp ? tcp : &_global_tcp)->tls_early_data = early_data;
+}
+
+int wget_tcp_get_tls_early_data(wget_tcp_t *tcp)
+{
+	return (tcp ? tcp : &_global_tcp)->tls_early_data;
+}
+
 void wget_tcp_set_dns_caching(wget_tcp_t *tcp, int caching)
 {
 	(tcp ? tcp : &_global_tcp)->caching = caching;
@@ -429,7 +231,7 @@ void wget_tcp_set_bind_address(wget_tcp_t *tcp, const char *bind_address)
 		tcp = &_global_tcp;
 
 	if (tcp->bind_addrinfo_allocated) {
-		freeaddrinfo(tcp->bind_addrinfo);
+		_wget_dns_freeaddrinfo(tcp->bind_addrinfo);
 		tcp->bind_addrinfo = NULL;
 	}
 
@@ -512,7 +314,7 @@ void wget_tcp_deinit(wget_tcp_t **_tcp)
 		wget_tcp_close(tcp);
 
 		if (tcp->bind_addrinfo_allocated) {
-			freeaddrinfo(tcp->bind_addrinfo);
+			_wget_dns_freeaddrinfo(tcp->bind_addrinfo);
 			tcp->bind_addrinfo = NULL;
 		}
 		xfree(tcp->ssl_hostname);
@@ -545,54 +347,302 @@ int wget_tcp_ready_2_transfer(wget_tcp_t *tcp, int flags)
 	return wget_ready_2_transfer(tcp->sockfd, tcp->timeout, flags);
 }
 
-int wget_tcp_connect(wget_tcp_t *tcp, const char *host, const char *port)
+// returns a new non-blocking socket for 'ai', -1 if it couldn't be created, -2 if binding failed
+static int _tcp_socket(wget_tcp_t *tcp, struct addrinfo *ai, int debug)
 {
-	struct addrinfo *ai;
-	int sockfd = -1, rc, ret = WGET_E_UNKNOWN;
 	char adr[NI_MAXHOST], s_port[NI_MAXSERV];
-	int debug = wget_logger_is_active(wget_get_logger(WGET_LOGGER_DEBUG));
+	int sockfd, rc, on = 1;
 
-	if (tcp->addrinfo_allocated)
-		freeaddrinfo(tcp->addrinfo);
+	if ((sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1) {
+		error_printf(_("Failed to create socket (%d)\n"), errno);
+		return -1;
+	}
 
-	tcp->addrinfo = wget_tcp_resolve(tcp, host, port);
-	tcp->addrinfo_allocated = !tcp->caching;
+	_set_async(sockfd);
 
-	for (ai = tcp->addrinfo; ai; ai = ai->ai_next) {
+	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on)) == -1)
+		error_printf(_("Failed to set socket option REUSEADDR\n"));
+
+	on = 1;
+	if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (void *)&on, sizeof(on)) == -1)
+		error_printf(_("Failed to set socket option NODELAY\n"));
+
+	if (tcp->bind_addrinfo) {
 		if (debug) {
-			if ((rc = getnameinfo(ai->ai_addr, ai->ai_addrlen, adr, sizeof(adr), s_port, sizeof(s_port), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
-				debug_printf("trying %s:%s...\n", adr, s_port);
+			if ((rc = getnameinfo(tcp->bind_addrinfo->ai_addr, tcp->bind_addrinfo->ai_addrlen, adr, sizeof(adr), s_port, sizeof(s_port), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
+				debug_printf("binding to %s:%s...\n", adr, s_port);
 			else
-				debug_printf("trying ???:%s (%s)...\n", s_port, gai_strerror(rc));
+				debug_printf("binding to ???:%s (%s)...\n", s_port, gai_strerror(rc));
 		}
 
-		if ((sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) != -1) {
-			int on = 1;
+		if (bind(sockfd, tcp->bind_addrinfo->ai_addr, tcp->bind_addrinfo->ai_addrlen) != 0) {
+			error_printf(_("Failed to bind (%d)\n"), errno);
+			close(sockfd);
+			return -2;
+		}
+	}
 
-			_set_async(sockfd);
+	return sockfd;
+}
 
-			if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on)) == -1)
-				error_printf(_("Failed to set socket option REUSEADDR\n"));
+static void _debug_trying(struct addrinfo *ai)
+{
+	char adr[NI_MAXHOST], s_port[NI_MAXSERV];
+	int rc;
 
-			on = 1;
-			if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (void *)&on, sizeof(on)) == -1)
-				error_printf(_("Failed to set socket option NODELAY\n"));
+	if ((rc = getnameinfo(ai->ai_addr, ai->ai_addrlen, adr, sizeof(adr), s_port, sizeof(s_port), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
+		debug_printf("trying %s:%s...\n", adr, s_port);
+	else
+		debug_printf("trying ???:%s (%s)...\n", s_port, gai_strerror(rc));
+}
 
-			if (tcp->bind_addrinfo) {
-				if (debug) {
-					if ((rc = getnameinfo(tcp->bind_addrinfo->ai_addr, tcp->bind_addrinfo->ai_addrlen, adr, sizeof(adr), s_port, sizeof(s_port), NI_NUMERICHOST | NI_NUMERICSERV)) == 0)
-						debug_printf("binding to %s:%s...\n", adr, s_port);
-					else
-						debug_printf("binding to ???:%s (%s)...\n", s_port, gai_strerror(rc));
+/*
+ * Happy Eyeballs (RFC 8305)
+ *
+ * With more than one address, connection attempts are started 250ms apart (or as soon as the
+ * previous attempt failed), alternating between the address families. The first connection
+ * that is established and passes the TLS handshake wins, the other attempts are cancelled.
+ * The TLS handshakes run non-blocking alongside the other attempts, so an address that accepts
+ * TCP connections but stalls in the handshake doesn't hold up the race.
+ * The winning address goes to the front of the DNS cache entry, so it's tried first next time.
+ */
+#define HAPPY_EYEBALLS_DELAY 250 // ms between connection attempts
+#define HAPPY_EYEBALLS_SLICE 50 // ms, how often all pending attempts are checked
+
+typedef struct {
+	struct addrinfo *
+		ai;
+	wget_tcp_t
+		tls; // copy of the racing connection for the TLS handshake, while 'handshake' is set
+	int
+		sockfd, // -1: not started or failed
+		io; // WGET_IO_* to wait for
+	unsigned char
+		handshake : 1; // connected, TLS handshake pending
+} HE_ATTEMPT;
+
+// give up 'attempt', e.g. because it lost the race
+static void _he_cancel(HE_ATTEMPT *attempt)
+{
+	if (attempt->handshake) {
+		_wget_ssl_open_cancel(&attempt->tls);
+		attempt->handshake = 0;
+	}
+
+	if (attempt->sockfd != -1) {
+		close(attempt->sockfd);
+		attempt->sockfd = -1;
+	}
+}
+
+// the connection of 'attempt' has been established, start the TLS handshake if needed
+// returns WGET_E_SUCCESS when done, > 0 while the handshake is pending, else an error
+static int _he_connected(wget_tcp_t *tcp, HE_ATTEMPT *attempt)
+{
+	int rc;
+
+	if (!tcp->ssl)
+		return WGET_E_SUCCESS;
+
+	attempt->tls = *tcp;
+	attempt->tls.sockfd = attempt->sockfd;
+	attempt->tls.connect_addrinfo = attempt->ai;
+	attempt->tls.tcp_fastopen = 0; // the connection is established, the TLS library writes to the socket directly
+	attempt->tls.ssl_session = NULL;
+
+	if ((rc = _wget_ssl_open_start(&attempt->tls)) > 0) {
+		attempt->handshake = 1;
+		attempt->io = rc;
+	}
+
+	return rc;
+}
+
+static int _tcp_connect_race(wget_tcp_t *tcp, const char *host, const char *port, int debug)
+{
+	HE_ATTEMPT *attempts, *newest;
+	struct addrinfo *ai;
+	long long now, next_start, deadline;
+	int naddrs = 0, started = 0, npending = 0, ret = WGET_E_CONNECT, first_family = tcp->addrinfo->ai_family;
+
+	for (ai = tcp->addrinfo; ai; ai = ai->ai_next)
+		naddrs++;
+
+	attempts = xmalloc(naddrs * sizeof(HE_ATTEMPT));
+
+	// interleave the address families, starting with the family of the first (preferred) address
+	{
+		struct addrinfo *ai_first = tcp->addrinfo, *ai_other = tcp->addrinfo;
+
+		for (int it = 0; it < naddrs; it++) {
+			int other = it % 2;
+
+			while (ai_first && ai_first->ai_family != first_family)
+				ai_first = ai_first->ai_next;
+			while (ai_other && ai_other->ai_family == first_family)
+				ai_other = ai_other->ai_next;
+
+			if ((other && ai_other) || !ai_first) {
+				attempts[it].ai = ai_other;
+				ai_other = ai_other->ai_next;
+			} else {
+				attempts[it].ai = ai_first;
+				ai_first = ai_first->ai_next;
+			}
+
+			attempts[it].sockfd = -1;
+			attempts[it].io = WGET_IO_WRITABLE;
+			attempts[it].handshake = 0;
+		}
+	}
+
+	now = next_start = wget_get_timemillis();
+	deadline = tcp->connect_timeout > 0 ? now + tcp->connect_timeout : -1;
+
+	for (;;) {
+		now = wget_get_timemillis();
+
+		if (deadline != -1 && now >= deadline) {
+			error_printf(_("Connect timeout\n"));
+			ret = WGET_E_TIMEOUT;
+			break;
+		}
+
+		// start the next attempt after the delay or as soon as all others failed
+		if (started < naddrs && (now >= next_start || npending == 0)) {
+			HE_ATTEMPT *attempt = &attempts[started++];
+
+			if (debug)
+				_debug_trying(attempt->ai);
+
+			if ((attempt->sockfd = _tcp_socket(tcp, attempt->ai, debug)) == -2) {
+				attempt->sockfd = -1;
+				ret = WGET_E_UNKNOWN;
+				break;
+			}
+
+			if (attempt->sockfd >= 0) {
+				if (connect(attempt->sockfd, attempt->ai->ai_addr, attempt->ai->ai_addrlen) < 0
+					&& errno != EAGAIN
+					&& errno != EINPROGRESS)
+				{
+					error_printf(_("Failed to connect (%d)\n"), errno);
+					close(attempt->sockfd);
+					attempt->sockfd = -1;
+				} else {
+					npending++;
+					next_start = now + HAPPY_EYEBALLS_DELAY;
 				}
+			}
 
-				if (bind(sockfd, tcp->bind_addrinfo->ai_addr, tcp->bind_addrinfo->ai_addrlen) != 0) {
-					error_printf(_("Failed to bind (%d)\n"), errno);
-					close(sockfd);
-					return -1;
+			continue;
+		}
+
+		if (npending == 0)
+			break; // all attempts failed
+
+		// wait for the most recent attempt, the event loop may run other tasks meanwhile
+		for (newest = attempts + started - 1; newest->sockfd == -1; newest--);
+
+		int timeout = HAPPY_EYEBALLS_SLICE;
+		if (started < naddrs && next_start - now < timeout)
+			timeout = (int) (next_start - now);
+		if (deadline != -1 && deadline - now < timeout)
+			timeout = (int) (deadline - now);
+		if (timeout > 0)
+			wget_ready_2_transfer(newest->sockfd, timeout, newest->io);
+
+		// check all pending attempts without waiting
+		for (HE_ATTEMPT *attempt = attempts; attempt < attempts + started; attempt++) {
+			int rc;
+
+			if (attempt->sockfd == -1 || wget_ready_2_transfer(attempt->sockfd, 0, attempt->io) <= 0)
+				continue;
+
+			if (attempt->handshake) {
+				if ((rc = _wget_ssl_open_continue(&attempt->tls)) > 0) {
+					attempt->io = rc;
+					continue;
+				}
+
+				attempt->handshake = 0; // the session has been freed on error
+			} else {
+				int err = 0;
+				socklen_t errlen = sizeof(err);
+
+				if (getsockopt(attempt->sockfd, SOL_SOCKET, SO_ERROR, (void *)&err, &errlen) || err) {
+					debug_printf("Failed to connect (%d)\n", err);
+					rc = WGET_E_CONNECT;
+				} else if ((rc = _he_connected(tcp, attempt)) > 0) {
+					continue; // the handshake runs while the remaining attempts go on
+				}
+			}
+
+			if (rc != WGET_E_SUCCESS) {
+				npending--;
+				_he_cancel(attempt);
+
+				if (rc == WGET_E_CERTIFICATE) {
+					ret = rc;
+					goto out; /* stop here - the server cert couldn't be validated */
 				}
+
+				next_start = now; // don't wait for the next attempt
+				continue;
 			}
 
+			tcp->sockfd = attempt->sockfd;
+			tcp->connect_addrinfo = attempt->ai;
+			tcp->first_send = 0;
+			if (tcp->ssl) {
+				tcp->ssl_session = attempt->tls.ssl_session;
+				tcp->protocol = attempt->tls.protocol;
+			}
+			attempt->sockfd = -1;
+
+			if (tcp->caching)
+				_wget_dns_cache_prefer(host, port, attempt->ai);
+
+			ret = WGET_E_SUCCESS;
+			goto out;
+		}
+	}
+
+out:
+	// cancel the attempts that lost the race
+	for (HE_ATTEMPT *attempt = attempts; attempt < attempts + started; attempt++)
+		_he_cancel(attempt);
+
+	xfree(attempts);
+
+	return ret;
+}
+
+int wget_tcp_connect(wget_tcp_t *tcp, const char *host, const char *port)
+{
+	struct addrinfo *ai;
+	int sockfd = -1, rc, ret = WGET_E_UNKNOWN;
+	int debug = wget_logger_is_active(wget_get_logger(WGET_LOGGER_DEBUG));
+
+	if (tcp->addrinfo_allocated)
+		_wget_dns_freeaddrinfo(tcp->addrinfo);
+
+	// a private copy, cache entries may expire while connected
+	tcp->addrinfo = _wget_tcp_resolve(tcp, host, port);
+	tcp->addrinfo_allocated = 1;
+
+	// TCP Fast Open delays the connect until the first write, that doesn't work for racing
+	if (tcp->addrinfo && tcp->addrinfo->ai_next)
+		return _tcp_connect_race(tcp, host, port, debug);
+
+	for (ai = tcp->addrinfo; ai; ai = ai->ai_next) {
+		if (debug)
+			_debug_trying(ai);
+
+		if ((sockfd = _tcp_socket(tcp, ai, debug)) != -1) {
+			if (sockfd == -2)
+				return -1;
+
 			if (tcp->tcp_fastopen) {
 				rc = 0;
 				errno = 0;
@@ -632,8 +682,7 @@ int wget_tcp_connect(wget_tcp_t *tcp, const char *host, const char *port)
 
 				return WGET_E_SUCCESS;
 			}
-		} else
-			error_printf(_("Failed to create socket (%d)\n"), errno);
+		}
 	}
 
 	return ret;
@@ -647,7 +696,7 @@ int wget_tcp_listen(wget_tcp_t *tcp, const char *host, const char *port, int bac
 	int debug = wget_logger_is_active(wget_get_logger(WGET_LOGGER_DEBUG));
 
 	if (tcp->bind_addrinfo_allocated)
-		freeaddrinfo(tcp->bind_addrinfo);
+		_wget_dns_freeaddrinfo(tcp->bind_addrinfo);
 
 	tcp->passive = 1;
 	tcp->bind_addrinfo = wget_tcp_resolve(tcp, host, port);
@@ -786,13 +835,135 @@ ssize_t wget_tcp_read(wget_tcp_t *tcp, char *buf, size_t count)
 	return rc;
 }
 
+#ifdef HAVE_SPLICE
+// write data to a file descriptor, returns count or -1
+static ssize_t _write_all(int fd, const char *data, size_t count)
+{
+	for (size_t done = 0; done < count;) {
+		ssize_t n = write(fd, data + done, count - done);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		done += n;
+	}
+
+	return count;
+}
+
+// read once via wget_tcp_read() and write what has been read to fd
+static ssize_t _tcp_copy(wget_tcp_t *tcp, int fd, size_t count)
+{
+	char buf[16384];
+	ssize_t nbytes;
+
+	if ((nbytes = wget_tcp_read(tcp, buf, count < sizeof(buf) ? count : sizeof(buf))) > 0) {
+		if (_write_all(fd, buf, nbytes) < 0) {
+			error_printf(_("Failed to write %zd bytes (%d)\n"), nbytes, errno);
+			return -1;
+		}
+	}
+
+	return nbytes;
+}
+#endif
+
+/**
+ * \param[in] tcp A TCP connection
+ * \param[in] fd File descriptor of a regular file
+ * \param[in] count Max. number of bytes to move
+ * \return Number of bytes written to \p fd, 0 on timeout or EOF, -1 on error or WGET_E_UNSUPPORTED
+ *
+ * Move up to \p count bytes received on \p tcp to the current position of \p fd with splice(),
+ * without copying them through user space.
+ *
+ * TLS connections need the kernel to decrypt the records (kTLS, see WGET_SSL_KTLS),
+ * which is set up with the first call.
+ *
+ * WGET_E_UNSUPPORTED is returned (and nothing has been read) if the system, the connection or \p fd
+ * (e.g. not a regular file or opened with O_APPEND) does not allow splicing. Use wget_tcp_read() then.
+ */
+ssize_t wget_tcp_splice(wget_tcp_t *tcp, int fd, size_t count)
+{
+#ifdef HAVE_SPLICE
+	struct stat st;
+	ssize_t nbytes, n;
+	int flags, rc;
+
+	if (!count)
+		return 0;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (flags = fcntl(fd, F_GETFL)) == -1 || (flags & O_APPEND))
+		return WGET_E_UNSUPPORTED;
+
+	if (tcp->ssl_session) {
+		if ((rc = _wget_ssl_ktls_ready(tcp->ssl_session)) < 0)
+			return rc;
+		if (rc == 0)
+			return _tcp_copy(tcp, fd, count); // data buffered by the TLS library
+	}
+
+	if (tcp->splice_pipe[0] == -1 && pipe(tcp->splice_pipe) == -1) {
+		tcp->splice_pipe[0] = tcp->splice_pipe[1] = -1;
+		return WGET_E_UNSUPPORTED;
+	}
+
+	for (;;) {
+		if (tcp->timeout) {
+			if ((rc = wget_ready_2_read(tcp->sockfd, tcp->timeout)) <= 0)
+				return rc;
+		}
+
+		if ((nbytes = splice(tcp->sockfd, NULL, tcp->splice_pipe[1], NULL, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) >= 0)
+			break;
+
+		if (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && tcp->timeout))
+			continue; // e.g. a kTLS record is not complete yet
+
+		// kTLS does not splice other than application data records, read them the usual way
+		if (errno == EINVAL && tcp->ssl_session)
+			return _tcp_copy(tcp, fd, count);
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+
+		error_printf(_("Failed to read %zu bytes (%d)\n"), count, errno);
+		return -1;
+	}
+
+	// empty the pipe, it is reused for the next call
+	for (ssize_t left = nbytes; left > 0; left -= n) {
+		if ((n = splice(tcp->splice_pipe[0], NULL, fd, NULL, left, SPLICE_F_MOVE)) <= 0) {
+			error_printf(_("Failed to write %zd bytes (%d)\n"), left, errno);
+			close(tcp->splice_pipe[0]);
+			close(tcp->splice_pipe[1]);
+			tcp->splice_pipe[0] = tcp->splice_pipe[1] = -1;
+			return -1;
+		}
+	}
+
+	return nbytes;
+#else
+	return WGET_E_UNSUPPORTED;
+#endif
+}
+
 ssize_t wget_tcp_write(wget_tcp_t *tcp, const char *buf, size_t count)
 {
 	ssize_t nwritten = 0, n;
 	int rc;
 
-	if (tcp->ssl_session)
+	if (tcp->ssl_session) {
+		if (tcp->tls_early_data) {
+			tcp->tls_early_data = 0; // only the first request
+			return _wget_ssl_write_early_data(tcp->ssl_session, buf, count, tcp->timeout);
+		}
+
 		return wget_ssl_write_timeout(tcp->ssl_session, buf, count, tcp->timeout);
+	}
 
 	while (count) {
 #ifdef MSG_FASTOPEN
@@ -889,8 +1060,13 @@ void wget_tcp_close(wget_tcp_t *tcp)
 			close(tcp->sockfd);
 			tcp->sockfd = -1;
 		}
+		if (tcp->splice_pipe[0] != -1) {
+			close(tcp->splice_pipe[0]);
+			close(tcp->splice_pipe[1]);
+			tcp->splice_pipe[0] = tcp->splice_pipe[1] = -1;
+		}
 		if (tcp->addrinfo_allocated) {
-			freeaddrinfo(tcp->addrinfo);
+			_wget_dns_freeaddrinfo(tcp->addrinfo);
 		}
 		tcp->addrinfo = NULL;
 	}
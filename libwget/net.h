@@ -44,6 +44,7 @@ struct wget_tcp_st {
 		ssl_hostname; // if set, do SSL hostname checking
 	int
 		sockfd,
+		splice_pipe[2], // see wget_tcp_splice()
 		// timeouts in milliseconds
 		// there is no real 'connect timeout', since connects are async
 		dns_timeout,
@@ -59,8 +60,36 @@ struct wget_tcp_st {
 		addrinfo_allocated : 1,
 		bind_addrinfo_allocated : 1,
 		tls_false_start : 1,
+		tls_early_data : 1, // the next write may be sent as TLS 1.3 early data, see wget_tcp_set_tls_early_data()
 		tcp_fastopen : 1, // do we use TCP_FASTOPEN or not
 		first_send : 1; // TCP_FASTOPEN's first packet is sent different
 };
 
+struct addrinfo;
+
+wget_tcp_t *_wget_tcp_get_global(void) G_GNUC_WGET_CONST;
+
+// address lists returned by wget_tcp_resolve() are allocated by libwget (dns.c)
+void _wget_dns_freeaddrinfo(struct addrinfo *ai);
+
+// like wget_tcp_resolve(), but always returns a copy to be freed with _wget_dns_freeaddrinfo()
+struct addrinfo *_wget_tcp_resolve(wget_tcp_t *tcp, const char *host, const char *port);
+
+// let the cached addresses of host:port start with 'ai' (the winner of a connection race)
+void _wget_dns_cache_prefer(const char *host, const char *port, const struct addrinfo *ai);
+
+// non-blocking wget_ssl_open() to run several handshakes at once: _wget_ssl_open_start() and _wget_ssl_open_continue()
+// return WGET_IO_READABLE/WGET_IO_WRITABLE to be called again when the socket is ready, WGET_E_SUCCESS when done,
+// else an error (the session has been freed then). _wget_ssl_open_cancel() stops a pending handshake.
+int _wget_ssl_open_start(wget_tcp_t *tcp);
+int _wget_ssl_open_continue(wget_tcp_t *tcp);
+void _wget_ssl_open_cancel(wget_tcp_t *tcp);
+
+// like wget_ssl_write_timeout(), but sends 'buf' as TLS 1.3 early data if wget_ssl_open() deferred the handshake
+ssize_t _wget_ssl_write_early_data(void *session, const char *buf, size_t count, int timeout);
+
+// 1 if the kernel decrypts the records of session (kTLS), so they can be spliced,
+// 0 if the TLS library still has data to hand out, else WGET_E_UNSUPPORTED
+int _wget_ssl_ktls_ready(void *session);
+
 #endif /* _LIBWGET_NET_H */
@@ -112,36 +112,48 @@ wget_ocsp_t *wget_ocsp_new(const char *fingerprint, time_t maxage, int valid)
 	return ocsp;
 }
 
-int wget_ocsp_fingerprint_in_cache(const wget_ocsp_db_t *ocsp_db, const char *fingerprint, int *revoked)
+// thread-safe, answers are added by the OCSP responder queries in the background
+int wget_ocsp_fingerprint_in_cache(wget_ocsp_db_t *ocsp_db, const char *fingerprint, int *revoked)
 {
+	int ret = 0;
+
 	if (ocsp_db) {
 		wget_ocsp_t ocsp, *ocspp;
 
+		wget_thread_mutex_lock(&ocsp_db->mutex);
+
 		// look for an exact match
 		ocsp.key = fingerprint;
 		if ((ocspp = wget_hashmap_get(ocsp_db->fingerprints, &ocsp)) && ocspp->maxage >= time(NULL)) {
 			if (revoked)
 				*revoked = !ocspp->valid;
-			return 1;
+			ret = 1;
 		}
+
+		wget_thread_mutex_unlock(&ocsp_db->mutex);
 	}
 
-	return 0;
+	return ret;
 }
 
-int wget_ocsp_hostname_is_valid(const wget_ocsp_db_t *ocsp_db, const char *hostname)
+int wget_ocsp_hostname_is_valid(wget_ocsp_db_t *ocsp_db, const char *hostname)
 {
+	int ret = 0;
+
 	if (ocsp_db) {
 		wget_ocsp_t ocsp, *ocspp;
 
+		wget_thread_mutex_lock(&ocsp_db->mutex);
+
 		// look for an exact match
 		ocsp.key = hostname;
-		if ((ocspp = wget_hashmap_get(ocsp_db->hosts, &ocsp)) && ocspp->maxage >= time(NULL)) {
-			return 1;
-		}
+		if ((ocspp = wget_hashmap_get(ocsp_db->hosts, &ocsp)) && ocspp->maxage >= time(NULL))
+			ret = 1;
+
+		wget_thread_mutex_unlock(&ocsp_db->mutex);
 	}
 
-	return 0;
+	return ret;
 }
 
 wget_ocsp_db_t *wget_ocsp_db_init(wget_ocsp_db_t *ocsp_db)
@@ -310,7 +322,7 @@ static int _ocsp_db_load(wget_ocsp_db_t *ocsp_db, FILE *fp, int load_hosts)
 			ocsp.mtime = atol(p);
 		}
 
-		// parse mtime (age of this entry)
+		// parse valid (1) or revoked (0)
 		if (*linep) {
 			for (p = ++linep; *linep && !isspace(*linep);) linep++;
 			ocsp.valid = atoi(p);
@@ -47,8 +47,13 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#ifdef HAVE_MMAP
+#	include <sys/mman.h>
+#endif
 
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
@@ -57,6 +62,16 @@
 #endif
 #include <gnutls/crypto.h>
 
+#if defined HAVE_LINUX_TLS_H && defined HAVE_SPLICE
+#	include <sys/socket.h>
+#	include <netinet/in.h>
+#	include <netinet/tcp.h>
+#	include <linux/tls.h>
+#	if defined TCP_ULP && defined SOL_TLS
+#		define HAVE_KTLS
+#	endif
+#endif
+
 #include <wget.h>
 #include "private.h"
 #include "net.h"
@@ -70,13 +85,15 @@ static struct _config {
 		*cert_file,
 		*key_file,
 		*crl_file,
+		*ca_cache_file, // DER cache of the CAs loaded from ca_directory
 		*ocsp_server,
 		*alpn;
 	wget_ocsp_db_t
-		*ocsp_cert_cache,
-		*ocsp_host_cache;
+		*ocsp_cert_cache; // OCSP answers for certificates and hosts
 	wget_tls_session_db_t
 		*tls_session_cache;
+	int
+		session_wait; // max. ms to wait for the session of a concurrent full handshake to the same host
 	char
 		check_certificate,
 		check_hostname,
@@ -85,7 +102,9 @@ static struct _config {
 		key_type,
 		print_info,
 		ocsp,
-		ocsp_stapling;
+		ocsp_stapling,
+		ocsp_soft_fail, // go on if there is no OCSP answer for a certificate
+		ktls; // let the kernel decrypt the bodies that are spliced into files
 } _config = {
 	.check_certificate=1,
 	.check_hostname = 1,
@@ -93,23 +112,43 @@ static struct _config {
 	.ocsp = 1,
 	.ocsp_stapling=1,
 #endif
+	.ocsp_soft_fail = 1,
 	.ca_type = WGET_SSL_X509_FMT_PEM,
 	.cert_type = WGET_SSL_X509_FMT_PEM,
 	.key_type = WGET_SSL_X509_FMT_PEM,
 	.secure_protocol = "AUTO",
 	.ca_directory = "system",
 	.alpn = "h2,h2-16,h2-14,http/1.1",
+	.session_wait = 1000,
 };
 
 struct _session_context {
 	const char *
 		hostname;
+	wget_vector_t *
+		ocsp_queries; // pending OCSP responder queries, see _ocsp_wait()
+	int
+		sockfd,
+		ocsp_nvalid, // number of certificates known to be valid at handshake time
+		ocsp_ncerts; // number of certificates in the chain
 	unsigned char
 		ocsp_stapling : 1,
 		valid : 1,
-		delayed_session_data : 1;
+		delayed_session_data : 1,
+		handshake_pending : 1, // deferred by wget_ssl_open() to send the first request as early data
+		ktls_rx : 1, // the kernel decrypts the received records, see _ktls_enable_rx()
+		ktls_failed : 1, // kTLS can't be used for this connection
+		claimed : 1; // the full handshake other connections wait for, see wget_tls_session_db_claim()
 };
 
+// TLS session data is valid for 18h
+#define SESSION_MAXAGE (18 * 3600)
+
+static wget_ssl_stats_t
+	_stats;
+static wget_thread_mutex_t
+	_stats_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+
 static gnutls_certificate_credentials_t
 	_credentials;
 static gnutls_priority_t
@@ -125,6 +164,7 @@ void wget_ssl_set_config_string(int key, const char *value)
 	case WGET_SSL_CERT_FILE: _config.cert_file = value; break;
 	case WGET_SSL_KEY_FILE: _config.key_file = value; break;
 	case WGET_SSL_CRL_FILE: _config.crl_file = value; break;
+	case WGET_SSL_CA_CACHE_FILE: _config.ca_cache_file = value; break;
 	case WGET_SSL_OCSP_SERVER: _config.ocsp_server = value; break;
 	case WGET_SSL_OCSP_CACHE: _config.ocsp_cert_cache = (wget_ocsp_db_t *)value; break;
 	case WGET_SSL_SESSION_CACHE: _config.tls_session_cache = (wget_tls_session_db_t *)value; break;
@@ -144,6 +184,9 @@ void wget_ssl_set_config_int(int key, int value)
 	case WGET_SSL_PRINT_INFO: _config.print_info = (char)value; break;
 	case WGET_SSL_OCSP: _config.ocsp = (char)value; break;
 	case WGET_SSL_OCSP_STAPLING: _config.ocsp_stapling = (char)value; break;
+	case WGET_SSL_OCSP_SOFT_FAIL: _config.ocsp_soft_fail = (char)value; break;
+	case WGET_SSL_SESSION_WAIT: _config.session_wait = value; break;
+	case WGET_SSL_KTLS: _config.ktls = (char)value; break;
 	default: error_printf(_("Unknown config key %d (or value must not be an integer)\n"), key);
 	}
 }
@@ -361,9 +404,28 @@ static int _print_info(gnutls_session_t session)
 	return 0;
 }
 
+/*
+ * Calculate fingerprint from certificate
+ */
+static char *_get_cert_fingerprint(gnutls_x509_crt_t cert, char *fingerprint_hex, size_t length)
+{
+	unsigned char fingerprint[64];
+	size_t fingerprint_size = sizeof(fingerprint);
+	int err;
+
+	if ((err = gnutls_x509_crt_get_fingerprint(cert, GNUTLS_DIG_SHA256, fingerprint, &fingerprint_size)) < 0) {
+		debug_printf("Failed to get fingerprint: %s\n", gnutls_strerror(err));
+		strlcpy(fingerprint_hex, "00", length);
+	} else {
+		wget_memtohex(fingerprint, fingerprint_size, fingerprint_hex, length);
+	}
+
+	return fingerprint_hex;
+}
+
 #ifdef HAVE_GNUTLS_OCSP_H
 static int
-_generate_ocsp_data(gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer,
+_generate_ocsp_data(gnutls_x509_crt_t *certs, int ncerts, gnutls_x509_crt_t issuer,
 		  gnutls_datum_t * rdata, gnutls_datum_t *nonce)
 {
 	gnutls_ocsp_req_t req;
@@ -375,10 +437,12 @@ _generate_ocsp_data(gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer,
 		return -1;
 	}
 
-	ret = gnutls_ocsp_req_add_cert(req, GNUTLS_DIG_SHA1, issuer, cert);
-	if (ret < 0) {
-		error_printf("ocsp_req_add_cert: %s", gnutls_strerror(ret));
-		goto error;
+	for (int it = 0; it < ncerts; it++) {
+		ret = gnutls_ocsp_req_add_cert(req, GNUTLS_DIG_SHA1, issuer, certs[it]);
+		if (ret < 0) {
+			error_printf("ocsp_req_add_cert: %s", gnutls_strerror(ret));
+			goto error;
+		}
 	}
 
 	if (nonce) {
@@ -399,56 +463,66 @@ _generate_ocsp_data(gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer,
 
 error:
 	gnutls_ocsp_req_deinit(req);
-	return -1;
+	return ret;
 }
 
-/* Returns 0 on ok, and -1 on error */
-static int send_ocsp_request(const char *server,
-		      gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer,
-		      wget_buffer_t **ocsp_data, gnutls_datum_t *nonce)
+/* Returns the URL of the OCSP responder for 'cert' or NULL */
+static char *_get_ocsp_responder(gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer)
 {
-	int ret = -1, rc;
-	int server_allocated = 0;
-	gnutls_datum_t body;
-	wget_iri_t *iri;
-	wget_http_request_t *req;
+	gnutls_datum_t data;
+	char *server;
+	unsigned i = 0;
+	int rc;
 
-	if (!server) {
-		/* try to read URL from issuer certificate */
-		gnutls_datum_t data;
-		unsigned i = 0;
+	if (_config.ocsp_server)
+		return wget_strdup(_config.ocsp_server);
 
+	/* try to read URL from issuer certificate */
+	do {
+		rc = gnutls_x509_crt_get_authority_info_access(cert, i++, GNUTLS_IA_OCSP_URI, &data, NULL);
+	} while(rc < 0 && rc != GNUTLS_E_REQUESTED_DATA_NOT_AVAILABLE);
+
+	if (rc < 0) {
+		i = 0;
 		do {
-			rc = gnutls_x509_crt_get_authority_info_access(cert, i++, GNUTLS_IA_OCSP_URI, &data, NULL);
+			rc = gnutls_x509_crt_get_authority_info_access(issuer, i++, GNUTLS_IA_OCSP_URI, &data, NULL);
 		} while(rc < 0 && rc != GNUTLS_E_REQUESTED_DATA_NOT_AVAILABLE);
+	}
 
-		if (rc < 0) {
-			i = 0;
-			do {
-				rc = gnutls_x509_crt_get_authority_info_access(issuer, i++, GNUTLS_IA_OCSP_URI, &data, NULL);
-			} while(rc < 0 && rc != GNUTLS_E_REQUESTED_DATA_NOT_AVAILABLE);
-		}
-
-		if (rc < 0) {
-			error_printf("Cannot find URL from issuer: %s\n", gnutls_strerror(rc));
-			return -1;
-		}
+	if (rc < 0) {
+		error_printf("Cannot find URL from issuer: %s\n", gnutls_strerror(rc));
+		return NULL;
+	}
 
-		server = wget_strmemdup((char *)data.data, data.size);
-		server_allocated = 1;
+	server = wget_strmemdup((char *)data.data, data.size);
+	gnutls_free(data.data);
 
-		gnutls_free(data.data);
+	// the query of a https responder would need an OCSP check itself
+	if (wget_strncasecmp_ascii(server, "http://", 7)) {
+		debug_printf("OCSP responder '%s' is not supported\n", server);
+		xfree(server);
 	}
 
-	iri = wget_iri_parse(server, NULL);
+	return server;
+}
 
-	if (server_allocated)
-		xfree(server);
+/* Returns 0 on ok, and -1 on error */
+static int send_ocsp_request(const char *server,
+		      gnutls_x509_crt_t *certs, int ncerts, gnutls_x509_crt_t issuer,
+		      wget_buffer_t **ocsp_data, gnutls_datum_t *nonce)
+{
+	int ret = -1, rc;
+	gnutls_datum_t body;
+	wget_iri_t *iri;
+	wget_http_request_t *req;
 
-	if (!iri)
+	if (!(iri = wget_iri_parse(server, NULL)))
 		return -1;
 
-	_generate_ocsp_data(cert, issuer, &body, nonce);
+	if (_generate_ocsp_data(certs, ncerts, issuer, &body, nonce) < 0) {
+		wget_iri_free(&iri);
+		return -1;
+	}
 
 	req = wget_http_create_request(iri, "POST");
 	wget_http_add_header(req, "Accept-Encoding", "identity");
@@ -460,12 +534,15 @@ static int send_ocsp_request(const char *server,
 		wget_http_request_set_body(req, "application/ocsp-request", wget_memdup(body.data, body.size), body.size);
 		if (wget_http_send_request(conn, req) == 0) {
 			wget_http_response_t *resp;
-			
+
 			if ((resp = wget_http_get_response(conn))) {
-				*ocsp_data = resp->body;
-				resp->body = NULL;
+				if (resp->code == 200 && resp->body) {
+					*ocsp_data = resp->body;
+					resp->body = NULL;
+					ret = 0;
+				} else
+					debug_printf("OCSP responder %s answered with %d\n", server, resp->code);
 				wget_http_free_response(&resp);
-				ret = 0;
 			}
 		}
 		wget_http_close(&conn);
@@ -513,25 +590,55 @@ static void print_ocsp_verify_res(unsigned int status)
 /* three days */
 #define OCSP_VALIDITY_SECS (3*60*60*24)
 
-/* Returns:
+/* Returns the time until an OCSP answer may be cached */
+static time_t _ocsp_expiry(time_t vtime, time_t ntime)
+{
+	time_t now = time(NULL), expiry = ntime != -1 ? ntime : vtime + OCSP_VALIDITY_SECS;
+
+	return expiry > now ? expiry : now + 3600;
+}
+
+/* Returns the index of the single response about 'cert' or -1 */
+static int _ocsp_find_response(gnutls_ocsp_resp_t resp, gnutls_x509_crt_t cert)
+{
+#if GNUTLS_VERSION_NUMBER >= 0x030103
+	for (int it = 0;; it++) {
+		int rc = gnutls_ocsp_resp_check_crt(resp, it, cert);
+
+		if (rc == 0)
+			return it;
+		if (rc == GNUTLS_E_REQUESTED_DATA_NOT_AVAILABLE)
+			return -1;
+	}
+#else
+	return 0;
+#endif
+}
+
+/* Checks the response to a query about 'ncerts' certificates of 'issuer'.
+ * Sets for each certificate:
  *  0: certificate is revoked
  *  1: certificate is ok
  *  -1: dunno
+ * and the time until the answer may be cached.
  */
-static int check_ocsp_response(gnutls_x509_crt_t cert,
+static void check_ocsp_response(gnutls_x509_crt_t *certs, int ncerts,
 	gnutls_x509_crt_t issuer, wget_buffer_t *data,
-	gnutls_datum_t *nonce)
+	gnutls_datum_t *nonce, int *valid, time_t *expiry)
 {
 	gnutls_ocsp_resp_t resp;
-	int ret = -1, rc;
+	int rc, nonce_ok = 1;
 	unsigned int status, cert_status;
 	time_t rtime, vtime, ntime, now;
 
 	now = time(NULL);
 
+	for (int it = 0; it < ncerts; it++)
+		valid[it] = -1;
+
 	if ((rc = gnutls_ocsp_resp_init(&resp)) < 0) {
 		debug_printf("ocsp_resp_init: %s", gnutls_strerror(rc));
-		return -1;
+		return;
 	}
 
 	rc = gnutls_ocsp_resp_import(resp, &(gnutls_datum_t){ .data = (unsigned char *) data->data, .size = data->length });
@@ -540,17 +647,6 @@ static int check_ocsp_response(gnutls_x509_crt_t cert,
 		goto cleanup;
 	}
 
-#if GNUTLS_VERSION_NUMBER >= 0x030103
-	if ((rc = gnutls_ocsp_resp_check_crt(resp, 0, cert)) < 0) {
-		if (rc == GNUTLS_E_REQUESTED_DATA_NOT_AVAILABLE) {
-			debug_printf("got OCSP response with no data (ignoring)\n");
-		} else {
-			debug_printf("got OCSP response on an unrelated certificate (ignoring)\n");
-		}
-		goto cleanup;
-	}
-#endif
-
 	if ((rc = gnutls_ocsp_resp_verify_direct(resp, issuer, &status, 0)) < 0) {
 		debug_printf("gnutls_ocsp_resp_verify_direct: %s", gnutls_strerror(rc));
 		goto cleanup;
@@ -561,131 +657,883 @@ static int check_ocsp_response(gnutls_x509_crt_t cert,
 		goto cleanup;
 	}
 
-	rc = gnutls_ocsp_resp_get_single(resp, 0, NULL, NULL, NULL, NULL,
-					  &cert_status, &vtime, &ntime, &rtime, NULL);
-	if (rc < 0) {
-		debug_printf("reading response: %s", gnutls_strerror(rc));
-		goto cleanup;
-	}
-
-	if (cert_status == GNUTLS_OCSP_CERT_REVOKED) {
-		debug_printf("*** Certificate was revoked at %s", ctime(&rtime));
-		ret = 0;
-		goto cleanup;
-	}
-
-	if (ntime == -1) {
-		if (now - vtime > OCSP_VALIDITY_SECS) {
-			debug_printf("*** The OCSP response is old (was issued at: %s) ignoring", ctime(&vtime));
-			goto cleanup;
-		}
-	} else {
-		/* there is a newer OCSP answer, don't trust this one */
-		if (ntime < now) {
-			debug_printf("*** The OCSP response was issued at: %s, but there is a newer issue at %s",
-				ctime(&vtime), ctime(&ntime));
-			goto cleanup;
-		}
-	}
-
 	if (nonce) {
 		gnutls_datum_t rnonce;
 
 		rc = gnutls_ocsp_resp_get_nonce(resp, NULL, &rnonce);
 		if (rc == GNUTLS_E_REQUESTED_DATA_NOT_AVAILABLE) {
 			debug_printf("*** The OCSP reply did not include the requested nonce.\n");
-			goto finish_ok;
+		} else if (rc < 0) {
+			debug_printf("could not read response's nonce: %s\n", gnutls_strerror(rc));
+			nonce_ok = 0;
+		} else {
+			if (rnonce.size != nonce->size || memcmp(nonce->data, rnonce.data, nonce->size) != 0) {
+				debug_printf("nonce in the response doesn't match\n");
+				nonce_ok = 0;
+			}
+			gnutls_free(rnonce.data);
+		}
+	}
+
+	for (int it = 0; it < ncerts; it++) {
+		int idx;
+
+		if ((idx = _ocsp_find_response(resp, certs[it])) < 0) {
+			debug_printf("got OCSP response without data for certificate %d (ignoring)\n", it);
+			continue;
 		}
 
+		rc = gnutls_ocsp_resp_get_single(resp, idx, NULL, NULL, NULL, NULL,
+						  &cert_status, &vtime, &ntime, &rtime, NULL);
 		if (rc < 0) {
-			debug_printf("could not read response's nonce: %s\n", gnutls_strerror(rc));
-			goto cleanup;
+			debug_printf("reading response: %s", gnutls_strerror(rc));
+			continue;
 		}
 
-		if (rnonce.size != nonce->size || memcmp(nonce->data, rnonce.data, nonce->size) != 0) {
-			debug_printf("nonce in the response doesn't match\n");
-			gnutls_free(rnonce.data);
-			goto cleanup;
+		if (cert_status == GNUTLS_OCSP_CERT_REVOKED) {
+			debug_printf("*** Certificate was revoked at %s", ctime(&rtime));
+			valid[it] = 0;
+			expiry[it] = _ocsp_expiry(vtime, ntime);
+			continue;
 		}
 
-		gnutls_free(rnonce.data);
-	}
+		if (ntime == -1) {
+			if (now - vtime > OCSP_VALIDITY_SECS) {
+				debug_printf("*** The OCSP response is old (was issued at: %s) ignoring", ctime(&vtime));
+				continue;
+			}
+		} else {
+			/* there is a newer OCSP answer, don't trust this one */
+			if (ntime < now) {
+				debug_printf("*** The OCSP response was issued at: %s, but there is a newer issue at %s",
+					ctime(&vtime), ctime(&ntime));
+				continue;
+			}
+		}
 
- finish_ok:
-	debug_printf("OCSP server flags certificate not revoked as of %s", ctime(&vtime));
-	ret = 1;
+		if (nonce_ok && cert_status == GNUTLS_OCSP_CERT_GOOD) {
+			debug_printf("OCSP server flags certificate not revoked as of %s", ctime(&vtime));
+			valid[it] = 1;
+			expiry[it] = _ocsp_expiry(vtime, ntime);
+		}
+	}
 
 cleanup:
 	gnutls_ocsp_resp_deinit(resp);
-	return ret;
 }
 
 /*
- * Calculate fingerprint from certificate
+ * Add cert to OCSP cache, being either valid or revoked (valid==0)
  */
-static char *_get_cert_fingerprint(gnutls_x509_crt_t cert, char *fingerprint_hex, size_t length)
+static void _add_cert_to_ocsp_cache(gnutls_x509_crt_t cert, int valid, time_t maxage)
 {
-	unsigned char fingerprint[64];
-	size_t fingerprint_size = sizeof(fingerprint);
-	int err;
+	if (_config.ocsp_cert_cache) {
+		char fingerprint_hex[64 * 2 +1];
 
-	if ((err = gnutls_x509_crt_get_fingerprint(cert, GNUTLS_DIG_SHA256, fingerprint, &fingerprint_size)) < 0) {
-		debug_printf("Failed to get fingerprint: %s\n", gnutls_strerror(err));
-		strlcpy(fingerprint_hex, "00", length);
-	} else {
-		wget_memtohex(fingerprint, fingerprint_size, fingerprint_hex, length);
+		_get_cert_fingerprint(cert, fingerprint_hex, sizeof(fingerprint_hex));
+		wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(fingerprint_hex, maxage, valid));
 	}
+}
 
-	return fingerprint_hex;
+/* Returns the time until the stapled OCSP answer may be cached */
+static time_t _get_stapled_ocsp_expiry(gnutls_session_t session)
+{
+	time_t vtime = time(NULL) - OCSP_VALIDITY_SECS, ntime = -1;
+#if GNUTLS_VERSION_NUMBER >= 0x030103
+	gnutls_ocsp_resp_t resp;
+	gnutls_datum_t data;
+
+	if (gnutls_ocsp_status_request_get(session, &data) == GNUTLS_E_SUCCESS && gnutls_ocsp_resp_init(&resp) == GNUTLS_E_SUCCESS) {
+		if (gnutls_ocsp_resp_import(resp, &data) == GNUTLS_E_SUCCESS)
+			gnutls_ocsp_resp_get_single(resp, 0, NULL, NULL, NULL, NULL, NULL, &vtime, &ntime, NULL, NULL);
+		gnutls_ocsp_resp_deinit(resp);
+	}
+#endif
+
+	return _ocsp_expiry(vtime, ntime);
 }
 
 /*
- * Add cert to OCSP cache, being either valid or revoked (valid==0)
+ * Asynchronous OCSP responder queries.
+ *
+ * The certificate verification callback only queues a query for each certificate
+ * that has no cached answer, the handshake goes on meanwhile.
+ * Worker threads send the queries, one request for all queued certificates of the same
+ * issuer and responder, and add the answers to the OCSP cache.
+ * A query is shared by all connections that wait for the same certificate.
+ * After the handshake, a connection waits for its queries, see _ocsp_wait().
+ * The wait is on a pipe per query, so an event loop can run other connections meanwhile.
  */
-static void _add_cert_to_ocsp_cache(gnutls_x509_crt_t cert, int valid)
+
+#define OCSP_MAX_WORKERS 4
+#define OCSP_MAX_BATCH 16
+
+typedef struct {
+	char *
+		fingerprint; // of the certificate
+	char *
+		responder; // URL of the OCSP responder
+	gnutls_datum_t
+		cert, // DER encoded certificate
+		issuer; // DER encoded issuer certificate
+	int
+		refs, // number of waiting connections + 1 while not answered
+		valid, // 1: valid, 0: revoked, -1: no answer
+		pipefd[2]; // becomes readable when done, only created if someone waits
+	unsigned char
+		inflight : 1, // a worker is asking the responder
+		done : 1;
+} _ocsp_query_t;
+
+static wget_vector_t
+	*_ocsp_queries; // not yet answered queries
+static wget_thread_t
+	_ocsp_workers[OCSP_MAX_WORKERS];
+static int
+	_ocsp_nworkers,
+	_ocsp_idle,
+	_ocsp_shutdown;
+static wget_thread_mutex_t
+	_ocsp_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static wget_thread_cond_t
+	_ocsp_work_cond = WGET_THREAD_COND_INITIALIZER; // signalled on new queries or shutdown
+
+// called with _ocsp_mutex locked
+static void _ocsp_query_unref(_ocsp_query_t *query)
 {
-	if (_config.ocsp_cert_cache) {
-		char fingerprint_hex[64 * 2 +1];
+	if (--query->refs == 0) {
+		if (query->pipefd[0] != -1) {
+			close(query->pipefd[0]);
+			close(query->pipefd[1]);
+		}
+		xfree(query->fingerprint);
+		xfree(query->responder);
+		xfree(query->cert.data);
+		gnutls_free(query->issuer.data);
+		xfree(query);
+	}
+}
 
-		_get_cert_fingerprint(cert, fingerprint_hex, sizeof(fingerprint_hex));
-		wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(fingerprint_hex, time(NULL) + 3600, valid)); // 1h valid
+// wake up the connections waiting for 'query', called with _ocsp_mutex locked
+static void _ocsp_query_wakeup(_ocsp_query_t *query)
+{
+	if (query->pipefd[1] != -1) {
+		// the pipe stays readable, no matter how many connections wait
+		if (write(query->pipefd[1], "", 1) != 1)
+			debug_printf("Failed to wake up OCSP waiters (%d)\n", errno);
 	}
 }
 
-/* OCSP check for the peer's certificate. Should be called
- * only after the certificate list verication is complete.
- * Returns:
- * 0: certificate is revoked
- * 1: certificate is ok
- * -1: dunno
- */
-//static int cert_verify_ocsp(gnutls_session_t session)
-static int cert_verify_ocsp(gnutls_x509_crt_t cert, gnutls_x509_crt_t issuer)
+static int _ocsp_same_batch(const _ocsp_query_t *q1, const _ocsp_query_t *q2)
 {
+	return q1->issuer.size == q2->issuer.size && !memcmp(q1->issuer.data, q2->issuer.data, q1->issuer.size)
+		&& !strcmp(q1->responder, q2->responder);
+}
+
+// ask the responder about all queries in 'batch', called without locking
+static void _ocsp_query_batch(_ocsp_query_t **batch, int n)
+{
+	gnutls_x509_crt_t issuer, certs[n];
 	wget_buffer_t *resp = NULL;
 	unsigned char noncebuf[23];
 	gnutls_datum_t nonce = { noncebuf, sizeof(noncebuf) };
-	int ret;
+	time_t expiry[n];
+	int valid[n], ncerts = 0, rc;
 
-	ret = gnutls_rnd(GNUTLS_RND_NONCE, nonce.data, nonce.size);
-	if (ret < 0) {
-		debug_printf("gnutls_rnd: %s", gnutls_strerror(ret));
-		return -1;
+	for (int it = 0; it < n; it++)
+		valid[it] = -1;
+
+	gnutls_x509_crt_init(&issuer);
+	if ((rc = gnutls_x509_crt_import(issuer, &batch[0]->issuer, GNUTLS_X509_FMT_DER)) != GNUTLS_E_SUCCESS) {
+		debug_printf("Decoding error: %s\n", gnutls_strerror(rc));
+		goto out;
+	}
+
+	for (ncerts = 0; ncerts < n; ncerts++) {
+		gnutls_x509_crt_init(&certs[ncerts]);
+		if ((rc = gnutls_x509_crt_import(certs[ncerts], &batch[ncerts]->cert, GNUTLS_X509_FMT_DER)) != GNUTLS_E_SUCCESS) {
+			debug_printf("Decoding error: %s\n", gnutls_strerror(rc));
+			gnutls_x509_crt_deinit(certs[ncerts]);
+			goto out;
+		}
 	}
 
-	if (send_ocsp_request(NULL, cert, issuer, &resp, &nonce) < 0) {
+	if ((rc = gnutls_rnd(GNUTLS_RND_NONCE, nonce.data, nonce.size)) < 0) {
+		debug_printf("gnutls_rnd: %s", gnutls_strerror(rc));
+		goto out;
+	}
+
+	debug_printf("Sending OCSP request for %d certificate(s) to %s\n", n, batch[0]->responder);
+
+	wget_thread_mutex_lock(&_stats_mutex);
+	_stats.ocsp_requests++;
+	_stats.ocsp_certs += n;
+	wget_thread_mutex_unlock(&_stats_mutex);
+
+	if (send_ocsp_request(batch[0]->responder, certs, n, issuer, &resp, &nonce) < 0) {
 		debug_printf("Cannot contact OCSP server\n");
-		return -1;
+		goto out;
 	}
 
-	/* verify and check the response for revoked cert */
-	ret = check_ocsp_response(cert, issuer, resp, &nonce);
+	/* verify and check the response for revoked certs */
+	check_ocsp_response(certs, n, issuer, resp, &nonce, valid, expiry);
 	wget_buffer_free(&resp);
 
-	return ret;
+	for (int it = 0; it < n; it++) {
+		debug_printf("check_ocsp_response() returned %d for %s\n", valid[it], batch[it]->fingerprint);
+		if (valid[it] >= 0)
+			wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(batch[it]->fingerprint, expiry[it], valid[it]));
+	}
+
+out:
+	for (int it = 0; it < ncerts; it++)
+		gnutls_x509_crt_deinit(certs[it]);
+	gnutls_x509_crt_deinit(issuer);
+
+	for (int it = 0; it < n; it++)
+		batch[it]->valid = valid[it];
+}
+
+static void *_ocsp_worker(void *unused G_GNUC_WGET_UNUSED)
+{
+	wget_thread_mutex_lock(&_ocsp_mutex);
+
+	while (!_ocsp_shutdown) {
+		_ocsp_query_t *batch[OCSP_MAX_BATCH], *query;
+		int n = 0;
+
+		for (int it = 0; it < wget_vector_size(_ocsp_queries) && n < OCSP_MAX_BATCH; it++) {
+			query = wget_vector_get(_ocsp_queries, it);
+			if (!query->inflight && (n == 0 || _ocsp_same_batch(batch[0], query))) {
+				query->inflight = 1;
+				batch[n++] = query;
+			}
+		}
+
+		if (n == 0) {
+			if (!wget_thread_support())
+				break; // called directly by _ocsp_submit()
+
+			_ocsp_idle++;
+			wget_thread_cond_wait(&_ocsp_work_cond, &_ocsp_mutex, 0);
+			_ocsp_idle--;
+			continue;
+		}
+
+		wget_thread_mutex_unlock(&_ocsp_mutex);
+		_ocsp_query_batch(batch, n);
+		wget_thread_mutex_lock(&_ocsp_mutex);
+
+		for (int it = 0; it < n; it++) {
+			batch[it]->done = 1;
+			_ocsp_query_wakeup(batch[it]);
+		}
+
+		for (int it = wget_vector_size(_ocsp_queries) - 1; it >= 0; it--) {
+			if ((query = wget_vector_get(_ocsp_queries, it))->done) {
+				wget_vector_remove_nofree(_ocsp_queries, it);
+				_ocsp_query_unref(query);
+			}
+		}
+	}
+
+	wget_thread_mutex_unlock(&_ocsp_mutex);
+
+	return NULL;
+}
+
+/* Queues an OCSP query for 'cert' or joins a query already queued by another connection.
+ * Returns the query the caller has to wait for or NULL if there is no OCSP responder.
+ */
+static _ocsp_query_t *_ocsp_submit(gnutls_x509_crt_t cert, const gnutls_datum_t *cert_der,
+	gnutls_x509_crt_t issuer, const char *fingerprint)
+{
+	_ocsp_query_t *query = NULL;
+	char *responder;
+	int start_worker = 0;
+
+	wget_thread_mutex_lock(&_ocsp_mutex);
+
+	for (int it = 0; it < wget_vector_size(_ocsp_queries); it++) {
+		_ocsp_query_t *q = wget_vector_get(_ocsp_queries, it);
+
+		if (!strcmp(q->fingerprint, fingerprint)) {
+			debug_printf("OCSP query for %s already queued\n", fingerprint);
+			query = q;
+			query->refs++;
+			goto out;
+		}
+	}
+
+	if (!(responder = _get_ocsp_responder(cert, issuer)))
+		goto out;
+
+	query = wget_calloc(1, sizeof(_ocsp_query_t));
+	query->fingerprint = wget_strdup(fingerprint);
+	query->responder = responder;
+	query->cert.data = wget_memdup(cert_der->data, cert_der->size);
+	query->cert.size = cert_der->size;
+	query->pipefd[0] = query->pipefd[1] = -1;
+
+	if (gnutls_x509_crt_export2(issuer, GNUTLS_X509_FMT_DER, &query->issuer) != GNUTLS_E_SUCCESS) {
+		query->refs = 1;
+		_ocsp_query_unref(query);
+		query = NULL;
+		goto out;
+	}
+
+	query->refs = 2;
+
+	if (!_ocsp_queries)
+		_ocsp_queries = wget_vector_create(8, -2, NULL);
+	wget_vector_add_noalloc(_ocsp_queries, query);
+
+	if (_ocsp_idle)
+		wget_thread_cond_signal(&_ocsp_work_cond);
+	else if (!wget_thread_support())
+		start_worker = 1;
+	else if (_ocsp_nworkers < OCSP_MAX_WORKERS) {
+		if (wget_thread_start(&_ocsp_workers[_ocsp_nworkers], _ocsp_worker, NULL, 0))
+			error_printf(_("Failed to start OCSP worker thread\n"));
+		else
+			_ocsp_nworkers++;
+	}
+
+out:
+	wget_thread_mutex_unlock(&_ocsp_mutex);
+
+	if (start_worker)
+		_ocsp_worker(NULL); // no thread support, answer the query right now
+
+	return query;
+}
+
+/* Waits up to 'timeout' ms (< 0: no limit) for the OCSP queries of a connection
+ * and checks the results together with the ones known at handshake time.
+ * Returns 0 to go on with the connection, else -1.
+ */
+static int _ocsp_wait(struct _session_context *ctx, int timeout)
+{
+	const char *tag = _config.check_certificate ? _("ERROR") : _("WARNING");
+	long long end = timeout > 0 ? wget_get_timemillis() + timeout : 0;
+	int nvalid = ctx->ocsp_nvalid, nrevoked = 0, nunknown = 0;
+
+	wget_thread_mutex_lock(&_ocsp_mutex);
+
+	for (int it = 0; it < wget_vector_size(ctx->ocsp_queries); it++) {
+		_ocsp_query_t *query = wget_vector_get(ctx->ocsp_queries, it);
+
+		while (!query->done && !_ocsp_shutdown && timeout) {
+			int ms = -1, fd, rc;
+
+			if (end && (ms = (int) (end - wget_get_timemillis())) <= 0)
+				break;
+
+			if (query->pipefd[0] == -1 && pipe(query->pipefd)) {
+				query->pipefd[0] = query->pipefd[1] = -1;
+				break;
+			}
+
+			fd = query->pipefd[0]; // our reference keeps the query and its pipe
+			wget_thread_mutex_unlock(&_ocsp_mutex);
+
+			// wget_ready_2_transfer() lets an event loop run other tasks meanwhile
+			rc = wget_ready_2_transfer(fd, ms, WGET_IO_READABLE);
+
+			wget_thread_mutex_lock(&_ocsp_mutex);
+
+			if (rc < 0)
+				break;
+		}
+
+		if (!query->done)
+			nunknown++;
+		else if (query->valid == 1)
+			nvalid++;
+		else if (query->valid == 0)
+			nrevoked++;
+		else
+			nunknown++;
+
+		_ocsp_query_unref(query);
+	}
+
+	wget_thread_mutex_unlock(&_ocsp_mutex);
+
+	wget_vector_clear_nofree(ctx->ocsp_queries);
+	wget_vector_free(&ctx->ocsp_queries);
+
+	if (nrevoked) {
+		error_printf(_("%s: The certificate of '%s' has been revoked (via OCSP)\n"), tag, ctx->hostname);
+		wget_ocsp_db_add_host(_config.ocsp_cert_cache, wget_ocsp_new(ctx->hostname, 0, 0)); // remove entry from cache
+		return -1;
+	}
+
+	if (nunknown) {
+		if (!_config.ocsp_soft_fail) {
+			error_printf(_("%s: No OCSP response for the certificate of '%s'\n"), tag, ctx->hostname);
+			return -1;
+		}
+		error_printf(_("WARNING: OCSP response ignored\n"));
+	} else if (nvalid == ctx->ocsp_ncerts)
+		wget_ocsp_db_add_host(_config.ocsp_cert_cache, wget_ocsp_new(ctx->hostname, time(NULL) + 3600, 1)); // 1h valid
+
+	return 0;
+}
+
+// drop the queries of a connection that is closed without waiting
+static void _ocsp_release(struct _session_context *ctx)
+{
+	if (ctx->ocsp_queries) {
+		wget_thread_mutex_lock(&_ocsp_mutex);
+		for (int it = 0; it < wget_vector_size(ctx->ocsp_queries); it++)
+			_ocsp_query_unref(wget_vector_get(ctx->ocsp_queries, it));
+		wget_thread_mutex_unlock(&_ocsp_mutex);
+
+		wget_vector_clear_nofree(ctx->ocsp_queries);
+		wget_vector_free(&ctx->ocsp_queries);
+	}
+}
+
+static void _ocsp_deinit(void)
+{
+	wget_thread_mutex_lock(&_ocsp_mutex);
+	_ocsp_shutdown = 1;
+	wget_thread_cond_signal(&_ocsp_work_cond);
+	for (int it = 0; it < wget_vector_size(_ocsp_queries); it++)
+		_ocsp_query_wakeup(wget_vector_get(_ocsp_queries, it));
+	wget_thread_mutex_unlock(&_ocsp_mutex);
+
+	for (int it = 0; it < _ocsp_nworkers; it++)
+		wget_thread_join(_ocsp_workers[it]);
+
+	wget_thread_mutex_lock(&_ocsp_mutex);
+	for (int it = 0; it < wget_vector_size(_ocsp_queries); it++)
+		_ocsp_query_unref(wget_vector_get(_ocsp_queries, it));
+	wget_vector_clear_nofree(_ocsp_queries);
+	wget_vector_free(&_ocsp_queries);
+
+	_ocsp_nworkers = 0;
+	_ocsp_shutdown = 0;
+	wget_thread_mutex_unlock(&_ocsp_mutex);
 }
 #endif // HAVE_GNUTLS_OCSP_H
 
+/*
+ * Cache of verified certificate chains.
+ * Handshakes presenting a chain that has been verified for the same hostname before
+ * (e.g. concurrent connections to the same host) skip the X.509 path validation.
+ * Only successful verifications are cached.
+ */
+
+// max. seconds a verification result is used
+#define VERIFIED_CHAIN_TTL 3600
+// the cache is cleared when it grows beyond this number of entries
+#define VERIFIED_CHAIN_MAX 1024
+
+typedef struct {
+	time_t
+		expires; // earliest expiration time of the chain's certificates, at most VERIFIED_CHAIN_TTL ahead
+	unsigned char
+		digest[32]; // SHA-256 over the whole chain
+} _verified_chain_t;
+
+static wget_stringmap_t
+	*_verified_chains; // key: hostname + fingerprint of the end-entity certificate
+static wget_thread_mutex_t
+	_verified_chains_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+
+static int _get_chain_digest(const gnutls_datum_t *cert_list, unsigned cert_list_size, unsigned char *digest)
+{
+	gnutls_hash_hd_t hash;
+
+	if (gnutls_hash_init(&hash, GNUTLS_DIG_SHA256) < 0)
+		return -1;
+
+	for (unsigned it = 0; it < cert_list_size; it++)
+		gnutls_hash(hash, cert_list[it].data, cert_list[it].size);
+
+	gnutls_hash_deinit(hash, digest);
+
+	return 0;
+}
+
+static int _verified_chain_key(gnutls_x509_crt_t cert, const char *hostname, char *key, size_t size)
+{
+	char fingerprint[64 * 2 + 1];
+
+	if (!hostname)
+		return -1;
+
+	_get_cert_fingerprint(cert, fingerprint, sizeof(fingerprint));
+	snprintf(key, size, "%s %s", hostname, fingerprint);
+
+	return 0;
+}
+
+static int _chain_is_verified(const char *key, const unsigned char *digest)
+{
+	_verified_chain_t *chain;
+	int ret = 0;
+
+	wget_thread_mutex_lock(&_verified_chains_mutex);
+	if (_verified_chains && (chain = wget_stringmap_get(_verified_chains, key)))
+		ret = chain->expires >= time(NULL) && !memcmp(chain->digest, digest, sizeof(chain->digest));
+	wget_thread_mutex_unlock(&_verified_chains_mutex);
+
+	return ret;
+}
+
+static void _add_verified_chain(const char *key, const unsigned char *digest,
+	const gnutls_datum_t *cert_list, unsigned cert_list_size)
+{
+	_verified_chain_t chain;
+	gnutls_x509_crt_t cert;
+
+	chain.expires = time(NULL) + VERIFIED_CHAIN_TTL;
+	memcpy(chain.digest, digest, sizeof(chain.digest));
+
+	for (unsigned it = 0; it < cert_list_size; it++) {
+		if (gnutls_x509_crt_init(&cert) < 0)
+			return;
+
+		if (gnutls_x509_crt_import(cert, &cert_list[it], GNUTLS_X509_FMT_DER) == GNUTLS_E_SUCCESS) {
+			time_t expires = gnutls_x509_crt_get_expiration_time(cert);
+
+			if (expires != (time_t) -1 && expires < chain.expires)
+				chain.expires = expires;
+		}
+
+		gnutls_x509_crt_deinit(cert);
+	}
+
+	wget_thread_mutex_lock(&_verified_chains_mutex);
+	if (!_verified_chains)
+		_verified_chains = wget_stringmap_create(16);
+	else if (wget_stringmap_size(_verified_chains) >= VERIFIED_CHAIN_MAX)
+		wget_stringmap_clear(_verified_chains);
+	wget_stringmap_put(_verified_chains, key, &chain, sizeof(chain));
+	wget_thread_mutex_unlock(&_verified_chains_mutex);
+}
+
+/*
+ * Trust store.
+ * The CA certificates and CRLs are loaded into a trust list by a thread that is started
+ * with the first TLS connection, so reading and parsing them overlaps with the TCP and TLS
+ * handshakes. The first certificate verification waits for it and hands the list over to
+ * _credentials, see _wait_for_trust_list().
+ *
+ * CAs loaded from a directory can be kept in a cache file (WGET_SSL_CA_CACHE_FILE) holding
+ * the certificates DER encoded, which saves scanning the directory and decoding PEM.
+ * The file is memory-mapped for loading and rebuilt when the directory's mtime changes.
+ */
+
+#define CA_CACHE_MAGIC "wget2 CA cache1" // including the trailing 0 this fills the magic field
+
+// a cache file is the header, the directory name (dirlen bytes) and then
+// for each certificate its length (32 bit) followed by the DER data
+typedef struct {
+	char
+		magic[16];
+	int64_t
+		mtime; // modification time of the CA directory
+	uint32_t
+		dirlen,
+		reserved;
+} _ca_cache_header_t;
+
+static gnutls_x509_trust_list_t
+	_trust_list; // set by _trust_list_loader(), owned by _credentials after _wait_for_trust_list()
+static wget_thread_t
+	_trust_loader;
+static wget_thread_mutex_t
+	_trust_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static int
+	_trust_ncerts;
+static char
+	_trust_loading; // _trust_loader has been started and not been joined yet
+
+static _GL_INLINE int _key_type(int type)
+{
+	if (type == WGET_SSL_X509_FMT_DER)
+		return GNUTLS_X509_FMT_DER;
+
+	return GNUTLS_X509_FMT_PEM;
+}
+
+// returns the number of certificates added to list, or -1 if the cache file is missing or stale
+static int _load_ca_cache(gnutls_x509_trust_list_t list, const char *fname, const char *dirname, time_t mtime)
+{
+	_ca_cache_header_t header;
+	struct stat st;
+	size_t size, pos, dirlen = strlen(dirname);
+	unsigned char *buf;
+	uint32_t len;
+	int fd, ncerts = -1;
+
+	if ((fd = open(fname, O_RDONLY)) == -1)
+		return -1;
+
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(header) + dirlen) {
+		close(fd);
+		return -1;
+	}
+
+	size = st.st_size;
+
+#ifdef HAVE_MMAP
+	buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (buf == MAP_FAILED)
+		return -1;
+#else
+	close(fd);
+
+	// the file might have changed since fstat()
+	if (!(buf = (unsigned char *) wget_read_file(fname, &size)))
+		return -1;
+
+	if (size < sizeof(header) + dirlen) {
+		xfree(buf);
+		return -1;
+	}
+#endif
+
+	memcpy(&header, buf, sizeof(header));
+
+	if (!memcmp(header.magic, CA_CACHE_MAGIC, sizeof(header.magic))
+		&& header.mtime == (int64_t) mtime
+		&& header.dirlen == dirlen
+		&& !memcmp(buf + sizeof(header), dirname, dirlen))
+	{
+		// check the layout before adding anything
+		for (pos = sizeof(header) + dirlen; size - pos >= sizeof(len); pos += len) {
+			memcpy(&len, buf + pos, sizeof(len));
+			pos += sizeof(len);
+			if (len > size - pos)
+				break;
+		}
+
+		if (pos == size) {
+			ncerts = 0;
+
+			for (pos = sizeof(header) + dirlen; pos < size; pos += len) {
+				gnutls_datum_t der;
+
+				memcpy(&len, buf + pos, sizeof(len));
+				pos += sizeof(len);
+
+				der.data = buf + pos;
+				der.size = len;
+
+				if (gnutls_x509_trust_list_add_trust_mem(list, &der, NULL, GNUTLS_X509_FMT_DER, 0, 0) > 0)
+					ncerts++;
+			}
+		}
+	}
+
+#ifdef HAVE_MMAP
+	munmap(buf, size);
+#else
+	xfree(buf);
+#endif
+
+	return ncerts;
+}
+
+static int _save_ca_cache(void *cache, FILE *fp)
+{
+	wget_buffer_t *buf = cache;
+
+	return fwrite(buf->data, 1, buf->length, fp) == buf->length ? 0 : -1;
+}
+
+// add the certificates of a PEM file to list and append them DER encoded to cache
+static int _add_pem_file(gnutls_x509_trust_list_t list, const char *fname, wget_buffer_t *cache)
+{
+	gnutls_datum_t pem, der;
+	gnutls_x509_crt_t *crts;
+	unsigned int ncrts;
+	int rc;
+
+	if ((rc = gnutls_load_file(fname, &pem)) < 0)
+		return rc;
+
+	rc = gnutls_x509_crt_list_import2(&crts, &ncrts, &pem, GNUTLS_X509_FMT_PEM, 0);
+	gnutls_free(pem.data);
+
+	if (rc < 0)
+		return rc;
+
+	for (unsigned it = 0; it < ncrts; it++) {
+		if (gnutls_x509_crt_export2(crts[it], GNUTLS_X509_FMT_DER, &der) == GNUTLS_E_SUCCESS) {
+			uint32_t len = der.size;
+
+			wget_buffer_memcat(cache, &len, sizeof(len));
+			wget_buffer_memcat(cache, der.data, der.size);
+			gnutls_free(der.data);
+		}
+	}
+
+	// the list takes over the certificates
+	rc = gnutls_x509_trust_list_add_cas(list, crts, ncrts, 0);
+	gnutls_free(crts);
+
+	return rc;
+}
+
+// load all *.pem files of dirname into list, if cache is not NULL also append them to cache
+static int _load_ca_directory(gnutls_x509_trust_list_t list, const char *dirname, wget_buffer_t *cache)
+{
+	DIR *dir;
+	struct dirent *dp;
+	size_t dirlen = strlen(dirname);
+	int ncerts = 0, rc;
+
+	if (!(dir = opendir(dirname))) {
+		error_printf(_("Failed to opendir %s\n"), dirname);
+		return 0;
+	}
+
+	while ((dp = readdir(dir))) {
+		size_t len = strlen(dp->d_name);
+
+		if (len >= 4 && !wget_strncasecmp_ascii(dp->d_name + len - 4, ".pem", 4)) {
+			struct stat st;
+			char fname[dirlen + 1 + len + 1];
+
+			snprintf(fname, sizeof(fname), "%s/%s", dirname, dp->d_name);
+			if (stat(fname, &st) == 0 && S_ISREG(st.st_mode)) {
+				debug_printf("GnuTLS loading %s\n", fname);
+
+				if (cache)
+					rc = _add_pem_file(list, fname, cache);
+				else
+					rc = gnutls_x509_trust_list_add_trust_file(list, fname, NULL, GNUTLS_X509_FMT_PEM, 0, 0);
+
+				if (rc <= 0)
+					debug_printf("Failed to load cert '%s': (%d)\n", fname, rc);
+				else
+					ncerts += rc;
+			}
+		}
+	}
+
+	closedir(dir);
+
+	return ncerts;
+}
+
+static int _load_ca_directory_cached(gnutls_x509_trust_list_t list, const char *dirname)
+{
+	_ca_cache_header_t header;
+	wget_buffer_t *cache;
+	struct stat st;
+	int ncerts;
+
+	if (stat(dirname, &st) != 0)
+		return _load_ca_directory(list, dirname, NULL);
+
+	if ((ncerts = _load_ca_cache(list, _config.ca_cache_file, dirname, st.st_mtime)) >= 0) {
+		debug_printf("GnuTLS loaded %d CAs from '%s'\n", ncerts, _config.ca_cache_file);
+		return ncerts;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CA_CACHE_MAGIC, sizeof(header.magic));
+	header.mtime = st.st_mtime;
+	header.dirlen = (uint32_t) strlen(dirname);
+
+	cache = wget_buffer_alloc(256 * 1024);
+	wget_buffer_memcpy(cache, &header, sizeof(header));
+	wget_buffer_memcat(cache, dirname, header.dirlen);
+
+	ncerts = _load_ca_directory(list, dirname, cache);
+
+	if (wget_update_file(_config.ca_cache_file, NULL, _save_ca_cache, cache) == 0)
+		debug_printf("GnuTLS saved %d CAs to '%s'\n", ncerts, _config.ca_cache_file);
+
+	wget_buffer_free(&cache);
+
+	return ncerts;
+}
+
+static void *_trust_list_loader(void *unused G_GNUC_WGET_UNUSED)
+{
+	gnutls_x509_trust_list_t list;
+	int ncerts = -1, rc;
+
+	if ((rc = gnutls_x509_trust_list_init(&list, 0)) != GNUTLS_E_SUCCESS) {
+		error_printf(_("GnuTLS: Failed to init trust list: %s\n"), gnutls_strerror(rc));
+		return NULL;
+	}
+
+	if (_config.ca_directory && *_config.ca_directory && _config.check_certificate) {
+		const char *dirname = _config.ca_directory;
+
+#if GNUTLS_VERSION_NUMBER >= 0x03000d
+		if (!strcmp(dirname, "system"))
+			ncerts = gnutls_x509_trust_list_add_system_trust(list, 0, 0);
+#else
+		if (!strcmp(dirname, "system"))
+			dirname = "/etc/ssl/certs";
+#endif
+
+		if (ncerts < 0) {
+			if (_config.ca_cache_file && *_config.ca_cache_file)
+				ncerts = _load_ca_directory_cached(list, dirname);
+			else
+				ncerts = _load_ca_directory(list, dirname, NULL);
+		}
+	}
+
+	if (_config.ca_file) {
+		if (gnutls_x509_trust_list_add_trust_file(list, _config.ca_file, NULL, _key_type(_config.ca_type), 0, 0) <= 0)
+			error_printf(_("No CAs were found in '%s'\n"), _config.ca_file);
+	}
+
+	if (_config.crl_file) {
+		if ((rc = gnutls_x509_trust_list_add_trust_file(list, NULL, _config.crl_file, GNUTLS_X509_FMT_PEM, 0, 0)) <= 0)
+			error_printf("Failed to load CRL '%s': (%d)\n", _config.crl_file, rc);
+	}
+
+	// _trust_loader is joined before these are read
+	_trust_list = list;
+	_trust_ncerts = ncerts;
+
+	return NULL;
+}
+
+// called with _mutex held by wget_ssl_init()
+static void _start_trust_list_loader(void)
+{
+	if (wget_thread_start(&_trust_loader, _trust_list_loader, NULL, 0) == 0)
+		_trust_loading = 1;
+	else
+		_trust_list_loader(NULL);
+}
+
+// the trust list has to be complete before the first certificate verification
+static void _wait_for_trust_list(void)
+{
+	wget_thread_mutex_lock(&_trust_mutex);
+
+	if (_trust_loading) {
+		wget_thread_join(_trust_loader);
+		_trust_loading = 0;
+	}
+
+	if (_trust_list) {
+		// replaces (and frees) the empty trust list of _credentials
+		gnutls_certificate_set_trust_list(_credentials, _trust_list, 0);
+		_trust_list = NULL;
+		debug_printf("Certificates loaded: %d\n", _trust_ncerts);
+	}
+
+	wget_thread_mutex_unlock(&_trust_mutex);
+}
+
 /* This function will verify the peer's certificate, and check
  * if the hostname matches, as well as the activation, expiration dates.
  */
@@ -694,10 +1542,13 @@ static int _verify_certificate_callback(gnutls_session_t session)
 	unsigned int status, deinit_cert = 0, deinit_issuer = 0;
 	const gnutls_datum_t *cert_list = 0;
 	unsigned int cert_list_size;
-	int ret = -1, err, ocsp_ok = 0;
+	int ret = -1, err;
 	gnutls_x509_crt_t cert = NULL, issuer = NULL;
 	const char *hostname;
 	const char *tag = _config.check_certificate ? _("ERROR") : _("WARNING");
+	char chain_key[256];
+	unsigned char chain_digest[32];
+	int chain_cached = 0;
 #ifdef HAVE_GNUTLS_OCSP_H
 	unsigned nvalid = 0, nrevoked = 0;
 #endif
@@ -706,6 +1557,34 @@ static int _verify_certificate_callback(gnutls_session_t session)
 	struct _session_context *ctx = gnutls_session_get_ptr(session);
 	hostname = ctx->hostname;
 
+	_wait_for_trust_list();
+
+	// skip the chain verification if the same chain has been verified for hostname before
+	if (gnutls_certificate_type_get(session) == GNUTLS_CRT_X509
+		&& (cert_list = gnutls_certificate_get_peers(session, &cert_list_size))
+		&& gnutls_x509_crt_init(&cert) == GNUTLS_E_SUCCESS)
+	{
+		if (gnutls_x509_crt_import(cert, &cert_list[0], GNUTLS_X509_FMT_DER) == GNUTLS_E_SUCCESS
+			&& _verified_chain_key(cert, hostname, chain_key, sizeof(chain_key)) == 0
+			&& _get_chain_digest(cert_list, cert_list_size, chain_digest) == 0)
+		{
+			if ((chain_cached = _chain_is_verified(chain_key, chain_digest)))
+				debug_printf("Certificate chain of '%s' is valid (cached)\n", hostname);
+		} else
+			*chain_key = 0;
+
+		gnutls_x509_crt_deinit(cert);
+		cert = NULL;
+
+		if (chain_cached) {
+			wget_thread_mutex_lock(&_stats_mutex);
+			_stats.verified_cached++;
+			wget_thread_mutex_unlock(&_stats_mutex);
+			goto verified;
+		}
+	} else
+		*chain_key = 0;
+
 	/* This verification function uses the trusted CAs in the credentials
 	 * structure. So you must have installed one or more CA certificates.
 	 */
@@ -735,7 +1614,7 @@ static int _verify_certificate_callback(gnutls_session_t session)
 				if (gnutls_x509_crt_init(&cert) == GNUTLS_E_SUCCESS) {
 					if ((cert_list = gnutls_certificate_get_peers(session, &cert_list_size))) {
 						if (gnutls_x509_crt_import(cert, &cert_list[0], GNUTLS_X509_FMT_DER) == GNUTLS_E_SUCCESS) {
-							_add_cert_to_ocsp_cache(cert, 0);
+							_add_cert_to_ocsp_cache(cert, 0, time(NULL) + 3600); // 1h valid
 						}
 					}
 					gnutls_x509_crt_deinit(cert);
@@ -778,6 +1657,7 @@ static int _verify_certificate_callback(gnutls_session_t session)
 		goto out;
 	}
 
+verified:
 	/* Up to here the process is the same for X.509 certificates and
 	 * OpenPGP keys. From now on X.509 certificates are assumed. This can
 	 * be easily extended to work with openpgp keys as well.
@@ -808,6 +1688,9 @@ static int _verify_certificate_callback(gnutls_session_t session)
 	else
 		goto out;
 
+	if (!chain_cached && *chain_key)
+		_add_verified_chain(chain_key, chain_digest, cert_list, cert_list_size);
+
 	// At this point, the cert chain has been found valid regarding the locally available CA certificates and CRLs.
 	// Now, we are going to check the revocation status via OCSP
 #ifdef HAVE_GNUTLS_OCSP_H
@@ -817,7 +1700,7 @@ static int _verify_certificate_callback(gnutls_session_t session)
 			if (gnutls_ocsp_status_request_is_checked(session, 0)) {
 				debug_printf("Server certificate is valid regarding OCSP stapling\n");
 //				_get_cert_fingerprint(cert, fingerprint, sizeof(fingerprint)); // calc hexadecimal fingerprint string
-				_add_cert_to_ocsp_cache(cert, 1);
+				_add_cert_to_ocsp_cache(cert, 1, _get_stapled_ocsp_expiry(session));
 				nvalid = 1;
 			} else if (!_config.ocsp)
 				error_printf(_("WARNING: The certificate's (stapled) OCSP status has not been sent\n"));
@@ -869,29 +1752,26 @@ static int _verify_certificate_callback(gnutls_session_t session)
 				continue;
 			}
 
-			ocsp_ok = cert_verify_ocsp(cert, issuer);
-			debug_printf("check_ocsp_response() returned %d\n", ocsp_ok);
-
-			if (ocsp_ok == 1) {
-				debug_printf("Certificate[%u] of '%s' is valid (via OCSP)\n", it, hostname);
-				wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(fingerprint, time(NULL) + 3600, 1)); // 1h valid
-				nvalid++;
-			} else if (ocsp_ok == 0) {
-				debug_printf(_("%s: Certificate[%u] of '%s' has been revoked (via OCSP)\n"), tag, it, hostname);
-				wget_ocsp_db_add_fingerprint(_config.ocsp_cert_cache, wget_ocsp_new(fingerprint, time(NULL) + 3600, 0));  // cert has been revoked
-				nrevoked++;
-			} else {
-				error_printf(_("WARNING: OCSP response ignored\n"));
+			// the answer is waited for after the handshake, see _ocsp_wait()
+			_ocsp_query_t *query = _ocsp_submit(cert, &cert_list[it], issuer, fingerprint);
+
+			if (query) {
+				if (!ctx->ocsp_queries)
+					ctx->ocsp_queries = wget_vector_create(4, -2, NULL);
+				wget_vector_add_noalloc(ctx->ocsp_queries, query);
 			}
 		}
 	}
 
 	if (_config.ocsp_stapling || _config.ocsp) {
-		if (nvalid == cert_list_size) {
-			wget_ocsp_db_add_host(_config.ocsp_cert_cache, wget_ocsp_new(hostname, time(NULL) + 3600, 1)); // 1h valid
-		} else if (nrevoked) {
+		if (nrevoked) {
 			wget_ocsp_db_add_host(_config.ocsp_cert_cache, wget_ocsp_new(hostname, 0, 0)); // remove entry from cache
 			ret = -1;
+		} else if (ctx->ocsp_queries) {
+			ctx->ocsp_nvalid = nvalid;
+			ctx->ocsp_ncerts = cert_list_size;
+		} else if (nvalid == cert_list_size) {
+			wget_ocsp_db_add_host(_config.ocsp_cert_cache, wget_ocsp_new(hostname, time(NULL) + 3600, 1)); // 1h valid
 		}
 	}
 #endif
@@ -910,14 +1790,6 @@ out:
 static int _init, _server_init;
 static wget_thread_mutex_t _mutex = WGET_THREAD_MUTEX_INITIALIZER;
 
-static _GL_INLINE int _key_type(int type)
-{
-	if (type == WGET_SSL_X509_FMT_DER)
-		return GNUTLS_X509_FMT_DER;
-
-	return GNUTLS_X509_FMT_PEM;
-}
-
 // ssl_init() is thread safe
 
 static void _set_credentials(gnutls_certificate_credentials_t *credentials)
@@ -942,76 +1814,24 @@ static void _set_credentials(gnutls_certificate_credentials_t *credentials)
 		if (gnutls_certificate_set_x509_key_file(*credentials, _config.cert_file, _config.key_file, _key_type(_config.key_type)) != GNUTLS_E_SUCCESS)
 			error_printf(_("No certificates or keys were found\n"));
 	}
-
-	if (_config.ca_file) {
-		if (gnutls_certificate_set_x509_trust_file(*credentials, _config.ca_file, _key_type(_config.ca_type)) <= 0)
-			error_printf(_("No CAs were found in '%s'\n"), _config.ca_file);
-	}
 }
 
 void wget_ssl_init(void)
 {
-	int ncerts = -1, rc;
-
-	wget_thread_mutex_lock(&_mutex);
-
-	if (!_init) {
-		debug_printf("GnuTLS init\n");
-		gnutls_global_init();
-		gnutls_certificate_allocate_credentials(&_credentials);
-		gnutls_certificate_set_verify_function(_credentials, _verify_certificate_callback);
-
-		if (_config.ca_directory && *_config.ca_directory && _config.check_certificate) {
-#if GNUTLS_VERSION_NUMBER >= 0x03000d
-			if (!strcmp(_config.ca_directory, "system"))
-				ncerts = gnutls_certificate_set_x509_system_trust(_credentials);
-#else
-			if (!strcmp(_config.ca_directory, "system"))
-				_config.ca_directory = "/etc/ssl/certs";
-#endif
-
-			if (ncerts < 0) {
-				DIR *dir;
-
-				ncerts = 0;
-
-				if ((dir = opendir(_config.ca_directory))) {
-					struct dirent *dp;
-					size_t dirlen = strlen(_config.ca_directory);
-
-					while ((dp = readdir(dir))) {
-						size_t len = strlen(dp->d_name);
-
-						if (len >= 4 && !wget_strncasecmp_ascii(dp->d_name + len - 4, ".pem", 4)) {
-							struct stat st;
-							char fname[dirlen + 1 + len + 1];
-
-							snprintf(fname, sizeof(fname), "%s/%s", _config.ca_directory, dp->d_name);
-							if (stat(fname, &st) == 0 && S_ISREG(st.st_mode)) {
-								debug_printf("GnuTLS loading %s\n", fname);
-								if ((rc = gnutls_certificate_set_x509_trust_file(_credentials, fname, GNUTLS_X509_FMT_PEM)) <= 0)
-									debug_printf("Failed to load cert '%s': (%d)\n", fname, rc);
-								else
-									ncerts += rc;
-							}
-						}
-					}
+	int rc;
 
-					closedir(dir);
-				} else {
-					error_printf(_("Failed to opendir %s\n"), _config.ca_directory);
-				}
-			}
-		}
+	wget_thread_mutex_lock(&_mutex);
 
-		if (_config.crl_file) {
-			if ((rc = gnutls_certificate_set_x509_crl_file(_credentials, _config.crl_file, GNUTLS_X509_FMT_PEM)) <= 0)
-				error_printf("Failed to load CRL '%s': (%d)\n", _config.crl_file, rc);
-		}
+	if (!_init) {
+		debug_printf("GnuTLS init\n");
+		gnutls_global_init();
+		gnutls_certificate_allocate_credentials(&_credentials);
+		gnutls_certificate_set_verify_function(_credentials, _verify_certificate_callback);
 
 		_set_credentials(&_credentials);
 
-		debug_printf("Certificates loaded: %d\n", ncerts);
+		// CAs and CRLs are loaded in the background, see _wait_for_trust_list()
+		_start_trust_list_loader();
 
 		if (_config.secure_protocol || _config.direct_options) {
 			const char *priorities = NULL;
@@ -1060,9 +1880,19 @@ void wget_ssl_init(void)
 
 void wget_ssl_deinit(void)
 {
+#ifdef HAVE_GNUTLS_OCSP_H
+	_ocsp_deinit(); // stop the OCSP workers before the TLS setup goes away
+#endif
+
 	wget_thread_mutex_lock(&_mutex);
 
 	if (_init == 1) {
+		_wait_for_trust_list(); // joins the loader, _credentials frees the list
+
+		wget_thread_mutex_lock(&_verified_chains_mutex);
+		wget_stringmap_free(&_verified_chains);
+		wget_thread_mutex_unlock(&_verified_chains_mutex);
+
 		gnutls_certificate_free_credentials(_credentials);
 		gnutls_priority_deinit(_priority_cache);
 		gnutls_global_deinit();
@@ -1178,24 +2008,154 @@ static ssize_t _ssl_writev(gnutls_transport_ptr_t *p, const giovec_t *iov, int i
 }
 #endif
 
-int wget_ssl_open(wget_tcp_t *tcp)
+static void _store_session_data(gnutls_session_t session, struct _session_context *ctx)
+{
+	gnutls_datum_t session_data;
+	int rc;
+
+	if ((rc = gnutls_session_get_data2(session, &session_data)) == GNUTLS_E_SUCCESS) {
+		wget_tls_session_t *tls_session =
+			wget_tls_session_new(ctx->hostname, time(NULL) + SESSION_MAXAGE, session_data.data, session_data.size);
+#if GNUTLS_VERSION_NUMBER >= 0x030200
+		gnutls_datum_t protocol;
+
+		if (_config.alpn && gnutls_alpn_get_selected_protocol(session, &protocol) == GNUTLS_E_SUCCESS)
+			wget_tls_session_set_alpn(tls_session, (const char *) protocol.data, protocol.size);
+#endif
+		wget_tls_session_db_add(_config.tls_session_cache, tls_session); // wakes up waiting connections
+		gnutls_free(session_data.data);
+		ctx->claimed = 0;
+	} else
+		debug_printf("Failed to get session data: %s\n", gnutls_strerror(rc));
+}
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+// TLS 1.3 session tickets arrive after the handshake, store each one as soon as it is received
+static int _session_ticket_hook(gnutls_session_t session, unsigned int htype, unsigned when, unsigned int incoming, const gnutls_datum_t *msg)
+{
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+
+	if (ctx && _config.tls_session_cache && gnutls_protocol_get_version(session) == GNUTLS_TLS1_3) {
+		debug_printf("Got TLS 1.3 session ticket for %s\n", ctx->hostname);
+		_store_session_data(session, ctx);
+	}
+
+	return 0;
+}
+#endif
+
+// bookkeeping after a client handshake completed successfully
+static void _handshake_completed(gnutls_session_t session, struct _session_context *ctx, int false_start)
+{
+	int resumed = gnutls_session_is_resumed(session);
+
+	debug_printf("Handshake completed%s\n", resumed ? " (resumed session)" : "");
+
+	wget_thread_mutex_lock(&_stats_mutex);
+	_stats.handshakes++;
+	if (resumed)
+		_stats.resumed++;
+	wget_thread_mutex_unlock(&_stats_mutex);
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+	if (gnutls_protocol_get_version(session) == GNUTLS_TLS1_3)
+		return; // see _session_ticket_hook()
+#endif
+
+	if (!resumed && _config.tls_session_cache) {
+		if (false_start)
+			ctx->delayed_session_data = 1;
+		else
+			_store_session_data(session, ctx);
+	}
+}
+
+// Finish a handshake deferred by wget_ssl_open().
+// If 'buf' is given, it is sent as early data along with the ClientHello.
+// Returns 'count' if the early data has been accepted, 0 if it has to be sent again, -1 on error.
+static ssize_t _finish_deferred_handshake(gnutls_session_t session, const char *buf, size_t count, int timeout)
+{
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+	int rc, early_data = 0;
+
+	ctx->handshake_pending = 0;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+	if (buf && (rc = gnutls_record_send_early_data(session, buf, count)) < 0)
+		debug_printf("GnuTLS: Failed to send early data: %s\n", gnutls_strerror(rc));
+	else
+		early_data = !!buf;
+#endif
+
+	if ((rc = _do_handshake(session, ctx->sockfd, timeout)) != WGET_E_SUCCESS) {
+		error_printf(_("TLS handshake with %s failed (%d)\n"), ctx->hostname, rc);
+		return -1;
+	}
+
+#ifdef HAVE_GNUTLS_OCSP_H
+	// the server did not resume the session and sent its certificates
+	if (ctx->ocsp_queries && _ocsp_wait(ctx, timeout) && _config.check_certificate)
+		return -1;
+#endif
+
+#if GNUTLS_VERSION_NUMBER >= 0x030200
+	gnutls_datum_t protocol;
+
+	// the connection has been set up for HTTP/1.1 already
+	if (_config.alpn && gnutls_alpn_get_selected_protocol(session, &protocol) == GNUTLS_E_SUCCESS
+		&& (protocol.size != 8 || memcmp(protocol.data, "http/1.1", 8)))
+	{
+		error_printf(_("%s switched to ALPN protocol '%.*s' on resumption\n"), ctx->hostname, (int) protocol.size, protocol.data);
+		return -1;
+	}
+#endif
+
+	if (_config.print_info)
+		_print_info(session);
+
+	_handshake_completed(session, ctx, 0);
+
+	if (early_data) {
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+		early_data = !!(gnutls_session_get_flags(session) & GNUTLS_SFLAGS_EARLY_DATA);
+#endif
+		debug_printf("TLS early data %s\n", early_data ? "accepted" : "rejected");
+
+		wget_thread_mutex_lock(&_stats_mutex);
+		if (early_data)
+			_stats.early_data++;
+		else
+			_stats.early_data_rejected++;
+		wget_thread_mutex_unlock(&_stats_mutex);
+	}
+
+	return early_data ? (ssize_t) count : 0;
+}
+
+// Sets up the TLS session on tcp->sockfd, returns 1 if the handshake has been deferred for early data.
+// With 'session_wait', a concurrent connection to the same host might be waited for to resume its session.
+static int _ssl_session_new(wget_tcp_t *tcp, int session_wait)
 {
 	gnutls_session_t session;
-	int ret = WGET_E_UNKNOWN;
 	int rc, sockfd, connect_timeout;
 	const char *hostname;
 
-	if (!tcp)
-		return WGET_E_INVALID;
-
-	if (!_init)
-		wget_ssl_init();
-
 	hostname = tcp->ssl_hostname;
 	sockfd= tcp->sockfd;
 	connect_timeout = tcp->connect_timeout;
 
-#if GNUTLS_VERSION_NUMBER >= 0x030500
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+	unsigned flags = GNUTLS_CLIENT | GNUTLS_NONBLOCK;
+
+	if (tcp->tls_false_start) {
+		debug_printf("TLS False Start requested\n");
+		flags |= GNUTLS_ENABLE_FALSE_START;
+	}
+	if (tcp->tls_early_data)
+		flags |= GNUTLS_ENABLE_EARLY_DATA;
+
+	gnutls_init(&session, flags);
+#elif GNUTLS_VERSION_NUMBER >= 0x030500
 	if (tcp->tls_false_start) {
 		debug_printf("TLS False Start requested\n");
 		gnutls_init(&session, GNUTLS_CLIENT | GNUTLS_NONBLOCK | GNUTLS_ENABLE_FALSE_START);
@@ -1225,6 +2185,7 @@ int wget_ssl_open(wget_tcp_t *tcp)
 
 	struct _session_context *ctx = wget_calloc(1, sizeof(struct _session_context));
 	ctx->hostname = wget_strdup(hostname);
+	ctx->sockfd = sockfd;
 
 #ifdef HAVE_GNUTLS_OCSP_H
 	// If we know the cert chain for the hostname being valid at the moment,
@@ -1232,7 +2193,7 @@ int wget_ssl_open(wget_tcp_t *tcp)
 	// In the unlikely case that the server's certificate chain changed right now,
 	// we fallback to OCSP responder request later.
 	if (hostname) {
-		if (!(ctx->valid = wget_ocsp_hostname_is_valid(_config.ocsp_host_cache, hostname))) {
+		if (!(ctx->valid = wget_ocsp_hostname_is_valid(_config.ocsp_cert_cache, hostname))) {
 #if GNUTLS_VERSION_NUMBER >= 0x030103
 			if ((rc = gnutls_ocsp_status_request_enable_client(session, NULL, 0, NULL)) == GNUTLS_E_SUCCESS)
 				ctx->ocsp_stapling = 1;
@@ -1274,6 +2235,11 @@ int wget_ssl_open(wget_tcp_t *tcp)
 	tcp->ssl_session = session;
 	gnutls_session_set_ptr(session, ctx);
 
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+	if (_config.tls_session_cache)
+		gnutls_handshake_set_hook_function(session, GNUTLS_HANDSHAKE_NEW_SESSION_TICKET, GNUTLS_HOOK_POST, _session_ticket_hook);
+#endif
+
 #ifdef MSG_FASTOPEN
 	if (wget_tcp_get_tcp_fastopen(tcp)) {
 		// prepare for TCP FASTOPEN... sendmsg() instead of connect/write on first write
@@ -1293,19 +2259,76 @@ int wget_ssl_open(wget_tcp_t *tcp)
 	}
 #endif
 
-	{
+	if (_config.tls_session_cache && ctx->hostname) {
 		void *data;
 		size_t size;
+		char *alpn = NULL;
+		int found;
+
+		found = !wget_tls_session_get2(_config.tls_session_cache, ctx->hostname, &data, &size, &alpn);
 
-		if (wget_tls_session_get(_config.tls_session_cache, ctx->hostname, &data, &size) == 0) {
+		if (!found && session_wait && _config.session_wait > 0) {
+			// let concurrent connections to the same host resume the session of the first one
+			int wait = connect_timeout > 0 && connect_timeout < _config.session_wait ? connect_timeout : _config.session_wait;
+
+			if ((rc = wget_tls_session_db_claim(_config.tls_session_cache, ctx->hostname, wait)) == 0)
+				ctx->claimed = 1;
+			else if (rc == 1)
+				found = !wget_tls_session_get2(_config.tls_session_cache, ctx->hostname, &data, &size, &alpn);
+		}
+
+		if (found) {
 			debug_printf("found cached session data for %s\n", ctx->hostname);
 			if ((rc = gnutls_session_set_data(session, data, size)) != GNUTLS_E_SUCCESS)
 				error_printf("GnuTLS: Failed to set session data: %s\n", gnutls_strerror(rc));
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+			// the first write will carry the request as early data (0-RTT),
+			// only with HTTP/1.1 since the protocol has to be known before the handshake
+			else if (tcp->tls_early_data && (alpn ? !strcmp(alpn, "http/1.1") : !_config.alpn))
+				ctx->handshake_pending = 1;
+#endif
 			xfree(data);
+			xfree(alpn);
 		}
 	}
 
-	ret = _do_handshake(session, sockfd, connect_timeout);
+	if (ctx->handshake_pending) {
+		debug_printf("Handshake deferred for early data\n");
+		tcp->protocol = WGET_PROTOCOL_HTTP_1_1;
+		return 1;
+	}
+
+	return 0;
+}
+
+// free the session of a failed or cancelled handshake
+static void _ssl_session_free(wget_tcp_t *tcp)
+{
+	gnutls_session_t session = tcp->ssl_session;
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+
+	if (ctx->claimed)
+		wget_tls_session_db_release(_config.tls_session_cache, ctx->hostname);
+#ifdef HAVE_GNUTLS_OCSP_H
+	_ocsp_release(ctx);
+#endif
+	xfree(ctx->hostname);
+	xfree(ctx);
+	gnutls_deinit(session);
+	tcp->ssl_session = NULL;
+}
+
+// the handshake is done ('ret' is its result), check OCSP and ALPN
+static int _ssl_open_finish(wget_tcp_t *tcp, int ret)
+{
+	gnutls_session_t session = tcp->ssl_session;
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+	int rc;
+
+#ifdef HAVE_GNUTLS_OCSP_H
+	if (ret == WGET_E_SUCCESS && ctx->ocsp_queries && _ocsp_wait(ctx, tcp->connect_timeout) && _config.check_certificate)
+		ret = WGET_E_CERTIFICATE;
+#endif
 
 #if GNUTLS_VERSION_NUMBER >= 0x030200
 	if (_config.alpn) {
@@ -1324,36 +2347,65 @@ int wget_ssl_open(wget_tcp_t *tcp)
 		_print_info(session);
 
 	if (ret == WGET_E_SUCCESS) {
-		int resumed = gnutls_session_is_resumed(session);
-
-		debug_printf("Handshake completed%s\n", resumed ? " (resumed session)" : "");
-
-		if (!resumed && _config.tls_session_cache) {
-			if (tcp->tls_false_start) {
-				ctx->delayed_session_data = 1;
-			} else {
-				gnutls_datum_t session_data;
-
-				if ((rc = gnutls_session_get_data2(session, &session_data)) == GNUTLS_E_SUCCESS) {
-					wget_tls_session_db_add(_config.tls_session_cache,
-						wget_tls_session_new(ctx->hostname, time(NULL) + 18 * 3600, session_data.data, session_data.size)); // 18h valid
-					gnutls_free(session_data.data);
-				} else
-					debug_printf("Failed to get session data: %s", gnutls_strerror(rc));
-			}
-		}
+		_handshake_completed(session, ctx, tcp->tls_false_start);
 	} else {
 		if (ret == WGET_E_TIMEOUT)
 			debug_printf("Handshake timed out\n");
-		xfree(ctx->hostname);
-		xfree(ctx);
-		gnutls_deinit(session);
-		tcp->ssl_session = NULL;
+		_ssl_session_free(tcp);
 	}
 
 	return ret;
 }
 
+int wget_ssl_open(wget_tcp_t *tcp)
+{
+	if (!tcp)
+		return WGET_E_INVALID;
+
+	if (!_init)
+		wget_ssl_init();
+
+	if (_ssl_session_new(tcp, 1))
+		return WGET_E_SUCCESS;
+
+	return _ssl_open_finish(tcp, _do_handshake(tcp->ssl_session, tcp->sockfd, tcp->connect_timeout));
+}
+
+int _wget_ssl_open_start(wget_tcp_t *tcp)
+{
+	if (!_init)
+		wget_ssl_init();
+
+	// waiting for the session of another connection would block the other handshakes
+	if (_ssl_session_new(tcp, 0))
+		return WGET_E_SUCCESS;
+
+	return WGET_IO_WRITABLE; // see _do_handshake()
+}
+
+int _wget_ssl_open_continue(wget_tcp_t *tcp)
+{
+	int rc, ret;
+
+	if ((rc = gnutls_handshake(tcp->ssl_session)) != 0 && !gnutls_error_is_fatal(rc))
+		return gnutls_record_get_direction(tcp->ssl_session) ? WGET_IO_WRITABLE : WGET_IO_READABLE;
+
+	if (rc == 0) {
+		ret = WGET_E_SUCCESS;
+	} else {
+		debug_printf("gnutls_handshake: (%d) %s\n", rc, gnutls_strerror(rc));
+		ret = rc == GNUTLS_E_CERTIFICATE_ERROR ? WGET_E_CERTIFICATE : WGET_E_HANDSHAKE;
+	}
+
+	return _ssl_open_finish(tcp, ret);
+}
+
+void _wget_ssl_open_cancel(wget_tcp_t *tcp)
+{
+	if (tcp->ssl_session)
+		_ssl_session_free(tcp);
+}
+
 void wget_ssl_close(void **session)
 {
 	if (session && *session) {
@@ -1371,15 +2423,30 @@ void wget_ssl_close(void **session)
 		gnutls_deinit(s);
 		*session = NULL;
 
+		if (ctx->claimed)
+			wget_tls_session_db_release(_config.tls_session_cache, ctx->hostname);
+#ifdef HAVE_GNUTLS_OCSP_H
+		_ocsp_release(ctx);
+#endif
+
 		xfree(ctx->hostname);
 		xfree(ctx);
 	}
 }
 
+void wget_ssl_get_stats(wget_ssl_stats_t *stats)
+{
+	wget_thread_mutex_lock(&_stats_mutex);
+	*stats = _stats;
+	wget_thread_mutex_unlock(&_stats_mutex);
+}
+
 static gnutls_certificate_credentials_t
 	_server_credentials;
 static gnutls_priority_t
 	_server_priority_cache;
+static gnutls_datum_t
+	_server_ticket_key; // encrypts the session tickets for resumption
 
 void wget_ssl_server_init(void)
 {
@@ -1394,6 +2461,11 @@ void wget_ssl_server_init(void)
 		gnutls_certificate_allocate_credentials(&_server_credentials);
 		_set_credentials(&_server_credentials);
 
+		if (_config.ca_file) {
+			if (gnutls_certificate_set_x509_trust_file(_server_credentials, _config.ca_file, _key_type(_config.ca_type)) <= 0)
+				error_printf(_("No CAs were found in '%s'\n"), _config.ca_file);
+		}
+
 		/* Generate Diffie-Hellman parameters - for use with DHE
 		 * kx algorithms. When short bit length is used, it might
 		 * be wise to regenerate parameters often.
@@ -1407,6 +2479,9 @@ void wget_ssl_server_init(void)
 		if ((ret = gnutls_priority_init(&_server_priority_cache, "PERFORMANCE", NULL)) < 0)
 			error_printf("GnuTLS: Unsupported server priority string '%s': %s\n", "PERFORMANCE", gnutls_strerror(ret));
 
+		if ((ret = gnutls_session_ticket_key_generate(&_server_ticket_key)) < 0)
+			error_printf("GnuTLS: Failed to generate session ticket key: %s\n", gnutls_strerror(ret));
+
 		_server_init++;
 
 		debug_printf("GnuTLS server init done\n");
@@ -1422,6 +2497,8 @@ void wget_ssl_server_deinit(void)
 	if (_server_init == 1) {
 		gnutls_certificate_free_credentials(_server_credentials);
 		gnutls_priority_deinit(_server_priority_cache);
+		gnutls_free(_server_ticket_key.data);
+		_server_ticket_key.data = NULL;
 		gnutls_global_deinit();
 	}
 
@@ -1462,6 +2539,9 @@ int wget_ssl_server_open(wget_tcp_t *tcp)
 	 */
 	gnutls_certificate_server_set_request(session, GNUTLS_CERT_IGNORE);
 
+	if (_server_ticket_key.data)
+		gnutls_session_ticket_enable_server(session, &_server_ticket_key);
+
 #ifdef HAVE_GNUTLS_TRANSPORT_GET_INT
 	// since GnuTLS 3.1.9, avoid warnings about illegal pointer conversion
 	gnutls_transport_set_int(session, sockfd);
@@ -1497,8 +2577,167 @@ void wget_ssl_server_close(void **session)
 	}
 }
 
+#ifdef HAVE_KTLS
+/*
+ * Kernel TLS (kTLS) receive offload.
+ * When a body is to be spliced into a file (see wget_tcp_splice()), the read keys of the session
+ * are handed over to the kernel. From then on the kernel decrypts the records and GnuTLS is only
+ * used for sending. Only AEAD ciphers are supported by the kernel.
+ *
+ * The kernel can't follow a TLS 1.3 KeyUpdate, which would fail the connection in the middle of
+ * a body. So kTLS is only used with TLS 1.2, where the keys stay the same for the connection.
+ */
+
+// TLS content types of the records received via kTLS
+#define TLS_RECORD_ALERT 21
+#define TLS_RECORD_HANDSHAKE 22
+#define TLS_RECORD_APPLICATION_DATA 23
+
+static int _ktls_enable_rx(gnutls_session_t session, struct _session_context *ctx, int sockfd)
+{
+	union {
+		struct tls12_crypto_info_aes_gcm_128 aes128;
+		struct tls12_crypto_info_aes_gcm_256 aes256;
+		struct tls12_crypto_info_chacha20_poly1305 chacha;
+	} info;
+	gnutls_datum_t iv, key;
+	unsigned char seq[8];
+	socklen_t size;
+
+	ctx->ktls_failed = 1; // just one try per connection
+
+	if (gnutls_protocol_get_version(session) != GNUTLS_TLS1_2) {
+		debug_printf("kTLS: only used with TLS 1.2\n");
+		return -1;
+	}
+
+	if (gnutls_record_get_state(session, 1, NULL, &iv, &key, seq) != GNUTLS_E_SUCCESS)
+		return -1;
+
+	memset(&info, 0, sizeof(info));
+
+	// GCM builds the nonce from a 4 byte salt plus the explicit nonce of each record
+	switch (gnutls_cipher_get(session)) {
+	case GNUTLS_CIPHER_AES_128_GCM:
+		if (key.size != sizeof(info.aes128.key) || iv.size < 4)
+			return -1;
+		info.aes128.info.version = TLS_1_2_VERSION;
+		info.aes128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		memcpy(info.aes128.key, key.data, key.size);
+		memcpy(info.aes128.salt, iv.data, sizeof(info.aes128.salt));
+		memcpy(info.aes128.iv, seq, sizeof(info.aes128.iv));
+		memcpy(info.aes128.rec_seq, seq, sizeof(info.aes128.rec_seq));
+		size = sizeof(info.aes128);
+		break;
+	case GNUTLS_CIPHER_AES_256_GCM:
+		if (key.size != sizeof(info.aes256.key) || iv.size < 4)
+			return -1;
+		info.aes256.info.version = TLS_1_2_VERSION;
+		info.aes256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		memcpy(info.aes256.key, key.data, key.size);
+		memcpy(info.aes256.salt, iv.data, sizeof(info.aes256.salt));
+		memcpy(info.aes256.iv, seq, sizeof(info.aes256.iv));
+		memcpy(info.aes256.rec_seq, seq, sizeof(info.aes256.rec_seq));
+		size = sizeof(info.aes256);
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case GNUTLS_CIPHER_CHACHA20_POLY1305:
+		if (key.size != sizeof(info.chacha.key) || iv.size != sizeof(info.chacha.iv))
+			return -1;
+		info.chacha.info.version = TLS_1_2_VERSION;
+		info.chacha.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+		memcpy(info.chacha.key, key.data, key.size);
+		memcpy(info.chacha.iv, iv.data, iv.size);
+		memcpy(info.chacha.rec_seq, seq, sizeof(info.chacha.rec_seq));
+		size = sizeof(info.chacha);
+		break;
+#endif
+	default:
+		debug_printf("kTLS: cipher %s not supported\n", gnutls_cipher_get_name(gnutls_cipher_get(session)));
+		return -1;
+	}
+
+	if (setsockopt(sockfd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == -1) {
+		debug_printf("kTLS: not available (%d)\n", errno);
+		memset(&info, 0, sizeof(info));
+		return -1;
+	}
+
+	if (setsockopt(sockfd, SOL_TLS, TLS_RX, &info, size) == -1) {
+		debug_printf("kTLS: failed to set the receive keys (%d)\n", errno);
+		memset(&info, 0, sizeof(info));
+		return -1;
+	}
+
+	memset(&info, 0, sizeof(info));
+
+	ctx->ktls_rx = 1;
+	debug_printf("kTLS: the kernel decrypts the received records\n");
+
+	wget_thread_mutex_lock(&_stats_mutex);
+	_stats.ktls++;
+	wget_thread_mutex_unlock(&_stats_mutex);
+
+	return 0;
+}
+
+// read application data from a kTLS socket, the other records are handled here
+static ssize_t _ktls_recv(int sockfd, char *buf, size_t count, int timeout)
+{
+	char control[CMSG_SPACE(sizeof(unsigned char))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t nbytes;
+	int rc;
+
+	for (;;) {
+		if ((rc = wget_ready_2_read(sockfd, timeout)) <= 0)
+			return rc;
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = count;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if ((nbytes = recvmsg(sockfd, &msg, 0)) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				continue; // e.g. just a part of a record
+			return -1;
+		}
+
+		if (!(cmsg = CMSG_FIRSTHDR(&msg)) || cmsg->cmsg_level != SOL_TLS || cmsg->cmsg_type != TLS_GET_RECORD_TYPE)
+			return nbytes;
+
+		switch (*(unsigned char *) CMSG_DATA(cmsg)) {
+		case TLS_RECORD_APPLICATION_DATA:
+			return nbytes;
+		case TLS_RECORD_ALERT:
+			if (nbytes >= 2 && buf[1] == 0)
+				return 0; // close_notify
+			error_printf(_("TLS alert %d received\n"), nbytes >= 2 ? (unsigned char) buf[1] : -1);
+			return -1;
+		case TLS_RECORD_HANDSHAKE:
+			// a client may ignore a renegotiation request (HelloRequest) of a TLS 1.2 server
+			debug_printf("kTLS: skipped handshake message %d\n", nbytes >= 1 ? (unsigned char) buf[0] : -1);
+			continue;
+		default:
+			return -1;
+		}
+	}
+}
+#endif // HAVE_KTLS
+
 ssize_t wget_ssl_read_timeout(void *session, char *buf, size_t count, int timeout)
 {
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+
+	if (ctx && ctx->handshake_pending && _finish_deferred_handshake(session, NULL, 0, timeout) < 0)
+		return -1;
+
 #ifdef HAVE_GNUTLS_TRANSPORT_GET_INT
 	// since GnuTLS 3.1.9, avoid warnings about illegal pointer conversion
 	int sockfd = gnutls_transport_get_int(session);
@@ -1506,6 +2745,11 @@ ssize_t wget_ssl_read_timeout(void *session, char *buf, size_t count, int timeou
 	int sockfd = (int)(ptrdiff_t)gnutls_transport_get_ptr(session);
 #endif
 
+#ifdef HAVE_KTLS
+	if (ctx && ctx->ktls_rx)
+		return _ktls_recv(sockfd, buf, count, timeout);
+#endif
+
 // #if GNUTLS_VERSION_NUMBER >= 0x030107
 #if 0
 	// GnuTLS <= 3.4.5 becomes slow with large timeouts (see loop in gnutls_system_recv_timeout()).
@@ -1543,18 +2787,10 @@ ssize_t wget_ssl_read_timeout(void *session, char *buf, size_t count, int timeou
 		nbytes = gnutls_record_recv(session, buf, count);
 
 		// If False Start + Session Resumption are enabled, we get the session data after the first read()
-		struct _session_context *ctx = gnutls_session_get_ptr(session);
 		if (ctx && ctx->delayed_session_data) {
-			gnutls_datum_t session_data;
-
-			if ((rc = gnutls_session_get_data2(session, &session_data)) == GNUTLS_E_SUCCESS) {
-				debug_printf("Got delayed session data\n");
-				ctx->delayed_session_data = 0;
-				wget_tls_session_db_add(_config.tls_session_cache,
-					wget_tls_session_new(ctx->hostname, time(NULL) + 18 * 3600, session_data.data, session_data.size)); // 18h valid
-				gnutls_free(session_data.data);
-			} else
-				debug_printf("No delayed session data%s\n", gnutls_strerror(rc));
+			debug_printf("Got delayed session data\n");
+			ctx->delayed_session_data = 0;
+			_store_session_data(session, ctx);
 		}
 
 		if (nbytes == GNUTLS_E_REHANDSHAKE) {
@@ -1574,6 +2810,11 @@ ssize_t wget_ssl_write_timeout(void *session, const char *buf, size_t count, int
 {
 	ssize_t nbytes;
 	int rc;
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+
+	if (ctx && ctx->handshake_pending && _finish_deferred_handshake(session, NULL, 0, timeout) < 0)
+		return -1;
+
 #ifdef HAVE_GNUTLS_TRANSPORT_GET_INT
 	// since GnuTLS 3.1.9, avoid warnings about illegal pointer conversion
 	int sockfd = gnutls_transport_get_int(session);
@@ -1602,21 +2843,71 @@ ssize_t wget_ssl_write_timeout(void *session, const char *buf, size_t count, int
 	return -1; // never comes here
 }
 
+ssize_t _wget_ssl_write_early_data(void *session, const char *buf, size_t count, int timeout)
+{
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+	ssize_t nbytes;
+
+	if (ctx && ctx->handshake_pending) {
+		if ((nbytes = _finish_deferred_handshake(session, buf, count, timeout)) != 0)
+			return nbytes;
+
+		// early data has been rejected by the server, send it again
+	}
+
+	return wget_ssl_write_timeout(session, buf, count, timeout);
+}
+
+int _wget_ssl_ktls_ready(void *session)
+{
+#ifdef HAVE_KTLS
+	struct _session_context *ctx = gnutls_session_get_ptr(session);
+
+	if (ctx->ktls_rx)
+		return 1;
+
+	if (!_config.ktls || ctx->ktls_failed || ctx->handshake_pending)
+		return WGET_E_UNSUPPORTED;
+
+	// GnuTLS has to hand out what it already decrypted (or is about to store) first
+	if (gnutls_record_check_pending(session) > 0 || ctx->delayed_session_data)
+		return 0;
+
+#ifdef HAVE_GNUTLS_TRANSPORT_GET_INT
+	int sockfd = gnutls_transport_get_int(session);
+#else
+	int sockfd = (int)(ptrdiff_t)gnutls_transport_get_ptr(session);
+#endif
+
+	return _ktls_enable_rx(session, ctx, sockfd) == 0 ? 1 : WGET_E_UNSUPPORTED;
+#else
+	return WGET_E_UNSUPPORTED;
+#endif
+}
+
 #else // WITH_GNUTLS
 
 #include <stddef.h>
+#include <string.h>
 
 #include <wget.h>
 #include "private.h"
+#include "net.h"
 
 void wget_ssl_set_config_string(int key, const char *value) { }
 void wget_ssl_set_config_int(int key, int value) { }
 void wget_ssl_init(void) { }
 void wget_ssl_deinit(void) { }
 int wget_ssl_open(wget_tcp_t *tcp) { return WGET_E_TLS_DISABLED; }
+int _wget_ssl_open_start(wget_tcp_t *tcp) { return WGET_E_TLS_DISABLED; }
+int _wget_ssl_open_continue(wget_tcp_t *tcp) { return WGET_E_TLS_DISABLED; }
+void _wget_ssl_open_cancel(wget_tcp_t *tcp) { }
 void wget_ssl_close(void **session) { }
 ssize_t wget_ssl_read_timeout(void *session, char *buf, size_t count, int timeout) { return 0; }
 ssize_t wget_ssl_write_timeout(void *session, const char *buf, size_t count, int timeout) { return 0; }
+ssize_t _wget_ssl_write_early_data(void *session, const char *buf, size_t count, int timeout) { return 0; }
+int _wget_ssl_ktls_ready(void *session) { return WGET_E_UNSUPPORTED; }
+void wget_ssl_get_stats(wget_ssl_stats_t *stats) { memset(stats, 0, sizeof(*stats)); }
 void wget_ssl_server_init(void) { }
 void wget_ssl_server_deinit(void) { }
 int wget_ssl_server_open(wget_tcp_t *tcp) { return WGET_E_TLS_DISABLED; }
@@ -43,8 +43,12 @@
 struct _wget_tls_session_db_st {
 	wget_hashmap_t *
 		entries;
+	wget_stringmap_t *
+		pending; // hosts with a full handshake in progress, see wget_tls_session_db_claim()
 	wget_thread_mutex_t
 		mutex;
+	wget_thread_cond_t
+		cond; // signalled when a pending handshake has been finished
 	time_t
 		load_time;
 	unsigned char
@@ -62,6 +66,8 @@ struct _wget_tls_session_st {
 		data_size;
 	const char *
 		data; // session resumption data
+	const char *
+		alpn; // ALPN protocol negotiated for the session, NULL if none
 //	unsigned char
 //		include_subdomains : 1; // whether or not subdomains are included
 };
@@ -111,6 +117,7 @@ void wget_tls_session_deinit(wget_tls_session_t *tls_session)
 	if (tls_session) {
 		xfree(tls_session->host);
 		xfree(tls_session->data);
+		xfree(tls_session->alpn);
 	}
 }
 
@@ -134,23 +141,101 @@ wget_tls_session_t *wget_tls_session_new(const char *host, time_t maxage, const
 	return tls_session;
 }
 
+void wget_tls_session_set_alpn(wget_tls_session_t *tls_session, const char *alpn, size_t len)
+{
+	xfree(tls_session->alpn);
+	tls_session->alpn = alpn && len ? wget_strmemdup(alpn, len) : NULL;
+}
+
 int wget_tls_session_get(const wget_tls_session_db_t *tls_session_db, const char *host, void **data, size_t *size)
 {
+	return wget_tls_session_get2(tls_session_db, host, data, size, NULL);
+}
+
+// like wget_tls_session_get(), also returns a copy of the ALPN protocol of the session (NULL if none)
+
+int wget_tls_session_get2(const wget_tls_session_db_t *tls_session_db, const char *host, void **data, size_t *size, char **alpn)
+{
+	int ret = 1;
+
 	if (tls_session_db) {
+		// locking doesn't change the entries, so the database stays const for the caller
+		wget_thread_mutex_t *mutex = (wget_thread_mutex_t *) &tls_session_db->mutex;
 		wget_tls_session_t tls_session, *tls_sessionp;
 		time_t now = time(NULL);
 
 		tls_session.host = host;
+
+		wget_thread_mutex_lock(mutex);
+
 		if ((tls_sessionp = wget_hashmap_get(tls_session_db->entries, &tls_session)) && tls_sessionp->maxage >= now) {
 			if (data)
 				*data = wget_memdup(tls_sessionp->data, tls_sessionp->data_size);
 			if (size)
 				*size = tls_sessionp->data_size;
-			return 0;
+			if (alpn)
+				*alpn = wget_strdup(tls_sessionp->alpn);
+			ret = 0;
 		}
+
+		wget_thread_mutex_unlock(mutex);
 	}
 
-	return 1;
+	return ret;
+}
+
+// Called before a full handshake with 'host', when there is no session data to resume.
+// Concurrent connections to the same host would all need full handshakes, so only the first
+// one does it while the others wait up to 'timeout' milliseconds for its session data.
+// Returns 0 if the caller does the full handshake for all, it has to call wget_tls_session_db_release()
+//   when the handshake failed or no session data will be added.
+// Returns 1 if the pending handshake has been finished, wget_tls_session_get() might find session data now.
+// Returns -1 if the wait timed out, the caller does a full handshake on its own.
+
+int wget_tls_session_db_claim(wget_tls_session_db_t *tls_session_db, const char *host, int timeout)
+{
+	long long end;
+	int ret = 0;
+
+	if (!tls_session_db)
+		return -1;
+
+	wget_thread_mutex_lock(&tls_session_db->mutex);
+
+	if (wget_stringmap_contains(tls_session_db->pending, host)) {
+		end = wget_get_timemillis() + timeout;
+
+		for (ret = -1; timeout > 0; timeout = end - wget_get_timemillis()) {
+			wget_thread_cond_wait(&tls_session_db->cond, &tls_session_db->mutex, timeout);
+
+			if (!wget_stringmap_contains(tls_session_db->pending, host)) {
+				ret = 1;
+				break;
+			}
+		}
+
+		debug_printf("waited for a TLS handshake with %s: %s\n", host, ret == 1 ? "finished" : "timed out");
+	} else
+		wget_stringmap_put(tls_session_db->pending, host, NULL, 0);
+
+	wget_thread_mutex_unlock(&tls_session_db->mutex);
+
+	return ret;
+}
+
+static void _tls_session_db_release(wget_tls_session_db_t *tls_session_db, const char *host)
+{
+	if (wget_stringmap_remove(tls_session_db->pending, host))
+		wget_thread_cond_signal(&tls_session_db->cond);
+}
+
+void wget_tls_session_db_release(wget_tls_session_db_t *tls_session_db, const char *host)
+{
+	if (tls_session_db) {
+		wget_thread_mutex_lock(&tls_session_db->mutex);
+		_tls_session_db_release(tls_session_db, host);
+		wget_thread_mutex_unlock(&tls_session_db->mutex);
+	}
 }
 
 wget_tls_session_db_t *wget_tls_session_db_init(wget_tls_session_db_t *tls_session_db)
@@ -162,7 +247,9 @@ wget_tls_session_db_t *wget_tls_session_db_init(wget_tls_session_db_t *tls_sessi
 	tls_session_db->entries = wget_hashmap_create(16, -2, (wget_hashmap_hash_t)_hash_tls_session, (wget_hashmap_compare_t)_compare_tls_session);
 	wget_hashmap_set_key_destructor(tls_session_db->entries, (wget_hashmap_key_destructor_t)wget_tls_session_free);
 	wget_hashmap_set_value_destructor(tls_session_db->entries, (wget_hashmap_value_destructor_t)wget_tls_session_free);
+	tls_session_db->pending = wget_stringmap_create(16);
 	wget_thread_mutex_init(&tls_session_db->mutex);
+	wget_thread_cond_init(&tls_session_db->cond);
 
 	return tls_session_db;
 }
@@ -172,6 +259,7 @@ void wget_tls_session_db_deinit(wget_tls_session_db_t *tls_session_db)
 	if (tls_session_db) {
 		wget_thread_mutex_lock(&tls_session_db->mutex);
 		wget_hashmap_free(&tls_session_db->entries);
+		wget_stringmap_free(&tls_session_db->pending);
 		wget_thread_mutex_unlock(&tls_session_db->mutex);
 	}
 }
@@ -208,6 +296,9 @@ void wget_tls_session_db_add(wget_tls_session_db_t *tls_session_db, wget_tls_ses
 		wget_hashmap_put_noalloc(tls_session_db->entries, tls_session, tls_session);
 		tls_session_db->changed = 1;
 
+		// wake up the connections waiting for this session
+		_tls_session_db_release(tls_session_db, tls_session->host);
+
 /*
 		if (old) {
 			if (old->mtime < tls_session->mtime) {
@@ -304,6 +395,14 @@ static int _tls_session_db_load(wget_tls_session_db_t *tls_session_db, FILE *fp)
 			ok = 1;
 		}
 
+		// parse ALPN protocol (optional)
+		if (ok && *linep) {
+			for (p = ++linep; *linep && !isspace(*linep); )
+				linep++;
+			if (linep > p)
+				tls_session.alpn = wget_strmemdup(p, linep - p);
+		}
+
 		if (ok) {
 			wget_tls_session_db_add(tls_session_db, wget_memdup(&tls_session, sizeof(tls_session)));
 		} else {
@@ -345,7 +444,10 @@ static int G_GNUC_WGET_NONNULL_ALL _tls_session_save(FILE *fp, const wget_tls_se
 
 	wget_base64_encode(session_b64, (const char *) tls_session->data, tls_session->data_size);
 
-	fprintf(fp, "%s %ld %ld %s\n", tls_session->host, tls_session->maxage, tls_session->mtime, session_b64);
+	if (tls_session->alpn)
+		fprintf(fp, "%s %ld %ld %s %s\n", tls_session->host, tls_session->maxage, tls_session->mtime, session_b64, tls_session->alpn);
+	else
+		fprintf(fp, "%s %ld %ld %s\n", tls_session->host, tls_session->maxage, tls_session->mtime, session_b64);
 	return 0;
 }
 
@@ -356,7 +458,7 @@ static int _tls_session_db_save(void *tls_session_db, FILE *fp)
 	if (wget_hashmap_size(entries) > 0) {
 		fputs("#TLSSession 1.0 file\n", fp);
 		fputs("#Generated by Wget2 " PACKAGE_VERSION ". Edit at your own risk.\n", fp);
-		fputs("#<hostname> <time_t maxage>  <time_t mtime> <session data>\n\n", fp);
+		fputs("#<hostname> <time_t maxage>  <time_t mtime> <session data> [<ALPN protocol>]\n\n", fp);
 
 		wget_hashmap_browse(entries, (wget_hashmap_browse_t)_tls_session_save, fp);
 
@@ -20,6 +20,13 @@
  *
  * IRI blacklist routines
  *
+ * The blacklist is the set of all URLs seen so far. It doesn't keep the parsed IRIs (the jobs own
+ * them), but a 64bit fingerprint of each normalized URL in an open addressing hash table.
+ * By default, the normalized URL is kept as well and compared when two fingerprints match
+ * (exact verification). With --compact-blacklist only the fingerprints are kept, that is about
+ * 16 bytes per URL - at the price of a tiny probability (~ n^2 / 2^65) that a new URL is taken
+ * for a known one.
+ *
  * Changelog
  * 08.11.2012  Tim Ruehsen  created
  *
@@ -31,87 +38,222 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <c-ctype.h>
 
 #include <wget.h>
 
 #include "wget_main.h"
+#include "wget_options.h"
 #include "wget_blacklist.h"
+#include "wget_checkpoint.h"
+
+// normalized URL for the exact verification
+typedef struct {
+	size_t
+		len;
+	char
+		data[];
+} URL_KEY;
 
-static wget_hashmap_t
-	*blacklist;
+static uint64_t
+	*fingerprints; // 0: empty slot
+static URL_KEY
+	**keys; // same index as 'fingerprints', NULL with --compact-blacklist
+static size_t
+	table_size, // power of 2
+	nkeybytes; // memory used by 'keys' entries
+static int
+	nentries,
+	ncollisions; // different URLs with the same fingerprint
 
 static wget_thread_mutex_t
 	mutex = WGET_THREAD_MUTEX_INITIALIZER;
 
-// Paul Larson's hash function from Microsoft Research
-// ~ O(1) insertion, search and removal
-static unsigned int G_GNUC_WGET_NONNULL_ALL hash_iri(const wget_iri_t *iri)
+// append 's' to 'buf', NULL and "" are different, path and query are compared case-insensitive (see wget_iri_compare())
+static void _key_add(wget_buffer_t *buf, const char *s, int lowercase)
 {
-	unsigned int h = 0; // use 0 as SALT if hash table attacks doesn't matter
-	const unsigned char *p;
+	if (s) {
+		size_t len = strlen(s), off = buf->length + 1;
 
-	for (p = (unsigned char *)iri->scheme; p && *p; p++)
-		h = h * 101 + *p;
+		wget_buffer_memcat(buf, "\x02", 1);
+		wget_buffer_memcat(buf, s, len);
 
-	for (p = (unsigned char *)iri->port; p && *p; p++)
-		h = h * 101 + *p;
+		if (lowercase) {
+			for (char *p = buf->data + off; *p; p++)
+				*p = c_tolower(*p);
+		}
+	}
 
-	for (p = (unsigned char *)iri->host; p && *p; p++)
-		h = h * 101 + *p;
+	wget_buffer_memcat(buf, "", 1);
+}
 
-	for (p = (unsigned char *)iri->path; p && *p; p++)
-		h = h * 101 + *p;
+static void _key_init(wget_buffer_t *buf, const wget_iri_t *iri)
+{
+	wget_buffer_reset(buf);
+	_key_add(buf, iri->scheme, 0);
+	_key_add(buf, iri->port, 0);
+	_key_add(buf, iri->host, 0);
+	_key_add(buf, iri->path, 1);
+	_key_add(buf, iri->query, 1);
+}
+
+// FNV-1a with a final avalanche step, so the lower bits can be used as table index
+static uint64_t _fingerprint(const char *data, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (size_t it = 0; it < len; it++) {
+		h ^= (unsigned char) data[it];
+		h *= 0x100000001b3ULL;
+	}
 
-	for (p = (unsigned char *)iri->query; p && *p; p++)
-		h = h * 101 + *p;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
 
-	return h;
+	return h ? h : 1;
 }
 
-static int G_GNUC_WGET_NONNULL_ALL _blacklist_print(G_GNUC_WGET_UNUSED void *ctx, const wget_iri_t *iri)
+static void _table_grow(void)
 {
-	debug_printf("blacklist %s\n", iri->uri);
-	return 0;
+	size_t old_size = table_size;
+	uint64_t *old_fingerprints = fingerprints;
+	URL_KEY **old_keys = keys;
+
+	table_size = table_size ? table_size * 2 : 1024;
+	fingerprints = wget_calloc(table_size, sizeof(uint64_t));
+	keys = config.compact_blacklist ? NULL : wget_calloc(table_size, sizeof(URL_KEY *));
+
+	for (size_t it = 0; it < old_size; it++) {
+		if (old_fingerprints[it]) {
+			size_t pos = old_fingerprints[it] & (table_size - 1);
+
+			while (fingerprints[pos])
+				pos = (pos + 1) & (table_size - 1);
+
+			fingerprints[pos] = old_fingerprints[it];
+			if (keys)
+				keys[pos] = old_keys[it];
+		}
+	}
+
+	xfree(old_fingerprints);
+	xfree(old_keys);
+}
+
+// returns 1 if the URL in 'buf' has been added, 0 if it is already known, called with mutex locked
+// 'buf' may be NULL to add just the fingerprint 'fp' (when resuming from a compact checkpoint)
+static int _table_add_fingerprint(const wget_buffer_t *buf, uint64_t fp)
+{
+	size_t pos;
+
+	// keep the load factor below 3/4
+	if ((size_t) nentries * 4 >= table_size * 3)
+		_table_grow();
+
+	for (pos = fp & (table_size - 1); fingerprints[pos]; pos = (pos + 1) & (table_size - 1)) {
+		if (fingerprints[pos] == fp) {
+			// entries without key can't be verified
+			if (!keys || !keys[pos] || !buf)
+				return 0;
+
+			if (keys[pos]->len == buf->length && !memcmp(keys[pos]->data, buf->data, buf->length))
+				return 0;
+
+			ncollisions++;
+		}
+	}
+
+	fingerprints[pos] = fp;
+
+	if (keys && buf) {
+		keys[pos] = wget_malloc(sizeof(URL_KEY) + buf->length);
+		keys[pos]->len = buf->length;
+		memcpy(keys[pos]->data, buf->data, buf->length);
+		nkeybytes += sizeof(URL_KEY) + buf->length;
+	}
+
+	nentries++;
+
+	return 1;
+}
+
+static int _table_add(const wget_buffer_t *buf)
+{
+	return _table_add_fingerprint(buf, _fingerprint(buf->data, buf->length));
 }
 
 void blacklist_print(void)
 {
+	wget_buffer_t buf;
+	char sbuf[1024];
+
+	wget_buffer_init(&buf, sbuf, sizeof(sbuf));
+
 	wget_thread_mutex_lock(&mutex);
-	wget_hashmap_browse(blacklist, (wget_hashmap_browse_t)_blacklist_print, NULL);
+
+	for (size_t it = 0; keys && it < table_size; it++) {
+		const char *field[5], *p;
+		int n;
+
+		if (!keys[it])
+			continue;
+
+		// split the key into scheme, port, host, path and query
+		for (n = 0, p = keys[it]->data; n < 5; n++, p += strlen(p) + 1)
+			field[n] = *p ? p + 1 : NULL;
+
+		wget_buffer_printf(&buf, "%s://%s", field[0], field[2]);
+		if (field[1])
+			wget_buffer_printf_append(&buf, ":%s", field[1]);
+		wget_buffer_printf_append(&buf, "/%s", field[3] ? field[3] : "");
+		if (field[4])
+			wget_buffer_printf_append(&buf, "?%s", field[4]);
+
+		debug_printf("blacklist %s\n", buf.data);
+	}
+
+	debug_printf("blacklist: %d URLs, %d fingerprint collisions, %zu bytes\n",
+		nentries, ncollisions, table_size * (sizeof(uint64_t) + (keys ? sizeof(URL_KEY *) : 0)) + nkeybytes);
+
 	wget_thread_mutex_unlock(&mutex);
+
+	wget_buffer_deinit(&buf);
 }
 
 int blacklist_size(void)
 {
-	return wget_hashmap_size(blacklist);
-}
-
-static void _free_entry(wget_iri_t *iri)
-{
-	wget_iri_free(&iri);
+	return nentries;
 }
 
+// Returns 'iri' if it has not been seen before, the caller is responsible to free it.
+// Else 'iri' is freed and NULL is returned.
 wget_iri_t *blacklist_add(wget_iri_t *iri)
 {
 	if (!iri)
 		return NULL;
 
 	if (wget_iri_supported(iri)) {
+		wget_buffer_t buf;
+		char sbuf[1024];
+		int added;
+
+		wget_buffer_init(&buf, sbuf, sizeof(sbuf));
+		_key_init(&buf, iri);
+
 		wget_thread_mutex_lock(&mutex);
+		added = _table_add(&buf);
+		wget_thread_mutex_unlock(&mutex);
 
-		if (!blacklist) {
-			blacklist = wget_hashmap_create(128, -2, (wget_hashmap_hash_t)hash_iri, (wget_hashmap_compare_t)wget_iri_compare);
-			wget_hashmap_set_key_destructor(blacklist, (wget_hashmap_key_destructor_t)_free_entry);
-		}
+		wget_buffer_deinit(&buf);
 
-		if (!wget_hashmap_contains(blacklist, iri)) {
+		if (added) {
 			// info_printf("Add to blacklist: %s\n",iri->uri);
-			wget_hashmap_put_noalloc(blacklist, iri, NULL); // use hashmap as a hashset (without value)
-			wget_thread_mutex_unlock(&mutex);
 			return iri;
 		}
-
-		wget_thread_mutex_unlock(&mutex);
 	}
 
 	wget_iri_free(&iri);
@@ -119,9 +261,77 @@ wget_iri_t *blacklist_add(wget_iri_t *iri)
 	return NULL;
 }
 
+// write all fingerprints, with the normalized URLs if we have them
+int blacklist_save(CHECKPOINT *cp)
+{
+	wget_thread_mutex_lock(&mutex);
+
+	checkpoint_write_uint(cp, nentries);
+	checkpoint_write_uint(cp, !!keys);
+
+	for (size_t it = 0; it < table_size; it++) {
+		if (fingerprints[it]) {
+			checkpoint_write_uint(cp, fingerprints[it]);
+			if (keys)
+				checkpoint_write_data(cp, keys[it] ? keys[it]->data : "", keys[it] ? keys[it]->len : 0);
+		}
+	}
+
+	wget_thread_mutex_unlock(&mutex);
+
+	return cp->error ? -1 : 0;
+}
+
+// URLs are added to the current blacklist, keys are dropped with --compact-blacklist
+int blacklist_load(CHECKPOINT *cp)
+{
+	uint64_t n = checkpoint_read_uint(cp);
+	int with_keys = (int) checkpoint_read_uint(cp);
+	wget_buffer_t buf = { .length = 0 };
+
+	wget_thread_mutex_lock(&mutex);
+
+	for (; n && !cp->error; n--) {
+		uint64_t fp = checkpoint_read_uint(cp);
+
+		if (with_keys) {
+			size_t len;
+			char *key;
+
+			if (!(key = checkpoint_read_data(cp, &len)))
+				break;
+
+			if (fp && len) {
+				buf.data = key;
+				buf.length = len;
+				_table_add_fingerprint(&buf, fp);
+			} else if (fp)
+				_table_add_fingerprint(NULL, fp);
+
+			xfree(key);
+		} else if (fp)
+			_table_add_fingerprint(NULL, fp);
+	}
+
+	wget_thread_mutex_unlock(&mutex);
+
+	if (!with_keys && !config.compact_blacklist)
+		info_printf(_("Checkpoint has URL fingerprints only, known URLs are not verified\n"));
+
+	return cp->error ? -1 : 0;
+}
+
 void blacklist_free(void)
 {
 	wget_thread_mutex_lock(&mutex);
-	wget_hashmap_free(&blacklist);
+
+	for (size_t it = 0; keys && it < table_size; it++)
+		xfree(keys[it]);
+
+	xfree(keys);
+	xfree(fingerprints);
+	table_size = nkeybytes = 0;
+	nentries = ncollisions = 0;
+
 	wget_thread_mutex_unlock(&mutex);
 }
@@ -0,0 +1,229 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Crawl checkpoints (--checkpoint-file, --resume-crawl)
+ *
+ * A checkpoint is a compact binary file with the state of a recursive download: the URL blacklist,
+ * the queued jobs and robots.txt rules of each host and some bookkeeping of the main module.
+ * Each module writes and reads its own part with the primitives below: unsigned integers as
+ * LEB128 varints, data and strings prefixed by their length.
+ *
+ * The file is written to a temporary file, synced to disk and renamed, so a crash while writing
+ * leaves the previous checkpoint intact. A trailing end marker detects truncated files.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <wget.h>
+
+#include "wget_main.h"
+#include "wget_checkpoint.h"
+
+#define CHECKPOINT_MAGIC "wget2 checkpoint\n"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_END 0x454e44 // "END"
+
+// no string or data block in a checkpoint is that large
+#define CHECKPOINT_DATA_MAX (1 << 30)
+
+struct checkpoint_context {
+	checkpoint_func_t
+		func;
+	void
+		*ctx;
+};
+
+static int _checkpoint_save(void *context, FILE *fp)
+{
+	struct checkpoint_context *ctx = context;
+	CHECKPOINT cp = { .fp = fp };
+
+	fputs(CHECKPOINT_MAGIC, fp);
+	checkpoint_write_uint(&cp, CHECKPOINT_VERSION);
+
+	if (ctx->func(&cp, ctx->ctx))
+		return -1;
+
+	checkpoint_write_uint(&cp, CHECKPOINT_END);
+
+	// make sure the data is on disk before the file replaces the former checkpoint
+	if (fflush(fp) || fsync(fileno(fp)))
+		cp.error = 1;
+
+	if (cp.error) {
+		error_printf(_("Failed to write checkpoint (%d)\n"), errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+int checkpoint_save(const char *fname, checkpoint_func_t save_func, void *ctx)
+{
+	struct checkpoint_context context = { .func = save_func, .ctx = ctx };
+
+	return wget_update_file(fname, NULL, _checkpoint_save, &context);
+}
+
+int checkpoint_load(const char *fname, checkpoint_func_t load_func, void *ctx)
+{
+	CHECKPOINT cp;
+	char magic[sizeof(CHECKPOINT_MAGIC) - 1];
+	int rc = -1;
+
+	if (!(cp.fp = fopen(fname, "rb"))) {
+		error_printf(_("Failed to open checkpoint '%s' (%d)\n"), fname, errno);
+		return -1;
+	}
+
+	cp.error = 0;
+
+	if (fread(magic, 1, sizeof(magic), cp.fp) != sizeof(magic) || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic))) {
+		error_printf(_("'%s' is not a checkpoint file\n"), fname);
+	} else if (checkpoint_read_uint(&cp) != CHECKPOINT_VERSION) {
+		error_printf(_("Unsupported version of checkpoint '%s'\n"), fname);
+	} else if (!load_func(&cp, ctx) && checkpoint_read_uint(&cp) == CHECKPOINT_END && !cp.error) {
+		rc = 0;
+	} else
+		error_printf(_("Failed to load checkpoint '%s'\n"), fname);
+
+	fclose(cp.fp);
+
+	return rc;
+}
+
+void checkpoint_write_uint(CHECKPOINT *cp, uint64_t value)
+{
+	if (cp->error)
+		return;
+
+	do {
+		int c = value & 0x7f;
+
+		if ((value >>= 7))
+			c |= 0x80;
+
+		if (putc(c, cp->fp) == EOF) {
+			cp->error = 1;
+			return;
+		}
+	} while (value);
+}
+
+void checkpoint_write_data(CHECKPOINT *cp, const void *data, size_t len)
+{
+	checkpoint_write_uint(cp, len);
+
+	if (!cp->error && len && fwrite(data, 1, len, cp->fp) != len)
+		cp->error = 1;
+}
+
+// NULL and "" are different
+void checkpoint_write_string(CHECKPOINT *cp, const char *s)
+{
+	if (s) {
+		size_t len = strlen(s);
+
+		checkpoint_write_uint(cp, len + 1);
+
+		if (!cp->error && len && fwrite(s, 1, len, cp->fp) != len)
+			cp->error = 1;
+	} else
+		checkpoint_write_uint(cp, 0);
+}
+
+uint64_t checkpoint_read_uint(CHECKPOINT *cp)
+{
+	uint64_t value = 0;
+
+	for (int shift = 0; !cp->error; shift += 7) {
+		int c = getc(cp->fp);
+
+		if (c == EOF || shift > 63) {
+			cp->error = 1;
+			break;
+		}
+
+		value |= (uint64_t) (c & 0x7f) << shift;
+
+		if (!(c & 0x80))
+			return value;
+	}
+
+	return 0;
+}
+
+// returns allocated data with a trailing 0 byte, NULL on error
+void *checkpoint_read_data(CHECKPOINT *cp, size_t *len)
+{
+	uint64_t n = checkpoint_read_uint(cp);
+	char *data;
+
+	if (cp->error || n > CHECKPOINT_DATA_MAX) {
+		cp->error = 1;
+		return NULL;
+	}
+
+	data = wget_malloc(n + 1);
+
+	if (n && fread(data, 1, n, cp->fp) != n) {
+		cp->error = 1;
+		xfree(data);
+		return NULL;
+	}
+
+	data[n] = 0;
+	*len = n;
+
+	return data;
+}
+
+char *checkpoint_read_string(CHECKPOINT *cp)
+{
+	uint64_t n = checkpoint_read_uint(cp);
+	char *s;
+
+	if (cp->error || !n)
+		return NULL;
+
+	if (n - 1 > CHECKPOINT_DATA_MAX) {
+		cp->error = 1;
+		return NULL;
+	}
+
+	s = wget_malloc(n);
+
+	if (n > 1 && fread(s, 1, n - 1, cp->fp) != n - 1) {
+		cp->error = 1;
+		xfree(s);
+		return NULL;
+	}
+
+	s[n - 1] = 0;
+
+	return s;
+}
@@ -0,0 +1,657 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Event driven download engine (--engine=event)
+ *
+ * A few event loop threads run many downloaders as user-space tasks (one stack each).
+ * libwget does all of its waiting for sockets (connect, TLS handshake, HTTP/1.1 and HTTP/2 I/O)
+ * in wget_ready_2_transfer(). We hook into that function: when called from a task, the socket
+ * is registered with the loop's epoll instance and the task switches back to the loop, which
+ * runs other tasks until the socket is ready or the timeout expired.
+ *
+ * This way the downloader code, the JOB/HOST queue and the body callbacks stay the same for
+ * both engines, while thousands of connections only need a handful of threads.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <wget.h>
+
+#include "wget_main.h"
+#include "wget_log.h"
+#include "wget_event.h"
+
+#if defined HAVE_SYS_EPOLL_H && defined HAVE_SYS_EVENTFD_H && defined HAVE_UCONTEXT_H && defined USE_POSIX_THREADS
+# define EVENT_ENGINE 1
+# include <pthread.h>
+# include <poll.h>
+# include <stdint.h>
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+# include <ucontext.h>
+#endif
+
+#ifdef EVENT_ENGINE
+
+// stack size of a task, only the pages really touched consume memory
+#define TASK_STACK_SIZE (512 * 1024)
+
+typedef struct EVENT_LOOP EVENT_LOOP;
+
+enum {
+	TASK_READY, // in the run queue or in the wakeup list
+	TASK_RUNNING,
+	TASK_WAIT_IO, // waiting for a file descriptor and/or a timeout
+	TASK_PARKED // waiting for event_task_wakeup() and/or a timeout
+};
+
+struct EVENT_TASK {
+	ucontext_t
+		ctx;
+	EVENT_LOOP
+		*loop;
+	EVENT_TASK
+		*next, // within the run queue or the wakeup list
+		*timer_prev, // within the list of tasks with a deadline
+		*timer_next;
+	void
+		*(*func)(void *),
+		*arg;
+	char
+		*stack;
+	long long
+		deadline; // 0 if the task is not in the timer list
+	int
+		fd, // file descriptor waited for, -1 if none
+		revents, // requested I/O flags while waiting, ready I/O flags afterwards
+		state;
+	char
+		wakeup, // event_task_wakeup() has been called while the task was not parked
+		done;
+};
+
+struct EVENT_LOOP {
+	ucontext_t
+		ctx;
+	wget_thread_t
+		tid;
+	wget_thread_mutex_t
+		mutex; // protects 'wakeups', 'ntasks', 'stop' and the parking state of the tasks
+	EVENT_TASK
+		*current, // task that is running right now
+		*runq,
+		*runq_tail,
+		*wakeups, // tasks made ready by other threads, moved into 'runq' by the loop thread
+		*wakeups_tail,
+		*timers; // tasks with a deadline
+	long long
+		next_deadline; // earliest deadline (might be too early after a task has been removed)
+	int
+		epfd,
+		evfd, // eventfd to wake up epoll_wait()
+		ntasks;
+	char
+		stop;
+};
+
+static EVENT_LOOP
+	*loops;
+static pthread_key_t
+	loop_key;
+static size_t
+	pagesize;
+static int
+	nloops,
+	next_loop;
+
+static void _runq_push(EVENT_LOOP *loop, EVENT_TASK *task)
+{
+	task->state = TASK_READY;
+	task->next = NULL;
+
+	if (loop->runq_tail)
+		loop->runq_tail->next = task;
+	else
+		loop->runq = task;
+
+	loop->runq_tail = task;
+}
+
+// must be called with loop->mutex locked
+static void _wakeups_push(EVENT_LOOP *loop, EVENT_TASK *task)
+{
+	task->state = TASK_READY;
+	task->next = NULL;
+
+	if (loop->wakeups_tail)
+		loop->wakeups_tail->next = task;
+	else
+		loop->wakeups = task;
+
+	loop->wakeups_tail = task;
+}
+
+static void _notify(EVENT_LOOP *loop)
+{
+	uint64_t one = 1;
+
+	if (write(loop->evfd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+		error_printf(_("Failed to wake up event loop (%d)\n"), errno);
+}
+
+static void _timer_add(EVENT_LOOP *loop, EVENT_TASK *task, long long deadline)
+{
+	task->deadline = deadline;
+	task->timer_prev = NULL;
+
+	if ((task->timer_next = loop->timers))
+		loop->timers->timer_prev = task;
+
+	loop->timers = task;
+
+	if (!loop->next_deadline || deadline < loop->next_deadline)
+		loop->next_deadline = deadline;
+}
+
+static void _timer_remove(EVENT_LOOP *loop, EVENT_TASK *task)
+{
+	if (!task->deadline)
+		return;
+
+	if (task->timer_prev)
+		task->timer_prev->timer_next = task->timer_next;
+	else
+		loop->timers = task->timer_next;
+
+	if (task->timer_next)
+		task->timer_next->timer_prev = task->timer_prev;
+
+	task->deadline = 0;
+}
+
+static void _expire_timers(EVENT_LOOP *loop)
+{
+	long long now = wget_get_timemillis();
+	EVENT_TASK *task, *next;
+
+	if (!loop->next_deadline || now < loop->next_deadline)
+		return;
+
+	// scanning is only needed when the earliest deadline has been reached
+	loop->next_deadline = 0;
+
+	for (task = loop->timers; task; task = next) {
+		next = task->timer_next;
+
+		if (task->deadline <= now) {
+			if (task->state == TASK_WAIT_IO) {
+				if (task->fd >= 0)
+					epoll_ctl(loop->epfd, EPOLL_CTL_DEL, task->fd, NULL); // avoid a late event for this task
+
+				task->revents = 0; // timeout
+				_timer_remove(loop, task);
+				_runq_push(loop, task);
+				continue;
+			}
+
+			if (task->state == TASK_PARKED) {
+				wget_thread_mutex_lock(&loop->mutex);
+				if (task->state == TASK_PARKED) {
+					_timer_remove(loop, task);
+					_runq_push(loop, task);
+				}
+				wget_thread_mutex_unlock(&loop->mutex);
+
+				if (!task->deadline)
+					continue;
+			}
+		}
+
+		if (!loop->next_deadline || task->deadline < loop->next_deadline)
+			loop->next_deadline = task->deadline;
+	}
+}
+
+static void _take_wakeups(EVENT_LOOP *loop)
+{
+	EVENT_TASK *task, *next;
+
+	wget_thread_mutex_lock(&loop->mutex);
+	task = loop->wakeups;
+	loop->wakeups = loop->wakeups_tail = NULL;
+	wget_thread_mutex_unlock(&loop->mutex);
+
+	for (; task; task = next) {
+		next = task->next;
+		_timer_remove(loop, task);
+		_runq_push(loop, task);
+	}
+}
+
+// switch from the current task back to its loop, returns when the loop resumes the task
+static void _task_suspend(EVENT_LOOP *loop, EVENT_TASK *task)
+{
+	int err = errno; // errno is per thread, not per task
+
+	swapcontext(&task->ctx, &loop->ctx);
+
+	errno = err;
+}
+
+static void _task_start(void)
+{
+	EVENT_LOOP *loop = pthread_getspecific(loop_key);
+	EVENT_TASK *task = loop->current;
+
+	task->func(task->arg);
+	task->done = 1;
+
+	// returning resumes the loop via uc_link
+}
+
+static void _task_free(EVENT_LOOP *loop, EVENT_TASK *task)
+{
+	_timer_remove(loop, task);
+	munmap(task->stack, TASK_STACK_SIZE);
+	xfree(task);
+
+	wget_thread_mutex_lock(&loop->mutex);
+	loop->ntasks--;
+	wget_thread_mutex_unlock(&loop->mutex);
+}
+
+static void *_loop_thread(void *p)
+{
+	EVENT_LOOP *loop = p;
+	struct epoll_event events[64];
+	EVENT_TASK *task;
+	int n, timeout, stop;
+
+	pthread_setspecific(loop_key, loop);
+
+	for (;;) {
+		while ((task = loop->runq)) {
+			if (!(loop->runq = task->next))
+				loop->runq_tail = NULL;
+
+			task->state = TASK_RUNNING;
+			loop->current = task;
+			swapcontext(&loop->ctx, &task->ctx);
+			loop->current = NULL;
+
+			if (task->done)
+				_task_free(loop, task);
+		}
+
+		wget_thread_mutex_lock(&loop->mutex);
+		stop = loop->stop && !loop->ntasks;
+		wget_thread_mutex_unlock(&loop->mutex);
+
+		if (stop)
+			break;
+
+		if (loop->next_deadline) {
+			long long ms = loop->next_deadline - wget_get_timemillis();
+
+			timeout = ms <= 0 ? 0 : (ms > INT_MAX ? INT_MAX : (int) ms);
+		} else
+			timeout = -1;
+
+		if ((n = epoll_wait(loop->epfd, events, countof(events), timeout)) < 0) {
+			if (errno != EINTR)
+				error_printf(_("Failed to wait for events (%d)\n"), errno);
+			n = 0;
+		}
+
+		for (int it = 0; it < n; it++) {
+			if (!(task = events[it].data.ptr)) {
+				uint64_t value;
+
+				if (read(loop->evfd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+					error_printf(_("Failed to read from eventfd (%d)\n"), errno);
+
+				_take_wakeups(loop);
+				continue;
+			}
+
+			if (task->state != TASK_WAIT_IO)
+				continue; // late event after a timeout
+
+			int flags = 0;
+
+			if (events[it].events & (EPOLLERR | EPOLLHUP))
+				flags = task->revents; // let the caller see the error on read/write
+			if (events[it].events & EPOLLIN)
+				flags |= WGET_IO_READABLE;
+			if (events[it].events & EPOLLOUT)
+				flags |= WGET_IO_WRITABLE;
+
+			task->revents = flags;
+			_timer_remove(loop, task);
+			_runq_push(loop, task);
+		}
+
+		_expire_timers(loop);
+	}
+
+	return NULL;
+}
+
+static int _poll(int fd, int timeout, short mode)
+{
+	struct pollfd pollfd = { .fd = fd };
+	int rc;
+
+	if (mode & WGET_IO_READABLE)
+		pollfd.events |= POLLIN;
+	if (mode & WGET_IO_WRITABLE)
+		pollfd.events |= POLLOUT;
+
+	if ((rc = poll(&pollfd, 1, timeout)) > 0) {
+		rc = 0;
+		if (pollfd.revents & POLLIN)
+			rc |= WGET_IO_READABLE;
+		if (pollfd.revents & POLLOUT)
+			rc |= WGET_IO_WRITABLE;
+	}
+
+	return rc;
+}
+
+// replacement for the waiting in wget_ready_2_transfer()
+static int _ready_2_transfer(int fd, int timeout, short mode)
+{
+	EVENT_LOOP *loop = pthread_getspecific(loop_key);
+	EVENT_TASK *task = loop ? loop->current : NULL;
+
+	if (!task)
+		return _poll(fd, timeout, mode); // not called from a task, e.g. from the main thread
+
+	struct epoll_event ev = { .events = EPOLLONESHOT, .data.ptr = task };
+
+	if (mode & WGET_IO_READABLE)
+		ev.events |= EPOLLIN;
+	if (mode & WGET_IO_WRITABLE)
+		ev.events |= EPOLLOUT;
+
+	// the socket might still be registered from an earlier wait
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) && (errno != ENOENT || epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev)))
+		return _poll(fd, timeout, mode); // e.g. epoll doesn't support regular files
+
+	task->fd = fd;
+	task->revents = mode & (WGET_IO_READABLE | WGET_IO_WRITABLE);
+	task->state = TASK_WAIT_IO;
+
+	if (timeout > 0)
+		_timer_add(loop, task, wget_get_timemillis() + timeout);
+
+	_task_suspend(loop, task);
+
+	task->fd = -1;
+
+	return task->revents;
+}
+
+int event_init(int n)
+{
+	if (n <= 0 && (n = (int) sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+		n = 1;
+
+	if (pthread_key_create(&loop_key, NULL))
+		return -1;
+
+	pagesize = (size_t) sysconf(_SC_PAGESIZE);
+	loops = wget_calloc(n, sizeof(EVENT_LOOP));
+
+	for (nloops = 0; nloops < n; nloops++) {
+		EVENT_LOOP *loop = &loops[nloops];
+		int rc;
+
+		if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			error_printf(_("Failed to create epoll instance (%d)\n"), errno);
+			break;
+		}
+
+		if ((loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+			error_printf(_("Failed to create eventfd (%d)\n"), errno);
+			close(loop->epfd);
+			break;
+		}
+
+		// eventfd gets a NULL pointer to be distinguishable from tasks
+		epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->evfd, &(struct epoll_event) { .events = EPOLLIN, .data.ptr = NULL });
+
+		wget_thread_mutex_init(&loop->mutex);
+
+		if ((rc = wget_thread_start(&loop->tid, _loop_thread, loop, 0)) != 0) {
+			error_printf(_("Failed to start event loop, error %d\n"), rc);
+			close(loop->evfd);
+			close(loop->epfd);
+			break;
+		}
+	}
+
+	if (!nloops) {
+		xfree(loops);
+		pthread_key_delete(loop_key);
+		return -1;
+	}
+
+	debug_printf("started %d event loops\n", nloops);
+
+	wget_ready_2_transfer_set_func(_ready_2_transfer);
+
+	return 0;
+}
+
+void event_deinit(void)
+{
+	for (int it = 0; it < nloops; it++) {
+		EVENT_LOOP *loop = &loops[it];
+
+		wget_thread_mutex_lock(&loop->mutex);
+		loop->stop = 1;
+		wget_thread_mutex_unlock(&loop->mutex);
+		_notify(loop);
+	}
+
+	for (int it = 0; it < nloops; it++) {
+		EVENT_LOOP *loop = &loops[it];
+		int rc;
+
+		if ((rc = wget_thread_join(loop->tid)) != 0)
+			error_printf(_("Failed to wait for event loop #%d (%d)\n"), it, rc);
+
+		close(loop->evfd);
+		close(loop->epfd);
+	}
+
+	if (nloops) {
+		wget_ready_2_transfer_set_func(NULL);
+		pthread_key_delete(loop_key);
+		xfree(loops);
+		nloops = 0;
+	}
+}
+
+// start 'func(arg)' as a new task, the loops are used round-robin
+int event_spawn(void *(*func)(void *), void *arg)
+{
+	EVENT_LOOP *loop;
+	EVENT_TASK *task;
+
+	if (!nloops)
+		return -1;
+
+	loop = &loops[next_loop++ % nloops];
+
+	task = wget_calloc(1, sizeof(EVENT_TASK));
+	task->loop = loop;
+	task->func = func;
+	task->arg = arg;
+	task->fd = -1;
+
+	task->stack = mmap(NULL, TASK_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (task->stack == MAP_FAILED) {
+		error_printf(_("Failed to allocate task stack (%d)\n"), errno);
+		xfree(task);
+		return -1;
+	}
+
+	// guard page to catch stack overflows (the stack grows downwards)
+	mprotect(task->stack, pagesize, PROT_NONE);
+
+	getcontext(&task->ctx);
+	task->ctx.uc_stack.ss_sp = task->stack;
+	task->ctx.uc_stack.ss_size = TASK_STACK_SIZE;
+	task->ctx.uc_link = &loop->ctx;
+	makecontext(&task->ctx, _task_start, 0);
+
+	wget_thread_mutex_lock(&loop->mutex);
+	loop->ntasks++;
+	_wakeups_push(loop, task);
+	wget_thread_mutex_unlock(&loop->mutex);
+
+	_notify(loop);
+
+	return 0;
+}
+
+EVENT_TASK *event_task_self(void)
+{
+	EVENT_LOOP *loop;
+
+	if (!nloops || !(loop = pthread_getspecific(loop_key)))
+		return NULL;
+
+	return loop->current;
+}
+
+// park the current task until event_task_wakeup() is called or 'ms' milliseconds passed (ms <= 0: infinite)
+void event_task_wait(long long ms)
+{
+	EVENT_TASK *task = event_task_self();
+	EVENT_LOOP *loop;
+
+	if (!task)
+		return;
+
+	loop = task->loop;
+
+	wget_thread_mutex_lock(&loop->mutex);
+	if (task->wakeup) {
+		task->wakeup = 0;
+		wget_thread_mutex_unlock(&loop->mutex);
+		return;
+	}
+	task->state = TASK_PARKED;
+	wget_thread_mutex_unlock(&loop->mutex);
+
+	// only the loop thread (that's us) touches the timers, so it's safe to do that unlocked
+	if (ms > 0)
+		_timer_add(loop, task, wget_get_timemillis() + ms);
+
+	_task_suspend(loop, task);
+
+	wget_thread_mutex_lock(&loop->mutex);
+	task->wakeup = 0;
+	wget_thread_mutex_unlock(&loop->mutex);
+}
+
+// may be called from any thread
+void event_task_wakeup(EVENT_TASK *task)
+{
+	EVENT_LOOP *loop = task->loop;
+	int notify = 0;
+
+	wget_thread_mutex_lock(&loop->mutex);
+	if (task->state == TASK_PARKED) {
+		_wakeups_push(loop, task);
+		notify = 1;
+	} else
+		task->wakeup = 1;
+	wget_thread_mutex_unlock(&loop->mutex);
+
+	if (notify)
+		_notify(loop);
+}
+
+void event_millisleep(int ms)
+{
+	EVENT_TASK *task = event_task_self();
+
+	if (!task) {
+		wget_millisleep(ms);
+		return;
+	}
+
+	if (ms <= 0)
+		return;
+
+	task->fd = -1;
+	task->state = TASK_WAIT_IO;
+	_timer_add(task->loop, task, wget_get_timemillis() + ms);
+	_task_suspend(task->loop, task);
+}
+
+#else // EVENT_ENGINE
+
+int event_init(int n G_GNUC_WGET_UNUSED)
+{
+	return -1;
+}
+
+void event_deinit(void)
+{
+}
+
+int event_spawn(void *(*func)(void *) G_GNUC_WGET_UNUSED, void *arg G_GNUC_WGET_UNUSED)
+{
+	return -1;
+}
+
+EVENT_TASK *event_task_self(void)
+{
+	return NULL;
+}
+
+void event_task_wait(long long ms G_GNUC_WGET_UNUSED)
+{
+}
+
+void event_task_wakeup(EVENT_TASK *task G_GNUC_WGET_UNUSED)
+{
+}
+
+void event_millisleep(int ms)
+{
+	wget_millisleep(ms);
+}
+
+#endif // EVENT_ENGINE
@@ -29,7 +29,10 @@
 # include <config.h>
 #endif
 
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include <wget.h>
 
@@ -37,13 +40,57 @@
 #include "wget_host.h"
 #include "wget_options.h"
 #include "wget_job.h"
+#include "wget_checkpoint.h"
 
 static wget_hashmap_t
 	*hosts;
+static wget_list_t
+	*ready_hosts, // hosts (HOST *) that have a job to hand out right now and no downloader working on them
+	*busy_hosts; // hosts (HOST *) that have a job to hand out right now, but already have downloaders attached
+static HOST
+	**retry_heap; // min-heap of hosts waiting for 'retry_ts', element 0 is unused
 static wget_thread_mutex_t
 	hosts_mutex = WGET_THREAD_MUTEX_INITIALIZER;
 static int
-	qsize; // overall number of jobs
+	qsize, // overall number of jobs
+	nmemjobs, // number of queued jobs kept in memory (w/o robots.txt jobs)
+	retry_heap_size,
+	retry_heap_alloc,
+	spill_fd = -1; // file descriptor of the spill file, -1 if not yet opened
+static off_t
+	spill_size, // current size of the spill file
+	spill_live; // bytes of the segments in the spill file that have not been read back yet
+
+// job records within the spill file
+typedef struct {
+	off_t
+		offset;
+	size_t
+		size;
+	int
+		njobs;
+} SPILL_SEGMENT;
+
+// fixed part of a spilled job, followed by the URL, Referer and local filename (each 0-terminated)
+typedef struct {
+	int
+		level,
+		redirection_level;
+	unsigned char
+		flags;
+} SPILL_RECORD;
+
+#define SPILL_SITEMAP           (1<<0)
+#define SPILL_HEAD_FIRST        (1<<1)
+#define SPILL_REQUESTED_BY_USER (1<<2)
+#define SPILL_REFERER           (1<<3)
+#define SPILL_LOCAL_FILENAME    (1<<4)
+
+// spilled jobs are buffered per host and written as one segment when this size is reached
+#define SPILL_SEGMENT_SIZE 8192
+
+// the spill file is compacted when at least that many bytes have been read back and are unused now
+#define SPILL_COMPACT_MIN (1 << 20)
 
 static int _host_compare(const HOST *host1, const HOST *host2)
 {
@@ -89,6 +136,8 @@ static void _free_host_entry(HOST *host)
 	if (host) {
 		host_queue_free(host);
 		wget_robots_free(&host->robots);
+		xfree(host->host);
+		xfree(host->port);
 		wget_xfree(host);
 	}
 }
@@ -107,11 +156,19 @@ HOST *host_add(wget_iri_t *iri)
 	if (!wget_hashmap_contains(hosts, &host)) {
 		// info_printf("Add to hosts: %s\n", hostname);
 		hostp = wget_memdup(&host, sizeof(host));
+		// the IRI belongs to a job and goes away with it
+		hostp->host = wget_strdup(iri->host);
+		hostp->port = wget_strdup(iri->resolv_port);
+		hostp->max_workers = config.max_host_connections ? 1 : 0;
 		wget_hashmap_put_noalloc(hosts, hostp, hostp);
 	}
 
 	wget_thread_mutex_unlock(&hosts_mutex);
 
+	// the address will likely be needed soon, resolve it while the downloaders are busy
+	if (hostp && config.dns_prefetch)
+		wget_dns_prefetch(iri->host, iri->resolv_port);
+
 	return hostp;
 }
 
@@ -132,152 +189,922 @@ HOST *host_get(wget_iri_t *iri)
 	return hostp;
 }
 
-struct _find_free_job_context {
-	JOB *job;
-	long long now;
-	long long pause;
-};
+/*
+ * Scheduler structures (all protected by hosts_mutex)
+ *
+ * A host is either
+ * - in 'ready_hosts' if it has a job to hand out right now and no downloader is attached to it,
+ * - in 'busy_hosts' if it has a job to hand out right now and downloaders are already attached,
+ * - in 'retry_heap' if it has to wait until 'retry_ts' has been reached (backoff after errors or --wait),
+ * - or in none of both (blocked, nothing to do or robots.txt still in progress).
+ *
+ * Each host keeps its ready jobs in 'host->ready' and the jobs being worked on in 'host->inflight'.
+ * That makes dequeuing a job O(1) (or O(log n) when a host wakes up from the retry heap),
+ * independent of the number of hosts and queued jobs.
+ *
+ * A downloader that got a job via host_get_job(NULL, ...) is attached to the job's host and keeps
+ * taking jobs from that host (connection reuse) until it runs dry and host_detach() is called.
+ * Idle downloaders prefer unattended hosts and only steal from busy hosts if there are none.
+ */
+
+static void _retry_heap_set(int pos, HOST *host)
+{
+	retry_heap[pos] = host;
+	host->heap_pos = pos;
+}
+
+// move the host at 'pos' up or down until the heap condition is satisfied
+static void _retry_heap_sift(int pos)
+{
+	HOST *host = retry_heap[pos];
+
+	while (pos > 1 && retry_heap[pos / 2]->retry_ts > host->retry_ts) {
+		_retry_heap_set(pos, retry_heap[pos / 2]);
+		pos /= 2;
+	}
+
+	for (int child; (child = pos * 2) <= retry_heap_size; pos = child) {
+		if (child < retry_heap_size && retry_heap[child + 1]->retry_ts < retry_heap[child]->retry_ts)
+			child++;
+
+		if (retry_heap[child]->retry_ts >= host->retry_ts)
+			break;
+
+		_retry_heap_set(pos, retry_heap[child]);
+	}
+
+	_retry_heap_set(pos, host);
+}
+
+static void _retry_heap_add(HOST *host)
+{
+	if (host->heap_pos) {
+		// already waiting, retry_ts might have changed
+		_retry_heap_sift(host->heap_pos);
+		return;
+	}
+
+	if (++retry_heap_size >= retry_heap_alloc) {
+		retry_heap_alloc = retry_heap_alloc ? retry_heap_alloc * 2 : 16;
+		retry_heap = wget_realloc(retry_heap, retry_heap_alloc * sizeof(HOST *));
+	}
+
+	_retry_heap_set(retry_heap_size, host);
+	_retry_heap_sift(retry_heap_size);
+}
+
+static void _retry_heap_remove(HOST *host)
+{
+	int pos = host->heap_pos;
+
+	if (!pos)
+		return;
+
+	HOST *last = retry_heap[retry_heap_size--];
+
+	host->heap_pos = 0;
+
+	if (last != host) {
+		_retry_heap_set(pos, last);
+		_retry_heap_sift(pos);
+	}
+}
+
+static void _host_set_ready(HOST *host, int ready)
+{
+	wget_list_t **list = ready ? (host->workers ? &busy_hosts : &ready_hosts) : NULL;
+
+	if (host->ready_list == list)
+		return;
+
+	if (host->ready_node) {
+		wget_list_remove(host->ready_list, host->ready_node);
+		host->ready_node = NULL;
+	}
+
+	if ((host->ready_list = list))
+		host->ready_node = wget_list_append(list, &host, sizeof(HOST *));
+}
+
+// --max-host-connections: no further downloader may attach to the host
+static int _host_saturated(const HOST *host)
+{
+	return host->max_workers && host->workers >= host->max_workers;
+}
+
+// move host into the scheduler structure that matches its current state
+static void _host_schedule(HOST *host)
+{
+	if (host->blocked) {
+		_retry_heap_remove(host);
+		_host_set_ready(host, 0);
+	} else if (host->retry_ts && host->retry_ts > wget_get_timemillis()) {
+		_retry_heap_add(host);
+		_host_set_ready(host, 0);
+	} else {
+		_retry_heap_remove(host);
+
+		if (_host_saturated(host))
+			_host_set_ready(host, 0); // the attached downloaders keep taking its jobs
+		else if (host->robot_job)
+			_host_set_ready(host, !host->robot_job->inuse); // nothing else before robots.txt has been processed
+		else
+			_host_set_ready(host, host->ready || host->nspilled);
+	}
+}
+
+/*
+ * Dynamic range splitting
+ *
+ * Once all parts of a file are handed out, an idle downloader takes over the upper half of the
+ * largest range that is still to be received. The owner of that part stops at the new end of its
+ * range, the new part is requested with an own Range header. That way a slow mirror or connection
+ * doesn't decide on the total download time.
+ *
+ * When there is nothing left worth splitting and only the final parts are still in progress (endgame),
+ * these are duplicated and downloaded from another mirror at the same time. The first downloader to
+ * complete the range wins, the other one stops receiving.
+ *
+ * 'length' and 'received' of a part in progress are shared between its downloader and the scheduler,
+ * both only access them with the hosts mutex locked. The downloader reserves each block before writing
+ * it (host_part_reserve()), so a split never cuts off data that is about to be written.
+ */
+
+// a part is only split if both halves are at least that large, less isn't worth a new request
+#define PART_SPLIT_MIN (1 << 20)
+
+// endgame: duplicate parts only when at most that many ranges are still in progress...
+#define PART_ENDGAME_PARTS 2
+
+// ...and at least that much of the range is left
+#define PART_TWIN_MIN (64 << 10)
+
+// returns the part an idle downloader should take over work from, 'split' tells how
+// must be called with hosts_mutex locked
+static PART *_part_to_steal(JOB *job, int *split)
+{
+	PART *best = NULL;
+	off_t best_left = 0;
+	int nranges = 0;
+
+	for (int it = 0; it < wget_vector_size(job->parts); it++) {
+		PART *part = wget_vector_get(job->parts, it);
+		off_t left;
+
+		if (part->done || (part->twin && part->twin->done))
+			continue;
+
+		if (!part->duplicate)
+			nranges++; // a range and its duplicate count once
+
+		if (!part->inuse || part->twin)
+			continue; // duplicated parts are neither split nor duplicated again
+
+		if ((left = part->length - part->received) > best_left) {
+			best = part;
+			best_left = left;
+		}
+	}
 
-static int _search_queue_for_free_job(struct _find_free_job_context *ctx, JOB *job)
+	if (!best)
+		return NULL;
+
+	if ((*split = best_left >= 2 * PART_SPLIT_MIN))
+		return best;
+
+	if (nranges <= PART_ENDGAME_PARTS && best_left >= PART_TWIN_MIN)
+		return best;
+
+	return NULL;
+}
+
+// must be called with hosts_mutex locked
+static PART *_part_split(JOB *job, PART *part)
 {
+	PART upper;
+
+	memset(&upper, 0, sizeof(PART));
+	upper.id = part->id;
+	upper.length = (part->length - part->received) / 2;
+	upper.position = part->position + part->length - upper.length;
+	upper.split = 1;
+
+	part->length -= upper.length; // the downloader of 'part' stops there
+	part->split = 1;
+
+	debug_printf("split chunk %d at pos=%lld\n", part->id, (long long) upper.position);
+
+	return wget_vector_get(job->parts, wget_vector_add(job->parts, &upper, sizeof(PART)));
+}
+
+// must be called with hosts_mutex locked
+static PART *_part_duplicate(JOB *job, PART *part)
+{
+	PART twin, *twinp;
+
+	memset(&twin, 0, sizeof(PART));
+	twin.id = part->id;
+	twin.position = part->position;
+	twin.length = part->length;
+	twin.split = part->split;
+	twin.duplicate = 1;
+	twin.twin = part;
+
+	debug_printf("duplicate chunk %d for the endgame\n", part->id);
+
+	twinp = wget_vector_get(job->parts, wget_vector_add(job->parts, &twin, sizeof(PART)));
+	part->twin = twinp;
+
+	return twinp;
+}
+
+// update the ready/inflight membership of a job after its (or its parts) 'inuse' flags changed
+static void _job_update(JOB *job)
+{
+	HOST *host = job->host;
+	int ready, inflight, split;
+
+	if (job == host->robot_job) {
+		_host_schedule(host);
+		return;
+	}
+
 	if (job->parts) {
-		for (int it = 0; it < wget_vector_size(job->parts); it++) {
+		ready = inflight = 0;
+
+		for (int it = 0; it < wget_vector_size(job->parts) && !(ready && inflight); it++) {
 			PART *part = wget_vector_get(job->parts, it);
 
-			if (!part->inuse) {
-				part->inuse = 1;
-				part->used_by = wget_thread_self();
-				job->part = part;
-				ctx->job = job;
-				debug_printf("dequeue chunk %d/%d %s\n", it + 1, wget_vector_size(job->parts), job->metalink->name);
-				return 1;
-			}
+			if (!part->inuse)
+				ready = 1;
+			else if (!part->done)
+				inflight = 1;
 		}
-	} else if (!job->inuse) {
-		job->inuse = 1;
-		job->used_by = wget_thread_self();
-		job->part = NULL;
-		ctx->job = job;
-		debug_printf("dequeue job %s\n", job->iri->uri);
-		return 1;
+
+		// idle downloaders may still take over work from the parts in progress
+		if (!ready && inflight)
+			ready = !!_part_to_steal(job, &split);
+	} else {
+		ready = !job->inuse;
+		inflight = job->inuse;
 	}
 
-	return 0;
+	if (ready) {
+		// jobs given back go to the front, so they are picked up again first
+		if (!job->ready_node)
+			job->ready_node = wget_list_prepend(&host->ready, &job, sizeof(JOB *));
+	} else if (job->ready_node) {
+		wget_list_remove(&host->ready, job->ready_node);
+		job->ready_node = NULL;
+	}
+
+	if (inflight) {
+		if (!job->inflight_node)
+			job->inflight_node = wget_list_append(&host->inflight, &job, sizeof(JOB *));
+	} else if (job->inflight_node) {
+		wget_list_remove(&host->inflight, job->inflight_node);
+		job->inflight_node = NULL;
+	}
+
+	_host_schedule(host);
 }
 
-static int G_GNUC_WGET_NONNULL_ALL _search_host_for_free_job(struct _find_free_job_context *ctx, HOST *host)
+/*
+ * Spilling jobs to disk (--max-jobs-in-memory)
+ *
+ * When more than config.max_jobs_in_memory jobs are queued, new jobs of a host are not kept as
+ * JOB in memory but serialized into a small record (URL, Referer, local filename, level and flags)
+ * appended to the host's 'spill_buf'. Full buffers are written as one segment to a temporary,
+ * append-only spill file, that is shared by all hosts. Once a host has spilled jobs, all further
+ * jobs of that host are spilled as well to keep the FIFO order. When the host has no ready job left,
+ * its oldest segment is read back and turned into jobs again.
+ *
+ * The memory used for queued jobs is thereby bounded by the limit plus one segment per host.
+ * The disk usage is bounded as well: the file is truncated when all segments have been read back,
+ * and the remaining segments are moved to the front when more than half of the file is unused.
+ */
+
+// disallowed by robots.txt and not explicitly requested
+static int _robots_disallowed(HOST *host, JOB *job)
 {
-	debug_printf("qsize=%d blocked=%d\n", host->qsize, host->blocked);
-	if (host->blocked)
+	if (!host->robots || job->requested_by_user || job->sitemap)
 		return 0;
 
-	long long pause = host->retry_ts - ctx->now;
-	debug_printf("pause=%lld\n", pause);
-	if (pause > 0) {
-		if (!ctx->pause || ctx->pause < pause)
-			ctx->pause = pause;
-		return 0;
-	}
+	for (int it = 0; it < wget_vector_size(host->robots->paths); it++) {
+		ROBOTS_PATH *path = wget_vector_get(host->robots->paths, it);
 
-	if (host->robot_job) {
-		if (!host->robot_job->inuse) {
-			host->robot_job->inuse = 1;
-			host->robot_job->used_by = wget_thread_self();
-			ctx->job = host->robot_job;
-			debug_printf("dequeue robot job %s\n", ctx->job->iri->uri);
+		// info_printf("%s: checked robot path '%.*s' / '%s' / '%s'\n", __func__, (int)path->len, path->path, job->iri->path, job->iri->uri);
+
+		if (path->len && !strncmp(path->path + 1, job->iri->path ? job->iri->path : "", path->len - 1))
 			return 1;
+	}
+
+	return 0;
+}
+
+// must be called with hosts_mutex locked
+static JOB *_host_queue_job(HOST *host, JOB *job)
+{
+	JOB *jobp;
+
+	jobp = wget_list_append(&host->queue, job, sizeof(JOB));
+	jobp->ready_node = wget_list_append(&host->ready, &jobp, sizeof(JOB *));
+	jobp->inflight_node = NULL;
+	nmemjobs++;
+
+	return jobp;
+}
+
+// must be called with hosts_mutex locked
+static void _host_drop_jobs(HOST *host, int njobs)
+{
+	host->qsize -= njobs;
+	if (!host->blocked)
+		qsize -= njobs;
+}
+
+static int _spill_open(void)
+{
+	if (spill_fd == -1) {
+		const char *tmpdir = getenv("TMPDIR");
+		char *fname = wget_aprintf("%s/wget2-queue-XXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp");
+
+		if ((spill_fd = mkstemp(fname)) != -1) {
+			unlink(fname); // the file goes away on close or exit
+			debug_printf("spilling queued jobs to %s\n", fname);
+		} else
+			error_printf(_("Failed to open spill file '%s' (%d)\n"), fname, errno);
+
+		xfree(fname);
+	}
+
+	return spill_fd;
+}
+
+// write the host's spill buffer as a new segment, on failure the jobs just stay in the buffer
+static void _host_spill_flush(HOST *host)
+{
+	wget_buffer_t *buf = host->spill_buf;
+
+	if (_spill_open() == -1)
+		return;
+
+	if (pwrite(spill_fd, buf->data, buf->length, spill_size) != (ssize_t) buf->length) {
+		error_printf(_("Failed to write spill file (%d)\n"), errno);
+		return;
+	}
+
+	SPILL_SEGMENT segment = { .offset = spill_size, .size = buf->length, .njobs = host->spill_buf_jobs };
+
+	wget_list_append(&host->segments, &segment, sizeof(segment));
+	spill_size += buf->length;
+	spill_live += buf->length;
+	debug_printf("%s: spilled %d jobs of %s (%zu bytes)\n", __func__, segment.njobs, host->host, segment.size);
+
+	wget_buffer_free(&host->spill_buf);
+	host->spill_buf_jobs = 0;
+}
+
+static void _spill_record_append(wget_buffer_t *buf, const JOB *job)
+{
+	SPILL_RECORD record = {
+		.level = job->level,
+		.redirection_level = job->redirection_level,
+		.flags = (job->sitemap ? SPILL_SITEMAP : 0)
+			| (job->head_first ? SPILL_HEAD_FIRST : 0)
+			| (job->requested_by_user ? SPILL_REQUESTED_BY_USER : 0)
+			| (job->referer ? SPILL_REFERER : 0)
+			| (job->local_filename ? SPILL_LOCAL_FILENAME : 0)
+	};
+
+	wget_buffer_memcat(buf, &record, sizeof(record));
+	wget_buffer_memcat(buf, job->iri->uri, strlen(job->iri->uri) + 1);
+	wget_buffer_memcat(buf, job->referer ? job->referer : "", job->referer ? strlen(job->referer) + 1 : 1);
+	wget_buffer_memcat(buf, job->local_filename ? job->local_filename : "", job->local_filename ? strlen(job->local_filename) + 1 : 1);
+}
+
+// number of records in 'data', -1 if they are malformed
+static int _spill_records_count(const char *data, size_t size)
+{
+	const char *p = data, *end = data + size;
+	int n;
+
+	for (n = 0; p < end; n++) {
+		if ((size_t) (end - p) < sizeof(SPILL_RECORD))
+			return -1;
+
+		p += sizeof(SPILL_RECORD);
+
+		for (int it = 0; it < 3; it++) {
+			const char *e = memchr(p, 0, end - p);
+
+			if (!e)
+				return -1;
+
+			p = e + 1;
+		}
+	}
+
+	return n;
+}
+
+// must be called with hosts_mutex locked
+static void _host_spill_job(HOST *host, JOB *job)
+{
+	if (!host->spill_buf)
+		host->spill_buf = wget_buffer_alloc(SPILL_SEGMENT_SIZE);
+
+	_spill_record_append(host->spill_buf, job);
+	host->spill_buf_jobs++;
+	host->nspilled++;
+
+	job_free(job);
+
+	if (host->spill_buf->length >= SPILL_SEGMENT_SIZE)
+		_host_spill_flush(host);
+}
+
+// turn spilled records back into queued jobs
+static void _host_unspill_jobs(HOST *host, const char *data, size_t size)
+{
+	const char *p = data, *end = data + size;
+
+	while (p < end) {
+		SPILL_RECORD record;
+		const char *url, *referer, *local_filename;
+		JOB job;
+
+		memcpy(&record, p, sizeof(record));
+		url = p + sizeof(record);
+		referer = url + strlen(url) + 1;
+		local_filename = referer + strlen(referer) + 1;
+		p = local_filename + strlen(local_filename) + 1;
+
+		wget_iri_t *iri = wget_iri_parse(url, "utf-8");
+		host->nspilled--;
+
+		if (!iri) {
+			error_printf(_("Failed to restore spilled URL '%s'\n"), url);
+			_host_drop_jobs(host, 1);
+			continue;
 		}
-		debug_printf("robot job inuse\n");
-		return 0; // someone is still working on robots.txt
+
+		job_init(&job, iri);
+		job.host = host;
+		job.level = record.level;
+		job.redirection_level = record.redirection_level;
+		job.sitemap = !!(record.flags & SPILL_SITEMAP);
+		job.head_first = !!(record.flags & SPILL_HEAD_FIRST);
+		job.requested_by_user = !!(record.flags & SPILL_REQUESTED_BY_USER);
+		if (record.flags & SPILL_REFERER)
+			job.referer = wget_strdup(referer);
+		if (record.flags & SPILL_LOCAL_FILENAME)
+			job.local_filename = wget_strdup(local_filename);
+
+		// robots.txt might have been processed after the job has been spilled
+		if (_robots_disallowed(host, &job)) {
+			info_printf(_("URL '%s' not followed (disallowed by robots.txt)\n"), job.iri->uri);
+			job_free(&job);
+			_host_drop_jobs(host, 1);
+			continue;
+		}
+
+		_host_queue_job(host, &job);
+	}
+}
+
+static int _spill_segment_collect(void *ctx, const void *key G_GNUC_WGET_UNUSED, void *value)
+{
+	HOST *host = value;
+
+	for (SPILL_SEGMENT *segment = wget_list_getfirst(host->segments), *last = wget_list_getlast(host->segments); segment;
+		segment = segment != last ? wget_list_getnext(segment) : NULL)
+	{
+		wget_vector_add_noalloc(ctx, segment);
+	}
+
+	return 0;
+}
+
+static int G_GNUC_WGET_NONNULL_ALL _spill_segment_compare(const SPILL_SEGMENT *s1, const SPILL_SEGMENT *s2)
+{
+	return s1->offset < s2->offset ? -1 : s1->offset > s2->offset;
+}
+
+// give back the space of the segments that have been read back
+// must be called with hosts_mutex locked
+static void _spill_compact(void)
+{
+	wget_vector_t *segments;
+	wget_buffer_t *buf;
+	off_t pos = 0;
+
+	if (spill_fd == -1 || spill_size - spill_live < SPILL_COMPACT_MIN || spill_size - spill_live < spill_live) {
+		if (spill_fd != -1 && !spill_live && spill_size && ftruncate(spill_fd, 0) == 0)
+			spill_size = 0; // all read back, the cheap case
+		return;
 	}
 
-	wget_list_browse(host->queue, (wget_list_browse_t)_search_queue_for_free_job, ctx);
+	// move the segments to the front in the order of their offsets, that never overwrites a segment not yet moved
+	segments = wget_vector_create(64, -2, (wget_vector_compare_t) _spill_segment_compare);
+	if (hosts)
+		wget_hashmap_browse(hosts, _spill_segment_collect, segments);
+	wget_vector_sort(segments);
+	buf = wget_buffer_alloc(SPILL_SEGMENT_SIZE * 2);
+
+	for (int it = 0; it < wget_vector_size(segments); it++) {
+		SPILL_SEGMENT *segment = wget_vector_get(segments, it);
+
+		if (segment->offset != pos) {
+			wget_buffer_ensure_capacity(buf, segment->size);
+
+			if (pread(spill_fd, buf->data, segment->size, segment->offset) != (ssize_t) segment->size
+				|| pwrite(spill_fd, buf->data, segment->size, pos) != (ssize_t) segment->size)
+			{
+				error_printf(_("Failed to compact spill file (%d)\n"), errno);
+				pos = spill_size; // the segments moved so far are fine, the others stay where they are
+				break;
+			}
+
+			segment->offset = pos;
+		}
 
-	return !!ctx->job;
+		pos += segment->size;
+	}
+
+	if (pos < spill_size && ftruncate(spill_fd, pos) == 0) {
+		debug_printf("%s: spill file %lld -> %lld bytes\n", __func__, (long long) spill_size, (long long) pos);
+		spill_size = pos;
+	}
+
+	wget_buffer_free(&buf);
+	wget_vector_clear_nofree(segments);
+	wget_vector_free(&segments);
 }
 
-JOB *host_get_job(HOST *host, long long *pause)
+// must be called with hosts_mutex locked, returns 1 if the host has ready jobs afterwards
+static int _host_unspill(HOST *host)
 {
-	struct _find_free_job_context ctx = { .now = wget_get_timemillis() };
+	while (!host->ready && host->nspilled) {
+		SPILL_SEGMENT *segment = wget_list_getfirst(host->segments);
+
+		if (segment) {
+			char *data = wget_malloc(segment->size);
+
+			if (pread(spill_fd, data, segment->size, segment->offset) == (ssize_t) segment->size) {
+				_host_unspill_jobs(host, data, segment->size);
+			} else {
+				error_printf(_("Failed to read spill file, %d jobs lost (%d)\n"), segment->njobs, errno);
+				host->nspilled -= segment->njobs;
+				_host_drop_jobs(host, segment->njobs);
+			}
+
+			xfree(data);
+			spill_live -= segment->size;
+			wget_list_remove(&host->segments, segment);
+			_spill_compact();
+		} else {
+			_host_unspill_jobs(host, host->spill_buf->data, host->spill_buf->length);
+			wget_buffer_free(&host->spill_buf);
+			host->spill_buf_jobs = 0;
+		}
+	}
+
+	return !!host->ready;
+}
+
+static JOB *_host_dequeue_job(HOST *host, DOWNLOADER *downloader)
+{
+	JOB *job;
+
+	if ((job = host->robot_job)) {
+		if (job->inuse) {
+			debug_printf("robot job inuse\n");
+			return NULL; // someone is still working on robots.txt
+		}
+
+		job->inuse = 1;
+		job->used_by = downloader;
+		downloader->part = NULL;
+		_host_schedule(host);
+		debug_printf("dequeue robot job %s\n", job->iri->uri);
+		return job;
+	}
+
+	while (host->ready || _host_unspill(host)) {
+		job = *(JOB **) wget_list_getfirst(host->ready);
+
+		if (job->parts) {
+			PART *part = NULL;
+			int split;
+
+			for (int it = 0; it < wget_vector_size(job->parts) && !part; it++) {
+				part = wget_vector_get(job->parts, it);
+
+				if (part->inuse)
+					part = NULL;
+			}
+
+			if (!part && (part = _part_to_steal(job, &split)))
+				part = split ? _part_split(job, part) : _part_duplicate(job, part);
+
+			if (part) {
+				part->inuse = 1;
+				part->used_by = downloader;
+				part->received = 0;
+				job->part = downloader->part = part;
+				_job_update(job);
+				debug_printf("dequeue chunk %d/%d %s\n", part->id, wget_vector_size(job->parts), job->metalink->name);
+				return job;
+			}
+		} else if (!job->inuse) {
+			job->inuse = 1;
+			job->used_by = downloader;
+			job->part = downloader->part = NULL;
+			_job_update(job);
+			debug_printf("dequeue job %s\n", job->iri->uri);
+			return job;
+		}
+
+		// nothing to do for this job, should not happen
+		_job_update(job);
+	}
+
+	_host_schedule(host);
+
+	return NULL;
+}
+
+// --wait: the host doesn't hand out its next job before the delay is over, other hosts are not affected
+static void _host_wait(HOST *host, long long now)
+{
+	long long ts;
+
+	if (config.random_wait)
+		ts = now + rand() % config.wait + config.wait / 2; // (0.5 - 1.5) * config.wait
+	else
+		ts = now + config.wait;
+
+	if (host->retry_ts < ts) {
+		host->retry_ts = ts;
+		_host_schedule(host);
+	}
+}
+
+JOB *host_get_job(HOST *host, DOWNLOADER *downloader, long long *pause)
+{
+	JOB *job = NULL;
+	long long now = wget_get_timemillis(), wait = 0;
+
+	wget_thread_mutex_lock(&hosts_mutex);
 
 	if (host) {
-		_search_host_for_free_job(&ctx, host);
+		debug_printf("qsize=%d blocked=%d\n", host->qsize, host->blocked);
+
+		// after the limit of downloaders has been lowered, the surplus ones detach
+		if (!host->blocked && !(host->max_workers && host->workers > host->max_workers)) {
+			if (host->retry_ts > now)
+				wait = host->retry_ts - now;
+			else
+				job = _host_dequeue_job(host, downloader);
+		}
 	} else {
-		wget_thread_mutex_lock(&hosts_mutex);
-		wget_hashmap_browse(hosts, (wget_hashmap_browse_t)_search_host_for_free_job, &ctx);
-		wget_thread_mutex_unlock(&hosts_mutex);
+		// wake up hosts that reached their retry time
+		while (retry_heap_size && retry_heap[1]->retry_ts <= now)
+			_host_schedule(retry_heap[1]);
+
+		// prefer hosts nobody works on, else steal from the busy ones
+		while (!job && ready_hosts)
+			job = _host_dequeue_job(*(HOST **) wget_list_getfirst(ready_hosts), downloader);
+
+		while (!job && busy_hosts)
+			job = _host_dequeue_job(*(HOST **) wget_list_getfirst(busy_hosts), downloader);
+
+		if (job) {
+			// the caller is attached to this host until host_detach()
+			job->host->workers++;
+			_host_schedule(job->host);
+
+			if (job->host->max_workers)
+				debug_printf("%s: workers=%d/%d\n", job->host->host, job->host->workers, job->host->max_workers);
+		} else if (retry_heap_size)
+			wait = retry_heap[1]->retry_ts - now;
 	}
 
+	if (job && config.wait)
+		_host_wait(job->host, now);
+
+	wget_thread_mutex_unlock(&hosts_mutex);
+
+	debug_printf("pause=%lld\n", wait);
+
 	if (pause)
-		*pause = ctx.pause;
+		*pause = wait;
+
+	return job;
+}
 
-	return ctx.job;
+void host_detach(HOST *host)
+{
+	wget_thread_mutex_lock(&hosts_mutex);
+	if (host->workers > 0)
+		host->workers--;
+	_host_schedule(host);
+	wget_thread_mutex_unlock(&hosts_mutex);
 }
 
-static int _release_job(wget_thread_t *ctx, JOB *job)
+int queue_ready(void)
 {
-	wget_thread_t self = *ctx;
+	int ready;
+
+	wget_thread_mutex_lock(&hosts_mutex);
+	ready = ready_hosts || busy_hosts;
+	wget_thread_mutex_unlock(&hosts_mutex);
+
+	return ready;
+}
+
+static int _release_job(DOWNLOADER *downloader, JOB *job)
+{
+	int released = 0;
 
 	if (job->parts) {
 		for (int it = 0; it < wget_vector_size(job->parts); it++) {
 			PART *part = wget_vector_get(job->parts, it);
 
-			if (part->inuse && part->used_by == self) {
+			if (part->inuse && !part->done && part->used_by == downloader) {
 				part->inuse = 0;
-				part->used_by = 0;
+				part->used_by = NULL;
+				released = 1;
 				debug_printf("released chunk %d/%d %s\n", it + 1, wget_vector_size(job->parts), job->local_filename);
 			}
 		}
-	} else if (job->inuse && job->used_by == self) {
+	} else if (job->inuse && job->used_by == downloader) {
 		job->inuse = 0;
-		job->used_by = 0;
+		job->used_by = NULL;
+		released = 1;
 		debug_printf("released job %s\n", job->iri->uri);
 	}
 
-	return 0;
+	return released;
 }
 
-void host_release_jobs(HOST *host)
+void host_release_jobs(HOST *host, DOWNLOADER *downloader)
 {
 	if (!host)
 		return;
 
-	wget_thread_t self = wget_thread_self();
-
 	wget_thread_mutex_lock(&hosts_mutex);
 
 	if (host->robot_job) {
-		if (host->robot_job->inuse && host->robot_job->used_by == self) {
+		if (host->robot_job->inuse && host->robot_job->used_by == downloader) {
 			host->robot_job->inuse = 0;
-			host->robot_job->used_by = 0;
+			host->robot_job->used_by = NULL;
 			debug_printf("released robots.txt job\n");
 		}
 	}
 
-	wget_list_browse(host->queue, (wget_list_browse_t)_release_job, &self);
+	// only the jobs in flight have to be looked at, not the whole queue
+	JOB **jobp = wget_list_getfirst(host->inflight), **last = wget_list_getlast(host->inflight), **next;
+
+	for (; jobp; jobp = next) {
+		JOB *job = *jobp;
+
+		next = jobp != last ? wget_list_getnext(jobp) : NULL;
+
+		if (_release_job(downloader, job))
+			_job_update(job); // might unlink jobp
+	}
+
+	_host_schedule(host);
+
+	wget_thread_mutex_unlock(&hosts_mutex);
+}
+
+int host_requeue_job(JOB *job)
+{
+	int ready;
+
+	wget_thread_mutex_lock(&hosts_mutex);
+	_job_update(job);
+	ready = job->ready_node || (job == job->host->robot_job && !job->inuse);
+	wget_thread_mutex_unlock(&hosts_mutex);
+
+	if (job->iri)
+		debug_printf("%s: %s ready=%d\n", __func__, job->iri->uri, ready);
+
+	return ready;
+}
+
+// reserve the next 'length' bytes of a part at 'offset' (relative to the part) before they are written
+// returns the number of bytes to write, 0 if the rest has been split off or has been downloaded by the twin
+// 'last' is set if the reserved bytes reach the end of the part
+size_t host_part_reserve(PART *part, off_t offset, size_t length, int *last)
+{
+	off_t left;
+
+	wget_thread_mutex_lock(&hosts_mutex);
+
+	if ((part->twin && part->twin->done) || (left = part->length - offset) <= 0) {
+		length = 0;
+		*last = 1;
+	} else {
+		if ((off_t) length > left)
+			length = (size_t) left;
+
+		part->received = offset + length;
+		*last = part->received >= part->length;
+	}
+
+	wget_thread_mutex_unlock(&hosts_mutex);
+
+	return length;
+}
+
+// the current length of 'part', it is lowered when its upper half is split off
+off_t host_part_length(PART *part)
+{
+	off_t length;
+
+	wget_thread_mutex_lock(&hosts_mutex);
+	length = part->length;
+	wget_thread_mutex_unlock(&hosts_mutex);
+
+	return length;
+}
+
+// returns 1 if the whole (possibly lowered) range of 'part' has been received, 2 if the twin completed it
+int host_part_complete(PART *part)
+{
+	int ret;
+
+	wget_thread_mutex_lock(&hosts_mutex);
+
+	if (part->twin && part->twin->done)
+		ret = 2;
+	else
+		ret = part->received == part->length;
+
+	wget_thread_mutex_unlock(&hosts_mutex);
+
+	return ret;
+}
+
+// account the end of a part download, 'ok' if the whole range has been received
+// returns 1 if all parts of the job are done now (for exactly one caller), else 0
+int host_finish_part(JOB *job, PART *part, int ok)
+{
+	int all_done = 1;
+
+	wget_thread_mutex_lock(&hosts_mutex);
+
+	if (ok || (part->twin && part->twin->done)) {
+		part->done = 1;
+	} else {
+		part->inuse = 0; // something was wrong, reload again later
+		part->used_by = NULL;
+	}
+
+	for (int it = 0; it < wget_vector_size(job->parts) && all_done; it++) {
+		PART *partp = wget_vector_get(job->parts, it);
+
+		if (!partp->done)
+			all_done = 0; // a duplicate that is still in progress also keeps the job alive
+	}
+
+	_job_update(job);
 
 	wget_thread_mutex_unlock(&hosts_mutex);
+
+	return all_done;
 }
 
+// returns the queued job or NULL if the job has been spilled to disk (and 'job' has been freed)
 JOB *host_add_job(HOST *host, JOB *job)
 {
-	JOB *jobp;
+	JOB *jobp = NULL;
 
 	job->host = host;
 	debug_printf("%s: job fname %s\n", __func__, job->local_filename);
 
+	if (job->iri)
+		debug_printf("%s: %s\n", __func__, job->iri->uri);
+	else if (job->metalink)
+		debug_printf("%s: %s\n", __func__, job->metalink->name);
+
 	wget_thread_mutex_lock(&hosts_mutex);
-	jobp = wget_list_append(&host->queue, job, sizeof(JOB));
+	// metalink jobs carry more state than a spill record, they always stay in memory
+	if (config.max_jobs_in_memory > 0 && job->iri && !job->metalink && !job->parts
+		&& (host->nspilled || nmemjobs >= config.max_jobs_in_memory))
+		_host_spill_job(host, job);
+	else
+		jobp = _host_queue_job(host, job);
 	host->qsize++;
 	if (!host->blocked)
 		qsize++;
+	_host_schedule(host);
 	wget_thread_mutex_unlock(&hosts_mutex);
 
-	if (job->iri)
-		debug_printf("%s: %p %s\n", __func__, (void *)jobp, job->iri->uri);
-	else if (job->metalink)
-		debug_printf("%s: %p %s\n", __func__, (void *)jobp, job->metalink->name);
-
 	debug_printf("%s: qsize %d host-qsize=%d\n", __func__, qsize, host->qsize);
 
 	return jobp;
@@ -297,6 +1124,7 @@ JOB *host_add_robotstxt_job(HOST *host, wget_iri_t *iri, const char *encoding)
 	host->qsize++;
 	if (!host->blocked)
 		qsize++;
+	_host_schedule(host);
 	wget_thread_mutex_unlock(&hosts_mutex);
 
 	debug_printf("%s: %p %s\n", __func__, (void *)job, job->iri->uri);
@@ -305,11 +1133,9 @@ JOB *host_add_robotstxt_job(HOST *host, wget_iri_t *iri, const char *encoding)
 	return job;
 }
 
-void host_remove_job(HOST *host, JOB *job)
+// must be called with hosts_mutex locked
+static void _host_remove_job(HOST *host, JOB *job)
 {
-	debug_printf("%s: %p\n", __func__, (void *)job);
-
-	wget_thread_mutex_lock(&hosts_mutex);
 	if (job == host->robot_job) {
 		// Special handling for automatic robots.txt jobs
 		// ==============================================
@@ -319,40 +1145,33 @@ void host_remove_job(HOST *host, JOB *job)
 		// and only now we know if we should follow these links or not.
 		// If any of these links that are disallowed have been explicitly requested by the user,
 		// we should download them.
+		// Spilled jobs are checked when they are read back.
 		if (host->robots) {
 			JOB *next, *thejob = wget_list_getfirst(host->queue);
 
-			for (int max = host->qsize - 1; max > 0; max--, thejob = next) {
+			for (int max = host->qsize - host->nspilled - 1; max > 0; max--, thejob = next) {
 				next = wget_list_getnext(thejob);
 
 				// info_printf("%s: checking '%s' / '%s'\n", __func__, thejob->iri->path, thejob->iri->uri);
-				if (thejob->requested_by_user)
-						continue;
-
-				if (thejob->sitemap)
-						continue;
-
-				for (int it = 0; it < wget_vector_size(host->robots->paths); it++) {
-					ROBOTS_PATH *path = wget_vector_get(host->robots->paths, it);
-
-					// info_printf("%s: checked robot path '%.*s' / '%s' / '%s'\n", __func__, (int)path->len, path->path, thejob->iri->path, thejob->iri->uri);
-
-					if (path->len && !strncmp(path->path + 1, thejob->iri->path ? thejob->iri->path : "", path->len - 1)) {
-						info_printf(_("URL '%s' not followed (disallowed by robots.txt)\n"), thejob->iri->uri);
-						host_remove_job(host, thejob);
-						break;
-					}
+				if (_robots_disallowed(host, thejob)) {
+					info_printf(_("URL '%s' not followed (disallowed by robots.txt)\n"), thejob->iri->uri);
+					_host_remove_job(host, thejob);
 				}
 			}
 		}
 
-		wget_iri_free(&job->iri);
 		job_free(job);
 		xfree(host->robot_job);
 	} else {
+		if (job->ready_node)
+			wget_list_remove(&host->ready, job->ready_node);
+		if (job->inflight_node)
+			wget_list_remove(&host->inflight, job->inflight_node);
+
 		job_free(job);
 
 		wget_list_remove(&host->queue, job);
+		nmemjobs--;
 	}
 
 	host->qsize--;
@@ -360,6 +1179,15 @@ void host_remove_job(HOST *host, JOB *job)
 		qsize--;
 	debug_printf("%s: qsize=%d host->qsize=%d\n", __func__, qsize, host->qsize);
 
+	_host_schedule(host);
+}
+
+void host_remove_job(HOST *host, JOB *job)
+{
+	debug_printf("%s: %p\n", __func__, (void *)job);
+
+	wget_thread_mutex_lock(&hosts_mutex);
+	_host_remove_job(host, job);
 	wget_thread_mutex_unlock(&hosts_mutex);
 }
 
@@ -367,13 +1195,108 @@ void hosts_free(void)
 {
 	// We don't need mutex locking here - this function is called on exit when all threads have ceased.
 	wget_hashmap_free(&hosts);
+	wget_list_free(&ready_hosts);
+	wget_list_free(&busy_hosts);
+	xfree(retry_heap);
+	retry_heap_size = retry_heap_alloc = 0;
+
+	if (spill_fd != -1) {
+		close(spill_fd);
+		spill_fd = -1;
+		spill_size = spill_live = 0;
+	}
 }
 
-void host_increase_failure(HOST *host)
+/*
+ * Adaptive number of downloaders per host (--max-host-connections)
+ *
+ * Like TCP congestion control, 'max_workers' grows by one each round (one response per allowed downloader)
+ * as long as the host is healthy, and is halved on trouble: 429/503 responses, connection errors or
+ * response times rising well above the best seen so far. An additional downloader that didn't increase the
+ * throughput stops the growth for a round. Trouble reported for requests sent before the last decrease
+ * is ignored, these requests were sent at the former, higher concurrency.
+ */
+
+// round average time to first byte that is considered normal jitter
+#define TTFB_SLACK 50
+
+static void _host_new_round(HOST *host, long long now)
+{
+	host->round_start = now;
+	host->round_responses = 0;
+	host->round_ttfb = 0;
+	host->round_bytes = 0;
+}
+
+static void _host_decrease_workers(HOST *host, long long now)
+{
+	if (!host->max_workers)
+		return;
+
+	if (host->max_workers > 1)
+		host->max_workers /= 2;
+
+	host->grown = 0;
+	host->round_rate = 0;
+	_host_new_round(host, now);
+
+	debug_printf("%s: max_workers=%d\n", host->host, host->max_workers);
+}
+
+void host_response_feedback(HOST *host, int code, long long sent, long long ttfb, size_t nbytes)
+{
+	long long now;
+
+	if (!config.max_host_connections)
+		return;
+
+	wget_thread_mutex_lock(&hosts_mutex);
+
+	now = wget_get_timemillis();
+
+	if (code == 429 || code == 503) {
+		// the server asks us to slow down
+		if (sent >= host->round_start)
+			_host_decrease_workers(host, now);
+	} else {
+		host->round_ttfb += ttfb;
+		host->round_bytes += nbytes;
+
+		if (++host->round_responses >= host->max_workers) {
+			long long ttfb_avg = host->round_ttfb / host->round_responses;
+			long long rate = host->round_bytes * 1000 / (now - host->round_start + 1);
+
+			if (!host->ttfb_min || ttfb_avg < host->ttfb_min)
+				host->ttfb_min = ttfb_avg;
+
+			if (ttfb_avg > host->ttfb_min * 2 + TTFB_SLACK && sent >= host->round_start) {
+				// requests queue up at the server
+				_host_decrease_workers(host, now);
+			} else {
+				if (host->grown && rate <= host->round_rate)
+					host->grown = 0; // the last additional downloader didn't pay off, wait a round
+				else if ((host->grown = host->max_workers < config.max_host_connections)) {
+					host->max_workers++;
+					debug_printf("%s: max_workers=%d\n", host->host, host->max_workers);
+				}
+
+				host->round_rate = rate;
+				_host_new_round(host, now);
+			}
+		}
+	}
+
+	_host_schedule(host);
+
+	wget_thread_mutex_unlock(&hosts_mutex);
+}
+
+void host_increase_failure(HOST *host, long long sent)
 {
 	wget_thread_mutex_lock(&hosts_mutex);
 	host->failures++;
-	host->retry_ts = wget_get_timemillis() + host->failures * 1000;
+	// linear backoff, up to --waitretry
+	host->retry_ts = wget_get_timemillis() + (host->failures * 1000LL > config.waitretry ? config.waitretry : host->failures * 1000LL);
 	debug_printf("%s: %s failures=%d\n", __func__, host->host, host->failures);
 
 	if (config.tries && host->failures >= config.tries) {
@@ -383,6 +1306,9 @@ void host_increase_failure(HOST *host)
 			debug_printf("%s: qsize=%d\n", __func__, qsize);
 		}
 	}
+	if (sent >= host->round_start)
+		_host_decrease_workers(host, wget_get_timemillis());
+	_host_schedule(host);
 	wget_thread_mutex_unlock(&hosts_mutex);
 }
 
@@ -394,19 +1320,30 @@ void host_final_failure(HOST *host)
 		qsize -= host->qsize;
 		debug_printf("%s: qsize=%d\n", __func__, qsize);
 	}
+	_host_schedule(host);
 	wget_thread_mutex_unlock(&hosts_mutex);
 }
 
+void host_disable_pipelining(HOST *host)
+{
+	wget_thread_mutex_lock(&hosts_mutex);
+	host->no_pipelining = 1;
+	wget_thread_mutex_unlock(&hosts_mutex);
+
+	info_printf(_("Disabled HTTP/1.1 pipelining for %s\n"), host->host);
+}
+
 void host_reset_failure(HOST *host)
 {
 	wget_thread_mutex_lock(&hosts_mutex);
 	host->failures = 0;
-	host->retry_ts = 0;
+	// 'retry_ts' is kept, it might be the --wait delay of the next job
 	if (host->blocked) {
 		host->blocked = 0;
 		qsize += host->qsize;
 		debug_printf("%s: qsize=%d\n", __func__, qsize);
 	}
+	_host_schedule(host);
 	wget_thread_mutex_unlock(&hosts_mutex);
 }
 
@@ -426,6 +1363,7 @@ int queue_empty(void)
 static int _queue_free_func(void *context G_GNUC_WGET_UNUSED, JOB *job)
 {
 	job_free(job);
+	nmemjobs--;
 	return 0;
 }
 
@@ -434,14 +1372,26 @@ void host_queue_free(HOST *host)
 	wget_thread_mutex_lock(&hosts_mutex);
 	wget_list_browse(host->queue, (wget_list_browse_t)_queue_free_func, NULL);
 	wget_list_free(&host->queue);
+	wget_list_free(&host->ready);
+	wget_list_free(&host->inflight);
+	for (SPILL_SEGMENT *segment = wget_list_getfirst(host->segments), *last = wget_list_getlast(host->segments); segment;
+		segment = segment != last ? wget_list_getnext(segment) : NULL)
+	{
+		spill_live -= segment->size;
+	}
+	wget_list_free(&host->segments);
+	_spill_compact();
+	wget_buffer_free(&host->spill_buf);
+	host->nspilled = host->spill_buf_jobs = 0;
 	if (host->robot_job) {
-		wget_iri_free(&host->robot_job->iri);
 		job_free(host->robot_job);
 		xfree(host->robot_job);
 	}
 	if (!host->blocked)
 		qsize -= host->qsize;
 	host->qsize = 0;
+	_retry_heap_remove(host);
+	_host_set_ready(host, 0);
 	wget_thread_mutex_unlock(&hosts_mutex);
 }
 
@@ -460,6 +1410,8 @@ void queue_print(HOST *host)
 
 	wget_thread_mutex_lock(&hosts_mutex);
 	wget_list_browse(host->queue, (wget_list_browse_t)_queue_print_func, NULL);
+	if (host->nspilled)
+		info_printf("  (%d more jobs spilled to disk)\n", host->nspilled);
 	wget_thread_mutex_unlock(&hosts_mutex);
 }
 
@@ -468,3 +1420,225 @@ int queue_size(void)
 	debug_printf("%s: qsize=%d\n", __func__, qsize);
 	return qsize;
 }
+
+/*
+ * Checkpoints (--checkpoint-file, --resume-crawl)
+ *
+ * For each host we save scheme/host/port, the robots.txt state and all unfinished jobs
+ * (queued, in flight, spilled) in spill record format, in chunks of about SPILL_SEGMENT_SIZE.
+ * There are no metalink jobs to save, --checkpoint-file switches off Metalink and --chunk-size.
+ */
+
+enum {
+	ROBOTS_PENDING = 0, // robots.txt has not been processed yet
+	ROBOTS_NONE = 1, // no robots.txt rules for us
+	ROBOTS_RULES = 2 // a list of disallowed paths follows
+};
+
+static void _checkpoint_write_chunk(CHECKPOINT *cp, wget_buffer_t *buf)
+{
+	if (buf->length) {
+		checkpoint_write_data(cp, buf->data, buf->length);
+		wget_buffer_reset(buf);
+	}
+}
+
+static int _host_save(void *ctx, const void *key G_GNUC_WGET_UNUSED, void *value)
+{
+	CHECKPOINT *cp = ctx;
+	HOST *host = value;
+	wget_buffer_t *buf = wget_buffer_alloc(SPILL_SEGMENT_SIZE);
+
+	checkpoint_write_string(cp, host->scheme);
+	checkpoint_write_string(cp, host->host);
+	checkpoint_write_string(cp, host->port);
+
+	if (host->robot_job)
+		checkpoint_write_uint(cp, ROBOTS_PENDING);
+	else if (!host->robots)
+		checkpoint_write_uint(cp, ROBOTS_NONE);
+	else {
+		checkpoint_write_uint(cp, ROBOTS_RULES);
+		checkpoint_write_uint(cp, wget_vector_size(host->robots->paths));
+
+		for (int it = 0; it < wget_vector_size(host->robots->paths); it++) {
+			ROBOTS_PATH *path = wget_vector_get(host->robots->paths, it);
+
+			checkpoint_write_data(cp, path->path, path->len);
+		}
+	}
+
+	// jobs in memory first, they are older than the spilled ones
+	for (JOB *job = wget_list_getfirst(host->queue), *last = wget_list_getlast(host->queue); job; job = job != last ? wget_list_getnext(job) : NULL) {
+		if (job->iri && !job->metalink) {
+			_spill_record_append(buf, job);
+
+			if (buf->length >= SPILL_SEGMENT_SIZE)
+				_checkpoint_write_chunk(cp, buf);
+		}
+	}
+
+	_checkpoint_write_chunk(cp, buf);
+
+	for (SPILL_SEGMENT *segment = wget_list_getfirst(host->segments), *last = wget_list_getlast(host->segments); segment;
+		segment = segment != last ? wget_list_getnext(segment) : NULL)
+	{
+		wget_buffer_ensure_capacity(buf, segment->size);
+
+		if (pread(spill_fd, buf->data, segment->size, segment->offset) != (ssize_t) segment->size) {
+			error_printf(_("Failed to read spill file (%d)\n"), errno);
+			cp->error = 1;
+			break;
+		}
+
+		buf->length = segment->size;
+		_checkpoint_write_chunk(cp, buf);
+	}
+
+	if (host->spill_buf) {
+		wget_buffer_bufcpy(buf, host->spill_buf);
+		_checkpoint_write_chunk(cp, buf);
+	}
+
+	checkpoint_write_data(cp, "", 0); // end of jobs
+
+	wget_buffer_free(&buf);
+
+	return cp->error;
+}
+
+int hosts_save(CHECKPOINT *cp)
+{
+	wget_thread_mutex_lock(&hosts_mutex);
+
+	checkpoint_write_uint(cp, sizeof(SPILL_RECORD));
+	checkpoint_write_uint(cp, wget_hashmap_size(hosts));
+
+	if (hosts)
+		wget_hashmap_browse(hosts, _host_save, cp);
+
+	wget_thread_mutex_unlock(&hosts_mutex);
+
+	return cp->error ? -1 : 0;
+}
+
+// must be called with hosts_mutex locked
+static int _host_restore_jobs(HOST *host, const char *data, size_t size)
+{
+	int njobs = _spill_records_count(data, size);
+
+	if (njobs < 0)
+		return -1;
+
+	host->qsize += njobs;
+	if (!host->blocked)
+		qsize += njobs;
+	host->nspilled += njobs;
+
+	if (config.max_jobs_in_memory > 0 && (host->spill_buf || host->segments || nmemjobs + njobs > config.max_jobs_in_memory)) {
+		// keep them spilled, they are read back when the host gets to them
+		if (!host->spill_buf)
+			host->spill_buf = wget_buffer_alloc(SPILL_SEGMENT_SIZE);
+
+		wget_buffer_memcat(host->spill_buf, data, size);
+		host->spill_buf_jobs += njobs;
+
+		if (host->spill_buf->length >= SPILL_SEGMENT_SIZE)
+			_host_spill_flush(host);
+	} else
+		_host_unspill_jobs(host, data, size);
+
+	_host_schedule(host);
+
+	return 0;
+}
+
+static HOST *_host_load(CHECKPOINT *cp)
+{
+	char *scheme = checkpoint_read_string(cp);
+	char *hostname = checkpoint_read_string(cp);
+	char *port = checkpoint_read_string(cp);
+	int robots_state = (int) checkpoint_read_uint(cp);
+	wget_iri_t *iri = NULL;
+	HOST *host = NULL;
+
+	if (cp->error || !scheme || !hostname)
+		goto out;
+
+	char *url = wget_aprintf(strchr(hostname, ':') ? "%s://[%s]:%s/" : "%s://%s:%s/", scheme, hostname, port ? port : "");
+
+	iri = wget_iri_parse(url, "utf-8");
+	xfree(url);
+
+	if (!iri) {
+		cp->error = 1;
+		goto out;
+	}
+
+	if (!(host = host_add(iri)))
+		host = host_get(iri);
+
+	if (robots_state == ROBOTS_PENDING) {
+		if (config.recursive && config.robots && !host->robot_job && !host->robots)
+			host_add_robotstxt_job(host, iri, "utf-8");
+	} else if (robots_state == ROBOTS_RULES) {
+		// rebuild the rules as robots.txt, so we get them into a ROBOTS structure the usual way
+		wget_buffer_t *buf = wget_buffer_alloc(1024);
+
+		wget_buffer_strcpy(buf, "User-agent: *\n");
+
+		for (uint64_t n = checkpoint_read_uint(cp); n && !cp->error; n--) {
+			size_t len;
+			char *path = checkpoint_read_data(cp, &len);
+
+			if (path) {
+				wget_buffer_printf_append(buf, "Disallow: %s\n", path);
+				xfree(path);
+			}
+		}
+
+		if (!host->robots && !host->robot_job)
+			host->robots = wget_robots_parse(buf->data, PACKAGE_NAME);
+
+		wget_buffer_free(&buf);
+	}
+
+out:
+	wget_iri_free(&iri);
+	xfree(port);
+	xfree(hostname);
+	xfree(scheme);
+
+	return cp->error ? NULL : host;
+}
+
+int hosts_load(CHECKPOINT *cp)
+{
+	uint64_t nhosts;
+
+	if (checkpoint_read_uint(cp) != sizeof(SPILL_RECORD)) {
+		error_printf(_("Checkpoint has been written on a different platform\n"));
+		return -1;
+	}
+
+	for (nhosts = checkpoint_read_uint(cp); nhosts && !cp->error; nhosts--) {
+		HOST *host = _host_load(cp);
+		char *data;
+		size_t size;
+
+		if (!host)
+			break;
+
+		while ((data = checkpoint_read_data(cp, &size)) && size) {
+			wget_thread_mutex_lock(&hosts_mutex);
+			if (_host_restore_jobs(host, data, size))
+				cp->error = 1;
+			wget_thread_mutex_unlock(&hosts_mutex);
+			xfree(data);
+		}
+
+		xfree(data);
+	}
+
+	return cp->error ? -1 : 0;
+}
@@ -42,10 +42,51 @@
 //#include "wget_log.h"
 #include "wget_job.h"
 
+// whether 'iri' belongs to one of the mirrors of 'metalink'
+static int _is_mirror_iri(const wget_metalink_t *metalink, const wget_iri_t *iri)
+{
+	for (int it = 0; metalink && it < wget_vector_size(metalink->mirrors); it++) {
+		wget_metalink_mirror_t *mirror = wget_vector_get(metalink->mirrors, it);
+
+		if (mirror->iri == iri)
+			return 1;
+	}
+
+	return 0;
+}
+
+// release the piece hash of an aborted download
+void part_hash_free(PART *part)
+{
+	if (part->hashing) {
+		unsigned char digest[64]; // large enough for sha-512
+
+		wget_hash_deinit(part->hash, digest);
+		part->hashing = 0;
+	}
+
+	wget_xfree(part->hash);
+}
+
+static void _parts_clear(JOB *job)
+{
+	for (int it = 0; it < wget_vector_size(job->parts); it++)
+		part_hash_free(wget_vector_get(job->parts, it));
+
+	wget_vector_clear(job->parts);
+}
+
 void job_free(JOB *job)
 {
+	// while downloading parts, 'iri' points to the mirror currently used
+	if (!_is_mirror_iri(job->metalink, job->iri))
+		wget_iri_free(&job->iri);
+
+	xfree(job->referer);
 	wget_http_free_challenges(&job->challenges);
 	wget_metalink_free(&job->metalink);
+	xfree(job->mirror_stats);
+	_parts_clear(job);
 	wget_vector_free(&job->parts);
 	xfree(job->local_filename);
 }
@@ -65,7 +106,7 @@ void job_create_parts(JOB *job)
 	if (!job->parts)
 		job->parts = wget_vector_create(wget_vector_size(metalink->pieces), 4, NULL);
 	else
-		wget_vector_clear(job->parts);
+		_parts_clear(job);
 
 	fsize = metalink->size;
 
@@ -164,7 +205,7 @@ int job_validate_file(JOB *job)
 	if (!job->parts)
 		job->parts = wget_vector_create(wget_vector_size(metalink->pieces), 4, NULL);
 	else
-		wget_vector_clear(job->parts);
+		_parts_clear(job);
 
 	fsize = metalink->size;
 
@@ -265,3 +306,157 @@ JOB *job_init(JOB *job, wget_iri_t *iri)
 	job->iri = iri;
 	return job;
 }
+
+/*
+ * Metalink mirror selection
+ *
+ * While the parts of a file are downloaded, we measure per mirror the time to connect, the throughput
+ * and the number of consecutive failures. The next part goes to the mirror with the lowest expected
+ * download time. Mirrors that haven't been measured yet are probed first (in order of priority),
+ * a failed probe puts the mirror behind the measured ones and mirrors that failed repeatedly are only
+ * used when nothing else is left.
+ */
+
+// a mirror that failed that many times in a row is demoted
+#define MIRROR_MAX_FAILURES 3
+
+struct MIRROR_STATS {
+	long long
+		connect_ms, // smoothed time to connect in milliseconds
+		rate; // smoothed throughput of a single download in bytes per second, 0 if not measured yet
+	int
+		failures, // number of consecutive failures
+		inuse; // number of downloads from this mirror in progress
+};
+
+static wget_thread_mutex_t
+	mirrors_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+
+// exponentially weighted moving average, the first sample is taken as is
+static long long _smooth(long long avg, long long sample)
+{
+	return avg ? (avg * 3 + sample) / 4 : sample;
+}
+
+// must be called with mirrors_mutex locked
+static struct MIRROR_STATS *_mirror_stats(JOB *job, int mirror)
+{
+	if (!job->mirror_stats)
+		job->mirror_stats = wget_calloc(wget_vector_size(job->metalink->mirrors), sizeof(struct MIRROR_STATS));
+
+	return &job->mirror_stats[mirror];
+}
+
+// lower is better: probe unmeasured mirrors, then the fastest ones, then those we don't want to use
+static int _mirror_class(JOB *job, PART *part, int mirror)
+{
+	struct MIRROR_STATS *stats = _mirror_stats(job, mirror);
+
+	if (stats->failures >= MIRROR_MAX_FAILURES)
+		return 4;
+	if (part->twin && part->twin->mirror == mirror)
+		return 3; // endgame: the twin is already downloading from there
+	if (!stats->rate)
+		return stats->inuse || stats->failures ? 2 : 0; // a probe is in progress or failed
+	return 1;
+}
+
+// expected time to download 'part' from a measured mirror in milliseconds
+static long long _mirror_cost(JOB *job, PART *part, int mirror)
+{
+	struct MIRROR_STATS *stats = _mirror_stats(job, mirror);
+
+	return stats->connect_ms + (long long) host_part_length(part) * 1000 / stats->rate;
+}
+
+// fill 'order' with the indices of the metalink mirrors, the one to try first at the beginning
+void job_rank_mirrors(JOB *job, PART *part, int *order)
+{
+	int count = wget_vector_size(job->metalink->mirrors);
+	int class[count];
+	long long cost[count];
+
+	wget_thread_mutex_lock(&mirrors_mutex);
+
+	// insertion sort, stable to keep the priority order within a class
+	for (int it = 0; it < count; it++) {
+		int pos = it;
+
+		class[it] = _mirror_class(job, part, it);
+		if (class[it] == 1)
+			cost[it] = _mirror_cost(job, part, it);
+		else if (class[it] == 2)
+			cost[it] = job->mirror_stats[it].inuse + job->mirror_stats[it].failures; // spread the downloads while nothing has been measured
+		else
+			cost[it] = 0;
+
+		for (; pos > 0; pos--) {
+			int prev = order[pos - 1];
+
+			if (class[prev] < class[it] || (class[prev] == class[it] && cost[prev] <= cost[it]))
+				break;
+
+			order[pos] = prev;
+		}
+
+		order[pos] = it;
+	}
+
+	wget_thread_mutex_unlock(&mirrors_mutex);
+}
+
+// the download of 'part' from 'mirror' starts
+void job_mirror_connected(JOB *job, PART *part, int mirror, long long connect_ms)
+{
+	wget_thread_mutex_lock(&mirrors_mutex);
+
+	struct MIRROR_STATS *stats = _mirror_stats(job, mirror);
+
+	stats->connect_ms = _smooth(stats->connect_ms, connect_ms ? connect_ms : 1);
+	stats->inuse++;
+
+	part->mirror = mirror;
+	part->started = wget_get_timemillis();
+
+	wget_thread_mutex_unlock(&mirrors_mutex);
+}
+
+// failed to connect to 'mirror'
+void job_mirror_failed(JOB *job, int mirror)
+{
+	wget_thread_mutex_lock(&mirrors_mutex);
+	_mirror_stats(job, mirror)->failures++;
+	wget_thread_mutex_unlock(&mirrors_mutex);
+}
+
+// the download of 'part' ended, 'failed' if the mirror is to blame
+void job_mirror_finished(JOB *job, PART *part, int failed)
+{
+	long long ms;
+
+	if (!part->started)
+		return;
+
+	ms = wget_get_timemillis() - part->started;
+	part->started = 0;
+
+	wget_thread_mutex_lock(&mirrors_mutex);
+
+	struct MIRROR_STATS *stats = _mirror_stats(job, part->mirror);
+
+	stats->inuse--;
+
+	// also a download that has been cut short tells us something about the mirror
+	if (part->received > 0)
+		stats->rate = _smooth(stats->rate, (long long) part->received * 1000 / (ms ? ms : 1));
+
+	if (failed)
+		stats->failures++;
+	else
+		stats->failures = 0;
+
+	debug_printf("mirror %d: %lld bytes/s, connect %lld ms, %d failures\n",
+		part->mirror, stats->rate, stats->connect_ms, stats->failures);
+
+	wget_thread_mutex_unlock(&mirrors_mutex);
+}
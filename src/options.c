@@ -109,9 +109,17 @@ static int G_GNUC_WGET_NORETURN print_help(G_GNUC_WGET_UNUSED option_t opt, G_GN
 		"  -r  --recursive         Recursive download. (default: off)\n"
 		"  -H  --span-hosts        Span hosts that were not given on the command line. (default: off)\n"
 		"      --max-threads       Max. concurrent download threads. (default: 5) (NEW!)\n"
+		"      --max-host-connections  Max. concurrent downloads from one host, adapted to the server's responsiveness, 0 = no limit. (default: 0) (NEW!)\n"
+		"      --engine            Run downloaders as 'thread's or as tasks on 'event' loops. (default: thread) (NEW!)\n"
+		"      --event-threads     Number of event loop threads for --engine=event. (default: number of CPUs) (NEW!)\n"
+		"      --pool-max-idle     Max. idle keep-alive connections kept per host, 0 disables the pool. (default: 4) (NEW!)\n"
+		"      --pool-idle-timeout Close pooled idle connections after this number of seconds. (default: 15) (NEW!)\n"
+		"      --preconnect        Max. connections to new hosts opened in advance at a time, 0 disables. (default: 0) (NEW!)\n"
 		"      --max-redirect      Max. number of redirections to follow. (default: 20)\n"
 		"  -T  --timeout           General network timeout in seconds.\n"
 		"      --dns-timeout       DNS lookup timeout in seconds.\n"
+		"      --dns-servers       Comma-separated list of name servers to send DNS queries to. (default: system resolver) (NEW!)\n"
+		"      --dns-prefetch      Resolve host names in the background when they are first seen. (default: on) (NEW!)\n"
 		"      --connect-timeout   Connect timeout in seconds.\n"
 		"      --read-timeout      Read and write timeout in seconds.\n"
 		"  -O  --output-document   File where downloaded content is written to, '-'  for STDOUT.\n"
@@ -153,13 +161,23 @@ static int G_GNUC_WGET_NORETURN print_help(G_GNUC_WGET_UNUSED option_t opt, G_GN
 		"      --ignore-case       Ignore case when matching files. (default: off)\n"
 		"  -k  --convert-links     Convert embedded URLs to local URLs. (default: off)\n"
 		"  -K  --backup-converted  When converting, keep the original file with a .orig suffix. (default: off)\n"
-		"  -w  --wait              Wait number of seconds between downloads (per thread). (default: 0)\n"
-		"      --waitretry         Wait up to number of seconds after error (per thread). (default: 10)\n"
-		"      --random-wait       Wait 0.5 up to 1.5*<--wait> seconds between downloads (per thread). (default: off)\n"
+		"  -w  --wait              Wait number of seconds between downloads (per host). (default: 0)\n"
+		"      --waitretry         Wait up to number of seconds after error (per host). (default: 10)\n"
+		"      --random-wait       Wait 0.5 up to 1.5*<--wait> seconds between downloads (per host). (default: off)\n"
+		"      --limit-rate        Limit the download rate of all downloads together (bytes per second). (default: 0 = no limit) (NEW!)\n"
+		"      --limit-rate-per-host  Limit the download rate from each host (bytes per second). (default: 0 = no limit) (NEW!)\n"
 		"      --dns-caching       Caching of domain name lookups. (default: on)\n"
+		"      --dns-cache-file    Set file for DNS caching across runs. (default: none) (NEW!)\n"
+		"      --dns-cache-size    Max. number of DNS cache entries, 0 for no limit. (default: 10000) (NEW!)\n"
 		"      --tcp-fastopen      Enable TCP Fast Open (TFO). (default: on)\n"
 		"      --iri               Wget dummy option, you can't switch off international support\n"
 		"      --robots            Respect robots.txt standard for recursive downloads. (default: on)\n"
+		"      --compact-blacklist Remember seen URLs by fingerprint only, without exact verification. (default: off) (NEW!)\n"
+		"      --max-jobs-in-memory  Max. queued jobs kept in memory, more are spilled to disk, 0 for no limit. (default: 0) (NEW!)\n"
+		"      --checkpoint-file   File to save the state of a recursive download to, regularly and on exit.\n"
+		"                          Switches off Metalink. (NEW!)\n"
+		"      --checkpoint-interval  Save the state every number of seconds, 0 only on exit. (default: 300) (NEW!)\n"
+		"      --resume-crawl      Continue the download saved in --checkpoint-file. (default: off) (NEW!)\n"
 		"      --restrict-file-names  unix, windows, nocontrol, ascii, lowercase, uppercase, none\n"
 		"  -m  --mirror            Turn on mirroring options -r -N -l inf\n"
 		"      --follow-tags       Scan additional tag/attributes for URLs, e.g. --follow-tags=\"img/data-500px,img/data-hires\n"
@@ -181,6 +199,7 @@ static int G_GNUC_WGET_NORETURN print_help(G_GNUC_WGET_UNUSED option_t opt, G_GN
 		"                          Download the list with:\n"
 		"                          wget -O suffixes.txt http://mxr.mozilla.org/mozilla-central/source/netwerk/dns/effective_tld_names.dat?raw=1\n"
 		"      --http-keep-alive   Keep connection open for further requests. (default: on)\n"
+		"      --http1-pipeline    Max. number of pipelined requests on HTTP/1.1 connections. (default: 0 = off) (NEW!)\n"
 		"      --header            Insert input string as a HTTP header in all requests\n"
 		"      --save-headers      Save the response headers in front of the response data. (default: off)\n"
 		"      --referer           Include Referer: url in HTTP requets. (default: off)\n"
@@ -207,6 +226,7 @@ static int G_GNUC_WGET_NORETURN print_help(G_GNUC_WGET_UNUSED option_t opt, G_GN
 		"      --private-key-type  Type of the private key (PEM or DER). (default: PEM)\n"
 		"      --ca-certificate    File with bundle of PEM CA certificates.\n"
 		"      --ca-directory      Directory with PEM CA certificates.\n"
+		"      --ca-cache-file     File to cache the CA certificates of --ca-directory in. (default: none) (NEW!)\n"
 		"      --crl-file          File with PEM CRL certificates.\n"
 		"      --random-file       File to be used as source of random data.\n"
 		"      --egd-file          File to be used as socket for random data from Entropy Gathering Daemon.\n"
@@ -217,10 +237,14 @@ static int G_GNUC_WGET_NORETURN print_help(G_GNUC_WGET_UNUSED option_t opt, G_GN
 		"      --ocsp-stapling     Use OCSP stapling to verify the server's certificate. (default: on)\n"
 		"      --ocsp              Use OCSP server access to verify server's certificate. (default: on)\n"
 		"      --ocsp-file         Set file for OCSP chaching. (default: ~/.wget-ocsp)\n"
+		"      --ocsp-server       Set OCSP server to ask instead of the one named in the certificates. (default: none) (NEW!)\n"
+		"      --ocsp-soft-fail    Accept certificates if the OCSP server does not answer in time. (default: on) (NEW!)\n"
 		"      --http2             Use HTTP/2 protocol if possible. (default: on)\n"
 		"      --tls-false-start   Enable TLS False Start (needs GnuTLS 3.5+). (default: on)\n"
 		"      --tls-resume        Enable TLS Session Resumption. (default: on)\n"
 		"      --tls-session-file  Set file for TLS Session caching. (default: ~/.wget-session)\n"
+		"      --tls-early-data    Send GET/HEAD requests as TLS 1.3 early data (0-RTT) when resuming a session. (default: off) (NEW!)\n"
+		"      --ktls              Let the kernel decrypt HTTPS bodies (kTLS) and splice them into the files. (default: off) (NEW!)\n"
 		"\n");
 	puts(
 		"Directory options:\n"
@@ -624,6 +648,18 @@ static int parse_prefer_family(option_t opt, const char *val)
 	return 0;
 }
 
+static int parse_engine(option_t opt, const char *val)
+{
+	if (!val || !wget_strcasecmp_ascii(val, "thread"))
+		*((char *)opt->var) = ENGINE_THREAD;
+	else if (!wget_strcasecmp_ascii(val, "event"))
+		*((char *)opt->var) = ENGINE_EVENT;
+	else
+		error_printf_exit("Unknown download engine '%s'\n", val);
+
+	return 0;
+}
+
 // default values for config options (if not 0 or NULL)
 struct config config = {
 	.connect_timeout = -1,
@@ -631,7 +667,12 @@ struct config config = {
 	.read_timeout = -1,
 	.max_redirect = 20,
 	.max_threads = 5,
+	.checkpoint_interval = 300000,
+	.pool_idle_timeout = 15000,
+	.pool_max_idle = 4,
 	.dns_caching = 1,
+	.dns_prefetch = 1,
+	.dns_cache_size = 10000,
 	.tcp_fastopen = 1,
 	.user_agent = PACKAGE_NAME"/"PACKAGE_VERSION,
 	.verbose = 1,
@@ -657,10 +698,10 @@ struct config config = {
 #if defined WITH_LIBNGHTTP2
 	.http2 = 1,
 	.http2_request_window = 30,
-	.http1_request_window = 10,
 #endif
 	.ocsp = 1,
 	.ocsp_stapling = 1,
+	.ocsp_soft_fail = 1,
 	.netrc = 1,
 	.waitretry = 10 * 1000,
 	.metalink = 1,
@@ -680,6 +721,7 @@ static const struct optionw options[] = {
 	{ "backups", &config.backups, parse_integer, 0, 0 },
 	{ "base", &config.base_url, parse_string, 1, 'B' },
 	{ "bind-address", &config.bind_address, parse_string, 1, 0 },
+	{ "ca-cache-file", &config.ca_cache_file, parse_string, 1, 0 },
 	{ "ca-certificate", &config.ca_cert, parse_string, 1, 0 },
 	{ "ca-directory", &config.ca_directory, parse_string, 1, 0 },
 	{ "cache", &config.cache, parse_bool, 0, 0 },
@@ -687,8 +729,11 @@ static const struct optionw options[] = {
 	{ "certificate-type", &config.cert_type, parse_cert_type, 1, 0 },
 	{ "check-certificate", &config.check_certificate, parse_bool, 0, 0 },
 	{ "check-hostname", &config.check_hostname, parse_bool, 0, 0 },
+	{ "checkpoint-file", &config.checkpoint_file, parse_string, 1, 0 },
+	{ "checkpoint-interval", &config.checkpoint_interval, parse_timeout, 1, 0 },
 	{ "chunk-size", &config.chunk_size, parse_numbytes, 1, 0 },
 	{ "clobber", &config.clobber, parse_bool, 0, 0 },
+	{ "compact-blacklist", &config.compact_blacklist, parse_bool, 0, 0 },
 	{ "config", &config.config_files, parse_stringlist, 1, 0}, // for backward compatibility only
 	{ "config-file", &config.config_files, parse_stringlist, 1, 0},
 	{ "connect-timeout", &config.connect_timeout, parse_timeout, 1, 0 },
@@ -705,10 +750,16 @@ static const struct optionw options[] = {
 	{ "delete-after", &config.delete_after, parse_bool, 0, 0 },
 	{ "directories", &config.directories, parse_bool, 0, 0 },
 	{ "directory-prefix", &config.directory_prefix, parse_string, 1, 'P' },
+	{ "dns-cache-file", &config.dns_cache_file, parse_string, 1, 0 },
+	{ "dns-cache-size", &config.dns_cache_size, parse_integer, 1, 0 },
 	{ "dns-caching", &config.dns_caching, parse_bool, 0, 0 },
+	{ "dns-prefetch", &config.dns_prefetch, parse_bool, 0, 0 },
+	{ "dns-servers", &config.dns_servers, parse_string, 1, 0 },
 	{ "dns-timeout", &config.dns_timeout, parse_timeout, 1, 0 },
 	{ "domains", &config.domains, parse_stringlist, 1, 'D' },
 	{ "egd-file", &config.egd_file, parse_string, 1, 0 },
+	{ "engine", &config.engine, parse_engine, 1, 0 },
+	{ "event-threads", &config.event_threads, parse_integer, 1, 0 },
 	{ "exclude-domains", &config.exclude_domains, parse_stringlist, 1, 0 },
 	{ "execute", NULL, parse_execute, 1, 'e' },
 	{ "follow-tags", &config.follow_tags, parse_taglist, 1, 0 },
@@ -731,6 +782,7 @@ static const struct optionw options[] = {
 	{ "http-password", &config.http_password, parse_string, 1, 0 },
 	{ "http-proxy", &config.http_proxy, parse_string, 1, 0 },
 	{ "http-user", &config.http_username, parse_string, 1, 0 },
+	{ "http1-pipeline", &config.http1_pipeline, parse_integer, 1, 0 },
 	{ "http2", &config.http2, parse_bool, 0, 0 },
 	{ "https-only", &config.https_only, parse_bool, 0, 0 },
 	{ "https-proxy", &config.https_proxy, parse_string, 1, 0 },
@@ -742,9 +794,14 @@ static const struct optionw options[] = {
 	{ "input-file", &config.input_file, parse_string, 1, 'i' },
 	{ "iri", NULL, parse_bool, 0, 0 }, // Wget compatibility, in fact a do-nothing option
 	{ "keep-session-cookies", &config.keep_session_cookies, parse_bool, 0, 0 },
+	{ "ktls", &config.ktls, parse_bool, 0, 0 },
 	{ "level", &config.level, parse_integer, 1, 'l' },
+	{ "limit-rate", &config.limit_rate, parse_numbytes, 1, 0 },
+	{ "limit-rate-per-host", &config.limit_rate_per_host, parse_numbytes, 1, 0 },
 	{ "load-cookies", &config.load_cookies, parse_string, 1, 0 },
 	{ "local-encoding", &config.local_encoding, parse_string, 1, 0 },
+	{ "max-host-connections", &config.max_host_connections, parse_integer, 1, 0 },
+	{ "max-jobs-in-memory", &config.max_jobs_in_memory, parse_integer, 1, 0 },
 	{ "max-redirect", &config.max_redirect, parse_integer, 1, 0 },
 	{ "max-threads", &config.max_threads, parse_integer, 1, 0 },
 	{ "metalink", &config.metalink, parse_bool, 0, 0 },
@@ -754,14 +811,19 @@ static const struct optionw options[] = {
 	{ "netrc-file", &config.netrc_file, parse_string, 1, 0 },
 	{ "ocsp", &config.ocsp, parse_bool, 0, 0 },
 	{ "ocsp-file", &config.ocsp_file, parse_string, 1, 0 },
+	{ "ocsp-server", &config.ocsp_server, parse_string, 1, 0 },
+	{ "ocsp-soft-fail", &config.ocsp_soft_fail, parse_bool, 0, 0 },
 	{ "ocsp-stapling", &config.ocsp_stapling, parse_bool, 0, 0 },
 	{ "output-document", &config.output_document, parse_string, 1, 'O' },
 	{ "output-file", &config.logfile, parse_string, 1, 'o' },
 	{ "page-requisites", &config.page_requisites, parse_bool, 0, 'p' },
 	{ "parent", &config.parent, parse_bool, 0, 0 },
 	{ "password", &config.password, parse_string, 1, 0 },
+	{ "pool-idle-timeout", &config.pool_idle_timeout, parse_timeout, 1, 0 },
+	{ "pool-max-idle", &config.pool_max_idle, parse_integer, 1, 0 },
 	{ "post-data", &config.post_data, parse_string, 1, 0 },
 	{ "post-file", &config.post_file, parse_string, 1, 0 },
+	{ "preconnect", &config.preconnect, parse_integer, 1, 0 },
 	{ "prefer-family", &config.preferred_family, parse_prefer_family, 1, 0 },
 	{ "private-key", &config.private_key, parse_string, 1, 0 },
 	{ "private-key-type", &config.private_key_type, parse_cert_type, 1, 0 },
@@ -777,6 +839,7 @@ static const struct optionw options[] = {
 	{ "reject", &config.reject_patterns, parse_stringlist, 1, 'R' },
 	{ "remote-encoding", &config.remote_encoding, parse_string, 1, 0 },
 	{ "restrict-file-names", &config.restrict_file_names, parse_restrict_names, 1, 0 },
+	{ "resume-crawl", &config.resume_crawl, parse_bool, 0, 0 },
 	{ "robots", &config.robots, parse_bool, 0, 0 },
 	{ "save-cookies", &config.save_cookies, parse_string, 1, 0 },
 	{ "save-headers", &config.save_headers, parse_bool, 0, 0 },
@@ -788,6 +851,7 @@ static const struct optionw options[] = {
 	{ "tcp-fastopen", &config.tcp_fastopen, parse_bool, 0, 0 },
 	{ "timeout", NULL, parse_timeout, 1, 'T' },
 	{ "timestamping", &config.timestamping, parse_bool, 0, 'N' },
+	{ "tls-early-data", &config.tls_early_data, parse_bool, 0, 0 },
 	{ "tls-false-start", &config.tls_false_start, parse_bool, 0, 0 },
 	{ "tls-resume", &config.tls_resume, parse_bool, 0, 0 },
 	{ "tls-session-file", &config.tls_session_file, parse_string, 1, 0 },
@@ -1381,6 +1445,20 @@ int init(int argc, const char **argv)
 	if (config.max_threads < 1)
 		config.max_threads = 1;
 
+	if (config.max_host_connections < 0)
+		config.max_host_connections = 0;
+
+	if (config.resume_crawl && !config.checkpoint_file) {
+		error_printf(_("--resume-crawl needs --checkpoint-file\n"));
+		return -1;
+	}
+
+	// metalink jobs (also the parts of --chunk-size) are not part of a checkpoint, a resumed crawl would lose them
+	if (config.checkpoint_file && (config.chunk_size || config.force_metalink)) {
+		error_printf(_("--checkpoint-file can't be combined with --chunk-size or --force-metalink\n"));
+		return -1;
+	}
+
 	// truncate output document
 	if (config.output_document && strcmp(config.output_document,"-")) {
 		int fd = open(config.output_document, O_WRONLY | O_TRUNC);
@@ -1405,6 +1483,10 @@ int init(int argc, const char **argv)
 		error_printf(_("Failed to set https proxies %s\n"), config.https_proxy);
 		return -1;
 	}
+	// names are resolved by the proxy, don't resolve them in advance
+	if (config.http_proxy || config.https_proxy || !config.dns_caching)
+		config.dns_prefetch = 0;
+
 	xfree(config.http_proxy);
 	xfree(config.https_proxy);
 
@@ -1446,7 +1528,7 @@ int init(int argc, const char **argv)
 		config.level = 1;
 	}
 
-	if (config.mirror)
+	if (config.mirror || config.checkpoint_file)
 		config.metalink = 0;
 
 	if ((rc = wget_net_init()))
@@ -1457,8 +1539,14 @@ int init(int argc, const char **argv)
 	wget_tcp_set_connect_timeout(NULL, config.connect_timeout);
 	wget_tcp_set_dns_timeout(NULL, config.dns_timeout);
 	wget_tcp_set_dns_caching(NULL, config.dns_caching);
+	if (config.dns_servers && wget_dns_set_servers(config.dns_servers) < 0)
+		return -1;
+	wget_dns_cache_set_max_size(config.dns_cache_size);
+	if (config.dns_caching && config.dns_cache_file)
+		wget_dns_cache_load(config.dns_cache_file);
 	wget_tcp_set_tcp_fastopen(NULL, config.tcp_fastopen);
 	wget_tcp_set_tls_false_start(NULL, config.tls_false_start);
+	wget_tcp_set_tls_early_data(NULL, config.tls_resume && config.tls_early_data);
 	wget_tcp_set_bind_address(NULL, config.bind_address);
 	if (config.inet4_only)
 		wget_tcp_set_family(NULL, WGET_NET_FAMILY_IPV4);
@@ -1477,13 +1565,20 @@ int init(int argc, const char **argv)
 	wget_ssl_set_config_int(WGET_SSL_PRINT_INFO, config.debug);
 	wget_ssl_set_config_int(WGET_SSL_OCSP, config.ocsp);
 	wget_ssl_set_config_int(WGET_SSL_OCSP_STAPLING, config.ocsp_stapling);
+	wget_ssl_set_config_int(WGET_SSL_OCSP_SOFT_FAIL, config.ocsp_soft_fail);
+	wget_ssl_set_config_int(WGET_SSL_KTLS, config.ktls);
+	// waiting for a concurrent TLS handshake would block a whole event loop
+	if (config.engine == ENGINE_EVENT)
+		wget_ssl_set_config_int(WGET_SSL_SESSION_WAIT, 0);
 	wget_ssl_set_config_string(WGET_SSL_SECURE_PROTOCOL, config.secure_protocol);
 	wget_ssl_set_config_string(WGET_SSL_DIRECT_OPTIONS, config.gnutls_options);
 	wget_ssl_set_config_string(WGET_SSL_CA_DIRECTORY, config.ca_directory);
 	wget_ssl_set_config_string(WGET_SSL_CA_FILE, config.ca_cert);
+	wget_ssl_set_config_string(WGET_SSL_CA_CACHE_FILE, config.ca_cache_file);
 	wget_ssl_set_config_string(WGET_SSL_CERT_FILE, config.cert_file);
 	wget_ssl_set_config_string(WGET_SSL_KEY_FILE, config.private_key);
 	wget_ssl_set_config_string(WGET_SSL_CRL_FILE, config.crl_file);
+	wget_ssl_set_config_string(WGET_SSL_OCSP_SERVER, config.ocsp_server);
 	wget_ssl_set_config_string(WGET_SSL_OCSP_CACHE, (const char *)config.ocsp_db);
 	wget_ssl_set_config_string(WGET_SSL_ALPN, config.http2 ? "h2,h2-16,h2-14,http/1.1" : NULL);
 	wget_ssl_set_config_string(WGET_SSL_SESSION_CACHE, (const char *)config.tls_session_db);
@@ -1542,6 +1637,9 @@ void deinit(void)
 	wget_ssl_deinit();
 
 	xfree(config.cookie_suffixes);
+	xfree(config.dns_servers);
+	xfree(config.dns_cache_file);
+	xfree(config.checkpoint_file);
 	xfree(config.load_cookies);
 	xfree(config.save_cookies);
 	xfree(config.hsts_file);
@@ -1554,8 +1652,10 @@ void deinit(void)
 	xfree(config.output_document);
 	xfree(config.ca_cert);
 	xfree(config.ca_directory);
+	xfree(config.ca_cache_file);
 	xfree(config.cert_file);
 	xfree(config.crl_file);
+	xfree(config.ocsp_server);
 	xfree(config.egd_file);
 	xfree(config.private_key);
 	xfree(config.random_file);
@@ -0,0 +1,990 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Keep-alive connection pool shared by all downloaders
+ *
+ * A downloader that is done with a connection (e.g. because it moves on to another host)
+ * checks it in here instead of closing it. The next downloader that needs a connection to the
+ * same scheme/host/port checks it out and saves the TCP and TLS handshakes.
+ *
+ * Idle connections are closed after --pool-idle-timeout, at most --pool-max-idle connections
+ * are kept per scheme/host/port.
+ *
+ * HTTP/2 connections are not handed over but shared: all downloaders working on the same
+ * scheme/host/port submit their requests as streams of one session. Only one downloader at a
+ * time drives the session (sending or receiving). Responses it receives for other downloaders
+ * are queued until their owners pick them up, so each job is still processed by the downloader
+ * that requested it.
+ *
+ * When a new host shows up, a few preconnect threads open a connection to it in the background
+ * (--preconnect) and check it in here, so the DNS, TCP and TLS handshakes are done by the time a
+ * downloader picks the host's first job. Only one connection per scheme/host/port is opened that
+ * way and only if the pool has none yet.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <wget.h>
+
+#include "wget_main.h"
+#include "wget_options.h"
+#include "wget_job.h"
+#include "wget_event.h"
+#include "wget_pool.h"
+
+typedef struct SHARED_CONN SHARED_CONN;
+
+typedef struct {
+	const char
+		*scheme,
+		*host,
+		*port;
+	wget_vector_t
+		*idle; // IDLE_CONN, oldest first
+	SHARED_CONN
+		*shared; // HTTP/2 connection used by several downloaders, or NULL
+	wget_iri_t
+		*preconnect_iri; // what to preconnect to while 'preconnect_queued'
+	unsigned char
+		connecting : 1, // a downloader is opening a connection that might become the shared one
+		preconnect_queued : 1, // waiting in 'preconnect_queue'
+		preconnecting : 1, // a preconnect thread is opening a connection
+		http1 : 1; // the server didn't negotiate HTTP/2, connections are not shared
+} POOL;
+
+struct SHARED_CONN {
+	wget_http_connection_t
+		*conn;
+	POOL
+		*pool;
+	wget_vector_t
+		*responses, // received responses, not yet picked up by the owning downloader
+		*waiters; // EVENT_TASK waiting for 'busy' to be cleared
+	wget_thread_mutex_t
+		mutex; // protects all members below
+	wget_thread_cond_t
+		cond; // signalled when 'busy' is cleared or a response has been queued
+	long long
+		since; // timestamp of the last detach, when no downloader is attached (ms)
+	int
+		refs, // number of attached downloaders, protected by the pool mutex
+		streams, // number of requests sent but not yet picked up
+		max_streams; // SETTINGS_MAX_CONCURRENT_STREAMS of the server
+	unsigned char
+		busy : 1, // a downloader is sending or receiving
+		broken : 1; // an error occurred, don't use for new requests
+};
+
+typedef struct {
+	wget_http_connection_t
+		*conn;
+	long long
+		since; // timestamp of check in (ms)
+} IDLE_CONN;
+
+static wget_hashmap_t
+	*pools;
+static wget_thread_mutex_t
+	mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static wget_thread_cond_t
+	connect_cond = WGET_THREAD_COND_INITIALIZER; // signalled when a pool's 'connecting' is cleared
+static wget_vector_t
+	*connect_waiters, // EVENT_TASK waiting for 'connecting' or 'preconnecting' to be cleared
+	*preconnect_queue; // POOL to open a connection for, oldest first
+static long long
+	last_sweep; // timestamp of the last scan for expired connections
+static int
+	nidle, // number of idle connections in all pools
+	hits,
+	shared_hits, // attached to a shared HTTP/2 connection
+	misses,
+	stale, // closed by the server while idle
+	expired,
+	evicted, // pool of the host was full
+	preconnected,
+	preconnect_failed;
+
+#define PRECONNECT_THREADS_MAX 16 // max. value of --preconnect
+#define PRECONNECT_QUEUE_MAX 64 // hosts further down the queue would likely be idle too long
+
+static wget_thread_cond_t
+	preconnect_cond = WGET_THREAD_COND_INITIALIZER; // signalled when a host has been queued
+static wget_thread_t
+	preconnect_tids[PRECONNECT_THREADS_MAX];
+static int
+	npreconnectors,
+	nidle_preconnectors;
+static unsigned char
+	preconnect_stop;
+
+static unsigned int G_GNUC_WGET_NONNULL_ALL _pool_hash(const POOL *pool)
+{
+	unsigned int h = 0; // use 0 as SALT if hash table attacks doesn't matter
+	const unsigned char *p;
+
+	for (p = (unsigned char *)pool->scheme; p && *p; p++)
+		h = h * 101 + *p;
+
+	for (p = (unsigned char *)pool->port; p && *p; p++)
+		h = h * 101 + *p;
+
+	for (p = (unsigned char *)pool->host; p && *p; p++)
+		h = h * 101 + *p;
+
+	return h;
+}
+
+static int G_GNUC_WGET_NONNULL_ALL _pool_compare(const POOL *pool1, const POOL *pool2)
+{
+	int n;
+
+	if ((n = wget_strcmp(pool1->host, pool2->host)))
+		return n;
+
+	if ((n = wget_strcmp(pool1->port, pool2->port)))
+		return n;
+
+	return wget_strcmp(pool1->scheme, pool2->scheme);
+}
+
+// requests still waiting for a response on 'conn' won't get one any more
+static void _close_conn(wget_http_connection_t **conn)
+{
+	if (*conn) {
+		http_free_pending_requests(*conn);
+		wget_http_close(conn);
+	}
+}
+
+// vector element destructor, the vector frees 'idle' itself
+static void _close_idle_conn(IDLE_CONN *idle)
+{
+	_close_conn(&idle->conn); // an expired shared connection might have unanswered requests
+}
+
+static void _free_response(wget_http_response_t *resp)
+{
+	wget_http_free_request(&resp->req);
+	wget_http_free_response(&resp);
+}
+
+static void _free_shared(SHARED_CONN *shared)
+{
+	wget_vector_free(&shared->responses);
+	wget_vector_free(&shared->waiters);
+	_close_conn(&shared->conn); // requests of all downloaders that will never get a response
+	xfree(shared);
+}
+
+static void _free_pool(POOL *pool)
+{
+	if (pool->shared)
+		_free_shared(pool->shared);
+	wget_vector_free(&pool->idle);
+	wget_iri_free(&pool->preconnect_iri);
+	xfree(pool->host);
+	xfree(pool->port);
+	xfree(pool);
+}
+
+struct _expire_ctx {
+	wget_vector_t
+		*closing;
+	long long
+		deadline;
+};
+
+// move idle connections checked in before 'ctx->deadline' into 'ctx->closing', called with mutex locked
+static int _pool_expire(struct _expire_ctx *ctx, POOL *pool, G_GNUC_WGET_UNUSED void *value)
+{
+	IDLE_CONN *idle;
+
+	while ((idle = wget_vector_get(pool->idle, 0)) && idle->since < ctx->deadline) {
+		wget_vector_add_noalloc(ctx->closing, idle);
+		wget_vector_remove_nofree(pool->idle, 0);
+		nidle--;
+		expired++;
+	}
+
+	// the connection of a detached shared HTTP/2 connection is closed like an idle one
+	if (pool->shared && pool->shared->refs == 0 && pool->shared->since < ctx->deadline) {
+		idle = wget_malloc(sizeof(IDLE_CONN));
+		idle->conn = pool->shared->conn;
+		pool->shared->conn = NULL;
+		wget_vector_add_noalloc(ctx->closing, idle);
+		_free_shared(pool->shared);
+		pool->shared = NULL;
+		expired++;
+	}
+
+	return 0;
+}
+
+// once a second, move connections that idled too long (of all hosts) into '*closing', called with mutex locked
+static void _pool_sweep(long long now, wget_vector_t **closing)
+{
+	if (config.pool_idle_timeout > 0 && now - last_sweep >= 1000) {
+		struct _expire_ctx ctx = { .deadline = now - config.pool_idle_timeout };
+
+		if (!*closing)
+			*closing = wget_vector_create(4, -2, NULL);
+
+		ctx.closing = *closing;
+		wget_hashmap_browse(pools, (wget_hashmap_browse_t)_pool_expire, &ctx);
+		last_sweep = now;
+	}
+}
+
+// closing might need network I/O (TLS close notify), so do it without holding the lock
+static void _close_all(wget_vector_t **closing)
+{
+	if (*closing) {
+		wget_vector_set_destructor(*closing, (wget_vector_destructor_t)_close_idle_conn);
+		wget_vector_free(closing);
+	}
+}
+
+// returns the pool of the scheme/host/port in 'key', creating it if needed, called with mutex locked
+static POOL *_get_pool(const POOL *key)
+{
+	POOL *pool;
+
+	if (!pools) {
+		pools = wget_hashmap_create(16, -2, (wget_hashmap_hash_t)_pool_hash, (wget_hashmap_compare_t)_pool_compare);
+		wget_hashmap_set_key_destructor(pools, (wget_hashmap_key_destructor_t)_free_pool);
+	}
+
+	if (!(pool = wget_hashmap_get(pools, key))) {
+		pool = wget_calloc(1, sizeof(POOL));
+		pool->scheme = key->scheme; // static string
+		pool->host = wget_strdup(key->host);
+		pool->port = wget_strdup(key->port);
+		pool->idle = wget_vector_create(4, -2, NULL);
+		wget_vector_set_destructor(pool->idle, (wget_vector_destructor_t)_close_idle_conn);
+		wget_hashmap_put_noalloc(pools, pool, pool);
+	}
+
+	return pool;
+}
+
+// Returns an idle connection to the scheme/host/port of 'iri', or NULL.
+wget_http_connection_t *pool_checkout(const wget_iri_t *iri)
+{
+	POOL *pool, key = { .scheme = iri->scheme, .host = iri->host, .port = iri->resolv_port };
+	IDLE_CONN *idle;
+	wget_http_connection_t *conn;
+
+	if (!config.pool_max_idle)
+		return NULL;
+
+	for (;;) {
+		wget_thread_mutex_lock(&mutex);
+
+		if (!pools || !(pool = wget_hashmap_get(pools, &key)) || !(idle = wget_vector_get(pool->idle, wget_vector_size(pool->idle) - 1))) {
+			misses++;
+			wget_thread_mutex_unlock(&mutex);
+			return NULL;
+		}
+
+		// the most recently used connection is the least likely to be closed by the server
+		wget_vector_remove_nofree(pool->idle, wget_vector_size(pool->idle) - 1);
+		nidle--;
+
+		conn = idle->conn;
+
+		if (config.pool_idle_timeout > 0 && wget_get_timemillis() - idle->since > config.pool_idle_timeout) {
+			// all other connections in this pool are older
+			expired++;
+			wget_thread_mutex_unlock(&mutex);
+			wget_http_close(&idle->conn);
+			xfree(idle);
+			continue;
+		}
+
+		wget_thread_mutex_unlock(&mutex);
+		xfree(idle);
+
+		// an idle HTTP/1.1 connection becomes readable when the server closed it
+		if (conn->protocol != WGET_PROTOCOL_HTTP_2_0) {
+			int timeout = wget_tcp_get_timeout(conn->tcp), rc;
+
+			wget_tcp_set_timeout(conn->tcp, 0);
+			rc = wget_tcp_ready_2_transfer(conn->tcp, WGET_IO_READABLE);
+
+			// ... or when a TLS 1.3 server sent session tickets after the handshake
+			if (rc > 0 && wget_tcp_get_ssl(conn->tcp)) {
+				char buf[16];
+
+				if (wget_tcp_read(conn->tcp, buf, sizeof(buf)) == 0)
+					rc = wget_tcp_ready_2_transfer(conn->tcp, WGET_IO_READABLE);
+			}
+
+			wget_tcp_set_timeout(conn->tcp, timeout);
+
+			if (rc != 0) {
+				debug_printf("pool: stale connection %s\n", conn->esc_host);
+				wget_http_close(&conn);
+				wget_thread_mutex_lock(&mutex);
+				stale++;
+				wget_thread_mutex_unlock(&mutex);
+				continue;
+			}
+		}
+
+		wget_thread_mutex_lock(&mutex);
+		hits++;
+		wget_thread_mutex_unlock(&mutex);
+
+		debug_printf("pool: reuse connection %s\n", conn->esc_host);
+		return conn;
+	}
+}
+
+// Hands '*conn' over to the pool (or closes it) and sets '*conn' to NULL.
+void pool_checkin(wget_http_connection_t **conn)
+{
+	wget_http_connection_t *c = *conn;
+	POOL *pool, key;
+	IDLE_CONN *idle;
+	wget_vector_t *closing = NULL;
+	long long now;
+
+	if (!c)
+		return;
+
+	*conn = NULL;
+
+	// connections with outstanding requests can't be handed to someone else
+	if (!config.pool_max_idle || !config.keep_alive || c->abort_indicator
+		|| wget_vector_size(c->pending_requests) > 0 || c->pending_http2_requests > 0
+		|| (c->readahead && c->readahead->length))
+	{
+		_close_conn(&c);
+		return;
+	}
+
+	key.scheme = c->scheme;
+	key.host = c->esc_host;
+	key.port = c->port;
+	now = wget_get_timemillis();
+
+	wget_thread_mutex_lock(&mutex);
+
+	pool = _get_pool(&key);
+
+	if (wget_vector_size(pool->idle) >= config.pool_max_idle) {
+		// replace the oldest connection
+		closing = wget_vector_create(4, -2, NULL);
+		wget_vector_add_noalloc(closing, wget_vector_get(pool->idle, 0));
+		wget_vector_remove_nofree(pool->idle, 0);
+		nidle--;
+		evicted++;
+	}
+
+	idle = wget_malloc(sizeof(IDLE_CONN));
+	idle->conn = c;
+	idle->since = now;
+	wget_vector_add_noalloc(pool->idle, idle);
+	nidle++;
+
+	_pool_sweep(now, &closing);
+
+	debug_printf("pool: keep connection %s (%d idle)\n", c->esc_host, nidle);
+
+	wget_thread_mutex_unlock(&mutex);
+
+	_close_all(&closing);
+}
+
+// wake up all downloaders waiting on 'cond' resp. in 'waiters', called with the mutex locked
+static void _wakeup(wget_thread_cond_t *cond, wget_vector_t *waiters)
+{
+	for (int it = 0; it < wget_vector_size(waiters); it++)
+		event_task_wakeup(wget_vector_get(waiters, it));
+
+	wget_vector_clear_nofree(waiters);
+	wget_thread_cond_signal(cond);
+}
+
+// wait for _wakeup(), called with 'mtx' locked
+static void _wait(wget_thread_cond_t *cond, wget_thread_mutex_t *mtx, wget_vector_t *waiters, DOWNLOADER *downloader)
+{
+	if (downloader->task) {
+		// a task must not block its event loop thread
+		wget_vector_add_noalloc(waiters, downloader->task);
+		wget_thread_mutex_unlock(mtx);
+		event_task_wait(0);
+		wget_thread_mutex_lock(mtx);
+
+		// spurious wakeup
+		for (int it = 0; it < wget_vector_size(waiters); it++) {
+			if (wget_vector_get(waiters, it) == downloader->task) {
+				wget_vector_remove_nofree(waiters, it);
+				break;
+			}
+		}
+	} else
+		wget_thread_cond_wait(cond, mtx, 0);
+}
+
+// no more requests on this connection, drop all queued responses, called with shared->mutex locked
+static void _shared_break(SHARED_CONN *shared)
+{
+	shared->broken = 1;
+	wget_vector_clear(shared->responses);
+	_wakeup(&shared->cond, shared->waiters);
+}
+
+static void _shared_detach(SHARED_CONN *shared)
+{
+	wget_vector_t *closing = NULL;
+	long long now = wget_get_timemillis();
+	int broken;
+
+	wget_thread_mutex_lock(&shared->mutex);
+	broken = shared->broken;
+	wget_thread_mutex_unlock(&shared->mutex);
+
+	wget_thread_mutex_lock(&mutex);
+
+	if (--shared->refs == 0 && (broken || !config.pool_max_idle || !config.keep_alive)) {
+		shared->pool->shared = NULL;
+	} else {
+		// keep the connection for the next downloader
+		shared->since = now;
+		shared = NULL;
+	}
+
+	_pool_sweep(now, &closing);
+
+	wget_thread_mutex_unlock(&mutex);
+
+	_close_all(&closing);
+
+	if (shared) {
+		debug_printf("pool: close shared connection %s\n", shared->conn->esc_host);
+		_free_shared(shared);
+	}
+}
+
+// a server might temporarily allow no streams at all, but one request must always be possible
+static int _max_streams(const wget_http_connection_t *conn)
+{
+	return conn->max_concurrent_streams > 0 ? conn->max_concurrent_streams : 1;
+}
+
+// remove 'pool' from the preconnect queue, called with mutex locked
+static void _preconnect_dequeue(POOL *pool)
+{
+	for (int it = 0; it < wget_vector_size(preconnect_queue); it++) {
+		if (wget_vector_get(preconnect_queue, it) == pool) {
+			wget_vector_remove_nofree(preconnect_queue, it);
+			break;
+		}
+	}
+
+	pool->preconnect_queued = 0;
+	wget_iri_free(&pool->preconnect_iri);
+}
+
+// whether connections to the server of 'iri' might negotiate HTTP/2 (via ALPN) and thus could be shared
+static int _may_share(const wget_iri_t *iri, const POOL *pool)
+{
+	return config.http2 && iri->scheme == WGET_IRI_SCHEME_HTTPS && !(pool && pool->http1);
+}
+
+// Connects 'downloader' to the shared HTTP/2 connection or to an idle connection of the scheme/host/port of 'iri'.
+// If NULL is returned, the caller opens a new connection and has to call pool_connected() afterwards.
+wget_http_connection_t *pool_get(DOWNLOADER *downloader, const wget_iri_t *iri)
+{
+	POOL *pool = NULL, key = { .scheme = iri->scheme, .host = iri->host, .port = iri->resolv_port };
+	SHARED_CONN *shared = NULL;
+	wget_vector_t *closing = NULL;
+	int connecting = 0;
+
+	wget_thread_mutex_lock(&mutex);
+
+	for (;;) {
+		if (pools && (pool = wget_hashmap_get(pools, &key)) && pool->shared) {
+			SHARED_CONN *candidate = pool->shared;
+			int broken;
+
+			wget_thread_mutex_lock(&candidate->mutex);
+			broken = candidate->broken;
+			wget_thread_mutex_unlock(&candidate->mutex);
+
+			if (candidate->refs == 0 && config.pool_idle_timeout > 0 && wget_get_timemillis() - candidate->since > config.pool_idle_timeout) {
+				IDLE_CONN *idle = wget_malloc(sizeof(IDLE_CONN));
+
+				if (!closing)
+					closing = wget_vector_create(4, -2, NULL);
+
+				idle->conn = candidate->conn;
+				candidate->conn = NULL;
+				wget_vector_add_noalloc(closing, idle);
+				_free_shared(candidate);
+				pool->shared = NULL;
+				expired++;
+			} else if (!broken) {
+				shared = candidate;
+				break;
+			}
+		}
+
+		if (pool && pool->preconnect_queued) {
+			// connecting right away is faster than waiting for a free preconnect thread
+			_preconnect_dequeue(pool);
+		}
+
+		if (pool && pool->preconnecting) {
+			// the connection is already on its way into the pool
+			if (!connect_waiters)
+				connect_waiters = wget_vector_create(4, -2, NULL);
+
+			_wait(&connect_cond, &mutex, connect_waiters, downloader);
+			continue;
+		}
+
+		if (!_may_share(iri, pool))
+			break;
+
+		if (!pool || !pool->connecting) {
+			// open the connection that the following downloaders share if HTTP/2 has been negotiated
+			pool = _get_pool(&key);
+			pool->connecting = 1;
+			connecting = 1;
+			break;
+		}
+
+		// another downloader is just connecting to this server, no need for a second TCP/TLS handshake
+		if (!connect_waiters)
+			connect_waiters = wget_vector_create(4, -2, NULL);
+
+		_wait(&connect_cond, &mutex, connect_waiters, downloader);
+	}
+
+	if (shared) {
+		shared->refs++;
+		shared_hits++;
+	}
+
+	wget_thread_mutex_unlock(&mutex);
+
+	_close_all(&closing);
+
+	if (shared) {
+		debug_printf("pool: share connection %s (%d downloaders)\n", shared->conn->esc_host, shared->refs);
+		downloader->shared = shared;
+		return downloader->conn = shared->conn;
+	}
+
+	// an idle HTTP/2 connection becomes the shared one
+	if ((downloader->conn = pool_checkout(iri)) && connecting)
+		pool_connected(downloader, iri);
+
+	return downloader->conn;
+}
+
+// Called after opening a connection to the server of 'iri' (successful or not).
+// A new HTTP/2 connection is offered to other downloaders.
+void pool_connected(DOWNLOADER *downloader, const wget_iri_t *iri)
+{
+	wget_http_connection_t *conn = downloader->conn;
+	POOL *pool, key = { .scheme = iri->scheme, .host = iri->host, .port = iri->resolv_port };
+	SHARED_CONN *shared;
+
+	wget_thread_mutex_lock(&mutex);
+
+	pool = _get_pool(&key);
+
+	// while 'connecting' is set, all other downloaders for this server wait in pool_get()
+	if (pool->connecting) {
+		pool->connecting = 0;
+		_wakeup(&connect_cond, connect_waiters);
+	}
+
+	if (!conn || downloader->shared) {
+		wget_thread_mutex_unlock(&mutex);
+		return;
+	}
+
+	if (conn->protocol != WGET_PROTOCOL_HTTP_2_0) {
+		pool->http1 = 1;
+		wget_thread_mutex_unlock(&mutex);
+		return;
+	}
+
+	if (pool->shared) {
+		// the shared connection broke, but still has downloaders attached, keep this one private
+		wget_thread_mutex_unlock(&mutex);
+		return;
+	}
+
+	shared = wget_calloc(1, sizeof(SHARED_CONN));
+	shared->conn = conn;
+	shared->pool = pool;
+	shared->responses = wget_vector_create(16, -2, NULL);
+	wget_vector_set_destructor(shared->responses, (wget_vector_destructor_t)_free_response);
+	shared->waiters = wget_vector_create(4, -2, NULL);
+	wget_thread_mutex_init(&shared->mutex);
+	wget_thread_cond_init(&shared->cond);
+	shared->refs = 1;
+	shared->max_streams = _max_streams(conn);
+	pool->shared = shared;
+
+	wget_thread_mutex_unlock(&mutex);
+
+	downloader->shared = shared;
+	debug_printf("pool: shared connection %s\n", conn->esc_host);
+}
+
+// The downloader doesn't need its connection any more, all responses have been received.
+void pool_release(DOWNLOADER *downloader)
+{
+	SHARED_CONN *shared;
+
+	if (!(shared = downloader->shared)) {
+		pool_checkin(&downloader->conn);
+		return;
+	}
+
+	downloader->shared = NULL;
+	downloader->conn = NULL;
+
+	_shared_detach(shared);
+}
+
+// The downloader had an error with its connection, close it.
+// A shared connection will be closed when the last downloader detached.
+void pool_close(DOWNLOADER *downloader)
+{
+	SHARED_CONN *shared;
+
+	if (!(shared = downloader->shared)) {
+		_close_conn(&downloader->conn);
+		return;
+	}
+
+	downloader->shared = NULL;
+	downloader->conn = NULL;
+
+	wget_thread_mutex_lock(&shared->mutex);
+	_shared_break(shared);
+	wget_thread_mutex_unlock(&shared->mutex);
+
+	_shared_detach(shared);
+}
+
+// Gives 'downloader' exclusive access to its connection for sending a request.
+int pool_lock(DOWNLOADER *downloader)
+{
+	SHARED_CONN *shared;
+
+	if (!(shared = downloader->shared))
+		return WGET_E_SUCCESS;
+
+	wget_thread_mutex_lock(&shared->mutex);
+
+	while (shared->busy && !shared->broken)
+		_wait(&shared->cond, &shared->mutex, shared->waiters, downloader);
+
+	if (shared->broken) {
+		wget_thread_mutex_unlock(&shared->mutex);
+		return WGET_E_UNKNOWN;
+	}
+
+	shared->busy = 1;
+	wget_thread_mutex_unlock(&shared->mutex);
+
+	return WGET_E_SUCCESS;
+}
+
+// Ends pool_lock(), 'sent' tells whether a request has been submitted.
+void pool_unlock(DOWNLOADER *downloader, int sent)
+{
+	SHARED_CONN *shared;
+
+	if (!(shared = downloader->shared))
+		return;
+
+	wget_thread_mutex_lock(&shared->mutex);
+	shared->busy = 0;
+	if (sent)
+		shared->streams++;
+	_wakeup(&shared->cond, shared->waiters);
+	wget_thread_mutex_unlock(&shared->mutex);
+}
+
+// Waits until the server's stream limit allows another request. Only to be called by a downloader without
+// requests in flight, else it might wait for its own responses.
+void pool_wait_stream(DOWNLOADER *downloader)
+{
+	SHARED_CONN *shared;
+
+	if (!(shared = downloader->shared))
+		return;
+
+	wget_thread_mutex_lock(&shared->mutex);
+
+	while (shared->streams >= shared->max_streams && !shared->broken)
+		_wait(&shared->cond, &shared->mutex, shared->waiters, downloader);
+
+	wget_thread_mutex_unlock(&shared->mutex);
+}
+
+// Returns whether 'downloader' may send another request without exceeding the server's stream limit.
+int pool_stream_available(DOWNLOADER *downloader)
+{
+	SHARED_CONN *shared;
+	int available;
+
+	if (!(shared = downloader->shared))
+		return 1;
+
+	wget_thread_mutex_lock(&shared->mutex);
+	available = shared->streams < shared->max_streams;
+	wget_thread_mutex_unlock(&shared->mutex);
+
+	return available;
+}
+
+// take a queued response of a request sent by 'downloader', called with shared->mutex locked
+static wget_http_response_t *_take_response(SHARED_CONN *shared, DOWNLOADER *downloader)
+{
+	for (int it = 0; it < wget_vector_size(shared->responses); it++) {
+		wget_http_response_t *resp = wget_vector_get(shared->responses, it);
+
+		if (((JOB *) resp->req->user_data)->downloader == downloader) {
+			wget_vector_remove_nofree(shared->responses, it);
+			return resp;
+		}
+	}
+
+	return NULL;
+}
+
+// Returns the next response for a request sent by 'downloader' (or NULL on error).
+// On a shared connection, whoever waits for a response and finds the connection idle does the receiving
+// (calling 'receive') and hands responses for other requests over to their downloaders.
+wget_http_response_t *pool_receive(DOWNLOADER *downloader, wget_http_response_t *(*receive)(wget_http_connection_t *))
+{
+	SHARED_CONN *shared;
+	wget_http_response_t *resp;
+
+	if (!(shared = downloader->shared))
+		return receive(downloader->conn);
+
+	wget_thread_mutex_lock(&shared->mutex);
+
+	while (!(resp = _take_response(shared, downloader)) && !shared->broken) {
+		if (shared->busy) {
+			_wait(&shared->cond, &shared->mutex, shared->waiters, downloader);
+			continue;
+		}
+
+		shared->busy = 1;
+		wget_thread_mutex_unlock(&shared->mutex);
+
+		resp = receive(shared->conn);
+
+		wget_thread_mutex_lock(&shared->mutex);
+		shared->busy = 0;
+
+		if (!resp) {
+			_shared_break(shared);
+			break;
+		}
+
+		shared->max_streams = _max_streams(shared->conn);
+
+		if (shared->broken) {
+			// the owner might have given up its job already
+			_free_response(resp);
+			resp = NULL;
+			break;
+		}
+
+		// the owning downloader is attached and waits for it, _take_response() picks it up
+		wget_vector_add_noalloc(shared->responses, resp);
+		_wakeup(&shared->cond, shared->waiters);
+	}
+
+	if (resp) {
+		shared->streams--;
+		_wakeup(&shared->cond, shared->waiters); // a stream became available
+	}
+
+	wget_thread_mutex_unlock(&shared->mutex);
+
+	return resp;
+}
+
+static void *_preconnect_thread(void *p G_GNUC_WGET_UNUSED)
+{
+	wget_http_connection_t *conn;
+	wget_iri_t *iri;
+	POOL *pool;
+	int rc;
+
+	wget_thread_mutex_lock(&mutex);
+
+	while (!preconnect_stop) {
+		if (!(pool = wget_vector_get(preconnect_queue, 0))) {
+			nidle_preconnectors++;
+			wget_thread_cond_wait(&preconnect_cond, &mutex, 0);
+			nidle_preconnectors--;
+			continue;
+		}
+
+		wget_vector_remove_nofree(preconnect_queue, 0);
+		pool->preconnect_queued = 0;
+		pool->preconnecting = 1;
+		iri = pool->preconnect_iri;
+		pool->preconnect_iri = NULL;
+
+		wget_thread_mutex_unlock(&mutex);
+
+		// a complete IRI, so wget_http_open() connects via the proxy like the downloader would
+		conn = NULL;
+		if ((rc = wget_http_open(&conn, iri)) == WGET_E_SUCCESS) {
+			debug_printf("pool: preconnected %s\n", conn->esc_host);
+			pool_checkin(&conn);
+		} else {
+			// the downloader will try again and report the error
+			debug_printf("pool: failed to preconnect %s (%d)\n", pool->host, rc);
+			wget_http_close(&conn);
+		}
+
+		wget_iri_free(&iri);
+
+		wget_thread_mutex_lock(&mutex);
+
+		if (rc == WGET_E_SUCCESS)
+			preconnected++;
+		else
+			preconnect_failed++;
+
+		// downloaders waiting in pool_get() now find the connection in the pool (or open their own)
+		pool->preconnecting = 0;
+		_wakeup(&connect_cond, connect_waiters);
+	}
+
+	wget_thread_mutex_unlock(&mutex);
+
+	return NULL;
+}
+
+// Opens a connection to the server of 'iri' in the background and checks it into the pool.
+// Called when a new host has been added to the queue.
+void pool_preconnect(wget_iri_t *iri)
+{
+	wget_iri_t *preconnect_iri;
+	POOL *pool, key;
+	int max_threads = config.preconnect < PRECONNECT_THREADS_MAX ? config.preconnect : PRECONNECT_THREADS_MAX;
+
+	if (max_threads <= 0 || !config.pool_max_idle || !config.keep_alive || !wget_thread_support())
+		return;
+
+	preconnect_iri = wget_iri_clone(iri);
+
+	// the downloader will switch to HTTPS as well, see try_connection()
+	if (config.hsts && iri->scheme == WGET_IRI_SCHEME_HTTP && wget_hsts_host_match(config.hsts_db, iri->host, atoi(iri->resolv_port)))
+		wget_iri_set_scheme(preconnect_iri, WGET_IRI_SCHEME_HTTPS);
+
+	// with TCP Fast Open, a plain HTTP connection isn't opened before the first request is sent
+	// and the idle socket would be taken for a stale one
+	if (config.tcp_fastopen && preconnect_iri->scheme == WGET_IRI_SCHEME_HTTP) {
+		wget_iri_free(&preconnect_iri);
+		return;
+	}
+
+	key = (POOL) { .scheme = preconnect_iri->scheme, .host = preconnect_iri->host, .port = preconnect_iri->resolv_port };
+
+	wget_thread_mutex_lock(&mutex);
+
+	if (preconnect_stop || wget_vector_size(preconnect_queue) >= PRECONNECT_QUEUE_MAX) {
+		wget_thread_mutex_unlock(&mutex);
+		wget_iri_free(&preconnect_iri);
+		return;
+	}
+
+	pool = _get_pool(&key);
+
+	// one connection per server is enough to get the first job going
+	if (pool->preconnect_queued || pool->preconnecting || pool->connecting || pool->shared || wget_vector_size(pool->idle) > 0) {
+		wget_thread_mutex_unlock(&mutex);
+		wget_iri_free(&preconnect_iri);
+		return;
+	}
+
+	if (!preconnect_queue)
+		preconnect_queue = wget_vector_create(16, -2, NULL);
+
+	wget_vector_add_noalloc(preconnect_queue, pool);
+	pool->preconnect_queued = 1;
+	pool->preconnect_iri = preconnect_iri;
+
+	// start another preconnect thread if all are busy
+	if (nidle_preconnectors == 0 && npreconnectors < max_threads) {
+		if (wget_thread_start(&preconnect_tids[npreconnectors], _preconnect_thread, NULL, 0) == 0)
+			npreconnectors++;
+		else if (npreconnectors == 0)
+			_preconnect_dequeue(pool);
+	}
+
+	wget_thread_cond_signal(&preconnect_cond);
+
+	wget_thread_mutex_unlock(&mutex);
+}
+
+void pool_print_stats(void)
+{
+	wget_thread_mutex_lock(&mutex);
+	debug_printf("pool: %d hits, %d misses (hit rate %d%%), %d shared, %d stale, %d expired, %d evicted, %d idle\n",
+		hits, misses, hits + misses ? hits * 100 / (hits + misses) : 0, shared_hits, stale, expired, evicted, nidle);
+	debug_printf("pool: %d preconnected, %d failed to preconnect\n", preconnected, preconnect_failed);
+	wget_thread_mutex_unlock(&mutex);
+}
+
+void pool_free(void)
+{
+	wget_thread_mutex_lock(&mutex);
+	preconnect_stop = 1;
+	wget_thread_cond_signal(&preconnect_cond);
+	wget_thread_mutex_unlock(&mutex);
+
+	// running preconnects are finished, queued ones are dropped
+	for (int it = 0; it < npreconnectors; it++)
+		wget_thread_join(preconnect_tids[it]);
+
+	wget_thread_mutex_lock(&mutex);
+	npreconnectors = 0;
+	wget_vector_free(&preconnect_queue);
+	wget_hashmap_free(&pools);
+	wget_vector_free(&connect_waiters);
+	nidle = 0;
+	preconnect_stop = 0;
+	wget_thread_mutex_unlock(&mutex);
+}
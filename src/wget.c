@@ -58,6 +58,9 @@
 #include "wget_blacklist.h"
 #include "wget_host.h"
 #include "wget_bar.h"
+#include "wget_event.h"
+#include "wget_pool.h"
+#include "wget_checkpoint.h"
 
 #define URL_FLG_REDIRECTION  (1<<0)
 #define URL_FLG_SITEMAP      (1<<1)
@@ -119,6 +122,8 @@ wget_http_response_t
 
 static wget_stringmap_t
 	*etags;
+static wget_thread_mutex_t
+	etag_mutex = WGET_THREAD_MUTEX_INITIALIZER;
 static wget_hashmap_t
 	*known_urls;
 static DOWNLOADER
@@ -396,6 +401,47 @@ static void _atomic_increment_int(int *p)
 #endif
 }
 
+static int _compare_and_swap_longlong(long long *p, long long old_value, long long new_value)
+{
+#ifdef WITH_SYNC_BOOL_COMPARE_AND_SWAP_LONGLONG
+	return __sync_bool_compare_and_swap(p, old_value, new_value);
+#else
+	static wget_thread_mutex_t
+		mutex = WGET_THREAD_MUTEX_INITIALIZER;
+	int swapped;
+
+	wget_thread_mutex_lock(&mutex);
+	if ((swapped = (*p == old_value)))
+		*p = new_value;
+	wget_thread_mutex_unlock(&mutex);
+
+	return swapped;
+#endif
+}
+
+// --limit-rate: bucket state of all downloads together
+static long long
+	rate_limit_ts;
+
+// bytes worth this many microseconds may be received at once, keeps the sleeps few and not too short
+#define RATE_LIMIT_BURST 50000
+
+// Token bucket for --limit-rate and --limit-rate-per-host, shared by all downloaders without a lock.
+// '*ts' is the time (in microseconds) at which all bytes accounted so far have been paid for at 'rate'
+// bytes per second. It never falls behind 'now', so unused bandwidth doesn't pile up.
+// Returns the number of milliseconds the caller has to wait before receiving more data.
+static long long _rate_limit(long long *ts, long long rate, size_t nbytes, long long now)
+{
+	long long old_ts, new_ts, cost = (long long) nbytes * 1000000 / rate;
+
+	do {
+		old_ts = *ts;
+		new_ts = (old_ts > now ? old_ts : now) + cost;
+	} while (!_compare_and_swap_longlong(ts, old_ts, new_ts));
+
+	return (new_ts - now - RATE_LIMIT_BURST) / 1000;
+}
+
 // Since quota may change at any time in a threaded environment,
 // we have to modify and check the quota in one (protected) step.
 static long long quota_modify_read(size_t nbytes)
@@ -447,6 +493,27 @@ static int in_host_pattern_list(const wget_vector_t *v, const char *hostname)
 	return 0;
 }
 
+// remember a URL given by the user as parent directory for --no-parent
+static void _parents_add(wget_iri_t *iri)
+{
+	// the job's IRI is freed when the job is done
+	wget_iri_t *parent = wget_iri_clone(iri);
+	char *p;
+
+	if (!parents) {
+		parents = wget_vector_create(4, -2, NULL);
+		wget_vector_set_destructor(parents, (wget_vector_destructor_t)wget_iri_free_content);
+	}
+
+	// calc length of directory part in iri->path (including last /)
+	if (!parent->path || !(p = strrchr(parent->path, '/')))
+		parent->dirlen = 0;
+	else
+		parent->dirlen = p - parent->path + 1;
+
+	wget_vector_add_noalloc(parents, parent);
+}
+
 // Add URLs given by user (command line, file or -i option).
 // Needs to be thread-save.
 static void add_url_to_queue(const char *url, wget_iri_t *base, const char *encoding)
@@ -480,6 +547,7 @@ static void add_url_to_queue(const char *url, wget_iri_t *base, const char *enco
 	if (wget_vector_contains(config.exclude_domains, iri->host)) {
 		// download from this scheme://domain are explicitely not wanted
 		wget_thread_mutex_unlock(&downloader_mutex);
+		wget_iri_free(&iri);
 		return;
 	}
 
@@ -489,6 +557,9 @@ static void add_url_to_queue(const char *url, wget_iri_t *base, const char *enco
 			// create a special job for downloading robots.txt (before anything else)
 			host_add_robotstxt_job(host, iri, encoding);
 		}
+
+		// do the TCP and TLS handshakes while the downloaders are busy
+		pool_preconnect(iri);
 	} else
 		host = host_get(iri);
 
@@ -498,20 +569,8 @@ static void add_url_to_queue(const char *url, wget_iri_t *base, const char *enco
 				wget_vector_add_str(config.domains, iri->host);
 		}
 
-		if (!config.parent) {
-			char *p;
-
-			if (!parents)
-				parents = wget_vector_create(4, -2, NULL);
-
-			// calc length of directory part in iri->path (including last /)
-			if (!iri->path || !(p = strrchr(iri->path, '/')))
-				iri->dirlen = 0;
-			else
-				iri->dirlen = p - iri->path + 1;
-
-			wget_vector_add_noalloc(parents, iri);
-		}
+		if (!config.parent)
+			_parents_add(iri);
 	}
 
 	new_job = job_init(&job_buf, iri);
@@ -537,15 +596,160 @@ static void add_url_to_queue(const char *url, wget_iri_t *base, const char *enco
 
 static wget_thread_mutex_t
 	main_mutex = WGET_THREAD_MUTEX_INITIALIZER,
+	worker_mutex = WGET_THREAD_MUTEX_INITIALIZER, // protects the idle stack
 	known_urls_mutex = WGET_THREAD_MUTEX_INITIALIZER;
 static wget_thread_cond_t
-	main_cond = WGET_THREAD_COND_INITIALIZER, // is signalled whenever a job is done
-	worker_cond = WGET_THREAD_COND_INITIALIZER;  // is signalled whenever a job is added
+	main_cond = WGET_THREAD_COND_INITIALIZER; // is signalled whenever the main thread has to check the state
+static DOWNLOADER
+	**idle_workers; // stack of idle downloaders, the one that became idle last is woken first
+static volatile int
+	nidle, // number of downloaders on the idle stack
+	nwanted; // number of downloaders to start beyond the number of queued jobs (parts of a file)
 static wget_thread_t
 	input_tid;
 static void
 	*input_thread(void *p);
 
+// wake up the main thread, e.g. to start another downloader or because the queue ran empty
+static void _wake_main(void)
+{
+	wget_thread_mutex_lock(&main_mutex);
+	wget_thread_cond_signal(&main_cond);
+	wget_thread_mutex_unlock(&main_mutex);
+}
+
+// must be called with worker_mutex locked
+static void _signal_worker(DOWNLOADER *downloader)
+{
+	downloader->idle = 2;
+
+	if (downloader->task)
+		event_task_wakeup(downloader->task);
+	else
+		wget_thread_cond_signal(&downloader->cond);
+}
+
+// hand new work to exactly one idle downloader instead of waking up all of them
+static void _wake_worker(void)
+{
+	DOWNLOADER *downloader = NULL;
+
+	wget_thread_mutex_lock(&worker_mutex);
+	if (nidle > 0) {
+		downloader = idle_workers[--nidle];
+		_signal_worker(downloader);
+	}
+	wget_thread_mutex_unlock(&worker_mutex);
+
+	// nobody is idle, maybe the main thread can start another downloader
+	if (!downloader && nthreads < config.max_threads)
+		_wake_main();
+}
+
+// the parts of a file can be downloaded in parallel, although they are only one job in the queue
+static void _wake_workers(int n)
+{
+	wget_thread_mutex_lock(&worker_mutex);
+	for (; n > 0 && nidle > 0; n--)
+		_signal_worker(idle_workers[--nidle]);
+	if (n > nwanted)
+		nwanted = n;
+	wget_thread_mutex_unlock(&worker_mutex);
+
+	if (n && nthreads < config.max_threads)
+		_wake_main();
+}
+
+static void _wake_all_workers(void)
+{
+	wget_thread_mutex_lock(&worker_mutex);
+	while (nidle > 0)
+		_signal_worker(idle_workers[--nidle]);
+	wget_thread_mutex_unlock(&worker_mutex);
+}
+
+// must be called with worker_mutex locked
+static void _idle_remove(DOWNLOADER *downloader)
+{
+	for (int it = 0; it < nidle; it++) {
+		if (idle_workers[it] == downloader) {
+			memmove(&idle_workers[it], &idle_workers[it + 1], (nidle - it - 1) * sizeof(DOWNLOADER *));
+			nidle--;
+			break;
+		}
+	}
+}
+
+// Called by a downloader that has nothing to do.
+// The first call just pushes the downloader onto the idle stack, so that the caller looks into
+// the queue once more before the next call really waits. That way no wakeup gets lost.
+static void _wait_for_work(DOWNLOADER *downloader, long long pause)
+{
+	wget_thread_mutex_lock(&worker_mutex);
+
+	if (!downloader->idle) {
+		idle_workers[nidle++] = downloader;
+		downloader->idle = 1;
+	} else {
+		if (downloader->idle == 1 && !terminate) {
+			if (downloader->task) {
+				// a task must not block its event loop thread
+				wget_thread_mutex_unlock(&worker_mutex);
+				event_task_wait(pause);
+				wget_thread_mutex_lock(&worker_mutex);
+			} else
+				wget_thread_cond_wait(&downloader->cond, &worker_mutex, pause);
+		}
+
+		if (downloader->idle == 1)
+			_idle_remove(downloader); // timeout (pause) or spurious wakeup
+
+		downloader->idle = 0;
+	}
+
+	wget_thread_mutex_unlock(&worker_mutex);
+}
+
+// Called by a downloader that got a job.
+static void _worker_busy(DOWNLOADER *downloader)
+{
+	int woken = 0;
+
+	if (downloader->idle) {
+		wget_thread_mutex_lock(&worker_mutex);
+		if (downloader->idle == 1)
+			_idle_remove(downloader);
+		else
+			woken = 1;
+		downloader->idle = 0;
+		wget_thread_mutex_unlock(&worker_mutex);
+	}
+
+	// if we used up a wakeup meant for new work or there is even more work, get another downloader going
+	if (woken || (nidle && queue_ready()))
+		_wake_worker();
+}
+
+// the Referer header value for links found in the document at 'iri'
+static char *_referer(wget_iri_t *iri)
+{
+	wget_buffer_t buf;
+
+	wget_buffer_init(&buf, NULL, 128);
+
+	wget_buffer_strcpy(&buf, iri->scheme);
+	wget_buffer_memcat(&buf, "://", 3);
+	wget_buffer_strcat(&buf, iri->host);
+	if (iri->resolv_port) {
+		wget_buffer_memcat(&buf, ":", 1);
+		wget_buffer_strcat(&buf, iri->resolv_port);
+	}
+	wget_buffer_memcat(&buf, "/", 1);
+	wget_iri_get_escaped_resource(iri, &buf);
+
+	return buf.data;
+}
+
 // Add URLs parsed from downloaded files
 // Needs to be thread-save
 static void add_url(JOB *job, const char *encoding, const char *url, int flags)
@@ -608,6 +812,7 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 		if (reason) {
 			wget_thread_mutex_unlock(&downloader_mutex);
 			info_printf(_("URL '%s' not followed (%s)\n"), iri->uri, reason);
+			wget_iri_free(&iri);
 			return;
 		}
 	}
@@ -632,6 +837,7 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 		if (!ok) {
 			wget_thread_mutex_unlock(&downloader_mutex);
 			info_printf(_("URL '%s' not followed (parent ascending not allowed)\n"), url);
+			wget_iri_free(&iri);
 			return;
 		}
 	}
@@ -642,6 +848,9 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 			// create a special job for downloading robots.txt (before anything else)
 			host_add_robotstxt_job(host, iri, encoding);
 		}
+
+		// do the TCP and TLS handshakes while the downloaders are busy
+		pool_preconnect(iri);
 	} else if ((host = host_get(iri))) {
 		if (host->robots && iri->path) {
 			// info_printf("%s: checking '%s' / '%s'\n", __func__, iri->path, iri->uri);
@@ -651,6 +860,7 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 				if (path->len && !strncmp(path->path + 1, iri->path ? iri->path : "", path->len - 1)) {
 					wget_thread_mutex_unlock(&downloader_mutex);
 					info_printf(_("URL '%s' not followed (disallowed by robots.txt)\n"), iri->uri);
+					wget_iri_free(&iri);
 					return;
 				}
 			}
@@ -659,6 +869,7 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 		// this should really not ever happen
 		wget_thread_mutex_unlock(&downloader_mutex);
 		error_printf(_("Failed to get '%s' from hosts\n"), iri->host);
+		wget_iri_free(&iri);
 		return;
 	}
 
@@ -674,11 +885,11 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 	if (job) {
 		if (flags & URL_FLG_REDIRECTION) {
 			new_job->redirection_level = job->redirection_level + 1;
-			new_job->referer = job->referer;
+			new_job->referer = wget_strdup(job->referer);
 		} else {
 			new_job->level = job->level + 1;
-			new_job->referer = job->iri;
-			job->iri = NULL;
+			if (job->iri)
+				new_job->referer = _referer(job->iri);
 		}
 	}
 
@@ -700,12 +911,103 @@ static void add_url(JOB *job, const char *encoding, const char *url, int flags)
 	// now add the new job to the queue (thread-safe))
 	new_job = host_add_job(host, new_job);
 
-	// and wake up all waiting threads
-	wget_thread_cond_signal(&worker_cond);
+	// and wake up one waiting downloader
+	_wake_worker();
 
 	wget_thread_mutex_unlock(&downloader_mutex);
 }
 
+static int _checkpoint_save_known_url(void *ctx, const void *key, void *value G_GNUC_WGET_UNUSED)
+{
+	checkpoint_write_string(ctx, key);
+	return 0;
+}
+
+static int _checkpoint_save_etag(void *ctx, const char *key, void *value G_GNUC_WGET_UNUSED)
+{
+	checkpoint_write_string(ctx, key);
+	return 0;
+}
+
+// the order matters: jobs are added to the blacklist before they are queued
+static int _checkpoint_save(CHECKPOINT *cp, void *ctx G_GNUC_WGET_UNUSED)
+{
+	// no new URLs, jobs or ETags while we take the snapshot, finished jobs may still go away
+	// known_urls_mutex comes first, it is held while the parsers queue new jobs
+	wget_thread_mutex_lock(&known_urls_mutex);
+	wget_thread_mutex_lock(&downloader_mutex);
+	wget_thread_mutex_lock(&etag_mutex);
+
+	blacklist_save(cp);
+	hosts_save(cp);
+
+	checkpoint_write_uint(cp, wget_vector_size(parents));
+	for (int it = 0; it < wget_vector_size(parents); it++)
+		checkpoint_write_string(cp, ((wget_iri_t *) wget_vector_get(parents, it))->uri);
+
+	checkpoint_write_uint(cp, wget_vector_size(config.domains));
+	for (int it = 0; it < wget_vector_size(config.domains); it++)
+		checkpoint_write_string(cp, wget_vector_get(config.domains, it));
+
+	checkpoint_write_uint(cp, wget_hashmap_size(known_urls));
+	if (known_urls)
+		wget_hashmap_browse(known_urls, _checkpoint_save_known_url, cp);
+
+	checkpoint_write_uint(cp, wget_stringmap_size(etags));
+	if (etags)
+		wget_stringmap_browse(etags, _checkpoint_save_etag, cp);
+
+	wget_thread_mutex_unlock(&etag_mutex);
+	wget_thread_mutex_unlock(&downloader_mutex);
+	wget_thread_mutex_unlock(&known_urls_mutex);
+
+	return cp->error ? -1 : 0;
+}
+
+static int _checkpoint_load(CHECKPOINT *cp, void *ctx G_GNUC_WGET_UNUSED)
+{
+	uint64_t n;
+	char *s;
+
+	if (blacklist_load(cp) || hosts_load(cp))
+		return -1;
+
+	for (n = checkpoint_read_uint(cp); n && !cp->error; n--) {
+		wget_iri_t *iri;
+
+		if ((s = checkpoint_read_string(cp)) && (iri = wget_iri_parse(s, "utf-8"))) {
+			_parents_add(iri);
+			wget_iri_free(&iri);
+		}
+		xfree(s);
+	}
+
+	for (n = checkpoint_read_uint(cp); n && !cp->error; n--) {
+		if ((s = checkpoint_read_string(cp))) {
+			if (wget_vector_find(config.domains, s) == -1)
+				wget_vector_add_noalloc(config.domains, s);
+			else
+				xfree(s);
+		}
+	}
+
+	// the maps take over the strings
+	for (n = checkpoint_read_uint(cp); n && !cp->error; n--) {
+		if ((s = checkpoint_read_string(cp)))
+			wget_hashmap_put_noalloc(known_urls, s, NULL);
+	}
+
+	for (n = checkpoint_read_uint(cp); n && !cp->error; n--) {
+		if ((s = checkpoint_read_string(cp))) {
+			if (!etags)
+				etags = wget_stringmap_create(128);
+			wget_stringmap_put_noalloc(etags, s, NULL);
+		}
+	}
+
+	return cp->error ? -1 : 0;
+}
+
 static void _convert_links(void)
 {
 	FILE *fpout = NULL;
@@ -883,6 +1185,18 @@ int main(int argc, const char **argv)
 		goto out;
 	}
 
+	if (config.resume_crawl) {
+		// without a checkpoint (e.g. on the first run) the crawl starts from scratch
+		if (access(config.checkpoint_file, F_OK) == 0) {
+			if (checkpoint_load(config.checkpoint_file, _checkpoint_load, NULL)) {
+				set_exit_status(1);
+				goto out;
+			}
+
+			info_printf(_("Resuming crawl from '%s', %d URLs queued\n"), config.checkpoint_file, queue_size());
+		}
+	}
+
 	for (; n < argc; n++) {
 		add_url_to_queue(argv[n], config.base, config.local_encoding);
 	}
@@ -978,7 +1292,16 @@ int main(int argc, const char **argv)
 		bar_init();
 	}
 
+	if (config.engine == ENGINE_EVENT && event_init(config.event_threads)) {
+		error_printf(_("Event engine not available, falling back to threads\n"));
+		config.engine = ENGINE_THREAD;
+	}
+
 	downloaders = wget_calloc(config.max_threads, sizeof(DOWNLOADER));
+	idle_workers = wget_calloc(config.max_threads, sizeof(DOWNLOADER *));
+
+	long long next_checkpoint = config.checkpoint_file && config.checkpoint_interval > 0 ?
+		wget_get_timemillis() + config.checkpoint_interval : 0;
 
 	wget_thread_mutex_lock(&main_mutex);
 	while (!terminate) {
@@ -987,14 +1310,21 @@ int main(int argc, const char **argv)
 			break;
 		}
 
-		for (;nthreads < config.max_threads && nthreads < queue_size(); nthreads++) {
+		for (;nthreads < config.max_threads && (nthreads < queue_size() || nwanted > 0); nthreads++) {
+			if (nthreads >= queue_size())
+				nwanted--;
+
 			downloaders[nthreads].id = nthreads;
+			wget_thread_cond_init(&downloaders[nthreads].cond);
 
 			if (config.progress)
 				bar_update_slots(nthreads + 2);
 
-			// start worker threads (I call them 'downloaders')
-			if ((rc = wget_thread_start(&downloaders[nthreads].tid, downloader_thread, &downloaders[nthreads], 0)) != 0) {
+			// start worker threads (I call them 'downloaders'), or tasks on the event loops
+			if (config.engine == ENGINE_EVENT) {
+				if (event_spawn(downloader_thread, &downloaders[nthreads]))
+					error_printf(_("Failed to start downloader task\n"));
+			} else if ((rc = wget_thread_start(&downloaders[nthreads].tid, downloader_thread, &downloaders[nthreads], 0)) != 0) {
 				error_printf(_("Failed to start downloader, error %d\n"), rc);
 			}
 		}
@@ -1008,26 +1338,60 @@ int main(int argc, const char **argv)
 			break;
 		}
 
-		// here we sit and wait for an event from our worker threads
-		wget_thread_cond_wait(&main_cond, &main_mutex, 0);
+		int timeout = config.progress ? 1000 : 0;
+
+		if (next_checkpoint) {
+			long long now = wget_get_timemillis();
+
+			if (now >= next_checkpoint) {
+				// downloaders call _wake_main() with downloader_mutex locked
+				wget_thread_mutex_unlock(&main_mutex);
+				checkpoint_save(config.checkpoint_file, _checkpoint_save, NULL);
+				wget_thread_mutex_lock(&main_mutex);
+				next_checkpoint = (now = wget_get_timemillis()) + config.checkpoint_interval;
+			}
+
+			if (!timeout || next_checkpoint - now < timeout)
+				timeout = (int) (next_checkpoint - now);
+		}
+
+		// here we sit and wait for an event from our worker threads,
+		// with a progress bar we also wake up regularly to update the status line
+		wget_thread_cond_wait(&main_cond, &main_mutex, timeout);
 		debug_printf("%s: wake up\n", __func__);
 	}
 	debug_printf("%s: done\n", __func__);
 
 	// stop downloaders
 	terminate = 1;
-	wget_thread_cond_signal(&worker_cond);
 	wget_thread_mutex_unlock(&main_mutex);
+	_wake_all_workers();
+
+	if (config.engine == ENGINE_EVENT) {
+		// the event loops return when all their tasks are done
+		event_deinit();
+	} else {
+		for (n = 0; n < nthreads; n++) {
+			//		struct timespec ts;
+			//		gettime(&ts);
+			//		ts.tv_sec += 1;
+			// if the thread is not detached, we have to call pthread_join()/pthread_timedjoin_np()
+			// else we will have a huge memory leak
+			//		if ((rc=pthread_timedjoin_np(downloader[n].tid, NULL, &ts))!=0)
+			if ((rc = wget_thread_join(downloaders[n].tid)) != 0)
+				error_printf(_("Failed to wait for downloader #%d (%d %d)\n"), n, rc, errno);
+		}
+	}
+
+	// close the idle keep-alive connections
+	pool_free();
 
-	for (n = 0; n < nthreads; n++) {
-		//		struct timespec ts;
-		//		gettime(&ts);
-		//		ts.tv_sec += 1;
-		// if the thread is not detached, we have to call pthread_join()/pthread_timedjoin_np()
-		// else we will have a huge memory leak
-		//		if ((rc=pthread_timedjoin_np(downloader[n].tid, NULL, &ts))!=0)
-		if ((rc = wget_thread_join(downloaders[n].tid)) != 0)
-			error_printf(_("Failed to wait for downloader #%d (%d %d)\n"), n, rc, errno);
+	// keep the state of an interrupted crawl, a finished crawl doesn't need it any more
+	if (config.checkpoint_file) {
+		if (queue_empty())
+			unlink(config.checkpoint_file);
+		else if (!checkpoint_save(config.checkpoint_file, _checkpoint_save, NULL))
+			info_printf(_("Saved crawl state to '%s', continue with --resume-crawl\n"), config.checkpoint_file);
 	}
 
 	if (config.progress)
@@ -1050,11 +1414,24 @@ int main(int argc, const char **argv)
 	if (config.ocsp && config.ocsp_file)
 		wget_ocsp_db_save(config.ocsp_db, config.ocsp_file);
 
+	if (config.dns_caching && config.dns_cache_file)
+		wget_dns_cache_save(config.dns_cache_file);
+
 	if (config.delete_after && config.output_document)
 		unlink(config.output_document);
 
-	if (config.debug)
+	if (config.debug) {
+		wget_ssl_stats_t tls_stats;
+
 		blacklist_print();
+		pool_print_stats();
+
+		wget_ssl_get_stats(&tls_stats);
+		debug_printf("TLS: %d handshakes, %d resumed (%d%%), %d with early data, %d early data rejected, %d chains verified from cache, %d with kTLS\n",
+			tls_stats.handshakes, tls_stats.resumed, tls_stats.handshakes ? tls_stats.resumed * 100 / tls_stats.handshakes : 0,
+			tls_stats.early_data, tls_stats.early_data_rejected, tls_stats.verified_cached, tls_stats.ktls);
+		debug_printf("OCSP: %d requests for %d certificates\n", tls_stats.ocsp_requests, tls_stats.ocsp_certs);
+	}
 
 	if (config.convert_links && !config.delete_after) {
 		_convert_links();
@@ -1069,9 +1446,9 @@ int main(int argc, const char **argv)
 		blacklist_free();
 		hosts_free();
 		xfree(downloaders);
+		xfree(idle_workers);
 		if (config.progress)
 			bar_deinit();
-		wget_vector_clear_nofree(parents);
 		wget_vector_free(&parents);
 		wget_hashmap_free(&known_urls);
 		wget_stringmap_free(&etags);
@@ -1091,12 +1468,13 @@ void *input_thread(void *p G_GNUC_WGET_UNUSED)
 
 	while ((len = wget_fdgetline(&buf, &bufsize, STDIN_FILENO)) >= 0) {
 		add_url_to_queue(buf, config.base, config.local_encoding);
-		wget_thread_cond_signal(&worker_cond);
+		_wake_worker();
 	}
 
 	// input closed, don't read from it any more
 	debug_printf("input closed\n");
 	input_tid = 0;
+	_wake_main();
 	return NULL;
 }
 
@@ -1119,16 +1497,26 @@ static int try_connection(DOWNLOADER *downloader, wget_iri_t *iri)
 			return WGET_E_SUCCESS;
 		}
 
-		debug_printf("close connection %s\n", conn->esc_host);
-		wget_http_close(&downloader->conn);
+		// keep the connection for other downloaders
+		pool_release(downloader);
+	}
+
+	// pooled connections have been kept alive before
+	if (pool_get(downloader, iri)) {
+		downloader->keep_alive = 1;
+		return WGET_E_SUCCESS;
 	}
 
+	downloader->keep_alive = 0;
+
 	if ((rc = wget_http_open(&downloader->conn, iri)) == WGET_E_SUCCESS) {
 		debug_printf("established connection %s\n", downloader->conn->esc_host);
 	} else {
 		debug_printf("Failed to connect (%d)\n", rc);
 	}
 
+	pool_connected(downloader, iri);
+
 	return rc;
 }
 
@@ -1138,41 +1526,39 @@ static int establish_connection(DOWNLOADER *downloader, wget_iri_t **iri)
 
 	downloader->final_error = 0;
 
-	if (downloader->job->part) {
+	if (downloader->part) {
 		JOB *job = downloader->job;
 		wget_metalink_t *metalink = job->metalink;
-		PART *part = job->part;
+		PART *part = downloader->part;
 		int mirror_count = wget_vector_size(metalink->mirrors);
-		int mirror_index;
 
-		if(mirror_count > 0)
-			mirror_index = downloader->id % mirror_count;
-		else {
+		if (mirror_count <= 0) {
 			host_final_failure(downloader->job->host);
 			set_exit_status(1);
 			return rc;
 		}
 
-		// we try every mirror max. 'config.tries' number of times
-		for (int tries = 0; tries < config.tries && !part->done && !terminate; tries++) {
-			wget_millisleep(tries * 1000 > config.waitretry ? config.waitretry : tries * 1000);
+		int order[mirror_count];
 
-			if (terminate)
-				break;
+		// fastest healthy mirrors first, see job_rank_mirrors()
+		job_rank_mirrors(job, part, order);
 
-			for (int mirrors = 0; mirrors < wget_vector_size(metalink->mirrors) && !part->done; mirrors++) {
-				wget_metalink_mirror_t *mirror = wget_vector_get(metalink->mirrors, mirror_index);
+		// try every mirror once, the caller backs off via the host's retry time and
+		// gives up after 'config.tries' failures (host_increase_failure())
+		for (int it = 0; it < mirror_count && !part->done && !terminate; it++) {
+			wget_metalink_mirror_t *mirror = wget_vector_get(metalink->mirrors, order[it]);
+			long long start = wget_get_timemillis();
 
-				mirror_index = (mirror_index + 1) % wget_vector_size(metalink->mirrors);
+			rc = try_connection(downloader, mirror->iri);
 
-				rc = try_connection(downloader, mirror->iri);
-
-				if (rc == WGET_E_SUCCESS) {
-					if (iri)
-						*iri = mirror->iri;
-					return rc;
-				}
+			if (rc == WGET_E_SUCCESS) {
+				job_mirror_connected(job, part, order[it], wget_get_timemillis() - start);
+				if (iri)
+					*iri = mirror->iri;
+				return rc;
 			}
+
+			job_mirror_failed(job, order[it]);
 		}
 	} else {
 		rc = try_connection(downloader, *iri);
@@ -1207,10 +1593,9 @@ static void add_statistics(wget_http_response_t *resp)
 		_atomic_increment_int(&stats.nerrors);
 }
 
-static int process_response_header(wget_http_response_t *resp)
+static int process_response_header(DOWNLOADER *downloader, wget_http_response_t *resp)
 {
 	JOB *job = resp->req->user_data;
-	DOWNLOADER *downloader = job->downloader;
 	wget_iri_t *iri = job->iri;
 
 	print_status(downloader, "HTTP response %d %s\n", resp->code, resp->reason);
@@ -1230,7 +1615,7 @@ static int process_response_header(wget_http_response_t *resp)
 	// For HTTP2 connections this flag is always set.
 	debug_printf("keep_alive=%d\n", resp->keep_alive);
 	if (!resp->keep_alive)
-		wget_http_close(&downloader->conn);
+		pool_close(downloader);
 
 	// do some statistics
 	add_statistics(resp);
@@ -1299,11 +1684,13 @@ static int process_response_header(wget_http_response_t *resp)
 	return 0;
 }
 
-static void process_head_response(wget_http_response_t *resp)
+static void _free_mirror(wget_metalink_mirror_t *mirror)
 {
-	static wget_thread_mutex_t
-		etag_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+	wget_iri_free(&mirror->iri);
+}
 
+static void process_head_response(wget_http_response_t *resp)
+{
 	JOB *job = resp->req->user_data;
 
 	job->head_first = 0;
@@ -1352,7 +1739,9 @@ static void process_head_response(wget_http_response_t *resp)
 			wget_vector_add(metalink->pieces, &piece, sizeof(wget_metalink_piece_t));
 		}
 
+		// the mirror takes over the job's IRI
 		metalink->mirrors = wget_vector_create(1, 1, NULL);
+		wget_vector_set_destructor(metalink->mirrors, (wget_vector_destructor_t)_free_mirror);
 
 		wget_vector_add(metalink->mirrors, &mirror, sizeof(wget_metalink_mirror_t));
 
@@ -1360,51 +1749,63 @@ static void process_head_response(wget_http_response_t *resp)
 
 		// start or resume downloading
 		if (!job_validate_file(job)) {
-			// wake up sleeping workers
-			wget_thread_cond_signal(&worker_cond);
 			job->inuse = 0; // do not remove this job from queue yet
 		} // else file already downloaded and checksum ok
 	}
 }
 
 // chunked or metalink partial download
-static void process_response_part(wget_http_response_t *resp)
+static void process_response_part(DOWNLOADER *downloader, wget_http_response_t *resp)
 {
 	JOB *job = resp->req->user_data;
-	DOWNLOADER *downloader = job->downloader;
-	PART *part = job->part;
+	PART *part = downloader->part; // metalink downloads are not pipelined
 
 	// just update number bytes read (body only) for display purposes
 	if (resp->body)
 		quota_modify_read(resp->cur_downloaded);
 
-	if (resp->code != 200 && resp->code != 206) {
+	int ok = 0, complete = host_part_complete(part);
+
+	if (complete == 2) {
+		print_status(downloader, "part %d downloaded by another downloader\n", part->id);
+	} else if (resp->code != 200 && resp->code != 206) {
 		print_status(downloader, "part %d download error %d\n", part->id, resp->code);
 	} else if (!resp->body) {
 		print_status(downloader, "part %d download error 'empty body'\n", part->id);
-	} else if (resp->body->length != (size_t)part->length) {
-		print_status(downloader, "part %d download error '%zu bytes of %lld expected'\n",
-			part->id, resp->body->length, (long long)part->length);
+	} else if (!complete) {
+		print_status(downloader, "part %d download error 'range not completely received'\n", part->id);
 	} else {
 		print_status(downloader, "part %d downloaded\n", part->id);
-		part->done = 1; // set this when downloaded ok
+		ok = 1;
 	}
 
-	if (part->done) {
-		// check if all parts are done (downloaded + hash-checked)
-		int all_done = 1, it;
+	if (!ok && complete != 2) {
+		print_status(downloader, "part %d failed\n", part->id);
+		job_mirror_finished(job, part, 1);
+	} else
+		job_mirror_finished(job, part, 0);
+
+	// check if all parts are done (downloaded + hash-checked)
+	if (host_finish_part(job, part, ok)) {
+		int all_verified = 1, it;
 
-		wget_thread_mutex_lock(&downloader_mutex);
+		// nobody else works on the parts any more
 		for (it = 0; it < wget_vector_size(job->parts); it++) {
 			PART *partp = wget_vector_get(job->parts, it);
-			if (!partp->done) {
-				all_done = 0;
-				break;
-			}
+
+			// no piece hash or mismatch, job_validate_file() checks the file and requeues bad pieces
+			if (!partp->verified && !(partp->twin && partp->twin->verified))
+				all_verified = 0;
 		}
-		wget_thread_mutex_unlock(&downloader_mutex);
 
-		if (all_done) {
+		if (all_verified) {
+			// each part has been checked against its piece hash while downloading, no need to read the file again
+			if (config.progress)
+				bar_print(downloader->id, "Checksum OK");
+			else
+				print_status(downloader, "%s checksum OK\n", job->metalink->name);
+			job->inuse = 1; // we are done with this job, main state machine will remove it
+		} else {
 			// check integrity of complete file
 			if (config.progress)
 				bar_print(downloader->id, "Checksumming...");
@@ -1425,9 +1826,6 @@ static void process_response_part(wget_http_response_t *resp)
 					debug_printf("checksum failed\n");
 			}
 		}
-	} else {
-		print_status(downloader, "part %d failed\n", part->id);
-		part->inuse = 0; // something was wrong, reload again later
 	}
 }
 
@@ -1516,8 +1914,10 @@ static void process_response(wget_http_response_t *resp)
 					// sort mirrors by priority to download from highest priority first
 					wget_metalink_sort_mirrors(job->metalink);
 
-					// wake up sleeping workers
-					wget_thread_cond_signal(&worker_cond);
+					// from now on, the parts are downloaded from the mirrors
+					wget_metalink_mirror_t *mirror = wget_vector_get(job->metalink->mirrors, 0);
+					wget_iri_free(&job->iri);
+					job->iri = mirror->iri;
 
 					job->inuse = 0; // do not remove this job from queue yet
 				} // else file already downloaded and checksum ok
@@ -1591,42 +1991,76 @@ enum actions {
 	ACTION_ERROR
 };
 
+// max. number of requests in flight on the downloader's connection
+static int _max_pending(DOWNLOADER *downloader, JOB *job)
+{
+	wget_http_connection_t *conn = downloader->conn;
+
+	if (config.wait || job->metalink || !conn)
+		return 1;
+
+	if (conn->protocol == WGET_PROTOCOL_HTTP_2_0)
+		return config.http2_request_window < conn->max_concurrent_streams ? config.http2_request_window : conn->max_concurrent_streams;
+
+	// HTTP/1.1 pipelining, not for POST requests and not before the server kept the connection alive
+	if (config.http1_pipeline > 1 && downloader->keep_alive && !job->host->no_pipelining
+		&& !config.post_data && !config.post_file)
+		return config.http1_pipeline;
+
+	return 1;
+}
+
+// The server dropped the connection while pipelined requests were outstanding.
+// Give the jobs back to the queue, they will be downloaded again without pipelining.
+static void _pipeline_failed(DOWNLOADER *downloader, HOST *host)
+{
+	host_disable_pipelining(host);
+	pool_close(downloader);
+	host_release_jobs(host, downloader);
+}
+
 void *downloader_thread(void *p)
 {
 	DOWNLOADER *downloader = p;
 	wget_http_response_t *resp = NULL;
 	JOB *job;
 	HOST *host = NULL;
-	int pending = 0, max_pending = 1, locked;
-	long long pause = 0;
+	int pending = 0, max_pending = 1;
+	long long pause = 0, started = 0; // 'started': time the first of the pending requests was about to be sent
 	enum actions action = ACTION_GET_JOB;
 
 	downloader->tid = wget_thread_self(); // to avoid race condition
-
-	wget_thread_mutex_lock(&main_mutex); locked = 1;
+	downloader->task = event_task_self();
 
 	while (!terminate) {
 		debug_printf("[%d] action=%d pending=%d host=%p\n", downloader->id, (int) action, pending, (void *) host);
 
 		switch (action) {
 		case ACTION_GET_JOB: // Get a job, connect, send request
-			if (!(job = host_get_job(host, &pause))) {
+			// once the quota is reached, further downloads won't be saved, leave them queued (--checkpoint-file)
+			if (config.quota && quota >= config.quota) {
+				job = NULL;
+				pause = 0;
+			} else
+				job = host_get_job(host, downloader, &pause);
+
+			if (!job) {
 				if (pending) {
-					wget_thread_mutex_unlock(&main_mutex); locked = 0;
 					action = ACTION_GET_RESPONSE;
 				} else if (host) {
-					wget_http_close(&downloader->conn);
+					pool_release(downloader);
+					host_detach(host);
 					host = NULL;
 				} else {
 					if (!wget_thread_support()) {
 						goto out;
 					}
-					wget_thread_cond_wait(&worker_cond, &main_mutex, pause); locked = 1;
+					_wait_for_work(downloader, pause);
 				}
 				break;
 			}
 
-			wget_thread_mutex_unlock(&main_mutex); locked = 0;
+			_worker_busy(downloader);
 
 			{
 				wget_iri_t *iri = job->iri;
@@ -1635,93 +2069,121 @@ void *downloader_thread(void *p)
 
 				if (++pending == 1) {
 					host = job->host;
+					started = wget_get_timemillis();
 
 					if (establish_connection(downloader, &iri)) {
-						host_increase_failure(host);
+						host_increase_failure(host, started);
 						action = ACTION_ERROR;
 						break;
 					}
 
 					job->iri = iri;
+					max_pending = _max_pending(downloader, job);
 
-					if (config.wait || job->metalink || !downloader->conn || downloader->conn->protocol != WGET_PROTOCOL_HTTP_2_0)
-						max_pending = 1;
-					else
-						max_pending = config.http2_request_window;
+					// other downloaders might use all streams of a shared HTTP/2 connection
+					pool_wait_stream(downloader);
 				}
 
-				// wait between sending requests
-				if (config.wait) {
-					if (config.random_wait)
-						wget_millisleep(rand() % config.wait + config.wait / 2); // (0.5 - 1.5) * config.wait
-					else
-						wget_millisleep(config.wait);
-
-					if (terminate)
+				if (http_send_request(job->iri, downloader)) {
+					if (pending > 1 && downloader->conn->protocol != WGET_PROTOCOL_HTTP_2_0) {
+						_pipeline_failed(downloader, host);
+						pending = 0;
 						break;
-				}
+					}
 
-				if (http_send_request(job->iri, downloader)) {
-					host_increase_failure(host);
+					host_increase_failure(host, started);
 					action = ACTION_ERROR;
 					break;
 				}
 
-				if (pending >= max_pending) {
+				// the streams of a shared HTTP/2 connection are also used by other downloaders
+				if (pending >= max_pending || !pool_stream_available(downloader))
 					action = ACTION_GET_RESPONSE;
-				} else {
-					wget_thread_mutex_lock(&main_mutex); locked = 1;
-				}
 			}
 			break;
 
 		case ACTION_GET_RESPONSE:
-			resp = http_receive_response(downloader->conn);
+			resp = pool_receive(downloader, http_receive_response);
 			if (!resp) {
+				if (pending > 1 && downloader->conn->protocol != WGET_PROTOCOL_HTTP_2_0) {
+					_pipeline_failed(downloader, host);
+					pending = 0;
+					action = ACTION_GET_JOB;
+					break;
+				}
+
 				// likely that the other side closed the connection, try again
-				host_increase_failure(host);
+				host_increase_failure(host, started);
 				action = ACTION_ERROR;
 				break;
 			}
 
 			host_reset_failure(host);
 
-			// general response check to see if we need further processing
-			if (process_response_header(resp) == 0) {
-				job = resp->req->user_data;
+			job = resp->req->user_data;
 
+			// general response check to see if we need further processing
+			if (process_response_header(downloader, resp) == 0) {
 				if (job->head_first) {
 					process_head_response(resp); // HEAD request/response
-				} else if (job->part) {
-					process_response_part(resp); // chunked/metalink GET download
+				} else if (downloader->part) {
+					process_response_part(downloader, resp); // chunked/metalink GET download
 				} else {
 					process_response(resp); // GET + POST request/response
 				}
 			}
 
+			// the rest of a part that is not needed any more is still on the wire
+			if (downloader->conn && downloader->conn->abort_indicator)
+				pool_close(downloader);
+
+			// start pipelining once the connection proved to be kept alive
+			if (downloader->conn) {
+				downloader->keep_alive = 1;
+				max_pending = _max_pending(downloader, job);
+			}
+
 			wget_http_free_request(&resp->req);
 			wget_http_free_response(&resp);
 
-			wget_thread_mutex_lock(&main_mutex); locked = 1;
-
-			// download of single-part file complete, remove from job queue
-			if (job && job->inuse) {
+			if (job->inuse) {
+				// download of single-part file complete, remove from job queue
 				host_remove_job(host, job);
+			} else if (host_requeue_job(job)) {
+				// job (or some of its parts) has to be downloaded (again), wake up sleeping downloaders
+				if (job->parts)
+					_wake_workers(wget_vector_size(job->parts));
+				else
+					_wake_worker();
 			}
 
-			wget_thread_cond_signal(&main_cond);
+			// the main thread only cares about the end of the queue and the quota
+			if (queue_empty() || (config.quota && quota >= config.quota))
+				_wake_main();
 
 			pending--;
 			action = ACTION_GET_JOB;
 
+			if (pending && !downloader->conn) {
+				// the server closed the connection ('Connection: close'), pipelined requests won't be answered
+				host_release_jobs(host, downloader);
+				pending = 0;
+			}
+
 			break;
 
 		case ACTION_ERROR:
-			wget_http_close(&downloader->conn);
+			if (downloader->part)
+				job_mirror_finished(downloader->job, downloader->part, 1); // connection lost
+			pool_close(downloader);
 
-			wget_thread_mutex_lock(&main_mutex); locked = 1;
-			host_release_jobs(host);
-			wget_thread_cond_signal(&main_cond);
+			host_release_jobs(host, downloader);
+			if (host)
+				host_detach(host);
+
+			// jobs of a blocked host are not counted any more
+			if (queue_empty())
+				_wake_main();
 
 			host = NULL;
 			pending = 0;
@@ -1736,12 +2198,13 @@ void *downloader_thread(void *p)
 	}
 
 out:
-	if (locked)
-		wget_thread_mutex_unlock(&main_mutex);
-	wget_http_close(&downloader->conn);
+	pool_close(downloader);
+	if (host)
+		host_detach(host);
 
-	// if we terminate, tell the other downloaders
-	wget_thread_cond_signal(&worker_cond);
+	// if we terminate, tell the other downloaders and the main thread
+	_wake_all_workers();
+	_wake_main();
 
 	return NULL;
 }
@@ -2181,6 +2644,7 @@ void metalink_parse_localfile(const char *fname)
 					host = host_get(mirror->iri);
 
 				host_add_job(host, &job);
+				_wake_workers(wget_vector_size(job.parts));
 			} else { // file already downloaded and checksum ok
 				wget_metalink_free(&metalink);
 			}
@@ -2479,11 +2943,74 @@ struct _body_callback_context {
 	JOB *job;
 	wget_buffer_t *body;
 	size_t max_memory;
+	size_t rate_limited; // number of received bytes accounted by _rate_limit()
 	off_t length;
+	long long sent; // time the request has been sent in milliseconds
+	long long head; // time the response became the next one to be read on a pipelined connection, or 0
+	long long ttfb; // time to the first byte of the response in milliseconds
+	PART *part; // part of a metalink/chunked download requested, else NULL
+	wget_http_connection_t *conn;
 	int outfd;
 	int progress_slot;
 };
 
+// start hashing a part while it is downloaded, if there is a usable piece hash for it
+static void _part_hash_init(JOB *job, PART *part)
+{
+	wget_metalink_piece_t *piece;
+	wget_digest_algorithm_t algorithm;
+
+	part_hash_free(part); // left over from an aborted download
+	part->hash_checked = part->verified = 0;
+
+	if (part->split)
+		return; // only a share of the piece, checked by job_validate_file() when all parts are done
+
+	if (!(piece = wget_vector_get(job->metalink->pieces, part->id - 1)) || !*piece->hash.type)
+		return; // e.g. --chunk-size without metalink
+
+	if ((algorithm = wget_hash_get_algorithm(piece->hash.type)) == WGET_DIGTYPE_UNKNOWN)
+		return;
+
+	part->hash = wget_hash_alloc();
+
+	if (wget_hash_init(part->hash, algorithm) == 0)
+		part->hashing = 1;
+	else
+		wget_xfree(part->hash);
+}
+
+// compare the hash of the downloaded part with the piece hash
+static void _part_hash_check(JOB *job, PART *part)
+{
+	wget_metalink_piece_t *piece = wget_vector_get(job->metalink->pieces, part->id - 1);
+	unsigned char digest[64]; // large enough for sha-512
+	char digest_hex[sizeof(digest) * 2 + 1];
+
+	wget_hash_deinit(part->hash, digest);
+	part->hashing = 0;
+
+	wget_memtohex(digest, wget_hash_get_len(wget_hash_get_algorithm(piece->hash.type)), digest_hex, sizeof(digest_hex));
+	part->verified = !part->split && !wget_strcasecmp_ascii(digest_hex, piece->hash.hash_hex); // split while downloading
+	part->hash_checked = 1;
+}
+
+// the body is needed in memory for these responses, see process_response()
+static int _body_is_parsed(JOB *job, wget_http_response_t *resp)
+{
+	if (job->sitemap || job->robotstxt)
+		return 1;
+
+	if (!config.recursive || !resp->content_type)
+		return 0;
+
+	return !wget_strcasecmp_ascii(resp->content_type, "text/html")
+		|| !wget_strcasecmp_ascii(resp->content_type, "application/xhtml+xml")
+		|| !wget_strcasecmp_ascii(resp->content_type, "text/css")
+		|| !wget_strcasecmp_ascii(resp->content_type, "application/atom+xml")
+		|| !wget_strcasecmp_ascii(resp->content_type, "application/rss+xml");
+}
+
 static int _get_header(wget_http_response_t *resp, void *context)
 {
 	struct _body_callback_context *ctx = (struct _body_callback_context *)context;
@@ -2491,14 +3018,23 @@ static int _get_header(wget_http_response_t *resp, void *context)
 	const char *dest = NULL, *name;
 	int ret = 0;
 
+	// a pipelined request waits for the responses before it, that's not the server's response time
+	if (config.max_host_connections)
+		ctx->ttfb = wget_get_timemillis() - (ctx->head > ctx->sent ? ctx->head : ctx->sent);
+
 	bool metalink = resp->content_type
 	    && (!wget_strcasecmp_ascii(resp->content_type, "application/metalink4+xml") ||
 		!wget_strcasecmp_ascii(resp->content_type, "application/metalink+xml"));
 
 	if (ctx->job->head_first || (config.metalink && metalink)) {
 		name = ctx->job->local_filename;
-	} else if ((part = ctx->job->part)) {
+	} else if ((part = ctx->part)) {
 		name = ctx->job->metalink->name;
+
+		// neither an error page of a mirror nor the whole file (Range ignored) must end up in the file
+		if (resp->code != 206 && !(resp->code == 200 && part->position == 0))
+			goto out;
+
 		ctx->outfd = open(ctx->job->metalink->name, O_WRONLY | O_CREAT | O_NONBLOCK, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 		if (ctx->outfd == -1) {
 			set_exit_status(3);
@@ -2511,6 +3047,7 @@ static int _get_header(wget_http_response_t *resp, void *context)
 			ret = -1;
 			goto out;
 		}
+		_part_hash_init(ctx->job, part); // saves re-reading the file for the checksum
 	}
 	else if (config.content_disposition && resp->content_filename)
 		name = dest = resp->content_filename;
@@ -2522,6 +3059,14 @@ static int _get_header(wget_http_response_t *resp, void *context)
 		if (ctx->outfd == -1)
 			ret = -1;
 	}
+
+	// let libwget move the body straight into the file, see _get_body()
+	if (config.ktls && ctx->outfd != -1 && !ctx->part && !config.limit_rate && !config.limit_rate_per_host
+		&& !_body_is_parsed(ctx->job, resp))
+	{
+		resp->splice_fd = ctx->outfd;
+		resp->splice_body = 1;
+	}
 //	info_printf("Opened %d\n", ctx->outfd);
 
 out:
@@ -2531,10 +3076,41 @@ out:
 	return ret;
 }
 
+// the rest of the part is not needed any more (split off or downloaded by the twin)
+static void _part_stop(wget_http_response_t *resp, struct _body_callback_context *ctx)
+{
+	// HTTP/1.1 can't cancel a request, the connection is closed after the response (HTTP/2 just drops the data)
+	if (ctx->conn->protocol != WGET_PROTOCOL_HTTP_2_0
+		&& (!resp->content_length_valid || (off_t) resp->content_length > ctx->length))
+	{
+		wget_http_abort_connection(ctx->conn);
+	}
+}
+
 static int _get_body(wget_http_response_t *resp, void *context, const char *data, size_t length)
 {
 	struct _body_callback_context *ctx = (struct _body_callback_context *)context;
 
+	if (!data) {
+		// 'length' bytes have been spliced into ctx->outfd
+		ctx->length += length;
+
+		if (config.progress)
+			bar_set_downloaded(ctx->progress_slot, resp->cur_downloaded);
+
+		return 0;
+	}
+
+	int part_last = 0;
+
+	if (ctx->part) {
+		// the end of the part is lowered when another downloader takes over its upper half
+		if (!(length = host_part_reserve(ctx->part, ctx->length, length, &part_last))) {
+			_part_stop(resp, ctx);
+			return 0;
+		}
+	}
+
 	ctx->length += length;
 
 	if (ctx->outfd >= 0) {
@@ -2560,16 +3136,45 @@ static int _get_body(wget_http_response_t *resp, void *context, const char *data
 		}
 	}
 
-	if (ctx->max_memory == 0 || ctx->length < (off_t) ctx->max_memory)
+	if (ctx->part) {
+		if (ctx->part->hashing)
+			wget_hash(ctx->part->hash, data, length);
+
+		if (part_last)
+			_part_stop(resp, ctx);
+	}
+
+	// parts are only written through to the file, their size is checked with 'part->received'
+	if (!ctx->part && (ctx->max_memory == 0 || ctx->length < (off_t) ctx->max_memory))
 		wget_buffer_memcat(ctx->body, data, length); // append new data to body
 
 	if (config.progress)
 		bar_set_downloaded(ctx->progress_slot, resp->cur_downloaded);
 
+	// not reading from the connection for a while slows down the sender
+	if ((config.limit_rate || config.limit_rate_per_host) && resp->cur_downloaded > ctx->rate_limited) {
+		size_t nbytes = resp->cur_downloaded - ctx->rate_limited; // as received, before decompression
+		long long now = wget_get_timemillis() * 1000, pause = 0, host_pause;
+
+		ctx->rate_limited = resp->cur_downloaded;
+
+		if (config.limit_rate)
+			pause = _rate_limit(&rate_limit_ts, config.limit_rate, nbytes, now);
+
+		if (config.limit_rate_per_host && ctx->job->host) {
+			host_pause = _rate_limit(&ctx->job->host->rate_limit_ts, config.limit_rate_per_host, nbytes, now);
+			if (host_pause > pause)
+				pause = host_pause;
+		}
+
+		if (pause > 0 && !terminate)
+			event_millisleep(pause);
+	}
+
 	return 0;
 }
 
-static wget_http_request_t *http_create_request(wget_iri_t *iri, JOB *job)
+static wget_http_request_t *http_create_request(wget_iri_t *iri, JOB *job, PART *part)
 {
 	wget_http_request_t *req;
 	wget_buffer_t buf;
@@ -2657,21 +3262,8 @@ static wget_http_request_t *http_create_request(wget_iri_t *iri, JOB *job)
 
 	if (config.referer)
 		wget_http_add_header(req, "Referer", config.referer);
-	else if (job->referer) {
-		wget_iri_t *referer = job->referer;
-
-		wget_buffer_strcpy(&buf, referer->scheme);
-		wget_buffer_memcat(&buf, "://", 3);
-		wget_buffer_strcat(&buf, referer->host);
-		if (referer->resolv_port) {
-			wget_buffer_memcat(&buf, ":", 1);
-			wget_buffer_strcat(&buf, referer->resolv_port);
-		}
-		wget_buffer_memcat(&buf, "/", 1);
-		wget_iri_get_escaped_resource(referer, &buf);
-
-		wget_http_add_header(req, "Referer", buf.data);
-	}
+	else if (job->referer)
+		wget_http_add_header(req, "Referer", job->referer);
 
 	if (job->challenges) {
 		// There might be more than one challenge, we could select the most secure one.
@@ -2721,9 +3313,9 @@ static wget_http_request_t *http_create_request(wget_iri_t *iri, JOB *job)
 		}
 	}
 
-	if (job->part)
+	if (part)
 		wget_http_add_header_printf(req, "Range", "bytes=%llu-%llu",
-			(unsigned long long) job->part->position, (unsigned long long) job->part->position + job->part->length - 1);
+			(unsigned long long) part->position, (unsigned long long) part->position + host_part_length(part) - 1);
 
 	// add cookies
 	if (config.cookies) {
@@ -2790,10 +3382,10 @@ int http_send_request(wget_iri_t *iri, DOWNLOADER *downloader)
 		// If the Content-Type header gives us not a parseable type, we are done.
 		print_status(downloader, "[%d] Checking '%s' ...\n", downloader->id, iri->uri);
 	} else {
-		if (job->part)
+		if (downloader->part)
 			print_status(downloader, "downloading part %d/%d (%lld-%lld) %s from %s\n",
-				job->part->id, wget_vector_size(job->parts),
-				(long long)job->part->position, (long long)(job->part->position + job->part->length - 1),
+				downloader->part->id, wget_vector_size(job->parts),
+				(long long)downloader->part->position, (long long)(downloader->part->position + host_part_length(downloader->part) - 1),
 				job->metalink->name, iri->host);
 		else if (config.progress)
 			bar_print(downloader->id, iri->uri);
@@ -2801,24 +3393,22 @@ int http_send_request(wget_iri_t *iri, DOWNLOADER *downloader)
 			print_status(downloader, "[%d] Downloading '%s' ...\n", downloader->id, iri->uri);
 	}
 
-	wget_http_request_t *req = http_create_request(iri, downloader->job);
+	wget_http_request_t *req = http_create_request(iri, downloader->job, downloader->part);
 
 	if (!req)
 		return WGET_E_UNKNOWN;
 
 	wget_http_request_set_ptr(req, WGET_HTTP_USER_DATA, downloader->job);
 
-	if ((rc = wget_http_send_request(conn, req))) {
-		wget_http_free_request(&req);
-		return rc;
-	}
-
+	// on a shared connection, another downloader might receive the response, so set up everything before sending
 	struct _body_callback_context *context = wget_calloc(1, sizeof(struct _body_callback_context));
 
 	context->job = downloader->job;
-	context->max_memory = downloader->job->part ? 0 : 10 * (1 << 20);
+	context->part = downloader->part; // the part the Range header has been created for
+	context->conn = conn;
+	context->max_memory = 10 * (1 << 20);
 	context->outfd = -1;
-	context->body = wget_buffer_alloc(102400);
+	context->body = wget_buffer_alloc(context->part ? 0 : 102400);
 	context->length = 0;
 	context->progress_slot = downloader->id;
 
@@ -2829,15 +3419,68 @@ int http_send_request(wget_iri_t *iri, DOWNLOADER *downloader)
 	// keep the received response header in 'resp->header'
 	wget_http_request_set_int(req, WGET_HTTP_RESPONSE_KEEPHEADER, config.save_headers || config.server_response);
 
+	// a shared connection is used by one downloader at a time
+	if ((rc = pool_lock(downloader)) == WGET_E_SUCCESS) {
+		if (config.max_host_connections)
+			context->sent = wget_get_timemillis();
+		rc = wget_http_send_request(conn, req);
+		pool_unlock(downloader, rc == 0);
+	}
+
+	if (rc) {
+		wget_buffer_free(&context->body);
+		xfree(context);
+		wget_http_free_request(&req);
+		return rc;
+	}
+
 	return WGET_E_SUCCESS;
 }
 
+// free a request that never got a response, together with its body callback context
+static void _free_unanswered_request(wget_http_request_t *req)
+{
+	struct _body_callback_context *context = req->body_user_data;
+
+	if (context) {
+		if (context->outfd != -1)
+			close(context->outfd);
+
+		wget_buffer_free(&context->body);
+		xfree(context);
+	}
+
+	wget_http_free_request(&req);
+}
+
+// Frees the requests sent on 'conn' that are still waiting for their response,
+// to be called before closing a broken connection.
+void http_free_pending_requests(wget_http_connection_t *conn)
+{
+	wget_http_request_t *req;
+
+	while ((req = wget_vector_get(conn->pending_requests, 0))) {
+		wget_vector_remove_nofree(conn->pending_requests, 0);
+		_free_unanswered_request(req);
+	}
+}
+
 wget_http_response_t *http_receive_response(wget_http_connection_t *conn)
 {
-	wget_http_response_t *resp = wget_http_get_response_cb(conn);
+	// an HTTP/1.1 request is removed from 'pending_requests' even if no response could be read
+	wget_http_request_t *req = conn->protocol != WGET_PROTOCOL_HTTP_2_0 ? wget_vector_get(conn->pending_requests, 0) : NULL;
+	wget_http_response_t *resp;
+
+	if (req && req->body_user_data && config.max_host_connections)
+		((struct _body_callback_context *) req->body_user_data)->head = wget_get_timemillis();
 
-	if (!resp)
+	resp = wget_http_get_response_cb(conn);
+
+	if (!resp) {
+		if (req)
+			_free_unanswered_request(req);
 		return NULL;
+	}
 
 	struct _body_callback_context *context = resp->req->body_user_data;
 
@@ -2858,9 +3501,15 @@ wget_http_response_t *http_receive_response(wget_http_connection_t *conn)
 		context->outfd = -1;
 	}
 
+	if (context->part && context->part->hashing)
+		_part_hash_check(context->job, context->part);
+
 	if (config.progress)
 		bar_slot_deregister(context->progress_slot);
 
+	if (context->job->host)
+		host_response_feedback(context->job->host, resp->code, context->sent, context->ttfb, resp->cur_downloaded);
+
 	xfree(context);
 
 	return resp;
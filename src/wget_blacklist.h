@@ -30,10 +30,14 @@
 
 #include <wget.h>
 
+#include "wget_checkpoint.h"
+
 int in_blacklist(wget_iri_t *iri) G_GNUC_WGET_NONNULL_ALL;
 int blacklist_size(void) G_GNUC_WGET_PURE;
 wget_iri_t *blacklist_add(wget_iri_t *iri);
 void blacklist_print(void);
+int blacklist_save(CHECKPOINT *cp) G_GNUC_WGET_NONNULL_ALL;
+int blacklist_load(CHECKPOINT *cp) G_GNUC_WGET_NONNULL_ALL;
 void blacklist_free(void);
 
 #endif /* _WGET_BLACKLIST_H */
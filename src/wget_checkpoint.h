@@ -0,0 +1,52 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Header file for crawl checkpoint routines
+ *
+ */
+
+#ifndef _WGET_CHECKPOINT_H
+#define _WGET_CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <wget.h>
+
+// checkpoint file being written or read, errors are sticky
+typedef struct {
+	FILE
+		*fp;
+	int
+		error; // set on the first write/read error or malformed data, further calls are no-ops
+} CHECKPOINT;
+
+typedef int (*checkpoint_func_t)(CHECKPOINT *cp, void *ctx);
+
+int checkpoint_save(const char *fname, checkpoint_func_t save_func, void *ctx) G_GNUC_WGET_NONNULL((1,2));
+int checkpoint_load(const char *fname, checkpoint_func_t load_func, void *ctx) G_GNUC_WGET_NONNULL((1,2));
+
+void checkpoint_write_uint(CHECKPOINT *cp, uint64_t value) G_GNUC_WGET_NONNULL_ALL;
+void checkpoint_write_data(CHECKPOINT *cp, const void *data, size_t len) G_GNUC_WGET_NONNULL((1));
+void checkpoint_write_string(CHECKPOINT *cp, const char *s) G_GNUC_WGET_NONNULL((1));
+uint64_t checkpoint_read_uint(CHECKPOINT *cp) G_GNUC_WGET_NONNULL_ALL;
+void *checkpoint_read_data(CHECKPOINT *cp, size_t *len) G_GNUC_WGET_NONNULL_ALL;
+char *checkpoint_read_string(CHECKPOINT *cp) G_GNUC_WGET_NONNULL_ALL;
+
+#endif /* _WGET_CHECKPOINT_H */
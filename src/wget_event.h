@@ -0,0 +1,37 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Header file for the event driven download engine
+ *
+ */
+
+#ifndef _WGET_EVENT_H
+#define _WGET_EVENT_H
+
+typedef struct EVENT_TASK EVENT_TASK;
+
+int event_init(int nloops);
+void event_deinit(void);
+int event_spawn(void *(*func)(void *), void *arg) G_GNUC_WGET_NONNULL((1));
+EVENT_TASK *event_task_self(void);
+void event_task_wait(long long ms);
+void event_task_wakeup(EVENT_TASK *task) G_GNUC_WGET_NONNULL((1));
+void event_millisleep(int ms);
+
+#endif /* _WGET_EVENT_H */
@@ -28,13 +28,23 @@
 #ifndef _WGET_HOST_H
 #define _WGET_HOST_H
 
+#include <sys/types.h> // for off_t
+
 #include <wget.h>
 
+#include "wget_checkpoint.h"
+
 struct JOB;
 typedef struct JOB JOB;
 
+typedef struct PART PART;
+
+typedef struct HOST HOST;
+
+typedef struct DOWNLOADER DOWNLOADER;
+
 // everything host/domain specific should go here
-typedef struct {
+struct HOST {
 	const char
 		*scheme,
 		*host,
@@ -44,31 +54,64 @@ typedef struct {
 	ROBOTS
 		*robots;
 	wget_list_t
-		*queue; // host specific job queue
+		*queue, // host specific job queue
+		*ready, // jobs (JOB *) from 'queue' that have work left to hand out, in FIFO order
+		*inflight, // jobs (JOB *) from 'queue' that are currently worked on by downloaders
+		*segments, // spilled jobs written to the spill file (SPILL_SEGMENT), oldest first
+		**ready_list; // list of hosts 'ready_node' is linked into, NULL if not linked
+	wget_buffer_t
+		*spill_buf; // spilled jobs not yet written to the spill file, they follow 'segments'
+	HOST
+		**ready_node; // position within the list of hosts with ready jobs, NULL if not linked
 	long long
-		retry_ts; // timestamp of earliest retry in milliseconds
+		retry_ts, // no job is handed out before this timestamp in milliseconds (backoff after errors, --wait)
+		rate_limit_ts, // --limit-rate-per-host: bucket state, see _rate_limit() in wget.c
+		round_start, // --max-host-connections: start of the current round in milliseconds
+		round_ttfb, // sum of the times to first byte in the current round in milliseconds
+		round_bytes, // bytes received in the current round
+		round_rate, // bytes per second received in the former round
+		ttfb_min; // lowest average time to first byte of a round in milliseconds, 0 if not yet known
 	int
-		qsize, // number of jobs in queue
+		heap_pos, // 1-based position within the retry heap, 0 if host is not waiting
+		workers, // number of downloaders attached to this host
+		max_workers, // --max-host-connections: current limit of attached downloaders, adapted to the feedback
+		round_responses, // number of responses in the current round
+		qsize, // number of jobs in queue, including the spilled ones
+		nspilled, // number of jobs in 'segments' and 'spill_buf'
+		spill_buf_jobs, // number of jobs in 'spill_buf'
 		failures; // number of consequent connection failures
 	unsigned char
-		blocked : 1; // host may be blocked after too many errors or even one final error
-} HOST;
+		blocked : 1, // host may be blocked after too many errors or even one final error
+		grown : 1, // 'max_workers' has been increased at the end of the former round
+		no_pipelining : 1; // host dropped the connection while HTTP/1.1 requests were pipelined
+};
 
 HOST *host_add(wget_iri_t *iri) G_GNUC_WGET_NONNULL((1));
 HOST *host_get(wget_iri_t *iri) G_GNUC_WGET_NONNULL((1));
-JOB *host_get_job(HOST *host, long long *pause);
+JOB *host_get_job(HOST *host, DOWNLOADER *downloader, long long *pause);
 JOB *host_add_job(HOST *host, JOB *job) G_GNUC_WGET_NONNULL((1,2));
 JOB *host_add_robotstxt_job(HOST *host, wget_iri_t *iri, const char *encoding) G_GNUC_WGET_NONNULL((1,2));
-void host_release_jobs(HOST *host);
+void host_detach(HOST *host) G_GNUC_WGET_NONNULL((1));
+void host_release_jobs(HOST *host, DOWNLOADER *downloader);
+int host_requeue_job(JOB *job) G_GNUC_WGET_NONNULL((1));
+size_t host_part_reserve(PART *part, off_t offset, size_t length, int *last) G_GNUC_WGET_NONNULL((1,4));
+off_t host_part_length(PART *part) G_GNUC_WGET_NONNULL((1));
+int host_part_complete(PART *part) G_GNUC_WGET_NONNULL((1));
+int host_finish_part(JOB *job, PART *part, int ok) G_GNUC_WGET_NONNULL((1,2));
 void host_remove_job(HOST *host, JOB *job) G_GNUC_WGET_NONNULL((1,2));
 void host_queue_free(HOST *host) G_GNUC_WGET_NONNULL((1));
 void hosts_free(void);
-void host_increase_failure(HOST *host) G_GNUC_WGET_NONNULL((1));
+int hosts_save(CHECKPOINT *cp) G_GNUC_WGET_NONNULL_ALL;
+int hosts_load(CHECKPOINT *cp) G_GNUC_WGET_NONNULL_ALL;
+void host_increase_failure(HOST *host, long long sent) G_GNUC_WGET_NONNULL((1));
 void host_final_failure(HOST *host) G_GNUC_WGET_NONNULL((1));
 void host_reset_failure(HOST *host) G_GNUC_WGET_NONNULL((1));
+void host_disable_pipelining(HOST *host) G_GNUC_WGET_NONNULL((1));
+void host_response_feedback(HOST *host, int code, long long sent, long long ttfb, size_t nbytes) G_GNUC_WGET_NONNULL((1));
 
 int queue_size(void) G_GNUC_WGET_PURE;
 int queue_empty(void) G_GNUC_WGET_PURE;
+int queue_ready(void);
 void queue_print(HOST *host);
 
 #endif /* _WGET_HOST_H */
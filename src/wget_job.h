@@ -34,30 +34,47 @@
 #include "wget_host.h"
 
 // file part to download
-typedef struct {
+struct PART {
 	off_t
 		position;
 	off_t
-		length;
+		length; // may be lowered while the part is downloaded, when its upper half is split off
+	off_t
+		received; // number of bytes reserved for writing by the current or last download
 	int
-		id;
-	wget_thread_t
-		used_by;
+		id; // number of the metalink piece the part belongs to
+	int
+		mirror; // index of the metalink mirror used for the last download
+	long long
+		started; // time the current download got connected to 'mirror' in milliseconds, 0 if none
+	wget_hash_hd_t
+		*hash; // piece hash computed while the part is downloaded, see 'hashing'
+	unsigned char
+		hashing : 1, // 'hash' is initialized and receives the downloaded data
+		hash_checked : 1, // the piece hash of the last download has been checked, see 'verified'
+		verified : 1; // the last download matched the piece hash
+	// the members below (and 'length' and 'received' while the part is in use) are only accessed
+	// with the hosts mutex locked, the bits above only by the downloader of the part (no shared storage unit)
+	DOWNLOADER
+		*used_by;
+	PART
+		*twin; // endgame: the same range downloaded by another downloader, the first one wins
 	unsigned char
 		inuse : 1,
-		done : 1;
-} PART;
-
-typedef struct DOWNLOADER DOWNLOADER;
+		done : 1,
+		split : 1, // covers only a share of its piece, there is no piece hash for it
+		duplicate : 1; // endgame copy of 'twin'
+};
 
 struct JOB {
 	wget_iri_t
-		*iri,
-		*referer;
+		*iri;
 
 	// Metalink information
 	wget_metalink_t
 		*metalink;
+	struct MIRROR_STATS
+		*mirror_stats; // measurements per metalink mirror, same order as metalink->mirrors
 
 	wget_vector_t
 		*challenges; // challenges from 401 response
@@ -67,21 +84,24 @@ struct JOB {
 	HOST
 		*host;
 	const char
-		*local_filename;
+		*local_filename,
+		*referer; // value of the Referer header
 	PART
 		*part; // current chunk to download
 	DOWNLOADER
-		*downloader;
+		*downloader,
+		*used_by; // keep track of who uses this job, for host_release_jobs()
+	JOB
+		**ready_node, // position within host->ready, NULL if not linked
+		**inflight_node; // position within host->inflight, NULL if not linked
 
-	wget_thread_t
-		used_by; // keep track of who uses this job, for host_release_jobs()
 	int
 		level, // current recursion level
 		redirection_level, // number of redirections occurred to create this job
 		mirror_pos, // where to look up the next (metalink) mirror to use
 		piece_pos; // where to look up the next (metalink) piece to download
 	unsigned char
-		inuse : 1, // if job is already in use, 'used_by' holds the thread id of the downloader
+		inuse : 1, // if job is already in use, 'used_by' points to the downloader
 		sitemap : 1, // URL is a sitemap to be scanned in recursive mode
 		robotstxt : 1, // URL is a robots.txt to be scanned
 		head_first : 1, // first check mime type by using a HEAD request
@@ -93,6 +113,8 @@ struct DOWNLOADER {
 		tid;
 	JOB
 		*job;
+	PART
+		*part; // the part of 'job' to download, NULL for a single-part download
 	wget_http_connection_t
 		*conn;
 	char
@@ -100,16 +122,27 @@ struct DOWNLOADER {
 	size_t
 		bufsize;
 	int
-		id;
+		id,
+		idle; // 0: busy, 1: waiting in the idle stack, 2: woken up by _wake_worker()
 	wget_thread_cond_t
-		cond;
+		cond; // signalled when this (idle) downloader should look for work
+	struct EVENT_TASK
+		*task; // task running this downloader with --engine=event, else NULL
+	struct SHARED_CONN
+		*shared; // 'conn' is an HTTP/2 connection shared with other downloaders, else NULL
 	char
-		final_error;
+		final_error,
+		keep_alive; // 'conn' has been kept alive after a response, so HTTP/1.1 requests may be pipelined
 };
 
 JOB *job_init(JOB *job, wget_iri_t *iri) G_GNUC_WGET_NONNULL((2));
 int job_validate_file(JOB *job) G_GNUC_WGET_NONNULL((1));
 void job_create_parts(JOB *job) G_GNUC_WGET_NONNULL((1));
 void job_free(JOB *job) G_GNUC_WGET_NONNULL((1));
+void part_hash_free(PART *part) G_GNUC_WGET_NONNULL((1));
+void job_rank_mirrors(JOB *job, PART *part, int *order) G_GNUC_WGET_NONNULL_ALL;
+void job_mirror_connected(JOB *job, PART *part, int mirror, long long connect_ms) G_GNUC_WGET_NONNULL((1,2));
+void job_mirror_failed(JOB *job, int mirror) G_GNUC_WGET_NONNULL((1));
+void job_mirror_finished(JOB *job, PART *part, int failed) G_GNUC_WGET_NONNULL((1,2));
 
 #endif /* _WGET_JOB_H */
@@ -49,5 +49,6 @@ extern int nthreads;
 
 void set_exit_status(int status);
 const char * G_GNUC_WGET_NONNULL_ALL get_local_filename(wget_iri_t *iri);
+void http_free_pending_requests(wget_http_connection_t *conn) G_GNUC_WGET_NONNULL_ALL;
 
 #endif /* _WGET_WGET_H */
@@ -41,6 +41,10 @@
 # define RESTRICT_NAMES_UPPERCASE  1<<4
 # define RESTRICT_NAMES_LOWERCASE  1<<5
 
+// types for --engine
+# define ENGINE_THREAD  0
+# define ENGINE_EVENT  1
+
 struct config {
 	wget_iri_t
 		*base;
@@ -56,6 +60,9 @@ struct config {
 		*local_encoding,  // encoding of the environment and file system
 		*remote_encoding, // encoding of remote files (if not specified in Content-Type HTTP header or in document itself)
 		*bind_address,
+		*dns_servers, // comma-separated list of name servers, NULL: system resolver
+		*dns_cache_file,
+		*checkpoint_file, // state of a recursive download for --resume-crawl
 		*input_file,
 		*base_url,
 		*default_page,
@@ -72,8 +79,10 @@ struct config {
 		*output_document,
 		*ca_cert,
 		*ca_directory,
+		*ca_cache_file, // DER cache of the CA certificates from ca_directory
 		*cert_file,
 		*crl_file,
+		*ocsp_server, // OCSP responder to ask instead of the one named in the certificates
 		*egd_file,
 		*private_key,
 		*random_file,
@@ -105,10 +114,12 @@ struct config {
 	size_t
 		chunk_size;
 	long long
-		quota;
+		quota,
+		limit_rate, // max. bytes per second of all downloads together, 0 = no limit
+		limit_rate_per_host; // max. bytes per second from a single host, 0 = no limit
 	int
 		http2_request_window,
-		http1_request_window,
+		http1_pipeline, // max. number of HTTP/1.1 requests in flight per connection, 0/1: no pipelining
 		backups,
 		tries,
 		wait,
@@ -121,10 +132,21 @@ struct config {
 		dns_timeout, // ms
 		read_timeout, // ms
 		max_redirect,
-		max_threads;
+		dns_cache_size, // max. number of DNS cache entries, 0: no limit
+		max_threads,
+		max_host_connections, // max. number of downloaders per host, adapted to the feedback; 0: no limit
+		pool_idle_timeout, // ms
+		pool_max_idle, // per scheme/host/port
+		preconnect, // max. number of connections opened in advance at a time
+		max_jobs_in_memory, // queued jobs beyond this number are spilled to disk, 0: no limit
+		checkpoint_interval, // ms, <= 0: save checkpoints only on exit
+		event_threads; // 0: one event loop per CPU
 	char
+		engine, // ENGINE_THREAD or ENGINE_EVENT
 		tls_resume,            // if TLS session resumption is enabled or not
 		tls_false_start,
+		tls_early_data, // send idempotent requests as TLS 1.3 early data on resumed sessions
+		ktls, // splice bodies into the files, HTTPS bodies decrypted by the kernel
 		progress,
 		content_on_error,
 		fsync_policy,
@@ -132,6 +154,7 @@ struct config {
 		http2,
 		ocsp_stapling,
 		ocsp,
+		ocsp_soft_fail, // go on if an OCSP responder does not answer
 		mirror,
 		backup_converted,
 		convert_links,
@@ -140,6 +163,8 @@ struct config {
 		random_wait,
 		trust_server_names,
 		robots,
+		compact_blacklist, // keep only fingerprints of seen URLs
+		resume_crawl, // load config.checkpoint_file at startup
 		parent,
 		https_only,
 		content_disposition,
@@ -171,6 +196,7 @@ struct config {
 		cookies,
 		spider,
 		dns_caching,
+		dns_prefetch, // resolve new host names in the background
 		tcp_fastopen,
 		check_certificate,
 		check_hostname,
@@ -0,0 +1,46 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Header file for the keep-alive connection pool
+ *
+ */
+
+#ifndef _WGET_POOL_H
+#define _WGET_POOL_H
+
+#include <wget.h>
+
+#include "wget_host.h"
+
+wget_http_connection_t *pool_checkout(const wget_iri_t *iri) G_GNUC_WGET_NONNULL_ALL;
+void pool_checkin(wget_http_connection_t **conn) G_GNUC_WGET_NONNULL_ALL;
+wget_http_connection_t *pool_get(DOWNLOADER *downloader, const wget_iri_t *iri) G_GNUC_WGET_NONNULL_ALL;
+void pool_connected(DOWNLOADER *downloader, const wget_iri_t *iri) G_GNUC_WGET_NONNULL_ALL;
+void pool_release(DOWNLOADER *downloader) G_GNUC_WGET_NONNULL_ALL;
+void pool_close(DOWNLOADER *downloader) G_GNUC_WGET_NONNULL_ALL;
+int pool_lock(DOWNLOADER *downloader) G_GNUC_WGET_NONNULL_ALL;
+void pool_unlock(DOWNLOADER *downloader, int sent) G_GNUC_WGET_NONNULL((1));
+void pool_wait_stream(DOWNLOADER *downloader) G_GNUC_WGET_NONNULL_ALL;
+int pool_stream_available(DOWNLOADER *downloader) G_GNUC_WGET_NONNULL_ALL;
+wget_http_response_t *pool_receive(DOWNLOADER *downloader, wget_http_response_t *(*receive)(wget_http_connection_t *)) G_GNUC_WGET_NONNULL_ALL;
+void pool_preconnect(wget_iri_t *iri) G_GNUC_WGET_NONNULL_ALL;
+void pool_print_stats(void);
+void pool_free(void);
+
+#endif /* _WGET_POOL_H */
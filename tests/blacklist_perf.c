@@ -0,0 +1,189 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing memory usage and throughput of the URL blacklist (blacklist_add())
+ * compared to a hashmap of parsed IRIs (how the blacklist used to work)
+ * usage: blacklist_perf [number of URLs]
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef __GLIBC__
+# include <malloc.h>
+#endif
+
+#include <wget.h>
+
+#include "../src/wget_main.h"
+#include "../src/wget_blacklist.h"
+#include "../src/wget_options.h"
+
+static double _elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+// bytes allocated on the heap, -1 if unknown
+static long long _heap_used(void)
+{
+#if defined __GLIBC__ && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	return (long long) mallinfo2().uordblks + (long long) mallinfo2().hblkhd;
+#elif defined __GLIBC__
+	return (long long) mallinfo().uordblks + (long long) mallinfo().hblkhd;
+#else
+	return -1;
+#endif
+}
+
+// URLs of a crawl: a few thousand hosts with many pages each
+static wget_iri_t **_parse_urls(int nurls)
+{
+	wget_iri_t **iris = wget_malloc(nurls * sizeof(wget_iri_t *));
+	char url[128];
+
+	for (int it = 0; it < nurls; it++) {
+		snprintf(url, sizeof(url), "https://www%d.example.com/section%d/article-%d.html?page=%d",
+			it % 5000, it % 37, it, it % 10);
+		iris[it] = wget_iri_parse(url, "utf-8");
+	}
+
+	return iris;
+}
+
+// the former implementation, the hashmap takes ownership of the IRIs
+static unsigned int _hash_iri(const wget_iri_t *iri)
+{
+	unsigned int h = 0;
+	const unsigned char *p;
+
+	for (p = (unsigned char *)iri->scheme; p && *p; p++)
+		h = h * 101 + *p;
+	for (p = (unsigned char *)iri->port; p && *p; p++)
+		h = h * 101 + *p;
+	for (p = (unsigned char *)iri->host; p && *p; p++)
+		h = h * 101 + *p;
+	for (p = (unsigned char *)iri->path; p && *p; p++)
+		h = h * 101 + *p;
+	for (p = (unsigned char *)iri->query; p && *p; p++)
+		h = h * 101 + *p;
+
+	return h;
+}
+
+static void _free_iri(wget_iri_t *iri)
+{
+	wget_iri_free(&iri);
+}
+
+static void _bench_hashmap(int nurls)
+{
+	wget_hashmap_t *blacklist = wget_hashmap_create(128, -2, (wget_hashmap_hash_t)_hash_iri, (wget_hashmap_compare_t)wget_iri_compare);
+	struct timespec start;
+	long long heap = _heap_used();
+	double ns;
+
+	wget_hashmap_set_key_destructor(blacklist, (wget_hashmap_key_destructor_t)_free_iri);
+
+	wget_iri_t **iris = _parse_urls(nurls);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int it = 0; it < nurls; it++) {
+		if (!wget_hashmap_contains(blacklist, iris[it]))
+			wget_hashmap_put_noalloc(blacklist, iris[it], NULL);
+	}
+	ns = _elapsed_ns(&start) / nurls;
+
+	xfree(iris);
+	heap = _heap_used() - heap;
+
+	printf("%8d URLs, IRI hashmap:        %6.1f ns per add, %6.1f bytes per URL\n", nurls, ns, heap >= 0 ? (double) heap / nurls : -1.0);
+
+	// look up all of them again, as with duplicate links
+	iris = _parse_urls(nurls);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int it = 0; it < nurls; it++) {
+		if (wget_hashmap_contains(blacklist, iris[it]))
+			wget_iri_free(&iris[it]);
+	}
+	printf("%8d URLs, IRI hashmap:        %6.1f ns per known URL\n", nurls, _elapsed_ns(&start) / nurls);
+	xfree(iris);
+
+	wget_hashmap_free(&blacklist);
+}
+
+static void _bench_blacklist(int nurls, int compact)
+{
+	struct timespec start;
+	long long heap = _heap_used();
+	const char *name = compact ? "fingerprints:        " : "fingerprints + URLs: ";
+	double ns;
+
+	config.compact_blacklist = (char) compact;
+
+	wget_iri_t **iris = _parse_urls(nurls);
+
+	// blacklist_add() returns new URLs to the caller, the job that would own them is left out here
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int it = 0; it < nurls; it++) {
+		if (blacklist_add(iris[it]) != iris[it])
+			iris[it] = NULL;
+	}
+	ns = _elapsed_ns(&start) / nurls;
+
+	for (int it = 0; it < nurls; it++)
+		wget_iri_free(&iris[it]);
+	xfree(iris);
+	heap = _heap_used() - heap;
+
+	printf("%8d URLs, %s%6.1f ns per add, %6.1f bytes per URL\n", nurls, name, ns, heap >= 0 ? (double) heap / nurls : -1.0);
+
+	iris = _parse_urls(nurls);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int it = 0; it < nurls; it++) {
+		if (blacklist_add(iris[it]))
+			fprintf(stderr, "URL %d unexpectedly new\n", it);
+	}
+	printf("%8d URLs, %s%6.1f ns per known URL\n", nurls, name, _elapsed_ns(&start) / nurls);
+	xfree(iris);
+
+	blacklist_free();
+}
+
+int main(int argc, const char **argv)
+{
+	int max_urls = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	for (int nurls = 10000; nurls <= max_urls; nurls *= 10) {
+		_bench_hashmap(nurls);
+		_bench_blacklist(nurls, 0);
+		_bench_blacklist(nurls, 1);
+	}
+
+	return 0;
+}
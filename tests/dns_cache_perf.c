@@ -0,0 +1,97 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing performance of the DNS cache (load, lookup, save) with many host names
+ * usage: dns_cache_perf [number of host names]
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wget.h>
+
+static double _elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+static void _bench(const char *fname, int nhosts, int max_size)
+{
+	struct timespec start;
+	char host[64];
+	int found = 0;
+
+	wget_dns_cache_set_max_size(max_size);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	wget_dns_cache_load(fname);
+	printf("%7d entries, max. %6d: %8.1f ns per entry loaded\n", nhosts, max_size, _elapsed_ns(&start) / nhosts);
+
+	// the last entries in the file are the most recently used ones
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int it = nhosts - 1; it >= 0; it--) {
+		snprintf(host, sizeof(host), "host%d.example.com", it);
+		if (wget_tcp_resolve(NULL, host, "80"))
+			found++;
+		if (found == max_size)
+			break; // the rest would be resolved by the system resolver
+	}
+	printf("%7d entries, max. %6d: %8.1f ns per cache hit\n", nhosts, max_size, _elapsed_ns(&start) / found);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	wget_dns_cache_save("dns_cache_perf.tmp");
+	printf("%7d entries, max. %6d: %8.1f ns per entry saved\n", nhosts, max_size, _elapsed_ns(&start) / found);
+
+	unlink("dns_cache_perf.tmp");
+	wget_dns_cache_free();
+}
+
+int main(int argc, const char **argv)
+{
+	int nhosts = argc > 1 ? atoi(argv[1]) : 100000;
+	const char *fname = "dns_cache_perf.txt";
+	long long expires = (long long) time(NULL) + 3600;
+	FILE *fp;
+
+	if (nhosts < 1 || !(fp = fopen(fname, "w")))
+		return 1;
+
+	for (int it = 0; it < nhosts; it++)
+		fprintf(fp, "host%d.example.com 80 %lld 0 10.%d.%d.%d\n", it, expires, (it >> 16) & 255, (it >> 8) & 255, it & 255);
+
+	fclose(fp);
+
+	_bench(fname, nhosts, 0);
+	_bench(fname, nhosts, nhosts / 10 ? nhosts / 10 : 1);
+
+	unlink(fname);
+
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing throughput of the downloaders (1 to 128 threads or tasks) against the test server
+ * usage: downloader_perf [number of files] [thread|event]
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libtest.h"
+
+static double _elapsed_s(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, const char **argv)
+{
+	int nfiles = argc > 1 ? atoi(argv[1]) : 2000;
+	const char *engine = argc > 2 ? argv[2] : "thread";
+	wget_test_url_t *urls = wget_calloc(nfiles + 1, sizeof(wget_test_url_t));
+	wget_test_file_t *files = wget_calloc(nfiles + 2, sizeof(wget_test_file_t));
+	wget_buffer_t *list = wget_buffer_alloc(nfiles * 48);
+	struct timespec start;
+	char options[160];
+
+	if (nfiles < 1)
+		return 1;
+
+	for (int it = 0; it < nfiles; it++) {
+		urls[it].name = wget_aprintf("/file%d.txt", it);
+		urls[it].code = "200 Dontcare";
+		urls[it].body = "some content";
+		urls[it].headers[0] = "Content-Type: text/plain";
+		urls[it].headers[1] = "Connection: close"; // the test server serves one request per connection
+
+		wget_buffer_printf_append(list, "http://localhost:{{port}}/file%d.txt\n", it);
+		files[it + 1].name = urls[it].name + 1;
+	}
+
+	urls[nfiles].name = "/urls.txt";
+	urls[nfiles].code = "200 Dontcare";
+	urls[nfiles].body = list->data;
+	urls[nfiles].headers[0] = "Content-Type: text/plain";
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, urls, (size_t) nfiles + 1,
+		0);
+
+	// the server replaced {{port}} within the URL list
+	files[0].name = "urls.txt";
+	files[0].content = urls[nfiles].body;
+
+	for (int nthreads = 1; nthreads <= 128; nthreads *= 2) {
+		snprintf(options, sizeof(options), "--no-debug -q --engine=%s --max-threads=%d -i urls.txt", engine, nthreads);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		wget_test(
+			WGET_TEST_OPTIONS, options,
+			WGET_TEST_REQUEST_URL, NULL,
+			WGET_TEST_EXPECTED_ERROR_CODE, 0,
+			WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+				{ files[0].name, files[0].content },
+				{ NULL } },
+			WGET_TEST_EXPECTED_FILES, files,
+			0);
+
+		double secs = _elapsed_s(&start);
+
+		printf("%3d downloaders (%s): %6d files in %6.3f s, %8.1f files/s\n", nthreads, engine, nfiles, secs, nfiles / secs);
+	}
+
+	// the test server frees the URL list at exit, the rest is left to the OS
+	exit(0);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing performance of the host job queue (dequeue cost vs. queue size)
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <wget.h>
+
+#include "../src/wget_main.h"
+#include "../src/wget_host.h"
+#include "../src/wget_job.h"
+#include "../src/wget_options.h"
+
+// referenced by host.c for robots.txt jobs, not needed here
+const char *get_local_filename(wget_iri_t *iri G_GNUC_WGET_UNUSED)
+{
+	return NULL;
+}
+
+static double _elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+static void _bench(int njobs, int jobs_per_host, int nops)
+{
+	int nhosts = (njobs + jobs_per_host - 1) / jobs_per_host;
+	wget_iri_t **iris = wget_malloc(nhosts * sizeof(wget_iri_t *));
+	HOST **hostv = wget_malloc(nhosts * sizeof(HOST *));
+	struct timespec start;
+	char url[64];
+	JOB job;
+
+	for (int it = 0; it < nhosts; it++) {
+		snprintf(url, sizeof(url), "http://host%d.example.com/", it);
+		iris[it] = wget_iri_parse(url, "utf-8");
+		hostv[it] = host_add(iris[it]);
+	}
+
+	// each job owns its IRI, job_free() frees it
+	for (int it = 0; it < njobs; it++)
+		host_add_job(hostv[it % nhosts], job_init(&job, wget_iri_clone(iris[it % nhosts])));
+
+	// let every 10th host wait in the retry heap
+	for (int it = 0; it < nhosts; it += 10)
+		host_increase_failure(hostv[it], wget_get_timemillis());
+
+	if (nops > njobs - njobs / 10)
+		nops = njobs - njobs / 10;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int it = 0; it < nops; it++) {
+		JOB *jobp = host_get_job(NULL, NULL, NULL);
+
+		if (!jobp) {
+			fprintf(stderr, "queue unexpectedly empty after %d dequeues\n", it);
+			break;
+		}
+
+		HOST *host = jobp->host;
+
+		host_remove_job(host, jobp);
+		host_detach(host);
+	}
+
+	printf("%8d jobs on %7d hosts: %8.1f ns per dequeue+remove\n", njobs, nhosts, _elapsed_ns(&start) / nops);
+
+	hosts_free();
+
+	for (int it = 0; it < nhosts; it++)
+		wget_iri_free(&iris[it]);
+	xfree(iris);
+	xfree(hostv);
+}
+
+int main(int argc, const char **argv)
+{
+	int max_jobs = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	// the host names are made up, don't resolve them
+	config.dns_prefetch = 0;
+
+	for (int njobs = 1000; njobs <= max_jobs; njobs *= 10) {
+		_bench(njobs, 1, 10000);
+		_bench(njobs, 100, 10000);
+	}
+
+	return 0;
+}
@@ -43,6 +43,10 @@
 #include <c-ctype.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
 
 #include <wget.h>
 #include "libtest.h"
@@ -51,13 +55,17 @@ static wget_thread_t
 	http_server_tid,
 	https_server_tid,
 	ftp_server_tid,
-	ftps_server_tid;
+	ftps_server_tid,
+	dns_server_tid;
 static int
 	http_server_port,
 	https_server_port,
 	ftp_server_port,
 	ftps_server_port,
+	dns_server_port,
+	dns_server_fd = -1,
 	ftps_implicit,
+	dns_server,
 	terminate,
 	keep_tmpfiles;
 /*static const char
@@ -231,7 +239,7 @@ static void *_http_server_thread(void *ctx)
 						nbytes += snprintf(buf + nbytes, sizeof(buf) - nbytes, "%.*s", (int)body_len, url->body + from_bytes);
 				} else {
 					// create response
-					body_len = strlen(url->body ? url->body : "");
+					body_len = url->body_len ? url->body_len : strlen(url->body ? url->body : "");
 					nbytes = snprintf(buf, sizeof(buf),
 						"HTTP/1.1 %s\r\n"\
 						"Content-Length: %zu\r\n",
@@ -240,12 +248,26 @@ static void *_http_server_thread(void *ctx)
 						nbytes += snprintf(buf + nbytes, sizeof(buf) - nbytes, "%s\r\n", url->headers[it]);
 					}
 					nbytes += snprintf(buf + nbytes, sizeof(buf) - nbytes, "\r\n");
-					if (!strcmp(method, "GET") || !strcmp(method, "POST"))
-						nbytes += snprintf(buf + nbytes, sizeof(buf) - nbytes, "%s", url->body ? url->body : "");
+					if (!strcmp(method, "GET") || !strcmp(method, "POST")) {
+						if (body_len >= sizeof(buf) - nbytes) {
+							// large bodies don't fit into buf
+							wget_tcp_write(tcp, buf, nbytes);
+							for (size_t sent = 0; sent < body_len; sent += n) {
+								if ((n = wget_tcp_write(tcp, url->body + sent, body_len - sent)) <= 0)
+									break;
+							}
+							nbytes = 0;
+						} else if (url->body_len) {
+							memcpy(buf + nbytes, url->body, url->body_len);
+							nbytes += url->body_len;
+						} else
+							nbytes += snprintf(buf + nbytes, sizeof(buf) - nbytes, "%s", url->body ? url->body : "");
+					}
 				}
 
 				// send response
-				wget_tcp_write(tcp, buf, nbytes);
+				if (nbytes)
+					wget_tcp_write(tcp, buf, nbytes);
 			}
 		} else if (!terminate)
 			wget_error_printf(_("Failed to get connection (%d)\n"), errno);
@@ -383,6 +405,77 @@ static void *_ftp_server_thread(void *ctx)
 	return NULL;
 }
 
+// A fake name server for the --dns-servers tests.
+// Every name resolves to 127.0.0.1 (IPv4 only), names ending with '.invalid' don't exist (RFC 6761).
+// Names starting with 'blackhole.' resolve to 127.0.0.2 first, where the test may put a blackhole socket.
+static void *_dns_server_thread(void *ctx G_GNUC_WGET_UNUSED)
+{
+	unsigned char buf[512];
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	ssize_t nbytes;
+
+#ifdef _WIN32
+	signal(SIGTERM, sigterm_handler);
+#else
+	sigaction(SIGTERM, &(struct sigaction) { .sa_handler = sigterm_handler }, NULL);
+#endif
+
+	while (!terminate) {
+		struct pollfd pollfd = { .fd = dns_server_fd, .events = POLLIN };
+		unsigned char *p, *end, *label = NULL;
+		int qtype, blackhole;
+
+		if (poll(&pollfd, 1, 100) <= 0)
+			continue;
+
+		addrlen = sizeof(addr);
+		if ((nbytes = recvfrom(dns_server_fd, buf, sizeof(buf) - 32, 0, (struct sockaddr *)&addr, &addrlen)) < 17)
+			continue;
+
+		// parse the question, just one is expected
+		p = buf + 12;
+		blackhole = *p == 9 && !wget_strncasecmp_ascii((char *)p + 1, "blackhole", 9);
+
+		for (end = buf + nbytes; p < end && *p; p += *p + 1)
+			label = p;
+
+		if (p + 5 > end || !label)
+			continue;
+
+		qtype = (p[1] << 8) | p[2];
+		p += 5;
+
+		buf[2] = 0x81; // QR, RD
+		buf[3] = 0x80; // RA, NOERROR
+		buf[6] = buf[7] = 0; // ANCOUNT
+		buf[8] = buf[9] = buf[10] = buf[11] = 0; // NSCOUNT, ARCOUNT
+
+		if (*label == 7 && !wget_strncasecmp_ascii((char *)label + 1, "invalid", 7)) {
+			buf[3] |= 3; // NXDOMAIN
+		} else if (qtype == 1) {
+			// name pointer to the question, type A, class IN, TTL 60, 127.0.0.1
+			static const unsigned char answer[16] = { 0xC0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 127, 0, 0, 1 };
+
+			if (blackhole) {
+				memcpy(p, answer, sizeof(answer));
+				p[15] = 2;
+				p += sizeof(answer);
+				buf[7]++;
+			}
+
+			memcpy(p, answer, sizeof(answer));
+			p += sizeof(answer);
+			buf[7]++;
+		}
+
+		if (sendto(dns_server_fd, buf, p - buf, 0, (struct sockaddr *)&addr, addrlen) < 0)
+			wget_error_printf(_("Failed to send DNS answer (%d)\n"), errno);
+	}
+
+	return NULL;
+}
+
 #if defined(__CYGWIN__)
 // Using opendir/readdir loop plus unlink() has a race condition
 // with CygWin. Not sure if this also happens on other systems as well.
@@ -468,12 +561,18 @@ void wget_test_stop_server(void)
 	pthread_kill(ftp_server_tid, SIGTERM);
 	if (ftps_implicit)
 		pthread_kill(ftps_server_tid, SIGTERM);
+	if (dns_server)
+		pthread_kill(dns_server_tid, SIGTERM);
 
 	wget_thread_join(http_server_tid);
 	wget_thread_join(https_server_tid);
 	wget_thread_join(ftp_server_tid);
 	if (ftps_implicit)
 		wget_thread_join(ftps_server_tid);
+	if (dns_server) {
+		wget_thread_join(dns_server_tid);
+		close(dns_server_fd);
+	}
 
 	if (chdir("..") != 0)
 		wget_error_printf(_("Failed to chdir ..\n"));
@@ -547,6 +646,11 @@ void wget_test_start_server(int first_key, ...)
 		exit(77);
 	}
 
+#ifndef _WIN32
+	// the client may close a connection the server is still writing to
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
 	wget_global_init(
 		WGET_DEBUG_FUNC, _write_msg,
 		WGET_ERROR_FUNC, _write_msg,
@@ -589,6 +693,9 @@ void wget_test_start_server(int first_key, ...)
 		case WGET_TEST_FTPS_IMPLICIT:
 			ftps_implicit = va_arg(args, int);
 			break;
+		case WGET_TEST_DNS_SERVER:
+			dns_server = va_arg(args, int);
+			break;
 		default:
 			wget_error_printf(_("Unknown option %d\n"), key);
 		}
@@ -618,7 +725,8 @@ void wget_test_start_server(int first_key, ...)
 	http_parent_tcp = wget_tcp_init();
 	wget_tcp_set_timeout(http_parent_tcp, -1); // INFINITE timeout
 	wget_tcp_set_preferred_family(http_parent_tcp, WGET_NET_FAMILY_IPV4); // to have a defined order of IPs
-	if (wget_tcp_listen(http_parent_tcp, "localhost", NULL, 5) != 0)
+	// the backlog must take all connection attempts of a multi-threaded client (see downloader_perf)
+	if (wget_tcp_listen(http_parent_tcp, "localhost", NULL, 128) != 0)
 		exit(1);
 	http_server_port = wget_tcp_get_local_port(http_parent_tcp);
 
@@ -650,6 +758,18 @@ void wget_test_start_server(int first_key, ...)
 		ftps_server_port = wget_tcp_get_local_port(ftps_parent_tcp);
 	}
 
+	if (dns_server) {
+		// init DNS server socket
+		struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+		socklen_t addrlen = sizeof(addr);
+
+		if ((dns_server_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1
+			|| bind(dns_server_fd, (struct sockaddr *)&addr, sizeof(addr))
+			|| getsockname(dns_server_fd, (struct sockaddr *)&addr, &addrlen))
+			wget_error_printf_exit(_("Failed to create DNS server socket (%d)\n"), errno);
+		dns_server_port = ntohs(addr.sin_port);
+	}
+
 	// now replace {{port}} in the body by the actual server port
 	for (wget_test_url_t *url = urls; url < urls + nurls; url++) {
 		char *p = _insert_ports(url->body);
@@ -686,6 +806,12 @@ void wget_test_start_server(int first_key, ...)
 		if ((rc = wget_thread_start(&ftps_server_tid, _ftp_server_thread, ftps_parent_tcp, 0)) != 0)
 			wget_error_printf_exit(_("Failed to start FTP server, error %d\n"), rc);
 	}
+
+	// start thread for DNS
+	if (dns_server) {
+		if ((rc = wget_thread_start(&dns_server_tid, _dns_server_thread, NULL, 0)) != 0)
+			wget_error_printf_exit(_("Failed to start DNS server, error %d\n"), rc);
+	}
 }
 
 static void _scan_for_unexpected(const char *dirname, const wget_test_file_t *expected_files)
@@ -741,7 +867,7 @@ void wget_test(int first_key, ...)
 	const char
 		*request_url,
 		*options="",
-		*executable="../../src/wget2_noinstall" EXEEXT " -d --max-threads=1 --prefer-family=ipv4";
+		*executable="../../src/wget2_noinstall" EXEEXT " -d --max-threads=1 --prefer-family=ipv4 --no-tls-resume"; // no TLS sessions from previous tests
 	const wget_test_file_t
 		*expected_files = NULL,
 		*existing_files = NULL;
@@ -923,6 +1049,11 @@ int wget_test_get_ftps_server_port(void)
 	return ftps_server_port;
 }
 
+int wget_test_get_dns_server_port(void)
+{
+	return dns_server_port;
+}
+
 // assume that we are in 'tmpdir'
 int wget_test_check_filesystem(void)
 {
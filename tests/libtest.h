@@ -46,6 +46,7 @@ extern "C" {
 #define WGET_TEST_FTP_IO_ORDERED 1004
 #define WGET_TEST_FTP_SERVER_HELLO 1005
 #define WGET_TEST_FTPS_IMPLICIT 1006
+#define WGET_TEST_DNS_SERVER 1007
 
 // defines for wget_test()
 #define WGET_TEST_REQUEST_URL 2001
@@ -108,6 +109,9 @@ typedef struct {
 		auth_username;
 	const char *
 		auth_password;
+
+	size_t
+		body_len; // length of a binary body, 0: body is a string
 } wget_test_url_t;
 
 typedef struct {
@@ -127,6 +131,7 @@ WGETAPI int wget_test_get_http_server_port(void) G_GNUC_WGET_PURE;
 WGETAPI int wget_test_get_https_server_port(void) G_GNUC_WGET_PURE;
 WGETAPI int wget_test_get_ftp_server_port(void) G_GNUC_WGET_PURE;
 WGETAPI int wget_test_get_ftps_server_port(void) G_GNUC_WGET_PURE;
+WGETAPI int wget_test_get_dns_server_port(void) G_GNUC_WGET_PURE;
 
 #if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 5)
 #	pragma GCC diagnostic ignored "-Wmissing-field-initializers"
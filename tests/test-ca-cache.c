@@ -0,0 +1,168 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing the CA cache file (--ca-cache-file)
+ * The cache file lives outside of the test directory to survive between the runs.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // exit()
+#include <string.h> // strstr()
+#include <unistd.h> // unlink(), getpid()
+#include <sys/stat.h> // stat()
+#include "libtest.h"
+
+// returns the number of CAs from the debug line "GnuTLS <action> <n> CAs ..." in 'fname', -1 if there is none
+static int _ca_count(const char *fname, const char *action)
+{
+	char buf[1024], prefix[32];
+	const char *p;
+	FILE *fp;
+	int ncerts = -1;
+
+	if (!(fp = fopen(fname, "r")))
+		wget_error_printf_exit("Failed to open %s\n", fname);
+
+	snprintf(prefix, sizeof(prefix), "GnuTLS %s ", action);
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if ((p = strstr(buf, prefix)))
+			sscanf(p + strlen(prefix), "%d CAs", &ncerts);
+	}
+
+	fclose(fp);
+
+	return ncerts;
+}
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/urls.txt",
+			.code = "200 Dontcare",
+			.body = "https://localhost:{{sslport}}/page1.html\nhttps://localhost:{{sslport}}/page2.html\n",
+			.headers = {
+				"Content-Type: text/plain",
+			}
+		},
+		{	.name = "/page1.html",
+			.code = "200 Dontcare",
+			.body = "<html>hello1</html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page2.html",
+			.code = "200 Dontcare",
+			.body = "<html>hello2</html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		}
+	};
+	char cache[64], options[256];
+	struct stat st;
+	int nsaved = -1;
+	off_t cache_size = 0;
+
+#ifndef WITH_GNUTLS
+	exit(77);
+#endif
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// the test directory is the current working directory now
+	snprintf(cache, sizeof(cache), "../.test_ca_cache_%d", (int) getpid());
+	unlink(cache);
+
+	// the CA of the test server is one of the PEM files in the certs directory
+	snprintf(options, sizeof(options),
+		"--ca-directory=../" SRCDIR "/certs --ca-cache-file=%s --no-ocsp -d -o ca.log -i urls.txt", cache);
+
+	// 1st run scans the directory and creates the cache, 2nd run loads the CAs from the cache
+	for (int run = 0; run < 2; run++) {
+		wget_test(
+			WGET_TEST_OPTIONS, options,
+			WGET_TEST_REQUEST_URL, NULL,
+			WGET_TEST_EXPECTED_ERROR_CODE, 0,
+			WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+				{	"urls.txt", urls[0].body },
+				{	NULL } },
+			WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+				{ urls[0].name + 1, urls[0].body },
+				{ urls[1].name + 1, urls[1].body },
+				{ urls[2].name + 1, urls[2].body },
+				{ "ca.log" },
+				{	NULL } },
+			0);
+
+		if (stat(cache, &st) != 0)
+			wget_error_printf_exit("Missing CA cache file %s\n", cache);
+
+		if (run == 0) {
+			if ((nsaved = _ca_count("ca.log", "saved")) <= 0)
+				wget_error_printf_exit("CA cache file %s has not been written\n", cache);
+			cache_size = st.st_size;
+		} else {
+			int nloaded = _ca_count("ca.log", "loaded");
+
+			if (nloaded != nsaved)
+				wget_error_printf_exit("Loaded %d CAs from the cache, expected %d\n", nloaded, nsaved);
+			if (_ca_count("ca.log", "saved") != -1 || st.st_size != cache_size)
+				wget_error_printf_exit("CA cache file %s has been rebuilt\n", cache);
+		}
+	}
+
+	unlink(cache);
+
+	// a broken cache file is rebuilt
+	snprintf(cache, sizeof(cache), "ca.cache");
+	snprintf(options, sizeof(options),
+		"--ca-directory=../" SRCDIR "/certs --ca-cache-file=%s --no-ocsp -d -o ca.log -i urls.txt", cache);
+
+	wget_test(
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"urls.txt", urls[0].body },
+			{	"ca.cache", "wget2 CA cache1 garbage" },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{ "ca.cache" },
+			{ "ca.log" },
+			{	NULL } },
+		0);
+
+	if (_ca_count("ca.log", "loaded") != -1 || _ca_count("ca.log", "saved") != nsaved)
+		wget_error_printf_exit("Broken CA cache file has not been rebuilt\n");
+
+	exit(0);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing asynchronous name resolution against a fake name server (--dns-servers)
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // exit()
+#include "libtest.h"
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body =
+				"<html><head><title>Main Page</title><body><p>Links to other hosts:" \
+				" <a href=\"http://www1.example.com:{{port}}/page1.html\">www1</a>," \
+				" <a href=\"http://www2.example.com:{{port}}/page2.html\">www2</a>," \
+				" <a href=\"http://nonexistent.invalid:{{port}}/page3.html\">nonexistent</a>." \
+				"</p></body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page1.html",
+			.code = "200 Dontcare",
+			.body = "page1",
+		},
+		{	.name = "/page2.html",
+			.code = "200 Dontcare",
+			.body = "page2",
+		},
+	};
+	char options[128];
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		WGET_TEST_DNS_SERVER, 1,
+		0);
+
+	// www1 and www2 resolve to the test server, nonexistent.invalid fails
+	snprintf(options, sizeof(options), "-r -H -nd -t 1 --no-robots --dns-servers=127.0.0.1:%d", wget_test_get_dns_server_port());
+
+	wget_test(
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{	NULL } },
+		0);
+
+	// the same with resolving on demand only
+	snprintf(options, sizeof(options), "-r -H -nd -t 1 --no-robots --no-dns-prefetch --dns-servers=127.0.0.1:%d", wget_test_get_dns_server_port());
+
+	wget_test(
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{	NULL } },
+		0);
+
+	exit(0);
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing Happy Eyeballs: the first address of a host is a blackhole, the second one works
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // exit()
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "libtest.h"
+
+// a listening socket with a full accept queue, SYNs to it are dropped
+static void _blackhole(int port)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t) port) };
+	int fd, on = 1;
+
+	inet_pton(AF_INET, "127.0.0.2", &addr.sin_addr);
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1
+		|| setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+		|| bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+		|| listen(fd, 0))
+	{
+		wget_error_printf("Failed to create blackhole socket: Skip\n");
+		exit(77);
+	}
+
+	// fill the accept queue, the sockets are left open until exit
+	for (int it = 0; it < 4; it++) {
+		int cfd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (cfd != -1) {
+			fcntl(cfd, F_SETFL, O_NONBLOCK);
+			connect(cfd, (struct sockaddr *)&addr, sizeof(addr));
+		}
+	}
+}
+
+// a listening socket that is never accept()ed: TCP connections succeed, but the TLS handshake stalls
+static void _stall(int port)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t) port) };
+	int fd, on = 1;
+
+	inet_pton(AF_INET, "127.0.0.2", &addr.sin_addr);
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1
+		|| setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+		|| bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+		|| listen(fd, 16))
+	{
+		wget_error_printf("Failed to create stalling socket: Skip\n");
+		exit(77);
+	}
+}
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body = "<html><body>Hello</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+	};
+	char options[256];
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		WGET_TEST_DNS_SERVER, 1,
+		0);
+
+	_blackhole(wget_test_get_http_server_port());
+
+	// blackhole.example.com resolves to 127.0.0.2 (blackhole) and 127.0.0.1 (test server)
+	snprintf(options, sizeof(options), "-t 1 --timeout=10 --dns-servers=127.0.0.1:%d http://blackhole.example.com:%d/index.html",
+		wget_test_get_dns_server_port(), wget_test_get_http_server_port());
+
+	wget_test(
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{	NULL } },
+		0);
+
+#ifdef WITH_GNUTLS
+	_stall(wget_test_get_https_server_port());
+
+	// 127.0.0.2 accepts the connection but never answers the TLS handshake,
+	// 127.0.0.1 has to win the race before the connect timeout
+	snprintf(options, sizeof(options), "-t 1 --timeout=3 --no-check-certificate --no-ocsp --dns-servers=127.0.0.1:%d https://blackhole.example.com:%d/index.html",
+		wget_test_get_dns_server_port(), wget_test_get_https_server_port());
+
+	wget_test(
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{	NULL } },
+		0);
+#endif
+
+	exit(0);
+}
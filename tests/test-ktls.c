@@ -0,0 +1,197 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing --ktls (bodies spliced into the files, decrypted by the kernel for HTTPS)
+ * Skipped without the 'tls' kernel module, else the HTTPS bodies would silently be read the usual way.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // fopen()
+#include <stdlib.h> // exit()
+#include <string.h> // memset()
+#include <unistd.h> // close()
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "libtest.h"
+
+#define BODY_SIZE (1024 * 1024 + 123)
+
+// check whether the 'tls' ULP can be attached to an established TCP connection
+static int _ktls_available(void)
+{
+#ifdef TCP_ULP
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addrlen = sizeof(addr);
+	int listenfd, fd = -1, ok = 0;
+
+	if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+		return 0;
+
+	if (bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) == 0 && listen(listenfd, 1) == 0
+		&& getsockname(listenfd, (struct sockaddr *) &addr, &addrlen) == 0
+		&& (fd = socket(AF_INET, SOCK_STREAM, 0)) != -1
+		&& connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+	{
+		ok = setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0;
+	}
+
+	if (fd != -1)
+		close(fd);
+	close(listenfd);
+
+	return ok;
+#else
+	return 0;
+#endif
+}
+
+// the number of kTLS connections from the TLS statistics in the debug log
+static int _ktls_count(const char *fname)
+{
+	char buf[1024];
+	const char *p;
+	int n = -1;
+	FILE *fp;
+
+	if (!(fp = fopen(fname, "r")))
+		return -1;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if ((p = strstr(buf, " with kTLS")) && strstr(buf, "TLS: ")) {
+			while (p > buf && p[-1] >= '0' && p[-1] <= '9')
+				p--;
+			n = atoi(p);
+		}
+	}
+
+	fclose(fp);
+
+	return n;
+}
+
+int main(void)
+{
+	char *body = wget_malloc(BODY_SIZE + 1);
+
+	for (int it = 0; it < BODY_SIZE; it++)
+		body[it] = 'a' + it % 26;
+	body[BODY_SIZE] = 0;
+
+	wget_test_url_t urls[]={
+		{	.name = "/urls.txt",
+			.code = "200 Dontcare",
+			.body = "https://localhost:{{sslport}}/big.txt\nhttps://localhost:{{sslport}}/small.txt\n",
+			.headers = {
+				"Content-Type: text/plain",
+			}
+		},
+		{	.name = "/big.txt",
+			.code = "200 Dontcare",
+			.body = body,
+			.headers = {
+				"Content-Type: text/plain",
+			}
+		},
+		{	.name = "/small.txt",
+			.code = "200 Dontcare",
+			.body = "small",
+			.headers = {
+				"Content-Type: text/plain",
+			}
+		},
+	};
+
+#ifndef WITH_GNUTLS
+	exit(77);
+#endif
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// plain HTTP
+	wget_test(
+		WGET_TEST_OPTIONS, "--ktls",
+		WGET_TEST_REQUEST_URLS, "big.txt", "small.txt", NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{	NULL } },
+		0);
+
+	// output to stdout can't be spliced
+	wget_test(
+		WGET_TEST_OPTIONS, "--ktls -O -",
+		WGET_TEST_REQUEST_URL, "small.txt",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{	NULL } },
+		0);
+
+	// HTTPS with the default protocol (TLS 1.3), the bodies are read the usual way
+	wget_test(
+		WGET_TEST_OPTIONS, "--ktls --ca-certificate=../" SRCDIR "/certs/x509-ca-cert.pem --no-ocsp -i urls.txt",
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"urls.txt", urls[0].body },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{	NULL } },
+		0);
+
+	if (!_ktls_available())
+		exit(77);
+
+	// HTTPS with TLS 1.2, the kernel decrypts the bodies
+	wget_test(
+		WGET_TEST_OPTIONS, "-d --ktls --ca-certificate=../" SRCDIR "/certs/x509-ca-cert.pem --no-ocsp --gnutls-options=NORMAL:-VERS-TLS1.3 -o ktls.log -i urls.txt",
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"urls.txt", urls[0].body },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{	"ktls.log" },
+			{	NULL } },
+		0);
+
+	// the statistics are only logged in debug mode, so -d is given explicitly above
+	int nktls = _ktls_count("ktls.log");
+
+	if (nktls < 0)
+		wget_error_printf_exit("No TLS statistics in ktls.log\n");
+	if (nktls < 1)
+		wget_error_printf_exit("kTLS not used\n");
+
+	exit(0);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing --limit-rate: several downloaders together stay within the rate
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h> // exit(), getenv()
+#include <string.h> // memset(), strlen()
+#include "libtest.h"
+
+#define NPAGES 30
+#define PAGE_SIZE 3000
+#define RATE 30720 // --limit-rate=30k
+#define BURST 50 // ms, RATE_LIMIT_BURST in src/wget.c
+
+int main(void)
+{
+	wget_test_url_t urls[1 + NPAGES];
+	wget_test_file_t files[1 + NPAGES + 1];
+	wget_buffer_t *index = wget_buffer_alloc(1024);
+	const char *valgrind = getenv("VALGRIND_TESTS");
+	long long start, elapsed, overhead, expected, nbytes = 0;
+
+	memset(urls, 0, sizeof(urls));
+	memset(files, 0, sizeof(files));
+
+	wget_buffer_strcpy(index, "<html><body>");
+
+	for (int it = 1; it <= NPAGES; it++) {
+		char *body = wget_malloc(PAGE_SIZE + 1);
+
+		memset(body, 'x', PAGE_SIZE);
+		body[PAGE_SIZE] = 0;
+
+		urls[it].name = wget_aprintf("/file%02d.txt", it);
+		urls[it].code = "200 Dontcare";
+		urls[it].body = body;
+		urls[it].headers[0] = "Content-Type: text/plain";
+
+		wget_buffer_printf_append(index, "<a href=\"%s\">file</a>", urls[it].name + 1);
+	}
+
+	wget_buffer_strcat(index, "</body></html>");
+
+	urls[0].name = "/index.html";
+	urls[0].code = "200 Dontcare";
+	urls[0].body = index->data;
+	urls[0].headers[0] = "Content-Type: text/html";
+
+	// the index is smaller than the burst allowance and isn't delayed, only the pages count
+	for (int it = 0; it < (int) countof(urls); it++) {
+		files[it].name = urls[it].name + 1;
+		files[it].content = urls[it].body;
+		if (it)
+			nbytes += strlen(urls[it].body);
+	}
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// without a limit, to measure what doesn't depend on the rate (startup, robots.txt, requests)
+	start = wget_get_timemillis();
+
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --max-threads=5",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, files,
+		0);
+
+	overhead = wget_get_timemillis() - start;
+
+	start = wget_get_timemillis();
+
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --max-threads=5 --limit-rate=30k",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, files,
+		0);
+
+	elapsed = wget_get_timemillis() - start - overhead;
+	expected = nbytes * 1000 / RATE - BURST;
+
+	// the aggregate rate has to be within 5% of the limit (not checked for slow runs under valgrind)
+	if (elapsed < expected * 95 / 100
+		|| ((!valgrind || !*valgrind || !strcmp(valgrind, "0")) && elapsed > expected * 105 / 100))
+	{
+		wget_error_printf_exit("Downloaded %lld bytes in %lld ms (%lld ms overhead), expected %lld ms at %d bytes/s\n",
+			nbytes, elapsed, overhead, expected, RATE);
+	}
+
+	exit(0);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing --max-host-connections: the number of downloaders per host grows up to the limit and shrinks
+ * (on a 503 response) without losing any job
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // fopen()
+#include <stdlib.h> // exit()
+#include <string.h> // memset()
+#include "libtest.h"
+
+#define NPAGES 40
+#define MAX_HOST_CONNECTIONS 4
+
+// checks the limits logged by the downloaders (-d), see host_get_job() and host_response_feedback()
+static void _check_log(const char *fname)
+{
+	char buf[1024];
+	const char *p;
+	int workers, max_workers, max = 0, prev = 0, decreased = 0;
+	FILE *fp;
+
+	if (!(fp = fopen(fname, "r")))
+		wget_error_printf_exit("Failed to open %s\n", fname);
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if ((p = strstr(buf, ": workers=")) && sscanf(p, ": workers=%d/%d", &workers, &max_workers) == 2) {
+			// a downloader only attaches to the host if the current limit allows it
+			if (workers > max_workers)
+				wget_error_printf_exit("%d downloaders attached, limit is %d\n", workers, max_workers);
+		} else if ((p = strstr(buf, ": max_workers=")) && sscanf(p, ": max_workers=%d", &max_workers) == 1) {
+			if (max_workers > MAX_HOST_CONNECTIONS)
+				wget_error_printf_exit("Limit grew to %d\n", max_workers);
+			if (max_workers > max)
+				max = max_workers;
+			if (max_workers < prev)
+				decreased = 1;
+			prev = max_workers;
+		}
+	}
+
+	fclose(fp);
+
+	if (max < 2)
+		wget_error_printf_exit("Limit didn't grow\n");
+	if (!decreased)
+		wget_error_printf_exit("Limit didn't shrink on 503\n");
+}
+
+int main(void)
+{
+	wget_test_url_t urls[2 + NPAGES];
+	wget_test_file_t files[1 + NPAGES + 2];
+	wget_buffer_t *index = wget_buffer_alloc(1024);
+
+	memset(urls, 0, sizeof(urls));
+	memset(files, 0, sizeof(files));
+
+	wget_buffer_strcpy(index, "<html><body>");
+
+	for (int it = 1; it <= NPAGES; it++) {
+		urls[it].name = wget_aprintf("/page%02d.html", it);
+		urls[it].code = "200 Dontcare";
+		urls[it].body = wget_aprintf("<html><body>Page %d</body></html>", it);
+		urls[it].headers[0] = "Content-Type: text/html";
+
+		wget_buffer_printf_append(index, "<a href=\"%s\">page</a>", urls[it].name + 1);
+	}
+
+	// requested last, after the limit had time to grow
+	wget_buffer_strcat(index, "<a href=\"busy.html\">busy</a></body></html>");
+
+	urls[0].name = "/index.html";
+	urls[0].code = "200 Dontcare";
+	urls[0].body = index->data;
+	urls[0].headers[0] = "Content-Type: text/html";
+
+	// asks the client to slow down
+	urls[1 + NPAGES].name = "/busy.html";
+	urls[1 + NPAGES].code = "503 Service Unavailable";
+	urls[1 + NPAGES].body = "";
+
+	for (int it = 0; it <= NPAGES; it++) {
+		files[it].name = urls[it].name + 1;
+		files[it].content = urls[it].body;
+	}
+	files[1 + NPAGES].name = "hosts.log";
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	wget_test(
+		WGET_TEST_OPTIONS, "-d -o hosts.log -r -nH --max-threads=8 --max-host-connections=4",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, files,
+		0);
+
+	_check_log("hosts.log");
+
+	exit(0);
+}
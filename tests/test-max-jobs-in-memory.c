@@ -0,0 +1,98 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing --max-jobs-in-memory: most of the queued jobs are spilled to disk and read back
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // exit()
+#include <string.h> // memset()
+#include "libtest.h"
+
+// enough pages with long names to fill several segments of the spill file
+#define NHUBS 10
+#define NPAGES 100
+
+int main(void)
+{
+	wget_test_url_t urls[1 + NHUBS + NPAGES];
+	wget_test_file_t files[1 + NHUBS + NPAGES + 1];
+	wget_buffer_t *body[1 + NHUBS];
+	char name[128];
+
+	memset(urls, 0, sizeof(urls));
+	memset(files, 0, sizeof(files));
+
+	// index.html links to the hubs, each hub links to NPAGES/NHUBS pages and back to index.html
+	for (int it = 0; it <= NHUBS; it++) {
+		body[it] = wget_buffer_alloc(1024);
+		wget_buffer_strcpy(body[it], "<html><body>");
+
+		urls[it].name = it ? wget_aprintf("/hub%d.html", it) : "/index.html";
+		urls[it].code = "200 Dontcare";
+		urls[it].headers[0] = "Content-Type: text/html";
+
+		if (it) {
+			wget_buffer_printf_append(body[0], "<a href=\"%s\">hub</a>", urls[it].name + 1);
+			wget_buffer_strcat(body[it], "<a href=\"index.html\">index</a>");
+		}
+	}
+
+	for (int it = 0; it < NPAGES; it++) {
+		wget_test_url_t *url = &urls[1 + NHUBS + it];
+
+		snprintf(name, sizeof(name), "/a-page-with-a-rather-long-name-to-fill-up-the-spill-buffer-%03d.html", it);
+		wget_buffer_printf_append(body[1 + it % NHUBS], "<a href=\"%s\">page</a>", name + 1);
+
+		url->name = wget_strdup(name);
+		url->code = "200 Dontcare";
+		url->body = wget_aprintf("<html><body>Page %d</body></html>", it);
+		url->headers[0] = "Content-Type: text/html";
+	}
+
+	for (int it = 0; it <= NHUBS; it++) {
+		wget_buffer_strcat(body[it], "</body></html>");
+		urls[it].body = body[it]->data;
+	}
+
+	for (int it = 0; it < (int) countof(urls); it++) {
+		files[it].name = urls[it].name + 1;
+		files[it].content = urls[it].body;
+	}
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// only two queued jobs are kept in memory, the others go through the spill file
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --max-jobs-in-memory=2",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, files,
+		0);
+
+	exit(0);
+}
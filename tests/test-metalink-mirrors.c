@@ -0,0 +1,208 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing the ranking of Metalink mirrors: a failing mirror is not used again, a slow one
+ * is left alone once the fast one has been measured
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // exit()
+#include <string.h>
+#include "libtest.h"
+
+#define PIECE_SIZE (256 * 1024)
+#define NPIECES 8
+#define FILE_SIZE (NPIECES * PIECE_SIZE)
+
+/*
+ * Three mirrors of the file, in order of priority:
+ *   /bad/  answers every request with 404
+ *   /slow/ sends about 320KB/s
+ *   /fast/ sends at full speed
+ * With one downloader, the first piece fails on /bad/ and is retried on /slow/ (both probes),
+ * the second piece probes /fast/ and all further pieces should go to /fast/.
+ */
+static wget_thread_mutex_t mirror_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static char *file_body;
+static int nbad, nslow, nfast;
+
+static void *_mirror_connection(void *ctx)
+{
+	wget_tcp_t *tcp = ctx;
+	char buf[4096], header[256], *p;
+	size_t nbytes = 0;
+	ssize_t n;
+	long long from = 0, to = FILE_SIZE - 1;
+	int slow, hlen;
+
+	while ((n = wget_tcp_read(tcp, buf + nbytes, sizeof(buf) - 1 - nbytes)) > 0) {
+		nbytes += n;
+		buf[nbytes] = 0;
+		if (strstr(buf, "\r\n\r\n"))
+			break;
+	}
+
+	if (!nbytes || strncmp(buf, "GET /", 5)) {
+		wget_tcp_deinit(&tcp);
+		return NULL;
+	}
+
+	wget_thread_mutex_lock(&mirror_mutex);
+	if (!strncmp(buf + 4, "/bad/", 5))
+		nbad++;
+	else if (!strncmp(buf + 4, "/slow/", 6))
+		nslow++;
+	else if (!strncmp(buf + 4, "/fast/", 6))
+		nfast++;
+	wget_thread_mutex_unlock(&mirror_mutex);
+
+	if (strncmp(buf + 4, "/slow/mirror.bin ", 17) && strncmp(buf + 4, "/fast/mirror.bin ", 17)) {
+		wget_tcp_printf(tcp, "HTTP/1.1 404 Not found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+		wget_tcp_deinit(&tcp);
+		return NULL;
+	}
+
+	slow = !strncmp(buf + 4, "/slow/", 6);
+
+	if ((p = strstr(buf, "\r\nRange: bytes=")))
+		sscanf(p + 15, "%lld-%lld", &from, &to);
+
+	hlen = snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\nContent-Type: application/octet-stream\r\n"
+		"Content-Range: bytes %lld-%lld/%d\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n",
+		from, to, FILE_SIZE, to - from + 1);
+
+	if (wget_tcp_write(tcp, header, hlen) == hlen) {
+		for (long long pos = from; pos <= to; pos += n) {
+			size_t chunk = slow ? 16384 : (size_t) (to - pos + 1);
+
+			if ((n = wget_tcp_write(tcp, file_body + pos, chunk < (size_t) (to - pos + 1) ? chunk : (size_t) (to - pos + 1))) <= 0)
+				break; // the client stopped receiving
+
+			if (slow)
+				wget_millisleep(50);
+		}
+	}
+
+	wget_tcp_deinit(&tcp);
+
+	return NULL;
+}
+
+static void *_mirror_server(void *ctx)
+{
+	wget_tcp_t *parent_tcp = ctx, *tcp;
+	wget_thread_t tid;
+
+	while ((tcp = wget_tcp_accept(parent_tcp))) {
+		if (wget_thread_start(&tid, _mirror_connection, tcp, 0))
+			wget_tcp_deinit(&tcp);
+	}
+
+	return NULL;
+}
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/mirror.meta4",
+			.code = "200 Dontcare",
+			.headers = {
+				"Content-Type: application/metalink4+xml",
+			}
+		},
+	};
+	wget_buffer_t *meta = wget_buffer_alloc(4096);
+	unsigned char digest[20];
+	char hex[sizeof(digest) * 2 + 1];
+	wget_tcp_t *mirror_tcp;
+	wget_thread_t tid;
+	int port;
+
+	if (!wget_thread_support())
+		exit(77);
+
+	file_body = wget_malloc(FILE_SIZE + 1);
+	for (int it = 0; it < FILE_SIZE; it++)
+		file_body[it] = 'a' + (it * 7 + it / 4096) % 26;
+	file_body[FILE_SIZE] = 0;
+
+	mirror_tcp = wget_tcp_init();
+	wget_tcp_set_timeout(mirror_tcp, -1);
+	if (wget_tcp_listen(mirror_tcp, "localhost", NULL, 10) || wget_thread_start(&tid, _mirror_server, mirror_tcp, 0))
+		exit(1);
+	port = wget_tcp_get_local_port(mirror_tcp);
+
+	wget_buffer_printf(meta,
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+		"<metalink xmlns=\"urn:ietf:params:xml:ns:metalink\">"
+		"<file name=\"mirror.bin\">"
+		"<size>%d</size>"
+		"<pieces length=\"%d\" type=\"sha-1\">",
+		FILE_SIZE, PIECE_SIZE);
+
+	for (int it = 0; it < NPIECES; it++) {
+		wget_hash_fast(WGET_DIGTYPE_SHA1, file_body + it * PIECE_SIZE, PIECE_SIZE, digest);
+		wget_memtohex(digest, sizeof(digest), hex, sizeof(hex));
+		wget_buffer_printf_append(meta, "<hash>%s</hash>", hex);
+	}
+
+	wget_buffer_printf_append(meta,
+		"</pieces>"
+		"<url priority=\"1\">http://localhost:%d/bad/mirror.bin</url>"
+		"<url priority=\"2\">http://localhost:%d/slow/mirror.bin</url>"
+		"<url priority=\"3\">http://localhost:%d/fast/mirror.bin</url>"
+		"</file>"
+		"</metalink>",
+		port, port, port);
+
+	urls[0].body = meta->data;
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	wget_test(
+		WGET_TEST_OPTIONS, "",
+		WGET_TEST_REQUEST_URL, "mirror.meta4",
+		WGET_TEST_EXPECTED_ERROR_CODE, 8, // the 404 of the failing mirror
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ "mirror.bin", file_body },
+			{	NULL } },
+		0);
+
+	wget_thread_mutex_lock(&mirror_mutex);
+	if (nbad != 1)
+		wget_error_printf_exit("Failing mirror has been asked %d times\n", nbad);
+	if (nslow != 1)
+		wget_error_printf_exit("Slow mirror has been asked %d times\n", nslow);
+	if (nfast != NPIECES - 1)
+		wget_error_printf_exit("Fast mirror has been asked %d times\n", nfast);
+	wget_thread_mutex_unlock(&mirror_mutex);
+
+	wget_buffer_free(&meta);
+	wget_xfree(file_body);
+
+	exit(0);
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing OCSP responder queries (--ocsp-server, --ocsp-soft-fail)
+ * The HTTP test server stands in for the OCSP responder with prepared answers.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // exit()
+#include <string.h>
+#include "libtest.h"
+
+/*
+ * A slow OCSP responder that only answers once another download made progress.
+ * It holds the response to the OCSP query until /plain2.html has been requested, which the client only does
+ * after it received /plain1.html (sent once the OCSP query arrived). If the connection waiting for the
+ * OCSP answer blocks the event loop, /plain2.html is not requested before the OCSP wait times out.
+ */
+static wget_thread_mutex_t slow_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static wget_thread_cond_t slow_cond = WGET_THREAD_COND_INITIALIZER;
+static int ocsp_arrived, plain2_requested;
+static const char *ocsp_body;
+#define PLAIN1 "<a href=\"plain2.html\">"
+static size_t ocsp_body_len;
+
+// wait up to 10s for 'flag' to be set
+static void _slow_wait(int *flag)
+{
+	long long end = wget_get_timemillis() + 10000, ms;
+
+	wget_thread_mutex_lock(&slow_mutex);
+	while (!*flag && (ms = end - wget_get_timemillis()) > 0)
+		wget_thread_cond_wait(&slow_cond, &slow_mutex, ms);
+	wget_thread_mutex_unlock(&slow_mutex);
+}
+
+static void _slow_set(int *flag)
+{
+	wget_thread_mutex_lock(&slow_mutex);
+	*flag = 1;
+	wget_thread_cond_signal(&slow_cond);
+	wget_thread_mutex_unlock(&slow_mutex);
+}
+
+static void _slow_respond(wget_tcp_t *tcp, const char *code, const char *type, const char *body, size_t body_len)
+{
+	char header[256];
+	int n = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		code, type, body_len);
+
+	wget_tcp_write(tcp, header, n);
+	if (body_len)
+		wget_tcp_write(tcp, body, body_len);
+}
+
+static void *_slow_connection(void *ctx)
+{
+	wget_tcp_t *tcp = ctx;
+	char buf[4096], *p;
+	size_t nbytes = 0;
+	ssize_t n;
+
+	// read the request header, a POST body (the OCSP request) isn't looked at
+	while ((n = wget_tcp_read(tcp, buf + nbytes, sizeof(buf) - 1 - nbytes)) > 0) {
+		nbytes += n;
+		buf[nbytes] = 0;
+		if ((p = strstr(buf, "\r\n\r\n")))
+			break;
+	}
+
+	if (!strncmp(buf, "POST /ocsp", 10)) {
+		_slow_set(&ocsp_arrived);
+		_slow_wait(&plain2_requested);
+		_slow_respond(tcp, "200 OK", "application/ocsp-response", ocsp_body, ocsp_body_len);
+	} else if (!strncmp(buf, "GET /plain1.html ", 17)) {
+		_slow_wait(&ocsp_arrived);
+		wget_millisleep(200); // let the HTTPS connection arrive at the OCSP wait
+		_slow_respond(tcp, "200 OK", "text/html", PLAIN1, strlen(PLAIN1));
+	} else if (!strncmp(buf, "GET /plain2.html ", 17)) {
+		_slow_set(&plain2_requested);
+		_slow_respond(tcp, "200 OK", "text/html", "plain2", 6);
+	} else
+		_slow_respond(tcp, "404 Not found", "text/plain", "", 0);
+
+	wget_tcp_deinit(&tcp);
+
+	return NULL;
+}
+
+static void *_slow_server(void *ctx)
+{
+	wget_tcp_t *parent_tcp = ctx, *tcp;
+	wget_thread_t tid;
+
+	while ((tcp = wget_tcp_accept(parent_tcp))) {
+		if (wget_thread_start(&tid, _slow_connection, tcp, 0))
+			wget_tcp_deinit(&tcp);
+	}
+
+	return NULL;
+}
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/urls.txt",
+			.code = "200 Dontcare",
+			.body =
+				"https://localhost:{{sslport}}/page1.html\n"
+				"https://localhost:{{sslport}}/page2.html\n"
+				"https://localhost:{{sslport}}/page3.html\n",
+			.headers = {
+				"Content-Type: text/plain",
+			}
+		},
+		{	.name = "/page1.html",
+			.code = "200 Dontcare",
+			.body = "<html>hello1</html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page2.html",
+			.code = "200 Dontcare",
+			.body = "<html>hello2</html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page3.html",
+			.code = "200 Dontcare",
+			.body = "<html>hello3</html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/ocsp/good",
+			.code = "200 Dontcare",
+			.headers = {
+				"Content-Type: application/ocsp-response",
+			}
+		},
+		{	.name = "/ocsp/revoked",
+			.code = "200 Dontcare",
+			.headers = {
+				"Content-Type: application/ocsp-response",
+			}
+		}
+	};
+	char options[512];
+	const char *fmt = "--ca-certificate=../" SRCDIR "/certs/x509-ca-cert.pem --ocsp --no-ocsp-stapling --ocsp-file=ocsp"
+		" --ocsp-server=http://localhost:%d/ocsp/%s --no-http-keep-alive --max-threads=3 -i urls.txt%s";
+
+#if !defined WITH_GNUTLS || !defined HAVE_GNUTLS_OCSP_H
+	exit(77);
+#endif
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	urls[4].body = wget_read_file("../" SRCDIR "/certs/x509-server-ocsp-good.der", &urls[4].body_len);
+	urls[5].body = wget_read_file("../" SRCDIR "/certs/x509-server-ocsp-revoked.der", &urls[5].body_len);
+	if (!urls[4].body || !urls[5].body)
+		exit(1);
+
+	// concurrent connections share the query for the server certificate
+	snprintf(options, sizeof(options), fmt, wget_test_get_http_server_port(), "good", "");
+	wget_test(
+		// WGET_TEST_KEEP_TMPFILES, 1,
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"urls.txt", urls[0].body },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ "ocsp", NULL },
+			{ "ocsp_hosts", NULL },
+			{	NULL } },
+		0);
+
+	// a revoked certificate is refused
+	snprintf(options, sizeof(options), fmt, wget_test_get_http_server_port(), "revoked", "");
+	wget_test(
+		// WGET_TEST_KEEP_TMPFILES, 1,
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 5,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"urls.txt", urls[0].body },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ "ocsp", NULL },
+			{ "ocsp_hosts", NULL },
+			{	NULL } },
+		0);
+
+	// no answer from the responder: accepted by default ...
+	snprintf(options, sizeof(options), fmt, wget_test_get_http_server_port(), "none", "");
+	wget_test(
+		// WGET_TEST_KEEP_TMPFILES, 1,
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"urls.txt", urls[0].body },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ "ocsp", NULL },
+			{ "ocsp_hosts", NULL },
+			{	NULL } },
+		0);
+
+	// ... and refused with --no-ocsp-soft-fail
+	snprintf(options, sizeof(options), fmt, wget_test_get_http_server_port(), "none", " --no-ocsp-soft-fail");
+	wget_test(
+		// WGET_TEST_KEEP_TMPFILES, 1,
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 5,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"urls.txt", urls[0].body },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ "ocsp", NULL },
+			{ "ocsp_hosts", NULL },
+			{	NULL } },
+		0);
+
+	// with --engine=event, other downloads go on while a connection waits for a slow responder
+	if (wget_thread_support()) {
+		wget_tcp_t *slow_tcp = wget_tcp_init();
+		wget_thread_t tid;
+		char body[256];
+
+		wget_tcp_set_timeout(slow_tcp, -1);
+		if (wget_tcp_listen(slow_tcp, "localhost", NULL, 10) || wget_thread_start(&tid, _slow_server, slow_tcp, 0))
+			exit(1);
+
+		ocsp_body = urls[4].body;
+		ocsp_body_len = urls[4].body_len;
+
+		snprintf(body, sizeof(body), "https://localhost:%d/page1.html\nhttp://localhost:%d/plain1.html\n",
+			wget_test_get_https_server_port(), wget_tcp_get_local_port(slow_tcp));
+
+		snprintf(options, sizeof(options), "--ca-certificate=../" SRCDIR "/certs/x509-ca-cert.pem --ocsp --no-ocsp-stapling --ocsp-file=ocsp"
+			" --ocsp-server=http://localhost:%d/ocsp --no-ocsp-soft-fail --connect-timeout=3"
+			" --engine=event --event-threads=1 --max-threads=2 --preconnect=0 -r -nd --no-robots -i urls.txt",
+			wget_tcp_get_local_port(slow_tcp));
+
+		wget_test(
+			// WGET_TEST_KEEP_TMPFILES, 1,
+			WGET_TEST_OPTIONS, options,
+			WGET_TEST_REQUEST_URL, NULL,
+			WGET_TEST_EXPECTED_ERROR_CODE, 0,
+			WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+				{	"urls.txt", body },
+				{	NULL } },
+			WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+				{ "urls.txt", body },
+				{ urls[1].name + 1, urls[1].body },
+				{ "plain1.html", PLAIN1 },
+				{ "plain2.html", "plain2" },
+				{ "ocsp", NULL },
+				{ "ocsp_hosts", NULL },
+				{	NULL } },
+			0);
+	}
+
+	wget_xfree(urls[4].body);
+	wget_xfree(urls[5].body);
+
+	exit(0);
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing dynamic range splitting and endgame duplicates of --chunk-size downloads
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // snprintf()
+#include <stdlib.h> // exit()
+#include <string.h>
+#include "libtest.h"
+
+#define FILE_SIZE (5 * 1024 * 1024)
+
+/*
+ * A range server that sends the first range starting at 0 slowly (about 640KB/s), all others at full speed.
+ * With --chunk-size=4M the file has two parts. While the first (4MB) part is still crawling, the second
+ * downloader finishes the 1MB part, takes over the upper half of the slow part and then downloads the rest
+ * of the slow part a second time (endgame), which wins against the slow connection.
+ */
+static wget_thread_mutex_t range_mutex = WGET_THREAD_MUTEX_INITIALIZER;
+static char *file_body;
+static int nslow;
+
+static void *_range_connection(void *ctx)
+{
+	wget_tcp_t *tcp = ctx;
+	char buf[4096], header[256], *p;
+	size_t nbytes = 0;
+	ssize_t n;
+	long long from = 0, to = FILE_SIZE - 1;
+	int slow = 0, head, hlen;
+
+	while ((n = wget_tcp_read(tcp, buf + nbytes, sizeof(buf) - 1 - nbytes)) > 0) {
+		nbytes += n;
+		buf[nbytes] = 0;
+		if (strstr(buf, "\r\n\r\n"))
+			break;
+	}
+
+	if (!nbytes || (strncmp(buf, "GET /file.bin ", 14) && strncmp(buf, "HEAD /file.bin ", 15))) {
+		wget_tcp_printf(tcp, "HTTP/1.1 404 Not found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+		wget_tcp_deinit(&tcp);
+		return NULL;
+	}
+
+	if ((head = !strncmp(buf, "HEAD", 4))) {
+		hlen = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+			"Accept-Ranges: bytes\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", FILE_SIZE);
+	} else {
+		if ((p = strstr(buf, "\r\nRange: bytes=")))
+			sscanf(p + 15, "%lld-%lld", &from, &to);
+
+		if (from == 0) {
+			wget_thread_mutex_lock(&range_mutex);
+			slow = nslow++ == 0;
+			wget_thread_mutex_unlock(&range_mutex);
+		}
+
+		hlen = snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\nContent-Type: application/octet-stream\r\n"
+			"Content-Range: bytes %lld-%lld/%d\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n",
+			from, to, FILE_SIZE, to - from + 1);
+	}
+
+	if (wget_tcp_write(tcp, header, hlen) == hlen && !head) {
+		for (long long pos = from; pos <= to; pos += n) {
+			size_t chunk = slow ? 16384 : (size_t) (to - pos + 1);
+
+			if ((n = wget_tcp_write(tcp, file_body + pos, chunk < (size_t) (to - pos + 1) ? chunk : (size_t) (to - pos + 1))) <= 0)
+				break; // the client stopped receiving
+
+			if (slow)
+				wget_millisleep(25);
+		}
+	}
+
+	wget_tcp_deinit(&tcp);
+
+	return NULL;
+}
+
+static void *_range_server(void *ctx)
+{
+	wget_tcp_t *parent_tcp = ctx, *tcp;
+	wget_thread_t tid;
+
+	while ((tcp = wget_tcp_accept(parent_tcp))) {
+		if (wget_thread_start(&tid, _range_connection, tcp, 0))
+			wget_tcp_deinit(&tcp);
+	}
+
+	return NULL;
+}
+
+// whether the debug log 'fname' contains 'text'
+static int _log_contains(const char *fname, const char *text)
+{
+	char buf[1024];
+	int found = 0;
+	FILE *fp;
+
+	if (!(fp = fopen(fname, "r")))
+		return 0;
+
+	while (!found && fgets(buf, sizeof(buf), fp))
+		found = !!strstr(buf, text);
+
+	fclose(fp);
+
+	return found;
+}
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body = "<html>hello</html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+	};
+	wget_tcp_t *range_tcp;
+	wget_thread_t tid;
+	char options[256];
+
+	if (!wget_thread_support())
+		exit(77);
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	file_body = wget_malloc(FILE_SIZE + 1);
+	for (int it = 0; it < FILE_SIZE; it++)
+		file_body[it] = 'a' + (it * 7 + it / 4096) % 26;
+	file_body[FILE_SIZE] = 0;
+
+	range_tcp = wget_tcp_init();
+	wget_tcp_set_timeout(range_tcp, -1);
+	if (wget_tcp_listen(range_tcp, "localhost", NULL, 10) || wget_thread_start(&tid, _range_server, range_tcp, 0))
+		exit(1);
+
+	snprintf(options, sizeof(options), "-d --max-threads=2 --chunk-size=4M -o split.log http://localhost:%d/file.bin",
+		wget_tcp_get_local_port(range_tcp));
+
+	wget_test(
+		WGET_TEST_OPTIONS, options,
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ "file.bin", file_body },
+			{ "split.log", NULL },
+			{	NULL } },
+		0);
+
+	// the slow part has been split, then the rest of it has been duplicated and completed by the twin
+	if (!_log_contains("split.log", "split chunk 1 "))
+		wget_error_printf_exit("Slow part has not been split\n");
+	if (!_log_contains("split.log", "duplicate chunk 1 "))
+		wget_error_printf_exit("Slow part has not been duplicated\n");
+	if (!_log_contains("split.log", "part 1 downloaded by another downloader"))
+		wget_error_printf_exit("Twin did not complete the slow part\n");
+
+	wget_xfree(file_body);
+
+	exit(0);
+}
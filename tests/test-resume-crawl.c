@@ -0,0 +1,126 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing --checkpoint-file and --resume-crawl: a crawl stopped by --quota is continued
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h> // exit()
+#include <unistd.h> // access(), unlink()
+#include "libtest.h"
+
+// the test directory is emptied before each run, so the checkpoint lives one level up
+#define CHECKPOINT "../test-resume-crawl.checkpoint"
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body =
+				"<html><body>" \
+				"<a href=\"page1.html\">1</a><a href=\"page2.html\">2</a><a href=\"page3.html\">3</a>" \
+				"</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page1.html",
+			.code = "200 Dontcare",
+			.body = "<html><body><a href=\"index.html\">index</a><a href=\"page4.html\">4</a></body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page2.html",
+			.code = "200 Dontcare",
+			.body = "<html><body><a href=\"page1.html\">1</a></body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page3.html",
+			.code = "200 Dontcare",
+			.body = "<html><body>Page 3</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page4.html",
+			.code = "200 Dontcare",
+			.body = "<html><body>Page 4</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+	};
+
+	unlink(CHECKPOINT);
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// the quota stops the crawl after index.html, the queued (and spilled) pages go into the checkpoint
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --max-threads=1 --quota=1 --max-jobs-in-memory=1 --checkpoint-file=" CHECKPOINT,
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{	NULL } },
+		0);
+
+	if (access(CHECKPOINT, F_OK))
+		wget_error_printf_exit("Missing checkpoint after an interrupted crawl\n");
+
+	// the known index.html is not downloaded again
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --resume-crawl --checkpoint-file=" CHECKPOINT,
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{ urls[4].name + 1, urls[4].body },
+			{	NULL } },
+		0);
+
+	if (!access(CHECKPOINT, F_OK)) {
+		unlink(CHECKPOINT);
+		wget_error_printf_exit("Checkpoint not removed after the crawl finished\n");
+	}
+
+	// chunked downloads can't be saved, they are refused instead of being lost on resume
+	wget_test(
+		WGET_TEST_OPTIONS, "--chunk-size=1k --checkpoint-file=" CHECKPOINT,
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 1,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{	NULL } },
+		0);
+
+	exit(0);
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing TLS session resumption: concurrent connections resume the session of the first one,
+ * --tls-early-data falls back to a normal request when the server rejects the early data
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h> // fopen()
+#include <stdlib.h> // exit()
+#include <string.h>
+#include "libtest.h"
+
+#define NPAGES 8
+
+typedef struct {
+	int
+		handshakes,
+		resumed,
+		early_data,
+		early_data_rejected;
+} tls_counters_t;
+
+// reads the TLS statistics that wget2 prints in debug mode at exit
+static void _tls_counters(const char *fname, tls_counters_t *c)
+{
+	char buf[1024];
+	const char *p;
+	FILE *fp;
+	int found = 0;
+
+	if (!(fp = fopen(fname, "r")))
+		wget_error_printf_exit("Failed to open %s\n", fname);
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if ((p = strstr(buf, "TLS: ")))
+			found = sscanf(p, "TLS: %d handshakes, %d resumed (%*d%%), %d with early data, %d early data rejected",
+				&c->handshakes, &c->resumed, &c->early_data, &c->early_data_rejected) == 4;
+	}
+
+	fclose(fp);
+
+	if (!found)
+		wget_error_printf_exit("No TLS statistics in %s\n", fname);
+}
+
+int main(void)
+{
+	wget_test_url_t urls[1 + NPAGES];
+	wget_test_file_t files[1 + NPAGES + 3];
+	wget_buffer_t *list = wget_buffer_alloc(1024);
+	tls_counters_t c;
+
+#ifndef WITH_GNUTLS
+	exit(77);
+#endif
+
+	memset(urls, 0, sizeof(urls));
+	memset(files, 0, sizeof(files));
+
+	for (int it = 1; it <= NPAGES; it++) {
+		urls[it].name = wget_aprintf("/page%d.html", it);
+		urls[it].code = "200 Dontcare";
+		urls[it].body = wget_aprintf("<html>hello%d</html>", it);
+		urls[it].headers[0] = "Content-Type: text/html";
+
+		wget_buffer_printf_append(list, "https://localhost:{{sslport}}%s\n", urls[it].name);
+	}
+
+	urls[0].name = "/urls.txt";
+	urls[0].code = "200 Dontcare";
+	urls[0].body = list->data;
+	urls[0].headers[0] = "Content-Type: text/plain";
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// the server replaced {{sslport}} in the bodies
+	for (int it = 0; it <= NPAGES; it++) {
+		files[it].name = urls[it].name + 1;
+		files[it].content = urls[it].body;
+	}
+	files[1 + NPAGES].name = "session";
+	files[2 + NPAGES].name = "tls.log";
+
+	// concurrent connections share the session of the first handshake
+	wget_test(
+		// WGET_TEST_KEEP_TMPFILES, 1,
+		WGET_TEST_OPTIONS, "--ca-certificate=../" SRCDIR "/certs/x509-ca-cert.pem --no-ocsp --tls-resume --tls-session-file=session"
+			" --no-http-keep-alive --max-threads=8 -d -o tls.log -i urls.txt",
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"urls.txt", urls[0].body },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, files,
+		0);
+
+	_tls_counters("tls.log", &c);
+	if (c.handshakes != NPAGES || c.resumed != NPAGES - 1)
+		wget_error_printf_exit("Expected 1 full and %d resumed handshakes, got %d handshakes, %d resumed\n",
+			NPAGES - 1, c.handshakes, c.resumed);
+	if (c.early_data || c.early_data_rejected)
+		wget_error_printf_exit("Early data sent without --tls-early-data\n");
+
+	// resumed connections send the requests as early data, the server may reject it
+	wget_test(
+		// WGET_TEST_KEEP_TMPFILES, 1,
+		WGET_TEST_OPTIONS, "--ca-certificate=../" SRCDIR "/certs/x509-ca-cert.pem --no-ocsp --tls-resume --tls-session-file=session"
+			" --tls-early-data --no-http-keep-alive --max-threads=1 -d -o tls.log -i urls.txt",
+		WGET_TEST_REQUEST_URL, NULL,
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+			{	"urls.txt", urls[0].body },
+			{	NULL } },
+		WGET_TEST_EXPECTED_FILES, files,
+		0);
+
+	// a new test directory has no session file: one full handshake, then every connection resumes
+	// and sends its GET as early data, accepted or rejected (and sent again)
+	_tls_counters("tls.log", &c);
+	if (c.handshakes != NPAGES || c.resumed != NPAGES - 1)
+		wget_error_printf_exit("Expected 1 full and %d resumed handshakes, got %d handshakes, %d resumed\n",
+			NPAGES - 1, c.handshakes, c.resumed);
+	if (c.early_data + c.early_data_rejected != NPAGES - 1)
+		wget_error_printf_exit("Expected %d requests as early data, got %d accepted, %d rejected\n",
+			NPAGES - 1, c.early_data, c.early_data_rejected);
+
+	wget_buffer_free(&list);
+	for (int it = 1; it <= NPAGES; it++) {
+		wget_xfree(urls[it].name);
+		wget_xfree(urls[it].body);
+	}
+
+	exit(0);
+}
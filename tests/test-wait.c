@@ -0,0 +1,100 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of libwget.
+ *
+ * Libwget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Libwget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libwget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Testing --wait: the delay applies per host, not per downloader thread
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h> // exit()
+#include "libtest.h"
+
+#define WAIT_MS 300
+
+int main(void)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body =
+				"<html><body>" \
+				"<a href=\"page1.html\">1</a>" \
+				"<a href=\"page2.html\">2</a>" \
+				"<a href=\"page3.html\">3</a>" \
+				"</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page1.html",
+			.code = "200 Dontcare",
+			.body = "<html><body>Page 1</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page2.html",
+			.code = "200 Dontcare",
+			.body = "<html><body>Page 2</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+		{	.name = "/page3.html",
+			.code = "200 Dontcare",
+			.body = "<html><body>Page 3</body></html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+	};
+	long long start, elapsed;
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// robots.txt, index.html and three pages from one host: four pauses between five requests,
+	// even though enough downloaders are there to fetch the pages in parallel
+	start = wget_get_timemillis();
+
+	wget_test(
+		WGET_TEST_OPTIONS, "-r -nH --max-threads=4 --wait=0.3",
+		WGET_TEST_REQUEST_URL, "index.html",
+		WGET_TEST_EXPECTED_ERROR_CODE, 0,
+		WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+			{ urls[0].name + 1, urls[0].body },
+			{ urls[1].name + 1, urls[1].body },
+			{ urls[2].name + 1, urls[2].body },
+			{ urls[3].name + 1, urls[3].body },
+			{	NULL } },
+		0);
+
+	elapsed = wget_get_timemillis() - start;
+
+	if (elapsed < 4 * WAIT_MS)
+		wget_error_printf_exit("Requests to the same host were only %lld ms apart in total, expected at least %d ms\n",
+			elapsed, 4 * WAIT_MS);
+
+	exit(0);
+}
@@ -1546,6 +1546,45 @@ static void test_vector(void)
 	wget_vector_free(&v);
 }
 
+static void test_list(void)
+{
+	wget_list_t *list = NULL;
+	int *elem, expected[] = { 0, 1, 2, 3 }, n = 0, data;
+
+	data = 2; wget_list_append(&list, &data, sizeof(data));
+	data = 1; wget_list_prepend(&list, &data, sizeof(data));
+	data = 3; wget_list_append(&list, &data, sizeof(data));
+	data = 0; wget_list_prepend(&list, &data, sizeof(data));
+
+	for (elem = wget_list_getfirst(list); n < (int) countof(expected); elem = wget_list_getnext(elem), n++) {
+		if (*elem == expected[n])
+			ok++;
+		else {
+			failed++;
+			info_printf("Failed [%d]: wget_list got %d (expected %d)\n", n, *elem, expected[n]);
+		}
+	}
+
+	elem = wget_list_getlast(list);
+	if (*elem == 3)
+		ok++;
+	else {
+		failed++;
+		info_printf("Failed: wget_list_getlast got %d (expected 3)\n", *elem);
+	}
+
+	wget_list_remove(&list, wget_list_getfirst(list));
+	elem = wget_list_getfirst(list);
+	if (*elem == 1)
+		ok++;
+	else {
+		failed++;
+		info_printf("Failed: wget_list_remove left %d as first element (expected 1)\n", *elem);
+	}
+
+	wget_list_free(&list);
+}
+
 // this hash function generates collisions and reduces the map to a simple list.
 // O(1) insertion, but O(n) search and removal
 static unsigned int hash_txt(G_GNUC_WGET_UNUSED const char *key)
@@ -1780,6 +1819,7 @@ int main(int argc, const char **argv)
 	test_strcasecmp_ascii();
 	test_hashing();
 	test_vector();
+	test_list();
 	test_stringmap();
 	test_striconv();
 
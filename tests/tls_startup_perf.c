@@ -0,0 +1,129 @@
+/*
+ * Copyright(c) 2016 Free Software Foundation, Inc.
+ *
+ * This file is part of Wget.
+ *
+ * Wget is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * testing the startup latency of a single HTTPS request against the test server,
+ * that is the time from starting wget2 until the first (and only) file has been received,
+ * with the different ways of loading the CA certificates
+ * usage: tls_startup_perf [number of runs] [CA directory]
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libtest.h"
+
+static double _elapsed_s(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, const char **argv)
+{
+	wget_test_url_t urls[]={
+		{	.name = "/urls.txt",
+			.code = "200 Dontcare",
+			.body = "https://localhost:{{sslport}}/index.html\n",
+			.headers = {
+				"Content-Type: text/plain",
+			}
+		},
+		{	.name = "/index.html",
+			.code = "200 Dontcare",
+			.body = "<html>hello</html>",
+			.headers = {
+				"Content-Type: text/html",
+			}
+		},
+	};
+	int nruns = argc > 1 ? atoi(argv[1]) : 20;
+	const char *ca_directory = argc > 2 ? argv[2] : "/etc/ssl/certs";
+	const char *modes[] = { "no verification", "system trust", "CA directory", "CA directory + cache" };
+	char options[512], cache[64];
+	struct timespec start;
+
+#ifndef WITH_GNUTLS
+	exit(77);
+#endif
+
+	if (nruns < 1)
+		return 1;
+
+	// functions won't come back if an error occurs
+	wget_test_start_server(
+		WGET_TEST_RESPONSE_URLS, &urls, countof(urls),
+		0);
+
+	// outside of the test directory, which is emptied before each run
+	snprintf(cache, sizeof(cache), "../.tls_startup_perf_%d", (int) getpid());
+	unlink(cache);
+
+	for (unsigned mode = 0; mode < countof(modes); mode++) {
+		const char *ca;
+
+		if (mode == 0)
+			ca = "--no-check-certificate";
+		else
+			ca = "--ca-certificate=../" SRCDIR "/certs/x509-ca-cert.pem";
+
+		if (mode == 0 || mode == 1)
+			snprintf(options, sizeof(options), "--no-debug -q --no-ocsp --no-tls-resume -i urls.txt %s", ca);
+		else if (mode == 2)
+			snprintf(options, sizeof(options), "--no-debug -q --no-ocsp --no-tls-resume -i urls.txt %s --ca-directory=%s", ca, ca_directory);
+		else
+			snprintf(options, sizeof(options), "--no-debug -q --no-ocsp --no-tls-resume -i urls.txt %s --ca-directory=%s --ca-cache-file=%s", ca, ca_directory, cache);
+
+		// not measured: warms up the page cache and creates the CA cache file
+		for (int run = -1; run < nruns; run++) {
+			if (run == 0)
+				clock_gettime(CLOCK_MONOTONIC, &start);
+
+			wget_test(
+				WGET_TEST_OPTIONS, options,
+				WGET_TEST_REQUEST_URL, NULL,
+				WGET_TEST_EXPECTED_ERROR_CODE, 0,
+				WGET_TEST_EXISTING_FILES, &(wget_test_file_t []) {
+					{	"urls.txt", urls[0].body },
+					{	NULL } },
+				WGET_TEST_EXPECTED_FILES, &(wget_test_file_t []) {
+					{ urls[0].name + 1, urls[0].body },
+					{ urls[1].name + 1, urls[1].body },
+					{	NULL } },
+				0);
+		}
+
+		double secs = _elapsed_s(&start);
+
+		printf("%-22s: %4d runs in %6.3f s, %7.2f ms to the first file\n", modes[mode], nruns, secs, secs * 1000 / nruns);
+	}
+
+	unlink(cache);
+
+	exit(0);
+}